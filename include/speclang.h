@@ -9,9 +9,11 @@
 
 //hints for dynamic buffer sizes
 #define ERR_BSIZE		1024
+#define ERR_MAX_ARGS		6
 #define SPCL_STR_BSIZE 		1024
 #define SPCL_ARGS_BSIZE 	16
 #define MAX_NUM_SIZE		10
+#define MAX_INT_SIZE		21
 #define LINE_SIZE 		128
 #define ALLOC_LST_N		16
 #define MAX_PRINT_ELS		8
@@ -38,12 +40,13 @@ struct spcl_val;
 struct spcl_inst;
 struct spcl_uf;
 struct spcl_fn_call;
+struct spcl_buf;
 
 //constants
 typedef struct spcl_val (*lib_call)(struct spcl_inst*, struct spcl_fn_call);
 
 typedef enum { E_SUCCESS, E_NOFILE, E_LACK_TOKENS, E_BAD_SYNTAX, E_BAD_VALUE, E_BAD_TYPE, E_NOMEM, E_NAN, E_UNDEF, E_OUT_OF_RANGE, E_ASSERT, N_ERRORS } parse_ercode;
-typedef enum {VAL_UNDEF, VAL_ERR, VAL_NUM, VAL_STR, VAL_ARRAY, VAL_MAT, VAL_LIST, VAL_FN, VAL_INST, N_VALTYPES} valtype;
+typedef enum {VAL_UNDEF, VAL_ERR, VAL_NUM, VAL_STR, VAL_ARRAY, VAL_MAT, VAL_LIST, VAL_FN, VAL_INST, VAL_COMPLEX, VAL_CARRAY, VAL_INT, VAL_IARRAY, VAL_FARRAY, VAL_I32ARRAY, VAL_U8ARRAY, VAL_DUAL, VAL_VEC, N_VALTYPES} valtype;
 //helper classes and things
 typedef enum {BLK_UNDEF, BLK_MISC, BLK_INVERT, BLK_TRANSFORM, BLK_DATA, BLK_ROOT, BLK_COMPOSITE, BLK_FUNC_DEC, BLK_LITERAL, BLK_COMMENT, BLK_SQUARE, BLK_QUOTE, BLK_QUOTE_SING, BLK_PAREN, BLK_CURLY, N_BLK_TYPES} blk_type;
 
@@ -148,17 +151,46 @@ char* fs_flatten(const spcl_fstream* fs, char sep_char, size_t* len);
 
 /** ============================ struct spcl_val ============================ **/
 
+typedef union spcl_err_arg {
+    long i;
+    unsigned long u;
+    double x;
+    const void* p;
+} spcl_err_arg;
+
 typedef struct spcl_error {
     parse_ercode c;
-    char msg[ERR_BSIZE];
+    size_t n_refs; //the number of spcl_vals which share this error. Preallocated errors have n_refs=0 and are never freed
+    const char* fmt; //the format specifier, which must outlive the error (e.g. a string literal)
+    char* msg; //the formatted message. This is only populated once spcl_err_msg() is called
+    size_t n_args;
+    spcl_err_arg args[ERR_MAX_ARGS]; //arguments captured for fmt. String arguments point to copies owned by the error
 } spcl_error;
 
+typedef struct spcl_tensor {
+    size_t ndim; //the number of axes, which is always at least two. One dimensional data is stored as an array.
+    size_t* shape; //the length of each axis. This points into the same allocation as the tensor.
+    psize* strides; //the number of elements separating consecutive entries along each axis. This points into the same allocation as the tensor.
+    double* data; //the first element, so that element (i,j,...) is data[i*strides[0] + j*strides[1] + ...]
+} spcl_tensor;
+
+//the maximum number of elements in a small vector
+#define SPCL_VEC_MAX	4
+
 union V {
     spcl_error* e;
     char* s;
     double x;
-    double* a;
+    long long i; //integers are stored exactly, unlike numbers
+    double z[2]; //the real and imaginary parts of a complex number
+    double v[SPCL_VEC_MAX]; //the elements of a small vector, which are stored inline
+    double* a; //the elements of an array. Complex arrays store the real and imaginary parts of each element next to each other.
+    long long* ia; //the elements of an integer array
+    float* fa; //the elements of a float32 array
+    int* i32; //the elements of an int32 array
+    unsigned char* u8; //the elements of a uint8 array
     struct spcl_val* l;
+    struct spcl_tensor* t;
     struct spcl_uf* f;
     struct spcl_inst* c;
 };
@@ -166,7 +198,8 @@ union V {
 struct spcl_val {
     valtype type;
     union V val;
-    size_t n_els; //only applicable for string and list types
+    size_t n_els; //only applicable for string and list types. For tensors this is the length of the first axis
+    struct spcl_buf* buf; //the reference counted buffer that the string, array, tensor or list points into. NULL indicates that the data was allocated directly with malloc and holds exactly n_els elements.
 };
 typedef struct spcl_val spcl_val;
 
@@ -175,16 +208,33 @@ typedef struct spcl_val spcl_val;
  */
 spcl_val spcl_make_none();
 /**
- * Create a new error with the specified code and format specifier
+ * Create a new error with the specified code and format specifier. The arguments are captured, but the message isn't formatted until it is requested with spcl_err_msg()
  * code: error code type
- * format: a format specifier (just like printf)
- * returns: a pointer to an error object with the specified, which should be deallocated with a call to free()
+ * format: a format specifier (just like printf). Only the conversions d, i, u, x, o, c, f, e, g, s and p are supported, and format must outlive the error (e.g. a string literal)
+ * returns: an error object with the specified code, which should be deallocated with a call to cleanup_spcl_val()
  */
 spcl_val spcl_make_err(parse_ercode code, const char* format, ...);
+/**
+ * Get the message describing the error er, formatting it if this hasn't been done already
+ * returns: a null terminated string owned by er or an empty string if er is not an error
+ */
+const char* spcl_err_msg(spcl_val er);
 /**
  * create a spcl_val from a float
  */
 spcl_val spcl_make_num(double x);
+/**
+ * create an integer spcl_val
+ */
+spcl_val spcl_make_int(long long i);
+/**
+ * create a complex spcl_val with the real part re and imaginary part im
+ */
+spcl_val spcl_make_complex(double re, double im);
+/**
+ * create a small vector spcl_val with the n elements in vs, where 0 < n <= SPCL_VEC_MAX. Small vectors never allocate.
+ */
+spcl_val spcl_make_vec(const double* vs, size_t n);
 /**
  * create a spcl_val from a string
  */
@@ -193,6 +243,36 @@ spcl_val spcl_make_str(const char* s, size_t n);
  * create a spcl_val from a c array of doubles
  */
 spcl_val spcl_make_array(double* vs, size_t n);
+/**
+ * create an integer array spcl_val from a c array of long longs
+ */
+spcl_val spcl_make_iarray(const long long* vs, size_t n);
+/**
+ * create an array spcl_val with the element type given by type from a c array
+ * vs: the elements, which must have the C type matching type (double, long long, float, int or unsigned char)
+ * type: one of VAL_ARRAY, VAL_IARRAY, VAL_FARRAY, VAL_I32ARRAY or VAL_U8ARRAY
+ */
+spcl_val spcl_make_typed_array(const void* vs, size_t n, valtype type);
+/**
+ * create a complex array spcl_val from a c array of doubles
+ * vs: the real and imaginary part of each element, so that vs has 2*n entries
+ * n: the number of complex elements
+ */
+spcl_val spcl_make_carray(const double* vs, size_t n);
+/**
+ * create a matrix spcl_val from a c array of doubles
+ * vs: the elements in row-major order. If vs is NULL, then all elements are set to zero
+ * rows: the number of rows
+ * cols: the number of columns
+ */
+spcl_val spcl_make_mat(const double* vs, size_t rows, size_t cols);
+/**
+ * create a tensor spcl_val from a c array of doubles
+ * vs: the elements in row-major order. If vs is NULL, then all elements are set to zero
+ * ndim: the number of axes. If ndim is one, then an array is returned instead
+ * shape: the length of each axis
+ */
+spcl_val spcl_make_tensor(const double* vs, size_t ndim, const size_t* shape);
 /**
  * create a spcl_val from a list
  */
@@ -252,11 +332,18 @@ void print_hierarchy(spcl_val v, FILE* f, size_t depth);
  * array+array: piecewise addition
  * array+num: add number to each element
  * mat+mat: matrix addition
+ * complex+*: complex arithmetic. Numbers and arrays are promoted to complex numbers and complex arrays.
  * list+*: append to list
  * str+*: append the string representation of the type * to str
  */
 // spcl_val operations
 void val_add(spcl_val* l, spcl_val r);
+/**
+ * Select the instruction set used by elementwise array arithmetic. This is intended for testing and benchmarking, by default the widest instruction set supported by the cpu is used.
+ * isa: one of "scalar", "sse2", "avx2" or "avx512", or NULL to restore the default
+ * returns: the name of the selected instruction set or NULL if isa is not supported, in which case the selection is unchanged
+ */
+const char* set_arr_kernels(const char* isa);
 /**
  * Add two spcl_vals together, overwriting the result to l
  * num+num: arithmetic
@@ -328,6 +415,9 @@ struct spcl_inst {
     name_val_pair* table;
     struct spcl_inst* parent;
     size_t n_memb;
+    //the key and the next unused block of the stream for rand() and friends. These are only used by root instances.
+    unsigned long long rng_seed;
+    unsigned long long rng_ctr;
     unsigned char t_bits;//the log base-2 of the size of the table
 };
 typedef struct spcl_inst spcl_inst;
@@ -406,7 +496,7 @@ int spcl_find_c_iarray(const spcl_inst* c, const char* str, int* sto, size_t n);
  */
 int spcl_find_c_uarray(const spcl_inst* c, const char* str, unsigned* sto, size_t n);
 /**
- * Lookup the spcl_val named str in c and write the first n elements of the resulting list/array to sto
+ * Lookup the spcl_val named str in c and write the first n elements of the resulting list/array to sto. Matrices are written in row-major order.
  * c: the spcl_inst to search
  * str: the name to lookup
  * sto: the array to save to. At most n values are written. If the spcl_array found has m elements and m<n, then all values sto[i] with i>=m are not modified.
@@ -414,6 +504,18 @@ int spcl_find_c_uarray(const spcl_inst* c, const char* str, unsigned* sto, size_
  * returns: the number of elements written on success or a negative spcl_val if an error occurred (-1 indicates no match, -2 indicates match of the wrong type, -3 indicates an invalid element)
  */
 int spcl_find_c_darray(const spcl_inst* c, const char* str, double* sto, size_t n);
+/**
+ * lookup the array spcl_val in c at str and save to sto as single precision floats. This is a plain copy for float32 arrays.
+ * returns: the number of elements written on success or a negative spcl_val if an error occurred (-1 indicates no match, -2 indicates match of the wrong type, -3 indicates an invalid element)
+ */
+int spcl_find_c_farray(const spcl_inst* c, const char* str, float* sto, size_t n);
+/**
+ * Get a pointer to the elements of the array in c at str without copying them. The pointer is owned by c and is only valid until the value is modified or c is destroyed.
+ * type: if not NULL, the element type is saved here (VAL_ARRAY for doubles, VAL_IARRAY for long longs, VAL_FARRAY for floats, VAL_I32ARRAY for ints or VAL_U8ARRAY for unsigned chars)
+ * n: if not NULL, the number of elements is saved here
+ * returns: the elements or NULL if str doesn't name an array. Small vectors are stored inline, so they must be read with spcl_find_c_darray() instead.
+ */
+const void* spcl_find_c_data(const spcl_inst* c, const char* str, valtype* type, size_t* n);
 /**
  * Lookup the spcl_val named str in c and write the string sto
  * c: the spcl_inst to search
@@ -433,11 +535,37 @@ int spcl_find_int(const spcl_inst* c, const char* str, int* sto);
  * returns: 0 on success or -1 if the name str couldn't be found
  */
 int spcl_find_uint(const spcl_inst* c, const char* str, unsigned* sto);
+/**
+ * lookup the 64 bit integer spcl_val in c at str and save to sto. Integers are read exactly, while numbers are rounded towards zero.
+ * returns: 0 on success or -1 if the name str couldn't be found
+ */
+int spcl_find_long(const spcl_inst* c, const char* str, long long* sto);
 /**
  * lookup the floating point spcl_val in c at str and save to sto.
  * returns: 0 on success or -1 if the name str couldn't be found
  */
 int spcl_find_float(const spcl_inst* c, const char* str, double* sto);
+/**
+ * A function sampled by tabulate(). The range [lo, hi] is split into n intervals of equal width, and each interval stores the coefficients of a polynomial of degree order in u = 2*(x - x_i)*scale - 1, which runs from -1 to 1 across the interval.
+ */
+typedef struct spcl_table {
+    double lo;
+    double hi;
+    double scale; //the number of intervals per unit length
+    double err; //the largest error found when checking the table against the function between its sample points
+    size_t n;
+    unsigned order;
+    const double* coeffs; //the order+1 coefficients of each interval in turn, starting with the constant term
+} spcl_table;
+/**
+ * lookup the table created by tabulate() in c at str and save it to sto. The coefficients are not copied, so sto is only valid until the value is modified or c is destroyed.
+ * returns: 0 on success or a negative value if an error occurred (-1 indicates no match, -2 indicates a match which isn't a table)
+ */
+int spcl_find_table(const spcl_inst* c, const char* str, spcl_table* sto);
+/**
+ * Evaluate the table t at x. Points outside [t->lo, t->hi] get the value at the nearest end.
+ */
+double spcl_table_eval(const spcl_table* t, double x);
 /**
  * Set the spcl_val with a name matching p_name to a copy of p_val.
  * name: the name of the variable to set
@@ -479,6 +607,8 @@ typedef struct spcl_uf {
     read_state code_lines;
     spcl_val (*exec)(spcl_inst*, spcl_fn_call);
     spcl_inst* fn_scope;
+    struct spcl_block* code; //the statements in code_lines, split on the first call
+    int deriv; //if positive, calls evaluate this derivative of the function instead. If negative, calls evaluate the gradient.
 } spcl_uf;
 
 /**
@@ -521,28 +651,213 @@ spcl_val spcl_assert(struct spcl_inst* c, spcl_fn_call tmp_f);
  */
 spcl_val spcl_isdef(struct spcl_inst* c, spcl_fn_call tmp_f);
 /**
- * Get the type of a spcl_val
+ * Get the type of a spcl_val. Small vectors made by vec() with two to four elements are reported as "array", like longer ones.
  */
 spcl_val spcl_typeof(struct spcl_inst* c, spcl_fn_call tmp_f);
 /**
- * Make a range following python syntax. If one argument is supplied then a list with tmp_f.args[0] elements is created starting at index 0 and going up to (but not including) tmp_f.args[0]. If two arguments are supplied then the range is from (tmp_f.args[0], tmp_f.args[1]). If three arguments are supplied then the range (tmp_f.args[0], tmp_f.args[1]) is still returned, but now the spacing between successive elements is tmp_f.args[2].
+ * Make a range following python syntax. If one argument is supplied then a list with tmp_f.args[0] elements is created starting at index 0 and going up to (but not including) tmp_f.args[0]. If two arguments are supplied then the range is from (tmp_f.args[0], tmp_f.args[1]). If three arguments are supplied then the range (tmp_f.args[0], tmp_f.args[1]) is still returned, but now the spacing between successive elements is tmp_f.args[2]. If any argument is an integer and all of them are whole numbers then an integer array is returned. The length is computed exactly whenever all arguments are whole numbers.
  */
 spcl_val spcl_range(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * int(x): Convert the number, array or list of numbers x to an integer or integer array, rounding towards zero. Integer arithmetic is exact (wrapping on overflow past 2^63). Numbers with whole values, including numeric literals, may be combined with integers without losing exactness, while division and anything involving fractional values gives ordinary numbers. Builtins other than range(), len(), typeof(), print(), astype() and dtype() receive integers as numbers.
+ */
+spcl_val spcl_int(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * astype(a, dtype): Convert the array or list a to the element type dtype, which is one of "f64" (the default for arrays), "f32", "i64" (integer arrays), "i32" or "u8". Conversions to integers round towards zero and wrap to the width of the type. Arithmetic between arrays with the same element type keeps that type, so float32 tables take half the memory of arrays. When types are mixed the result is floating point if either operand is and otherwise the wider type wins, except that float32 mixed with int32 or integer arrays gives f64. Numbers and integers never make an array wider, but numbers with fractional values make integer arrays f64, as does division of integer types. Other builtins receive typed arrays converted to f64.
+ */
+spcl_val spcl_astype(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * dtype(a): Get the element type of the array a as a string (see astype()).
+ */
+spcl_val spcl_dtype(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * where(mask, a, b): Get an array with a[i] wherever mask[i] is nonzero and b[i] elsewhere. a and b may be numbers or arrays with the same length as mask, and the element type follows the same rules as arithmetic between a and b. Masks are uint8 arrays of zeros and ones given by the comparisons <, <=, > and >= between an array and a number or an array of the same length (== and != still compare whole values). Tensors may be compared with numbers or tensors of the same shape, which gives a mask over all of their elements in row-major order. a and b may then be tensors with that shape, in which case the result is a tensor with the same shape. Masks are combined with & and | and inverted with !. Indexing an array, tensor or list with a mask, as in a[a < 0], selects the elements where the mask is nonzero (as an array for tensors), and a[mask] = x assigns x (either a number or an array with one element for each selected element) to them.
+ */
+spcl_val spcl_where(struct spcl_inst* c, spcl_fn_call tmp_f);
 /**
  * linspace(a, b, n) Create a list of n equally spaced real numbers starting at a and ending at b. This function must be called with three aguments unlike np.linspace. Note that the spcl_val b is included in the list
  */
 spcl_val spcl_linspace(struct spcl_inst* c, spcl_fn_call tmp_f);
 /**
- * Take a list spcl_val and flatten it so that it has numpy dimensions (n) where n is the sum of the length of each list in the base list. spcl_vals are copied in order e.g flatten([0,1],[2,3]) -> [0,1,2,3]
+ * Take a list spcl_val and flatten it so that it has numpy dimensions (n) where n is the sum of the length of each list in the base list. spcl_vals are copied in order e.g flatten([0,1],[2,3]) -> [0,1,2,3]. Lists may be nested to any depth. Tensors are flattened to an array which shares storage with the tensor if it is contiguous.
  * spcl_fn_call: the function with arguments passed
  */
 spcl_val spcl_flatten(struct spcl_inst* c, spcl_fn_call tmp_f);
 /**
  * Take a list spcl_val and flatten it so that it has numpy dimensions (n) where n is the sum of the length of each list in the base list. spcl_vals are copied in order e.g flatten([0,1],[2,3]) -> [0,1,2,3]
+ * Integer and typed arrays keep their element type, which is promoted as for arithmetic when the arguments differ. Appending a number that isn't whole to an integer array gives an array.
  * spcl_fn_call: the function with arguments passed
  */
 spcl_val spcl_cat(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * shape(a): Get an array with the length of each axis in the array or tensor a.
+ */
+spcl_val spcl_shape(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * reshape(a, n_0, n_1, ...): Get a view of the array or tensor a with the axes (n_0, n_1, ...). The shape may also be passed as a single list or array, and at most one length may be -1 to infer it from the number of elements. The result shares storage with a unless a isn't contiguous.
+ */
+spcl_val spcl_reshape(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * transpose(a, optional axes): Get a view of the tensor a with its axes reversed or permuted so that axis i of the result is axis axes[i] of a. The result shares storage with a.
+ */
+spcl_val spcl_transpose(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * sum(a, optional axis): Get the sum of the elements in the array, tensor or numeric list a. If axis is given, then a is only summed along that axis. Blocks of elements are added pairwise, so the rounding error grows like log(n).
+ */
+spcl_val spcl_sum(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * prod(a, optional axis): Get the product of the elements in a, or along axis.
+ */
+spcl_val spcl_prod(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * min(a, optional axis): Get the smallest element in a, or along axis. If called with several numbers, e.g. min(1, 2, 3), then the smallest of them is returned.
+ */
+spcl_val spcl_min(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * max(a, optional axis): Get the largest element in a, or along axis. If called with several numbers, then the largest of them is returned.
+ */
+spcl_val spcl_max(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * mean(a, optional axis): Get the mean of the elements in a, or along axis.
+ */
+spcl_val spcl_mean(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * dot(a, b): Get the dot product of the arrays (or numeric lists) a and b, which must have the same length. Small vectors such as vec(x, y, z) are handled without any allocation.
+ */
+spcl_val spcl_dot(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * norm(a, optional p): Get the p-norm of the elements in a. p defaults to 2, and p=1/0 gives the largest absolute value.
+ */
+spcl_val spcl_norm(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * cross(a, b): Get the cross product of the three element vectors (or arrays or numeric lists) a and b as a small vector.
+ */
+spcl_val spcl_cross(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * matmul(a, b): Get the matrix product of a and b, which may be matrices or arrays. Arrays are treated as rows on the left and columns on the right, so the product of two arrays is their dot product. This is equivalent to a @ b.
+ */
+spcl_val spcl_matmul(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * inv(a): Get the inverse of the square matrix a. An error is returned if a is singular.
+ */
+spcl_val spcl_inv(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * solve(a, b): Solve the linear system a @ x = b for x, where a is a square matrix and b is an array or a matrix with one column for each right hand side.
+ */
+spcl_val spcl_solve(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * det(a): Get the determinant of the square matrix a.
+ */
+spcl_val spcl_det(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * diff(a, optional n): Get the n-th order forward differences of a along its last axis. n defaults to 1, and each order shortens the axis by one element.
+ */
+spcl_val spcl_diff(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * stencil(a, coeffs, offsets, optional mode): Get sum(coeffs[k]*a[i+offsets[k]]) for each i along the last axis of a. The default mode "valid" only keeps elements for which every offset is inside a. The modes "same", "wrap" and "edge" keep the length of a by padding with zeros, periodic copies or the nearest element respectively.
+ */
+spcl_val spcl_stencil(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * convolve(a, v, optional mode): Get the discrete convolution of the arrays a and v. mode may be "full" (the default), "same" or "valid" with the same meaning as in numpy.
+ */
+spcl_val spcl_convolve(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * sort(a): Get a sorted copy of the array or list a. Arrays keep their element type, NaNs are placed last, and lists may hold numbers or other values that can be compared, such as strings.
+ */
+spcl_val spcl_sort(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * argsort(a): Get the integer array of indices which sorts a, so that a[i] for each i in argsort(a) is in ascending order. The sort is stable, so equal elements keep their order.
+ */
+spcl_val spcl_argsort(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * unique(a): Get the sorted distinct elements of the array or list a.
+ */
+spcl_val spcl_unique(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * searchsorted(a, v, optional side): Get the index at which v would be inserted into the sorted array or list a to keep it sorted. If side is "right", then v is placed after elements equal to it instead of before (the default "left"). If v is an array or list, then an integer array with the index of each element is returned.
+ */
+spcl_val spcl_searchsorted(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * interp(x, xp, fp, optional left, optional right): Linearly interpolate the values fp at the strictly increasing grid points xp for each element of the number, array or tensor x. Points below or above the grid get left and right, which default to the first and last values. Uniform grids are detected and use index arithmetic instead of a binary search.
+ */
+spcl_val spcl_interp(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * interp2d(x, y, xp, yp, fp): Bilinearly interpolate the matrix fp with fp[i][j] at (xp[i], yp[j]) for each pair of points in x and y. Either coordinate may be a single number, and points outside the grid are moved to its nearest edge.
+ */
+spcl_val spcl_interp2d(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * lookup(x, lo, hi, fp): Linearly interpolate the table fp sampled at evenly spaced points from lo to hi for each element of x. Points outside [lo, hi] get the value at the nearest end. lookup(x, tab) instead evaluates the table tab made by tabulate().
+ */
+spcl_val spcl_lookup(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * tabulate(fn, lo, hi, n, optional order): Sample the function fn of one variable on n intervals of equal width from lo to hi and fit a polynomial of the given degree (3 by default, at most 15) to each interval. fn is called once with an array of every sample point if it returns an array of the same length which agrees with calls of fn with single numbers at both ends and three points in between, otherwise it is called once per point. The result is an object with __type__ = "table" which can be evaluated by lookup() or from C with spcl_find_table() and spcl_table_eval(). Its err member holds the largest difference between the table and separate calls of fn with single numbers at points halfway between the samples.
+ */
+spcl_val spcl_tabulate(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * deriv(fn, optional order): Get the function which evaluates the order-th derivative (1 by default, at most 16) of the function fn of one variable. Derivatives are exact up to rounding, since fn is evaluated once with a dual number which carries the taylor coefficients through arithmetic and the math functions. Arrays are differentiated at each element.
+ */
+spcl_val spcl_deriv(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * grad(fn): Get the function which evaluates the array of partial derivatives of fn with respect to each of its arguments, which must be numbers. Each partial derivative takes one evaluation of fn with a dual number.
+ */
+spcl_val spcl_grad(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * fft(a): Get the discrete fourier transform of the real or complex array a as a complex array. Tensors with shape (n, 2) holding the real and imaginary part of each element are also accepted. Any length is supported, and the plan for each length is computed once and reused.
+ */
+spcl_val spcl_fft(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * ifft(a): Get the inverse discrete fourier transform of a, normalized so that ifft(fft(a)) gives back a.
+ */
+spcl_val spcl_ifft(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * rfft(a): Get the first n/2+1 coefficients of the fourier transform of the real array a of length n. The remaining coefficients are the complex conjugates of these.
+ */
+spcl_val spcl_rfft(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * complex(re, optional im): Get the complex number or complex array with real part re and imaginary part im. Either part may be a number or an array, and im defaults to zero. Complex literals may also be written with a j suffix, e.g. 1 + 2j.
+ */
+spcl_val spcl_complex(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * real(z): Get the real part of the number, complex number or (complex) array z.
+ */
+spcl_val spcl_real(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * imag(z): Get the imaginary part of z, which is zero for real values.
+ */
+spcl_val spcl_imag(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * conj(z): Get the complex conjugate of z.
+ */
+spcl_val spcl_conj(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * angle(z): Get the argument of z in radians, between -pi and pi.
+ */
+spcl_val spcl_angle(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * seed(s): Restart the random number stream used by rand(), randn() and uniform() with the non-negative integer key s. Every instance starts with seed(0), so scripts give the same random numbers each time they are read.
+ */
+spcl_val spcl_seed(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * rand(n_0, n_1, ...): Get an array or tensor with the shape (n_0, n_1, ...) of random numbers uniformly distributed in [0, 1), or a single number if no shape is given. The shape may also be passed as a single list. Numbers come from a counter-based (philox) generator, so large draws are split across threads with identical results for any number of threads.
+ */
+spcl_val spcl_rand(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * randn(n_0, n_1, ...): The same as rand(), but the numbers have a normal distribution with mean 0 and standard deviation 1.
+ */
+spcl_val spcl_randn(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * uniform(lo, hi, n_0, n_1, ...): The same as rand(), but the numbers are uniformly distributed in [lo, hi).
+ */
+spcl_val spcl_uniform(struct spcl_inst* c, spcl_fn_call tmp_f);
 spcl_val spcl_print(struct spcl_inst* c, spcl_fn_call tmp_f);
+/**
+ * Functions in the math namespace (e.g. math.exp) use vectorized polynomial approximations for arrays, which may differ from the C math library by a few units in the last place. Complex arguments always use the C complex math library, and math.abs of a complex value gives its (real) magnitude. Calling this with strict != 0 makes them use the C math library for every element instead.
+ */
+void spcl_set_strict_math(int strict);
+/**
+ * Set the number of threads used for large array operations, including the calling thread. n_threads = 0 (the default) uses one thread per core, and n_threads = 1 keeps everything on the calling thread. Arrays with fewer than min_n elements are never split between threads, and min_n = 0 keeps the current threshold. The threads belong to a pool which is shared by every instance. Results don't depend on the number of threads.
+ */
+void spcl_set_threads(unsigned n_threads, size_t min_n);
 spcl_val errtype(struct spcl_inst* c, spcl_fn_call tmp_f);
 
 #endif //READ_H
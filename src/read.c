@@ -1,3 +1,9 @@
+#include <pthread.h>
+#include <complex.h>
+#include <unistd.h>
+#ifdef SPCL_USE_BLAS
+#include <cblas.h>
+#endif
 #include "utils.h"
 #include "speclang.h"
 
@@ -7,9 +13,9 @@ typedef enum { KEY_NONE, KEY_IMPORT, KEY_CLASS, KEY_IF, KEY_FOR, KEY_ELSE, KEY_W
 static s8 spcl_keywords[SPCL_N_KEYS] = {s8(" "), s8("import"), s8("class"), s8("if"), s8("for"), s8("else"), s8("while"), s8("break"), s8("continue"), s8("return"), s8("fn")};
 static const char* const errnames[N_ERRORS] =
 {"SUCCESS", "NO_FILE", "LACK_TOKENS", "BAD_SYNTAX", "BAD_VALUE", "BAD_TYPE", "NOMEM", "NAN", "UNDEFINED_TOKEN", "OUT_OF_BOUNDS", "ASSERT"};
-static const char* const valnames[N_VALTYPES] = {"none", "error", "numeric", "string", "array", "list", "fn", "obj"};
+static const char* const valnames[N_VALTYPES] = {"none", "error", "numeric", "string", "array", "tensor", "list", "fn", "obj", "complex", "complex array", "integer", "integer array", "float32 array", "int32 array", "uint8 array", "dual", "vector"};
 
-#define spcl_isfalse(v) (v.type == VAL_UNDEF || (v.type == VAL_NUM && v.val.x == 0) || v.n_els == 0)
+#define spcl_isfalse(v) (v.type == VAL_UNDEF || (v.type == VAL_NUM && v.val.x == 0) || (v.type == VAL_INT && v.val.i == 0) || (v.type == VAL_COMPLEX && v.val.z[0] == 0 && v.val.z[1] == 0) || (v.type == VAL_DUAL && v.val.a[0] == 0) || v.n_els == 0)
 #define spcl_istrue(v) (!spcl_isfalse(v))
 
 //dumb forward declarations
@@ -43,547 +49,4506 @@ int spcl_strcmp(spcl_val a, spcl_val b) {
     return a.n_els - b.n_els;
 }
 
+/** ============================ shared buffers ============================ **/
+
 /**
- * get the psize of a spcl_context
+ * A reference counted block of memory. Copies of arrays and tensors share the same buffer, which is only duplicated once one of them is modified (see make_unique()). Strings and lists are never shared, but still use a buffer to keep track of how much room is left for appending.
  */
-static inline size_t con_size(const spcl_inst* c) {
-    if (!c)
-	return 0;
-    return 1 << c->t_bits;
+struct spcl_buf {
+    size_t n_refs;
+    size_t size;	//the number of bytes available in data
+    double data[];
+};
+static inline struct spcl_buf* alloc_buf(size_t size) {
+    struct spcl_buf* b = xmalloc(sizeof(struct spcl_buf) + size);
+    b->n_refs = 1;
+    b->size = size;
+    return b;
+}
+/**
+ * Release the memory which data points into. Values with a NULL buffer own data directly.
+ */
+static inline void release_data(spcl_val* v, void* data) {
+    if (!v->buf)
+	xfree(data);
+    else if (--v->buf->n_refs == 0)
+	xfree(v->buf);
+    v->buf = NULL;
 }
 
 /**
- * iterate through a spcl_inst by finding defined entries in the table
+ * Make sure that the buffer owned by the string, array, tensor or list v has room for at least n elements. The buffer grows geometrically so that repeated appends take amortized constant time.
+ * v: the value to grow. n_els is left unmodified. Arrays and tensors must already be unique and tensors must be contiguous.
+ * n: the minimum number of elements (or entries along the first axis for tensors) that v must be able to hold
+ * el_size: the size of each element (or entry along the first axis) in bytes
  */
-static inline size_t con_it_next(const spcl_inst* c, size_t i) {
-    for (; i < con_size(c); ++i) {
-	if (c->table[i].v.type)
-	    return i;
+static inline void grow_val(spcl_val* v, size_t n, size_t el_size) {
+    char** ptr = (v->type == VAL_MAT)? (char**)&(v->val.t->data) : &(v->val.s);
+    //strings always have room for a null terminator
+    size_t extra = (v->type == VAL_STR);
+    size_t off = (v->buf && *ptr)? (size_t)(*ptr - (char*)v->buf->data) : 0;
+    size_t cap = (v->buf)? (v->buf->size - off - extra)/el_size : v->n_els;
+    if (n <= cap && *ptr && (!v->buf || v->buf->n_refs == 1))
+	return;
+    if (cap < ALLOC_LST_N)
+	cap = ALLOC_LST_N;
+    while (cap < n)
+	cap *= 2;
+    size_t size = el_size*cap + extra;
+    if (v->buf && v->buf->n_refs == 1 && off == 0) {
+	v->buf = xrealloc(v->buf, sizeof(struct spcl_buf) + size);
+	v->buf->size = size;
+    } else {
+	//views into the middle of a buffer and values that own their memory directly are moved to a fresh buffer
+	struct spcl_buf* b = alloc_buf(size);
+	if (*ptr) {
+	    memcpy(b->data, *ptr, el_size*v->n_els);
+	    release_data(v, *ptr);
+	}
+	v->buf = b;
     }
-    return i;
+    *ptr = (char*)v->buf->data;
 }
 
+/** ============================ tensors ============================ **/
+
 /**
- * Helper function that finds the start of first token before the index s in the read state rs. The returned spcl_val is greater than or equal to zero.
- * fs: the line buffer to read from
- * s: the current position
- * stop: do not return any tokens before this index
+ * Allocate a tensor descriptor with room for ndim axes. The shape and strides are left uninitialized.
  */
-static inline psize find_token_before(const spcl_fstream* fs, psize s, psize stop) {
-    int started = 0;
-    while (s > stop) {
-	s -= 1;
-	char c = fs_get(fs, s);
-	if (!is_whitespace(c))
-	    started = 1;
-	if ((!started && is_char_sep(c)) || s ==0)
-	    return s;
+static inline spcl_tensor* alloc_tensor_desc(size_t ndim) {
+    spcl_tensor* t = xmalloc(sizeof(spcl_tensor) + ndim*(sizeof(size_t) + sizeof(psize)));
+    t->ndim = ndim;
+    t->shape = (size_t*)(t+1);
+    t->strides = (psize*)(t->shape + ndim);
+    t->data = NULL;
+    return t;
+}
+//the total number of elements in t
+static inline size_t tensor_size(const spcl_tensor* t) {
+    size_t n = 1;
+    for (size_t d = 0; d < t->ndim; ++d)
+	n *= t->shape[d];
+    return n;
+}
+//the number of rows along the last axis of t
+static inline size_t tensor_rows(const spcl_tensor* t) {
+    size_t n = 1;
+    for (size_t d = 0; d+1 < t->ndim; ++d)
+	n *= t->shape[d];
+    return n;
+}
+/**
+ * Get a pointer to the start of row k (counting in row-major order) along the last axis of t. Consecutive elements in a row are separated by t->strides[t->ndim-1].
+ */
+static inline double* tensor_row(const spcl_tensor* t, size_t k) {
+    double* ret = t->data;
+    for (size_t d = t->ndim-1; d > 0; --d) {
+	ret += (psize)(k % t->shape[d-1])*t->strides[d-1];
+	k /= t->shape[d-1];
     }
-    return stop;
+    return ret;
+}
+//check whether the elements of t are stored contiguously in row-major order
+static inline int tensor_is_contiguous(const spcl_tensor* t) {
+    psize expect = 1;
+    for (size_t d = t->ndim; d > 0; --d) {
+	if (t->shape[d-1] > 1 && t->strides[d-1] != expect)
+	    return 0;
+	expect *= t->shape[d-1];
+    }
+    return 1;
 }
-
-STACK_DEF(char,BLK_MAX)
 /**
- * Find the index of the first character c that isn't nested inside a block or NULL if an error occurred
+ * Copy the elements of t into the contiguous buffer dst in row-major order
  */
-static inline psize strchr_block_rs(const spcl_fstream* fs, psize s, psize e, char c) {
-    stack(char,BLK_MAX) blk_stk = make_stack(char,BLK_MAX)();
-    char prev;
-    char cur = 0;
-    while (s < e && s < fs->flen) {
-	prev = cur;
-	cur = fs_get(fs, s);
-	if (!cur)
-	    break;
-	//now look for matches
-	if (cur == c && blk_stk.ptr == 0)
-	    return s;
-	if (cur == BEG_PAR || cur == BEG_SQR || cur == BEG_CRL) {
-	    if ( push(char,BLK_MAX)(&blk_stk, cur) ) return e;
-	} else if (cur == END_CRL || cur == END_SQR ||cur == END_PAR) {
-	    if ( pop(char,BLK_MAX)(&blk_stk, &prev) || cur != get_match(prev) ) return e;
-	} else if (cur == '\"') {
-	    if (blk_stk.ptr != 0 && !peek(char,BLK_MAX)(&blk_stk, 1, &prev) && prev == '\"') {
-		if ( pop(char,BLK_MAX)(&blk_stk, NULL) ) return e;
-	    } else {
-		if ( push(char,BLK_MAX)(&blk_stk, cur) ) return e;
-	    }
-	} else if (cur == '\'') {
-	    //quotes are more complicated
-	    if (blk_stk.ptr != 0 && !peek(char,BLK_MAX)(&blk_stk, 1, &prev) && prev == '\'') {
-		if ( pop(char,BLK_MAX)(&blk_stk, NULL) ) return e;
-	    } else {
-		if ( push(char,BLK_MAX)(&blk_stk, cur) ) return e;
-	    }
+static inline void tensor_gather(const spcl_tensor* t, double* dst) {
+    size_t n = t->shape[t->ndim-1];
+    psize s = t->strides[t->ndim-1];
+    size_t rows = tensor_rows(t);
+    for (size_t k = 0; k < rows; ++k, dst += n) {
+	const double* row = tensor_row(t, k);
+	if (s == 1) {
+	    memcpy(dst, row, sizeof(double)*n);
+	} else {
+	    for (size_t j = 0; j < n; ++j)
+		dst[j] = row[(psize)j*s];
 	}
-	++s;
     }
-    return e;
 }
-
 /**
- * Find the first instance of a token (i.e. surrounded by whitespace) in the string str which matches comp
+ * Copy the contiguous buffer src into the elements of t in row-major order
  */
-static inline psize token_block(const spcl_fstream* fs, psize s, psize e, const char* cmp, size_t cmp_len) {
-    if (!fs || !cmp)
-	return e;
-    stack(char,BLK_MAX) blk_stk = make_stack(char,BLK_MAX)();
-    char prev;
-    char cur = 0;
-    while (s != e && s < fs->flen) {
-	prev = cur;
-	cur = fs_get(fs, s);
-	if (!cur)
-	    break;
-	//check whether we're at the root level and there was a seperation terminator
-	if (blk_stk.ptr == 0 && is_char_sep(prev)) {
-	    int found = 1;
-	    for (size_t j = 0; j < cmp_len; ++j) {
-		//make sure the first cmp_len characters match
-		if ( cmp[j] != fs_get(fs, s+j) ) {
-		    found = 0;
-		    break;
-		}
-	    }
-	    //make sure its ended by a separator
-	    if ( found && is_char_sep(fs_get(fs, s+cmp_len)) )
-		return s;
-	}
-	if (cur == BEG_PAR || cur == BEG_SQR || cur == BEG_CRL) {
-	    if ( push(char,BLK_MAX)(&blk_stk, cur) ) return e;
-	} else if (cur == END_CRL || cur == END_SQR || cur == END_PAR) {
-	    if ( pop(char,BLK_MAX)(&blk_stk, &prev)  || cur != get_match(prev) ) return e;
-	//comments use more then one character
-	} else if (prev == '/' && cur == '*') {
-	    if ( push(char,BLK_MAX)(&blk_stk, '*') ) return e;
-	} else if (prev == '*' && cur == '/') {
-	    if ( pop(char,BLK_MAX)(&blk_stk, &prev) || cur != get_match(prev) ) return e;
-	} else if (prev == '/' && cur == '/') {
-	    if ( push(char,BLK_MAX)(&blk_stk, cur) ) return e;
-	//quotes are more complicated 
-	} else if (cur == '\"') {
-	    if (blk_stk.ptr != 0 && !peek(char,BLK_MAX)(&blk_stk, 1, &prev) && prev == '\"') {
-		if ( pop(char,BLK_MAX)(&blk_stk, NULL) ) return e;
-	    } else {
-		if ( push(char,BLK_MAX)(&blk_stk, cur) ) return e;
-	    }
-	} else if (cur == '\'') {
-	    //quotes are more complicated
-	    if (blk_stk.ptr != 0 && !peek(char,BLK_MAX)(&blk_stk, 1, &prev) && prev == '\'') {
-		if ( pop(char,BLK_MAX)(&blk_stk, NULL) ) return e;
-	    } else {
-		if ( push(char,BLK_MAX)(&blk_stk, cur) ) return e;
-	    }
+static inline void tensor_scatter(const spcl_tensor* t, const double* src) {
+    size_t n = t->shape[t->ndim-1];
+    psize s = t->strides[t->ndim-1];
+    size_t rows = tensor_rows(t);
+    for (size_t k = 0; k < rows; ++k, src += n) {
+	double* row = tensor_row(t, k);
+	if (s == 1) {
+	    memcpy(row, src, sizeof(double)*n);
+	} else {
+	    for (size_t j = 0; j < n; ++j)
+		row[(psize)j*s] = src[j];
 	}
-	++s;
     }
-    return e;
 }
-
-/** ============================ psize ============================ **/
-
-spcl_local read_state make_read_state(const spcl_fstream* fs, psize s, psize e) {
-    read_state rs;
-    rs.b = fs;
-    rs.start = s;
-    rs.end = e;
-    return rs;
+//set the strides of t so that it is contiguous in row-major order
+static inline void tensor_set_strides(spcl_tensor* t) {
+    psize s = 1;
+    for (size_t d = t->ndim; d > 0; --d) {
+	t->strides[d-1] = s;
+	s *= t->shape[d-1];
+    }
 }
-
-/** ============================ spcl_fstream ============================ **/
-
 /**
- * Grow the cache used for the fstream fs by attempting to double its size
- * returns: 0 on failure or 1 on success
+ * Allocate an array with n elements that are left uninitialized
  */
-static inline int grow_fstream(spcl_fstream* fs) {
-    //detect overflows
-    if (fs->clen > PSIZE_MAX >> 2)
-	return 0;
-    //reallocate and check for success
-    char* tmp_cache = realloc(fs->cache, 2*fs->clen);
-    if (!tmp_cache)
-	return 0;
-    //if successful then adjust the size and the cache
-    fs->clen *= 2;
-    fs->cache = tmp_cache;
-    return 1;
+static inline spcl_val alloc_array(size_t n) {
+    spcl_val v = spcl_make_none();
+    v.type = VAL_ARRAY;
+    v.n_els = n;
+    v.buf = alloc_buf(sizeof(double)*n);
+    v.val.a = v.buf->data;
+    return v;
 }
-static inline spcl_fstream* alloc_fstream(psize hint) {
-    spcl_fstream* fs = xmalloc(sizeof(spcl_fstream));
-    memset(fs, 0, sizeof(spcl_fstream));
-    //set the cache to have hint bytes if applicable
-    if (hint > 0) {
-	char* tmp = calloc(hint, sizeof(char));
-	if (!tmp)
-	    return fs;
-	fs->cache = tmp;
-	fs->clen = hint;
-    }
-    return fs;
+/**
+ * Allocate a complex array with n elements that are left uninitialized. The real and imaginary parts of each element are stored next to each other, so the layout matches an array of double complex.
+ */
+static inline spcl_val alloc_carray(size_t n) {
+    spcl_val v = alloc_array(2*n);
+    v.type = VAL_CARRAY;
+    v.n_els = n;
+    return v;
 }
-spcl_fstream* make_spcl_fstream_str(const char* str, size_t n) {
-    spcl_fstream* fs = alloc_fstream(n);
-    fs->cache = malloc(n);
-    if (!fs->cache) {
-	free(fs);
-	return NULL;
+/**
+ * Typed arrays store narrower elements than arrays (float32, int32 or uint8) to save memory. Arrays (float64) and integer arrays (int64) are the wide types that computations fall back to.
+ */
+static inline int is_typed(valtype t) {
+    return t == VAL_FARRAY || t == VAL_I32ARRAY || t == VAL_U8ARRAY;
+}
+static inline int is_int(valtype t) {
+    return t == VAL_INT || t == VAL_IARRAY;
+}
+//check whether t is an array type with integer elements
+static inline int is_int_dtype(valtype t) {
+    return t == VAL_IARRAY || t == VAL_I32ARRAY || t == VAL_U8ARRAY;
+}
+//check whether t is an array type with real elements
+static inline int is_real_arr(valtype t) {
+    return t == VAL_ARRAY || t == VAL_IARRAY || is_typed(t);
+}
+//the number of bytes used by each element of an array with type t
+static inline size_t el_size(valtype t) {
+    switch (t) {
+    case VAL_FARRAY:
+    case VAL_I32ARRAY:	return 4;
+    case VAL_U8ARRAY:	return 1;
+    case VAL_CARRAY:	return 2*sizeof(double);
+    default:		return 8;
     }
-    fs->f = NULL;
-    fs->cst = 0;
-    fs->flen = n;
-    fs->clen = n;
-    memcpy(fs->cache, str, n);
-    return fs;
 }
-spcl_fstream* make_spcl_fstreamn(const char* p_fname, size_t n) {
-    if (!p_fname)
-	return alloc_fstream(0);
-
-    //this is so fucking dumb, i hate null-terminated strings
-    char* tmp_fname = strndup(p_fname, n);
-    FILE* fp = fopen(tmp_fname, "r");
-    free(tmp_fname);
-    if (fp) {
-	//allocate memory for the stream and initialize to be empty
-	spcl_fstream* fs = alloc_fstream(SPCL_STR_BSIZE);
-	fs->f = fp;
-	//figure out the length of the file
-	fseek(fp, 0, SEEK_END);
-	fs->flen = ftell(fs->f);
-	fseek(fp, 0, SEEK_SET);
-	//TODO: reading the entire file into memory is dumb, we should stream from it instead
-	psize j = 0;
-	int res = fgetc(fp);
-	while (1) {
-	    //if we reached the end of the buffer, try growing and return NULL if that fails
-	    if (j == fs->clen) {
-		if (!grow_fstream(fs)) {
-		    destroy_spcl_fstream(fs);
-		    return NULL;
-		}
-	    }
-	    //NULL terminate and exit at the end of the file
-	    if (res == EOF) {
-		fs->cache[j] = 0;
-		return fs;
-	    }
-	    //otherwise, append
-	    fs->cache[j++] = (char)res;
-	    res = fgetc(fp);
-	}
-	return fs;
+/**
+ * Allocate an array with n elements of the type t (e.g. VAL_IARRAY or VAL_FARRAY) that are left uninitialized
+ */
+static inline spcl_val alloc_typed(size_t n, valtype t) {
+    spcl_val v = spcl_make_none();
+    v.type = t;
+    v.n_els = n;
+    v.buf = alloc_buf(el_size(t)*n);
+    v.val.a = v.buf->data;
+    return v;
+}
+static inline spcl_val alloc_iarray(size_t n) {
+    return alloc_typed(n, VAL_IARRAY);
+}
+//read element i of the real array v as a double
+static inline double arr_get(const spcl_val* v, size_t i) {
+    switch (v->type) {
+    case VAL_IARRAY:	return (double)v->val.ia[i];
+    case VAL_FARRAY:	return v->val.fa[i];
+    case VAL_I32ARRAY:	return v->val.i32[i];
+    case VAL_U8ARRAY:	return v->val.u8[i];
+    default:		return v->val.a[i];
     }
-    return NULL;
 }
-void destroy_spcl_fstream(spcl_fstream* fs) {
-    if (!fs)
-	return;
-    if (fs->cache)
-	free(fs->cache);
-    if (fs->f)
-	fclose(fs->f);
-    free(fs);
+//read element i of the real array v as an integer, rounding towards zero
+static inline long long arr_geti(const spcl_val* v, size_t i) {
+    switch (v->type) {
+    case VAL_IARRAY:	return v->val.ia[i];
+    case VAL_I32ARRAY:	return v->val.i32[i];
+    case VAL_U8ARRAY:	return v->val.u8[i];
+    default:		{ double x = arr_get(v, i); return (fabs(x) < 0x1p63)? (long long)x : 0; }
+    }
 }
-psize fs_find_line(const spcl_fstream* fs, psize s) {
-    psize ret = 0;
-    for (psize i = 0; i < s; ++i) {
-	if (fs_get(fs, i) == '\n')
-	    ++ret;
+//set element i of the real array v to k, wrapping to the width of the element type
+static inline void arr_seti(spcl_val* v, size_t i, long long k) {
+    switch (v->type) {
+    case VAL_IARRAY:	v->val.ia[i] = k; break;
+    case VAL_FARRAY:	v->val.fa[i] = (float)k; break;
+    case VAL_I32ARRAY:	v->val.i32[i] = (int)(unsigned)k; break;
+    case VAL_U8ARRAY:	v->val.u8[i] = (unsigned char)k; break;
+    default:		v->val.a[i] = (double)k; break;
     }
-    return ret;
 }
-psize fs_line_end(const spcl_fstream* fs, psize s) {
-    while (s < fs->flen && fs_get(fs, s) != '\n')
-	++s;
-    return s;
+//set element i of the real array v to x. Integer types round towards zero and then wrap.
+static inline void arr_setx(spcl_val* v, size_t i, double x) {
+    if (v->type == VAL_ARRAY)
+	v->val.a[i] = x;
+    else if (v->type == VAL_FARRAY)
+	v->val.fa[i] = (float)x;
+    else
+	arr_seti(v, i, (fabs(x) < 0x1p63)? (long long)x : 0);
 }
-//Below are protected functions in fstream. They are not intended to be used by external libraries.
-spcl_local s8 fs_read(const spcl_fstream* fs, psize s, psize e) {
-    if (s >= fs->clen)
-	return (s8){NULL, 0};
-    if (e >= fs->clen)
-	e = fs->clen;
-    return (s8){fs->cache+s, e-s};
+//rank the integer array types by width
+static inline int int_rank(valtype t) {
+    return (t == VAL_U8ARRAY)? 0 : (t == VAL_I32ARRAY)? 1 : 2;
+}
+/**
+ * Get the element type of the result of an operation between arrays with element types a and b. Floating point types win over integer types and wider types win over narrower ones. float32 only holds integers exactly up to 2^24, so it is only kept when mixed with uint8.
+ */
+static inline valtype promote_dtype(valtype a, valtype b) {
+    if (a == b)
+	return a;
+    if (is_int_dtype(a) && is_int_dtype(b))
+	return (int_rank(a) > int_rank(b))? a : b;
+    if ((a == VAL_FARRAY && b == VAL_U8ARRAY) || (a == VAL_U8ARRAY && b == VAL_FARRAY))
+	return VAL_FARRAY;
+    return VAL_ARRAY;
+}
+//get the value of the number or integer v as a double
+static inline double val_to_x(const spcl_val* v) {
+    return (v->type == VAL_INT)? (double)v->val.i : v->val.x;
+}
+/**
+ * Convert the real array v to an array with the element type t. Integers are copied exactly between integer types.
+ */
+static inline spcl_val convert_arr(const spcl_val* v, valtype t) {
+    spcl_val ret = alloc_typed(v->n_els, t);
+    if (is_int_dtype(t) && is_int_dtype(v->type)) {
+	for (size_t i = 0; i < v->n_els; ++i)
+	    arr_seti(&ret, i, arr_geti(v, i));
+    } else {
+	for (size_t i = 0; i < v->n_els; ++i)
+	    arr_setx(&ret, i, arr_get(v, i));
+    }
+    return ret;
+}
+/**
+ * Convert integers, integer arrays and typed arrays to numbers and (float64) arrays, which is what most builtins and the tensor and complex kernels expect.
+ * returns: a new value that must be cleaned up by the caller. Other values are copied.
+ */
+static inline spcl_val to_f64(spcl_val v) {
+    if (v.type == VAL_INT)
+	return spcl_make_num((double)v.val.i);
+    if (!is_int_dtype(v.type) && !is_typed(v.type))
+	return copy_spcl_val(v);
+    return convert_arr(&v, VAL_ARRAY);
+}
+/**
+ * Small vectors store their elements inline, so that geometric code never touches the heap. Most builtins expect arrays, which are made by vec_to_array().
+ */
+static inline spcl_val vec_to_array(const spcl_val* v) {
+    spcl_val ret = alloc_array(v->n_els);
+    memcpy(ret.val.a, v->val.v, sizeof(double)*v->n_els);
+    return ret;
+}
+//check whether v is a small vector or a list containing one at any depth
+static inline int has_vec(const spcl_val* v) {
+    if (v->type == VAL_VEC)
+	return 1;
+    for (size_t i = 0; v->type == VAL_LIST && i < v->n_els; ++i) {
+	if (has_vec(v->val.l + i))
+	    return 1;
+    }
+    return 0;
+}
+/**
+ * Copy v, replacing any small vectors (including those nested in lists) with arrays.
+ * returns: a new value that must be cleaned up by the caller
+ */
+static inline spcl_val unbox_vecs(spcl_val v) {
+    if (v.type == VAL_VEC)
+	return vec_to_array(&v);
+    if (!has_vec(&v))
+	return copy_spcl_val(v);
+    spcl_val ret = v;
+    ret.buf = NULL;
+    ret.val.l = xmalloc(sizeof(spcl_val)*v.n_els);
+    for (size_t i = 0; i < v.n_els; ++i)
+	ret.val.l[i] = unbox_vecs(v.val.l[i]);
+    return ret;
+}
+//get the value of the number, integer or complex number v as a complex number. Undefined values are treated as zero, as for a unary sign.
+static inline double complex val_to_z(const spcl_val* v) {
+    if (v->type == VAL_COMPLEX)
+	return CMPLX(v->val.z[0], v->val.z[1]);
+    return CMPLX((v->type == VAL_NUM || v->type == VAL_INT)? val_to_x(v) : 0, 0);
+}
+/**
+ * Allocate a contiguous tensor with the specified shape. The elements are left uninitialized.
+ */
+static inline spcl_val alloc_tensor(size_t ndim, const size_t* shape) {
+    spcl_val v = spcl_make_none();
+    v.type = VAL_MAT;
+    v.val.t = alloc_tensor_desc(ndim);
+    memcpy(v.val.t->shape, shape, sizeof(size_t)*ndim);
+    tensor_set_strides(v.val.t);
+    v.n_els = shape[0];
+    v.buf = alloc_buf(sizeof(double)*tensor_size(v.val.t));
+    v.val.t->data = v.buf->data;
+    return v;
+}
+//move the elements of the tensor v to a new contiguous buffer
+static inline void move_tensor(spcl_val* v) {
+    struct spcl_buf* b = alloc_buf(sizeof(double)*tensor_size(v->val.t));
+    tensor_gather(v->val.t, b->data);
+    release_data(v, v->val.t->data);
+    v->buf = b;
+    v->val.t->data = b->data;
+    tensor_set_strides(v->val.t);
+}
+/**
+ * Make sure that the array or tensor v doesn't share its buffer with any other value so that it may be safely modified in place. Tensors that have to be copied are made contiguous.
+ */
+static inline void make_unique(spcl_val* v) {
+    if (!v->buf || v->buf->n_refs == 1)
+	return;
+    if (v->type == VAL_ARRAY || v->type == VAL_CARRAY || is_int_dtype(v->type) || is_typed(v->type)) {
+	size_t size = el_size(v->type)*v->n_els;
+	struct spcl_buf* b = alloc_buf(size);
+	memcpy(b->data, v->val.a, size);
+	release_data(v, v->val.a);
+	v->buf = b;
+	v->val.a = b->data;
+    } else if (v->type == VAL_MAT) {
+	move_tensor(v);
+    }
+}
+/**
+ * Make sure that the tensor v is unique and that its elements are contiguous in row-major order
+ */
+static inline void make_contiguous(spcl_val* v) {
+    if (v->type == VAL_MAT && !tensor_is_contiguous(v->val.t))
+	move_tensor(v);
+    else
+	make_unique(v);
+}
+/**
+ * Create a value for the sub-tensor of t with axes t->shape[skip...] starting at data. Values with fewer than two axes are returned as arrays (or numbers) so that one dimensional data always has the same type. The result holds a reference to buf.
+ */
+static inline spcl_val tensor_view(const spcl_tensor* t, size_t skip, double* data, struct spcl_buf* buf) {
+    size_t ndim = t->ndim - skip;
+    if (ndim == 0)
+	return spcl_make_num(*data);
+    spcl_val v = spcl_make_none();
+    if (ndim == 1 && (t->strides[skip] != 1 && t->shape[skip] > 1)) {
+	//arrays are always contiguous, so strided rows are copied
+	v = alloc_array(t->shape[skip]);
+	for (size_t j = 0; j < v.n_els; ++j)
+	    v.val.a[j] = data[(psize)j*t->strides[skip]];
+	return v;
+    }
+    v.n_els = t->shape[skip];
+    v.buf = buf;
+    if (buf)
+	++buf->n_refs;
+    if (ndim == 1) {
+	v.type = VAL_ARRAY;
+	v.val.a = data;
+    } else {
+	v.type = VAL_MAT;
+	v.val.t = alloc_tensor_desc(ndim);
+	memcpy(v.val.t->shape, t->shape+skip, sizeof(size_t)*ndim);
+	memcpy(v.val.t->strides, t->strides+skip, sizeof(psize)*ndim);
+	v.val.t->data = data;
+    }
+    return v;
+}
+/**
+ * Get the elements of the tensor v in row-major order as an array. Contiguous tensors are viewed in place and the result holds a reference to their buffer, while other tensors are copied.
+ */
+static inline spcl_val tensor_flat(const spcl_val* v) {
+    if (!v->buf || !tensor_is_contiguous(v->val.t)) {
+	spcl_val ret = alloc_array(tensor_size(v->val.t));
+	tensor_gather(v->val.t, ret.val.a);
+	return ret;
+    }
+    spcl_val ret = spcl_make_none();
+    ret.type = VAL_ARRAY;
+    ret.n_els = tensor_size(v->val.t);
+    ret.buf = v->buf;
+    ++ret.buf->n_refs;
+    ret.val.a = v->val.t->data;
+    return ret;
+}
+//check whether the tensors s and t have the same shape
+static inline int same_shape(const spcl_tensor* s, const spcl_tensor* t) {
+    if (s->ndim != t->ndim)
+	return 0;
+    for (size_t d = 0; d < s->ndim; ++d) {
+	if (s->shape[d] != t->shape[d])
+	    return 0;
+    }
+    return 1;
 }
 
+/** ============================ array kernels ============================ **/
+
+//integer exponents with at most this magnitude are evaluated by repeated squaring instead of pow()
+#define POWI_MAX	64
+//check whether y is an integer exponent which should use the repeated squaring fast path
+#define is_powi(y)	((y) == floor(y) && fabs(y) <= POWI_MAX)
+
 /**
- * Helper function which jumps to the first non-whitespace character after rs.
- * fs: the filestream to use
- * s: the index to start from
- * e: ensure that s does not read past this value. Set this value to be negative to indicate reading to the end of the file
- * force: if non-zero, then the returned value is guaranteed to move rs.start by at least one character. For instance, if you know that the rs.start is on an open parentheses and you want to act on the enclosed string, set this to one
- * returns: the index of the first non-whitespace character after s before e
+ * Vectorized math functions. These use polynomial approximations after a range reduction, and agree with libm to within a few units in the last place (ulp). The maximum differences from glibc measured over 3*10^7 random points (including points near 1 for log and near multiples of pi/2 for the trigonometric functions) are:
+ *   exp: 1 ulp for |x| <= 708
+ *   log: 2 ulp for all positive normal x
+ *   sin, cos: 2 ulp for |x| <= 10^5
+ *   tan: 4 ulp for |x| <= 10^5
+ * Arguments outside of these ranges, including infinities and nans, are passed to libm. spcl_set_strict_math() forces libm everywhere.
  */
-static inline psize skip_ws(const spcl_fstream* fs, psize s, psize e, int force) {
-    if (force)
-	++s;
-    //ensure that we don't read past the end of the file
-    if (e < s || e > fs->flen)
-	e = fs->flen;
-    while (is_whitespace(fs_get(fs, s)) && s < e)
-	++s;
-    return s;
+typedef enum { VM_NONE, VM_EXP, VM_LOG, VM_SIN, VM_COS, VM_TAN } vmath_fn;
+//adding and subtracting 1.5*2^52 rounds to the nearest integer, which is left in the low bits of the sum
+#define VM_MAGIC	0x1.8p52
+#define VM_LN2_HI	6.93147180369123816490e-01
+#define VM_LN2_LO	1.90821492927058770002e-10
+#define VM_PIO2_1	1.57079632673412561417e+00
+#define VM_PIO2_2	6.07710050630396597660e-11
+#define VM_PIO2_3	2.02226624871116645580e-21
+#define VM_PIO2_3T	8.47842766036889956997e-32
+#define VM_EXP_MAX	708.0
+#define VM_TRIG_MAX	1e5
+//taylor series coefficients in the order used by horner's method
+static const double EXP_C[] = {1.0/6227020800, 1.0/479001600, 1.0/39916800, 1.0/3628800, 1.0/362880, 1.0/40320, 1.0/5040, 1.0/720, 1.0/120, 1.0/24, 1.0/6, 1.0/2, 1, 1};
+static const double LOG_C[] = {1.0/23, 1.0/21, 1.0/19, 1.0/17, 1.0/15, 1.0/13, 1.0/11, 1.0/9, 1.0/7, 1.0/5, 1.0/3};
+static const double SIN_C[] = {1.0/355687428096000, -1.0/1307674368000, 1.0/6227020800, -1.0/39916800, 1.0/362880, -1.0/5040, 1.0/120, -1.0/6};
+static const double COS_C[] = {-1.0/6402373705728000, 1.0/20922789888000, -1.0/87178291200, 1.0/479001600, -1.0/3628800, 1.0/40320, -1.0/720, 1.0/24};
+//if set, then math functions always use libm
+static int strict_math = 0;
+
+static inline double scalar_math_fn(double x, vmath_fn fn) {
+    switch (fn) {
+    case VM_EXP: return exp(x);
+    case VM_LOG: return log(x);
+    case VM_SIN: return sin(x);
+    case VM_COS: return cos(x);
+    case VM_TAN: return tan(x);
+    default: return x;
+    }
 }
+static void scalar_math(double* y, const double* x, size_t n, vmath_fn fn) {
+    for (size_t i = 0; i < n; ++i)
+	y[i] = scalar_math_fn(x[i], fn);
+}
+//the largest radix of a single fft stage. Lengths with larger prime factors use Bluestein's algorithm
+#define FFT_MAX_RADIX	16
+/**
+ * One stage of a Stockham fft. The input is viewed as sequences with stride s, and the stage computes a radix point DFT for each q < s and p < m, reading element q + s*(p + j*m) for each j < radix and writing element q + s*(radix*p + k) for each k < radix after multiplying by the twiddle factor (wr + i*wi)[p*radix + k].
+ */
+typedef struct fft_stage {
+    size_t radix;
+    size_t s;
+    size_t m;
+    double* wr;
+    double* wi;
+    //the radix-th roots of unity
+    double* rr;
+    double* ri;
+} fft_stage;
+/**
+ * A set of elementwise kernels for one instruction set. The scalar kernels work everywhere, while the others are compiled for a specific target and only selected if the cpu supports it.
+ * vv: x[i] = x[i] op y[i] for each i < n
+ * vs: x[i] = x[i] op y for each i < n
+ * powi: x[i] = x[i]^k for each i < n where |k| <= POWI_MAX
+ * math: y[i] = fn(x[i]) for each i < n. x and y may be the same array.
+ * reduce: combine x[i] (or x[i]*y[i] if y isn't NULL) for each i < n with op, which may be '+', '*', '<' (minimum) or '>' (maximum)
+ * gemm: c[GEMM_MR*GEMM_NR] = the product of the packed panels a[kc*GEMM_MR] and b[kc*GEMM_NR] (see gemm())
+ * axpy: x[i] = x[i] + a*y[i] for each i < n
+ * fft_stage: apply one stage of a fast fourier transform to the complex sequence xr + i*xi, writing the result to yr + i*yi (see fft_stage)
+ * cmp: m[i] = x[i*sx] < y[i*sy] (or <= if or_eq is set) for each i < n, where the strides are 0 or 1
+ * blend: z[i] = (m[i])? a[i*sa] : b[i*sb] for each i < n, where the strides are 0 or 1
+ */
+typedef struct arr_kernels {
+    const char* name;
+    void (*vv)(double* x, const double* y, size_t n, char op);
+    void (*vs)(double* x, double y, size_t n, char op);
+    void (*powi)(double* x, long k, size_t n);
+    void (*math)(double* y, const double* x, size_t n, vmath_fn fn);
+    double (*reduce)(const double* x, const double* y, size_t n, char op);
+    void (*gemm)(size_t kc, const double* a, const double* b, double* c);
+    void (*axpy)(double* x, double a, const double* y, size_t n);
+    void (*fft_stage)(const struct fft_stage* st, const double* xr, const double* xi, double* yr, double* yi);
+    void (*cmp)(unsigned char* m, const double* x, psize sx, const double* y, psize sy, size_t n, int or_eq);
+    void (*blend)(double* z, const unsigned char* m, const double* a, psize sa, const double* b, psize sb, size_t n);
+    void (*philox)(double* y, size_t n, unsigned long long ctr, unsigned long long key);
+} arr_kernels;
 
-/** ======================================================== spcl_fn_call ======================================================== **/
+static inline double scalar_powi(double x, unsigned long m) {
+    double r = 1;
+    for (; m; m >>= 1, x *= x) {
+	if (m & 1)
+	    r *= x;
+    }
+    return r;
+}
+static void scalar_vv(double* x, const double* y, size_t n, char op) {
+    switch (op) {
+    case '+': for (size_t i = 0; i < n; ++i) x[i] += y[i];break;
+    case '-': for (size_t i = 0; i < n; ++i) x[i] -= y[i];break;
+    case '*': for (size_t i = 0; i < n; ++i) x[i] *= y[i];break;
+    case '/': for (size_t i = 0; i < n; ++i) x[i] /= y[i];break;
+    case '%': for (size_t i = 0; i < n; ++i) x[i] -= floor(x[i]/y[i])*y[i];break;
+    case '^': for (size_t i = 0; i < n; ++i) x[i] = pow(x[i], y[i]);break;
+    }
+}
+static void scalar_vs(double* x, double y, size_t n, char op) {
+    switch (op) {
+    case '+': for (size_t i = 0; i < n; ++i) x[i] += y;break;
+    case '-': for (size_t i = 0; i < n; ++i) x[i] -= y;break;
+    case '*': for (size_t i = 0; i < n; ++i) x[i] *= y;break;
+    case '/': for (size_t i = 0; i < n; ++i) x[i] /= y;break;
+    case '%': for (size_t i = 0; i < n; ++i) x[i] -= floor(x[i]/y)*y;break;
+    case '^': for (size_t i = 0; i < n; ++i) x[i] = pow(x[i], y);break;
+    }
+}
+static void scalar_powi_arr(double* x, long k, size_t n) {
+    unsigned long m = (k < 0)? -(unsigned long)k : (unsigned long)k;
+    for (size_t i = 0; i < n; ++i)
+	x[i] = (k < 0)? 1/scalar_powi(x[i], m) : scalar_powi(x[i], m);
+}
+//Reductions accumulate element i into accumulator i % RED_LANES. Every instruction set uses the same number of accumulators and combines them in the same order, so the results don't depend on which kernels are selected.
+#define RED_LANES	8
+static inline double red_identity(char op) {
+    switch (op) {
+    case '*': return 1;
+    case '<': return INFINITY;
+    case '>': return -INFINITY;
+    default: return 0;
+    }
+}
+static inline double red_apply(double a, double b, char op) {
+    switch (op) {
+    case '+': return a + b;
+    case '*': return a * b;
+    case '<': return (b < a)? b : a;
+    default: return (b > a)? b : a;
+    }
+}
+/**
+ * Add the remaining n < RED_LANES elements of x (times y) to the accumulators acc[RED_LANES], then combine the accumulators pairwise
+ */
+static inline double red_finish(double* acc, const double* x, const double* y, size_t n, char op) {
+    for (size_t j = 0; j < n; ++j)
+	acc[j] = red_apply(acc[j], (y)? x[j]*y[j] : x[j], op);
+    for (size_t w = RED_LANES/2; w > 0; w /= 2) {
+	for (size_t j = 0; j < w; ++j)
+	    acc[j] = red_apply(acc[j], acc[j+w], op);
+    }
+    return acc[0];
+}
+static double scalar_reduce(const double* x, const double* y, size_t n, char op) {
+    double acc[RED_LANES];
+    for (size_t j = 0; j < RED_LANES; ++j)
+	acc[j] = red_identity(op);
+    size_t i = 0;
+    for (; i+RED_LANES <= n; i += RED_LANES) {
+	for (size_t j = 0; j < RED_LANES; ++j)
+	    acc[j] = red_apply(acc[j], (y)? x[i+j]*y[i+j] : x[i+j], op);
+    }
+    return red_finish(acc, x+i, (y)? y+i : NULL, n-i, op);
+}
+//matrix products are accumulated in tiles of GEMM_MR rows by GEMM_NR columns, which are small enough to stay in registers
+#define GEMM_MR		4
+#define GEMM_NR		8
+static void scalar_gemm(size_t kc, const double* a, const double* b, double* c) {
+    memset(c, 0, sizeof(double)*GEMM_MR*GEMM_NR);
+    for (size_t p = 0; p < kc; ++p, a += GEMM_MR, b += GEMM_NR) {
+	for (size_t i = 0; i < GEMM_MR; ++i) {
+	    for (size_t j = 0; j < GEMM_NR; ++j)
+		c[i*GEMM_NR + j] += a[i]*b[j];
+	}
+    }
+}
+static void scalar_axpy(double* x, double a, const double* y, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+	x[i] += a*y[i];
+}
+//radix 2 and 4 butterflies for element q of butterfly p (see fft_stage)
+static inline void fft_bfly2(const fft_stage* st, const double* xr, const double* xi, double* yr, double* yi, size_t p, size_t q) {
+    size_t s = st->s, m = st->m;
+    double wr = st->wr[2*p+1], wi = st->wi[2*p+1];
+    double ar = xr[q + s*p], ai = xi[q + s*p];
+    double br = xr[q + s*(p+m)], bi = xi[q + s*(p+m)];
+    yr[q + s*2*p] = ar + br;
+    yi[q + s*2*p] = ai + bi;
+    yr[q + s*(2*p+1)] = (ar - br)*wr - (ai - bi)*wi;
+    yi[q + s*(2*p+1)] = (ar - br)*wi + (ai - bi)*wr;
+}
+static inline void fft_bfly4(const fft_stage* st, const double* xr, const double* xi, double* yr, double* yi, size_t p, size_t q) {
+    size_t s = st->s, m = st->m;
+    const double* wr = st->wr + 4*p;
+    const double* wi = st->wi + 4*p;
+    double a0r = xr[q + s*p], a0i = xi[q + s*p];
+    double a1r = xr[q + s*(p+m)], a1i = xi[q + s*(p+m)];
+    double a2r = xr[q + s*(p+2*m)], a2i = xi[q + s*(p+2*m)];
+    double a3r = xr[q + s*(p+3*m)], a3i = xi[q + s*(p+3*m)];
+    //t3 = -i*(a1 - a3)
+    double t0r = a0r + a2r, t0i = a0i + a2i;
+    double t1r = a0r - a2r, t1i = a0i - a2i;
+    double t2r = a1r + a3r, t2i = a1i + a3i;
+    double t3r = a1i - a3i, t3i = a3r - a1r;
+    double* y0r = yr + q + s*4*p;
+    double* y0i = yi + q + s*4*p;
+    y0r[0] = t0r + t2r;
+    y0i[0] = t0i + t2i;
+    y0r[s] = (t1r + t3r)*wr[1] - (t1i + t3i)*wi[1];
+    y0i[s] = (t1r + t3r)*wi[1] + (t1i + t3i)*wr[1];
+    y0r[2*s] = (t0r - t2r)*wr[2] - (t0i - t2i)*wi[2];
+    y0i[2*s] = (t0r - t2r)*wi[2] + (t0i - t2i)*wr[2];
+    y0r[3*s] = (t1r - t3r)*wr[3] - (t1i - t3i)*wi[3];
+    y0i[3*s] = (t1r - t3r)*wi[3] + (t1i - t3i)*wr[3];
+}
+static void scalar_fft_stage(const fft_stage* st, const double* xr, const double* xi, double* yr, double* yi) {
+    size_t r = st->radix, s = st->s, m = st->m;
+    double ar[FFT_MAX_RADIX], ai[FFT_MAX_RADIX];
+    for (size_t p = 0; p < m; ++p) {
+	for (size_t q = 0; q < s; ++q) {
+	    if (r == 2) {
+		fft_bfly2(st, xr, xi, yr, yi, p, q);
+		continue;
+	    } else if (r == 4) {
+		fft_bfly4(st, xr, xi, yr, yi, p, q);
+		continue;
+	    }
+	    //other radices use a direct DFT
+	    for (size_t j = 0; j < r; ++j) {
+		ar[j] = xr[q + s*(p + j*m)];
+		ai[j] = xi[q + s*(p + j*m)];
+	    }
+	    for (size_t k = 0; k < r; ++k) {
+		double sr = 0, si = 0;
+		for (size_t j = 0, t = 0; j < r; ++j, t = (t + k) % r) {
+		    sr += ar[j]*st->rr[t] - ai[j]*st->ri[t];
+		    si += ar[j]*st->ri[t] + ai[j]*st->rr[t];
+		}
+		size_t o = q + s*(r*p + k);
+		yr[o] = sr*st->wr[p*r + k] - si*st->wi[p*r + k];
+		yi[o] = sr*st->wi[p*r + k] + si*st->wr[p*r + k];
+	    }
+	}
+    }
+}
+static void scalar_cmp(unsigned char* m, const double* x, psize sx, const double* y, psize sy, size_t n, int or_eq) {
+    if (or_eq) {
+	for (size_t i = 0; i < n; ++i) m[i] = x[(psize)i*sx] <= y[(psize)i*sy];
+    } else {
+	for (size_t i = 0; i < n; ++i) m[i] = x[(psize)i*sx] < y[(psize)i*sy];
+    }
+}
+static void scalar_blend(double* z, const unsigned char* m, const double* a, psize sa, const double* b, psize sb, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+	z[i] = (m[i])? a[(psize)i*sa] : b[(psize)i*sb];
+}
+/**
+ * Philox4x32-10 counter-based random numbers. Block b of the stream for a key is a function of b alone, so any range of blocks can be generated independently (and on any thread) with identical results. Each block of four 32 bit words gives two doubles uniformly distributed in [0, 1).
+ */
+#define PHILOX_ROUNDS	10
+#define PHILOX_M0	0xD2511F53u
+#define PHILOX_M1	0xCD9E8D57u
+#define PHILOX_W0	0x9E3779B9u
+#define PHILOX_W1	0xBB67AE85u
+#define PHILOX_LO	0xffffffffull
+static void scalar_philox(double* y, size_t n, unsigned long long ctr, unsigned long long key) {
+    for (size_t i = 0; i < n; ++i) {
+	unsigned long long x0 = (ctr + i) & PHILOX_LO, x1 = (ctr + i) >> 32, x2 = 0, x3 = 0;
+	unsigned k0 = (unsigned)key, k1 = (unsigned)(key >> 32);
+	for (int r = 0; r < PHILOX_ROUNDS; ++r, k0 += PHILOX_W0, k1 += PHILOX_W1) {
+	    unsigned long long p0 = x0*PHILOX_M0, p1 = x2*PHILOX_M1;
+	    x0 = (p1 >> 32) ^ x1 ^ k0;
+	    x1 = p1 & PHILOX_LO;
+	    x2 = (p0 >> 32) ^ x3 ^ k1;
+	    x3 = p0 & PHILOX_LO;
+	}
+	//keep the top 53 bits of each pair of words
+	y[2*i] = (double)(((x0 << 32) | x1) >> 11) * 0x1p-53;
+	y[2*i+1] = (double)(((x2 << 32) | x3) >> 11) * 0x1p-53;
+    }
+}
+static const arr_kernels scalar_kernels = {"scalar", scalar_vv, scalar_vs, scalar_powi_arr, scalar_math, scalar_reduce, scalar_gemm, scalar_axpy, scalar_fft_stage, scalar_cmp, scalar_blend, scalar_philox};
 
-void cleanup_spcl_fn_call(spcl_fn_call* f) {
-    if (f) {
-	for (size_t i = 0; i < f->n_args; ++i)
-	    cleanup_spcl_val(f->args+i);
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPCL_X86_KERNELS 1
+/**
+ * Define the kernels for an instruction set using gcc vector extensions. Each function is compiled for the target ATTR with vectors of W doubles. Remainders, and operations without a vector instruction (% and ^ with non-integer exponents), fall back to the scalar kernels.
+ */
+#define DEF_ARR_KERNELS(ISA, W, ATTR)									\
+typedef double ISA##_vec __attribute__((vector_size(8*W)));						\
+static inline __attribute__((target(ATTR))) ISA##_vec ISA##_load(const double* p) {			\
+    ISA##_vec v;											\
+    memcpy(&v, p, sizeof(v));										\
+    return v;												\
+}													\
+static inline __attribute__((target(ATTR))) void ISA##_store(double* p, ISA##_vec v) {		\
+    memcpy(p, &v, sizeof(v));										\
+}													\
+static __attribute__((target(ATTR))) void ISA##_vv(double* x, const double* y, size_t n, char op) {	\
+    size_t i = 0;											\
+    switch (op) {											\
+    case '+': for (; i+W <= n; i += W) ISA##_store(x+i, ISA##_load(x+i) + ISA##_load(y+i));break;	\
+    case '-': for (; i+W <= n; i += W) ISA##_store(x+i, ISA##_load(x+i) - ISA##_load(y+i));break;	\
+    case '*': for (; i+W <= n; i += W) ISA##_store(x+i, ISA##_load(x+i) * ISA##_load(y+i));break;	\
+    case '/': for (; i+W <= n; i += W) ISA##_store(x+i, ISA##_load(x+i) / ISA##_load(y+i));break;	\
+    }													\
+    scalar_vv(x+i, y+i, n-i, op);									\
+}													\
+static __attribute__((target(ATTR))) void ISA##_vs(double* x, double y, size_t n, char op) {		\
+    size_t i = 0;											\
+    switch (op) {											\
+    case '+': for (; i+W <= n; i += W) ISA##_store(x+i, ISA##_load(x+i) + y);break;			\
+    case '-': for (; i+W <= n; i += W) ISA##_store(x+i, ISA##_load(x+i) - y);break;			\
+    case '*': for (; i+W <= n; i += W) ISA##_store(x+i, ISA##_load(x+i) * y);break;			\
+    case '/': for (; i+W <= n; i += W) ISA##_store(x+i, ISA##_load(x+i) / y);break;			\
+    }													\
+    scalar_vs(x+i, y, n-i, op);										\
+}													\
+static __attribute__((target(ATTR))) void ISA##_powi(double* x, long k, size_t n) {			\
+    unsigned long m = (k < 0)? -(unsigned long)k : (unsigned long)k;					\
+    size_t i = 0;											\
+    for (; i+W <= n; i += W) {										\
+	ISA##_vec b = ISA##_load(x+i);									\
+	ISA##_vec r = (ISA##_vec){0} + 1.0;								\
+	for (unsigned long e = m; e; e >>= 1, b *= b) {							\
+	    if (e & 1)											\
+		r *= b;											\
+	}												\
+	ISA##_store(x+i, (k < 0)? 1.0/r : r);								\
+    }													\
+    scalar_powi_arr(x+i, k, n-i);									\
+}													\
+static __attribute__((target(ATTR))) void ISA##_axpy(double* x, double a, const double* y, size_t n) {	\
+    size_t i = 0;											\
+    for (; i+W <= n; i += W)										\
+	ISA##_store(x+i, ISA##_load(x+i) + a*ISA##_load(y+i));						\
+    scalar_axpy(x+i, a, y+i, n-i);									\
+}
+/**
+ * Define vectorized exp, log, sin, cos and tan for an instruction set. This must follow DEF_ARR_KERNELS() for the same ISA.
+ */
+#define DEF_MATH_KERNELS(ISA, W, ATTR)		\
+typedef long long ISA##_ivec __attribute__((vector_size(8*W)));									\
+/* select a in lanes where the mask m is set and b otherwise */										\
+static inline __attribute__((target(ATTR))) ISA##_vec ISA##_sel(ISA##_ivec m, ISA##_vec a, ISA##_vec b) {				\
+    return (ISA##_vec)(((ISA##_ivec)a & m) | ((ISA##_ivec)b & ~m));									\
+}																	\
+static inline __attribute__((target(ATTR))) ISA##_vec ISA##_vexp(ISA##_vec x) {							\
+    /* x = n*ln(2) + r where |r| <= ln(2)/2, then exp(x) = 2^n*exp(r) */									\
+    ISA##_vec t = x*M_LOG2E + VM_MAGIC;												\
+    ISA##_vec n = t - VM_MAGIC;													\
+    ISA##_vec r = (x - n*VM_LN2_HI) - n*VM_LN2_LO;											\
+    ISA##_vec p = (ISA##_vec){0} + EXP_C[0];												\
+    for (size_t k = 1; k < sizeof(EXP_C)/sizeof(double); ++k)									\
+	p = p*r + EXP_C[k];														\
+    ISA##_ivec ni = (ISA##_ivec)t - (ISA##_ivec)((ISA##_vec){0} + VM_MAGIC);								\
+    return p*(ISA##_vec)((ni + 1023) << 52);												\
+}																	\
+static inline __attribute__((target(ATTR))) ISA##_vec ISA##_vlog(ISA##_vec x) {							\
+    /* x = 2^e*m where sqrt(1/2) <= m < sqrt(2), then log(m) = 2*atanh(f) with f = (m-1)/(m+1) */					\
+    ISA##_ivec bits = (ISA##_ivec)x;													\
+    ISA##_ivec e = ((bits >> 52) & 0x7ff) - 1023;											\
+    ISA##_vec m = (ISA##_vec)((bits & 0x000fffffffffffffLL) | 0x3ff0000000000000LL);							\
+    ISA##_ivec big = (ISA##_ivec)(m > M_SQRT2);											\
+    m = ISA##_sel(big, m*0.5, m);													\
+    e -= big;															\
+    ISA##_vec ed = (ISA##_vec)(e + (ISA##_ivec)((ISA##_vec){0} + VM_MAGIC)) - VM_MAGIC;						\
+    ISA##_vec f = (m - 1)/(m + 1);													\
+    ISA##_vec s = f*f;														\
+    ISA##_vec p = (ISA##_vec){0} + LOG_C[0];												\
+    for (size_t k = 1; k < sizeof(LOG_C)/sizeof(double); ++k)									\
+	p = p*s + LOG_C[k];														\
+    return ed*VM_LN2_HI + ((2*f + 2*f*s*p) + ed*VM_LN2_LO);										\
+}																	\
+/**																	\
+ * Compute sin(x), or cos(x) if shift=1, or tan(x) if shift=-1									\
+ */																	\
+static inline __attribute__((target(ATTR))) ISA##_vec ISA##_vsin(ISA##_vec x, int shift) {						\
+    /* x = n*pi/2 + r where |r| <= pi/4. pi/2 is split into pieces with few enough bits that n*VM_PIO2_1 and n*VM_PIO2_2 are exact */	\
+    ISA##_vec t = x*M_2_PI + VM_MAGIC;												\
+    ISA##_vec n = t - VM_MAGIC;													\
+    ISA##_vec r = ((x - n*VM_PIO2_1) - n*VM_PIO2_2) - n*VM_PIO2_3;									\
+    r -= n*VM_PIO2_3T;														\
+    ISA##_vec z = r*r;														\
+    ISA##_vec ps = (ISA##_vec){0} + SIN_C[0];											\
+    ISA##_vec pc = (ISA##_vec){0} + COS_C[0];											\
+    for (size_t k = 1; k < sizeof(SIN_C)/sizeof(double); ++k) {									\
+	ps = ps*z + SIN_C[k];													\
+	pc = pc*z + COS_C[k];													\
+    }																\
+    ISA##_vec s = r + r*z*ps;													\
+    ISA##_vec c = (1 - 0.5*z) + z*z*pc;												\
+    ISA##_ivec q = (ISA##_ivec)t - (ISA##_ivec)((ISA##_vec){0} + VM_MAGIC);								\
+    ISA##_ivec odd = -(q & 1);													\
+    if (shift < 0)															\
+	return ISA##_sel(odd, -c/s, s/c);												\
+    q += shift;															\
+    odd = -(q & 1);															\
+    return (ISA##_vec)((ISA##_ivec)ISA##_sel(odd, c, s) ^ ((q & 2) << 62));								\
+}																	\
+static __attribute__((target(ATTR))) void ISA##_math(double* y, const double* x, size_t n, vmath_fn fn) {				\
+    for (size_t i = 0; i < n; i += W) {												\
+	/* the last partial vector is padded so that every element gets the same treatment */						\
+	size_t m = (n-i < W)? n-i : W;												\
+	double tmp[W] = {0};														\
+	memcpy(tmp, x+i, sizeof(double)*m);												\
+	ISA##_vec v = ISA##_load(tmp);												\
+	ISA##_vec res;														\
+	ISA##_ivec ok;														\
+	switch (fn) {														\
+	case VM_EXP: res = ISA##_vexp(v);ok = (ISA##_ivec)(v >= -VM_EXP_MAX) & (ISA##_ivec)(v <= VM_EXP_MAX);break;			\
+	case VM_LOG: res = ISA##_vlog(v);ok = (ISA##_ivec)(v >= 0x1p-1022) & (ISA##_ivec)(v <= 0x1.fffffffffffffp1023);break;				\
+	case VM_SIN: res = ISA##_vsin(v, 0);ok = (ISA##_ivec)(v >= -VM_TRIG_MAX) & (ISA##_ivec)(v <= VM_TRIG_MAX);break;		\
+	case VM_COS: res = ISA##_vsin(v, 1);ok = (ISA##_ivec)(v >= -VM_TRIG_MAX) & (ISA##_ivec)(v <= VM_TRIG_MAX);break;		\
+	default:     res = ISA##_vsin(v, -1);ok = (ISA##_ivec)(v >= -VM_TRIG_MAX) & (ISA##_ivec)(v <= VM_TRIG_MAX);break;		\
+	}																\
+	ISA##_store(tmp, res);													\
+	/* arguments outside of the range of the polynomial approximations (including infinities and nans) are handled by libm */	\
+	for (size_t j = 0; j < m; ++j)												\
+	    y[i+j] = (ok[j])? tmp[j] : scalar_math_fn(x[i+j], fn);									\
+    }																\
+}
+
+/**
+ * Define the reduction kernel for an instruction set. This must follow DEF_MATH_KERNELS() for the same ISA. The RED_LANES accumulators are stored in RED_LANES/W vectors.
+ */
+#define RED_LOOP(ISA, W, ...)										\
+    for (; i+RED_LANES <= n; i += RED_LANES) {								\
+	for (size_t j = 0; j < RED_LANES/W; ++j) {							\
+	    ISA##_vec v = ISA##_load(x+i+j*W);								\
+	    __VA_ARGS__;										\
+	}												\
     }
+#define DEF_RED_KERNELS(ISA, W, ATTR)									\
+static __attribute__((target(ATTR))) double ISA##_reduce(const double* x, const double* y, size_t n, char op) {	\
+    ISA##_vec acc[RED_LANES/W];										\
+    for (size_t j = 0; j < RED_LANES/W; ++j)								\
+	acc[j] = (ISA##_vec){0} + red_identity(op);							\
+    size_t i = 0;											\
+    switch (op) {											\
+    case '+':												\
+	if (y) {											\
+	    RED_LOOP(ISA, W, acc[j] += v*ISA##_load(y+i+j*W))						\
+	} else {											\
+	    RED_LOOP(ISA, W, acc[j] += v)								\
+	}												\
+	break;												\
+    case '*': RED_LOOP(ISA, W, acc[j] *= v);break;							\
+    case '<': RED_LOOP(ISA, W, acc[j] = ISA##_sel((ISA##_ivec)(v < acc[j]), v, acc[j]));break;		\
+    case '>': RED_LOOP(ISA, W, acc[j] = ISA##_sel((ISA##_ivec)(v > acc[j]), v, acc[j]));break;		\
+    }													\
+    double res[RED_LANES];										\
+    memcpy(res, acc, sizeof(res));									\
+    return red_finish(res, x+i, (y)? y+i : NULL, n-i, op);						\
 }
 
-/** ======================================================== name_val_pair ======================================================== **/
+/* each step of the product broadcasts one element of a panel column against GEMM_NR/W vectors of b */
+#define DEF_GEMM_KERNELS(ISA, W, ATTR)										\
+static __attribute__((target(ATTR))) void ISA##_gemm(size_t kc, const double* a, const double* b, double* c) {	\
+    ISA##_vec acc[GEMM_MR][GEMM_NR/W];										\
+    for (size_t i = 0; i < GEMM_MR; ++i) {									\
+	for (size_t j = 0; j < GEMM_NR/W; ++j)									\
+	    acc[i][j] = (ISA##_vec){0};										\
+    }														\
+    for (size_t p = 0; p < kc; ++p, a += GEMM_MR, b += GEMM_NR) {						\
+	ISA##_vec bv[GEMM_NR/W];										\
+	for (size_t j = 0; j < GEMM_NR/W; ++j)									\
+	    bv[j] = ISA##_load(b+j*W);										\
+	for (size_t i = 0; i < GEMM_MR; ++i) {									\
+	    for (size_t j = 0; j < GEMM_NR/W; ++j)								\
+		acc[i][j] += a[i]*bv[j];									\
+	}													\
+    }														\
+    for (size_t i = 0; i < GEMM_MR; ++i) {									\
+	for (size_t j = 0; j < GEMM_NR/W; ++j)									\
+	    ISA##_store(c + i*GEMM_NR + j*W, acc[i][j]);							\
+    }														\
+}
 
-void cleanup_name_val_pair(name_val_pair nv) {
-    if (nv.s.s)
-	free(nv.s.s);
-    cleanup_spcl_val(&nv.v);
+/* radix 2 and 4 stages are vectorized over q, which is contiguous, once the stride is at least one vector wide */
+#define DEF_FFT_KERNELS(ISA, W, ATTR)												\
+static __attribute__((target(ATTR))) void ISA##_fft_stage(const fft_stage* st, const double* xr, const double* xi, double* yr, double* yi) {	\
+    size_t r = st->radix, s = st->s, m = st->m;											\
+    if ((r != 2 && r != 4) || s < W) {												\
+	scalar_fft_stage(st, xr, xi, yr, yi);											\
+	return;															\
+    }																\
+    for (size_t p = 0; p < m; ++p) {												\
+	size_t q = 0;														\
+	if (r == 2) {														\
+	    double wr = st->wr[2*p+1], wi = st->wi[2*p+1];									\
+	    for (; q+W <= s; q += W) {												\
+		ISA##_vec ar = ISA##_load(xr + q + s*p), ai = ISA##_load(xi + q + s*p);						\
+		ISA##_vec br = ISA##_load(xr + q + s*(p+m)), bi = ISA##_load(xi + q + s*(p+m));				\
+		ISA##_store(yr + q + s*2*p, ar + br);										\
+		ISA##_store(yi + q + s*2*p, ai + bi);										\
+		ISA##_store(yr + q + s*(2*p+1), (ar - br)*wr - (ai - bi)*wi);							\
+		ISA##_store(yi + q + s*(2*p+1), (ar - br)*wi + (ai - bi)*wr);							\
+	    }															\
+	    for (; q < s; ++q)													\
+		fft_bfly2(st, xr, xi, yr, yi, p, q);										\
+	    continue;														\
+	}															\
+	const double* wr = st->wr + 4*p;											\
+	const double* wi = st->wi + 4*p;											\
+	for (; q+W <= s; q += W) {												\
+	    ISA##_vec a0r = ISA##_load(xr + q + s*p), a0i = ISA##_load(xi + q + s*p);						\
+	    ISA##_vec a1r = ISA##_load(xr + q + s*(p+m)), a1i = ISA##_load(xi + q + s*(p+m));					\
+	    ISA##_vec a2r = ISA##_load(xr + q + s*(p+2*m)), a2i = ISA##_load(xi + q + s*(p+2*m));				\
+	    ISA##_vec a3r = ISA##_load(xr + q + s*(p+3*m)), a3i = ISA##_load(xi + q + s*(p+3*m));				\
+	    ISA##_vec t0r = a0r + a2r, t0i = a0i + a2i;										\
+	    ISA##_vec t1r = a0r - a2r, t1i = a0i - a2i;										\
+	    ISA##_vec t2r = a1r + a3r, t2i = a1i + a3i;										\
+	    ISA##_vec t3r = a1i - a3i, t3i = a3r - a1r;										\
+	    double* y0r = yr + q + s*4*p;											\
+	    double* y0i = yi + q + s*4*p;											\
+	    ISA##_store(y0r, t0r + t2r);											\
+	    ISA##_store(y0i, t0i + t2i);											\
+	    ISA##_store(y0r + s, (t1r + t3r)*wr[1] - (t1i + t3i)*wi[1]);							\
+	    ISA##_store(y0i + s, (t1r + t3r)*wi[1] + (t1i + t3i)*wr[1]);							\
+	    ISA##_store(y0r + 2*s, (t0r - t2r)*wr[2] - (t0i - t2i)*wi[2]);							\
+	    ISA##_store(y0i + 2*s, (t0r - t2r)*wi[2] + (t0i - t2i)*wr[2]);							\
+	    ISA##_store(y0r + 3*s, (t1r - t3r)*wr[3] - (t1i - t3i)*wi[3]);							\
+	    ISA##_store(y0i + 3*s, (t1r - t3r)*wi[3] + (t1i - t3i)*wr[3]);							\
+	}															\
+	for (; q < s; ++q)													\
+	    fft_bfly4(st, xr, xi, yr, yi, p, q);										\
+    }																\
 }
 
-/** ======================================================== builtin functions ======================================================== **/
-spcl_val get_sigerr(spcl_fn_call f, size_t min_args, size_t max_args, const valtype* sig) {
-    if (!sig || max_args < min_args)
-	return spcl_make_none();
-    if (f.n_args < min_args)
-	return spcl_make_err(E_LACK_TOKENS, "%.*s expected %lu arguments, got %lu", f.name.n, f.name.s, min_args, f.n_args);
-    if (f.n_args > max_args)
-	return spcl_make_err(E_LACK_TOKENS, "%.*s with too many arguments, %lu", f.name.n, f.name.s, f.n_args);
-    for (size_t i = 0; i < f.n_args; ++i) {
-	//treat undefined as allowing for arbitrary type
-	if (sig[i] && f.args[i].type != sig[i]) {
-	    //if the type is an error, let it pass through
-	    if (f.args[i].type == VAL_ERR)
-		return f.args[i];
-	    return spcl_make_err(E_BAD_TYPE, "%.*s expected args[%lu].type=%s, got %s", f.name.n, f.name.s, i, valnames[sig[i]], valnames[f.args[i].type]);
+/* comparisons and blends of masks. Operands with stride 0 are broadcast to every lane, and the bytes of the mask are widened to lanes with every bit set */
+#define DEF_MASK_KERNELS(ISA, W, ATTR)										\
+static inline __attribute__((target(ATTR))) ISA##_vec ISA##_lds(const double* p, psize s) {			\
+    return (s)? ISA##_load(p) : (ISA##_vec){0} + *p;								\
+}														\
+static __attribute__((target(ATTR))) void ISA##_cmp(unsigned char* m, const double* x, psize sx, const double* y, psize sy, size_t n, int or_eq) {	\
+    size_t i = 0;												\
+    for (; i+W <= n; i += W) {											\
+	ISA##_vec a = ISA##_lds(x + (psize)i*sx, sx), b = ISA##_lds(y + (psize)i*sy, sy);			\
+	ISA##_ivec r = (or_eq)? (ISA##_ivec)(a <= b) : (ISA##_ivec)(a < b);					\
+	for (size_t j = 0; j < W; ++j)										\
+	    m[i+j] = r[j] & 1;											\
+    }														\
+    scalar_cmp(m+i, x + (psize)i*sx, sx, y + (psize)i*sy, sy, n-i, or_eq);					\
+}														\
+static __attribute__((target(ATTR))) void ISA##_blend(double* z, const unsigned char* m, const double* a, psize sa, const double* b, psize sb, size_t n) {	\
+    size_t i = 0;												\
+    for (; i+W <= n; i += W) {											\
+	ISA##_ivec mv;												\
+	for (size_t j = 0; j < W; ++j)										\
+	    mv[j] = -(long long)(m[i+j] != 0);									\
+	ISA##_store(z+i, ISA##_sel(mv, ISA##_lds(a + (psize)i*sa, sa), ISA##_lds(b + (psize)i*sb, sb)));	\
+    }														\
+    scalar_blend(z+i, m+i, a + (psize)i*sa, sa, b + (psize)i*sb, sb, n-i);					\
+}
+
+/* random numbers. Each lane holds one block of the philox stream with its 32 bit words widened to 64 bits, so that the high and low halves of each product are exact */
+#define DEF_RNG_KERNELS(ISA, W, ATTR)										\
+typedef unsigned long long ISA##_uvec __attribute__((vector_size(8*W)));					\
+static __attribute__((target(ATTR))) void ISA##_philox(double* y, size_t n, unsigned long long ctr, unsigned long long key) {	\
+    size_t i = 0;												\
+    for (; i+W <= n; i += W) {											\
+	ISA##_uvec x0, x1, x2 = {0}, x3 = {0};									\
+	for (size_t j = 0; j < W; ++j) {									\
+	    x0[j] = (ctr + i + j) & PHILOX_LO;									\
+	    x1[j] = (ctr + i + j) >> 32;									\
+	}													\
+	unsigned k0 = (unsigned)key, k1 = (unsigned)(key >> 32);						\
+	for (int r = 0; r < PHILOX_ROUNDS; ++r, k0 += PHILOX_W0, k1 += PHILOX_W1) {				\
+	    ISA##_uvec p0 = x0*PHILOX_M0, p1 = x2*PHILOX_M1;							\
+	    x0 = (p1 >> 32) ^ x1 ^ k0;										\
+	    x1 = p1 & PHILOX_LO;										\
+	    x2 = (p0 >> 32) ^ x3 ^ k1;										\
+	    x3 = p0 & PHILOX_LO;										\
+	}													\
+	ISA##_uvec a = ((x0 << 32) | x1) >> 11, b = ((x2 << 32) | x3) >> 11;					\
+	for (size_t j = 0; j < W; ++j) {									\
+	    y[2*(i+j)] = (double)a[j] * 0x1p-53;								\
+	    y[2*(i+j)+1] = (double)b[j] * 0x1p-53;								\
+	}													\
+    }														\
+    scalar_philox(y + 2*i, n-i, ctr+i, key);									\
+}
+
+#define DEF_KERNELS(ISA, W, ATTR) DEF_ARR_KERNELS(ISA, W, ATTR) DEF_MATH_KERNELS(ISA, W, ATTR) DEF_RED_KERNELS(ISA, W, ATTR) DEF_GEMM_KERNELS(ISA, W, ATTR) DEF_FFT_KERNELS(ISA, W, ATTR) DEF_MASK_KERNELS(ISA, W, ATTR) DEF_RNG_KERNELS(ISA, W, ATTR)	\
+static const arr_kernels ISA##_kernels = {#ISA, ISA##_vv, ISA##_vs, ISA##_powi, ISA##_math, ISA##_reduce, ISA##_gemm, ISA##_axpy, ISA##_fft_stage, ISA##_cmp, ISA##_blend, ISA##_philox};
+
+DEF_KERNELS(sse2, 2, "sse2")
+DEF_KERNELS(avx2, 4, "avx2")
+DEF_KERNELS(avx512, 8, "avx512f")
+#endif
+
+//the kernels used for all array arithmetic. This is NULL until the first call to get_kernels()
+static const arr_kernels* cur_kernels = NULL;
+/**
+ * Find the kernels for the instruction set named isa.
+ * returns: the matching kernels or NULL if the cpu doesn't support isa
+ */
+static inline const arr_kernels* find_kernels(const char* isa) {
+    if (strcmp(isa, "scalar") == 0)
+	return &scalar_kernels;
+#ifdef SPCL_X86_KERNELS
+    __builtin_cpu_init();
+    if (strcmp(isa, "avx512") == 0 && __builtin_cpu_supports("avx512f"))
+	return &avx512_kernels;
+    if (strcmp(isa, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+	return &avx2_kernels;
+    if (strcmp(isa, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+	return &sse2_kernels;
+#endif
+    return NULL;
+}
+/**
+ * Get the kernels for the widest instruction set supported by the cpu
+ */
+static inline const arr_kernels* get_kernels() {
+    if (cur_kernels)
+	return cur_kernels;
+    static const char* const isas[] = {"avx512", "avx2", "sse2", "scalar"};
+    for (size_t i = 0; !cur_kernels; ++i)
+	cur_kernels = find_kernels(isas[i]);
+    return cur_kernels;
+}
+spcl_local const char* set_arr_kernels(const char* isa) {
+    const arr_kernels* k = (isa)? find_kernels(isa) : NULL;
+    if (k || !isa)
+	cur_kernels = k;
+    return (k || !isa)? get_kernels()->name : NULL;
+}
+//loops over at least this many elements are split between threads by par_for(), unless changed with spcl_set_threads()
+#define PAR_THREAD_MIN	(1 << 18)
+//the most threads used by par_for()
+#define PAR_MAX_THREADS	64
+/**
+ * A loop passed to par_for() is divided into one contiguous share for each thread. Threads take chunks from the front of their own share, and then steal chunks from the other shares once it is exhausted, so threads which finish early pick up the slack. Shares are padded to a cache line so that threads don't contend for the same line.
+ */
+typedef struct par_share {
+    size_t next;
+    size_t end;
+    char pad[64 - 2*sizeof(size_t)];
+} par_share;
+typedef struct par_job {
+    void (*fn)(void* arg, size_t start, size_t end);
+    void* arg;
+    size_t chunk;
+    long n_shares;
+    par_share shares[PAR_MAX_THREADS];
+} par_job;
+static void par_run(par_job* job, long id) {
+    for (long s = 0; s < job->n_shares; ++s) {
+	par_share* sh = job->shares + (id + s) % job->n_shares;
+	for (size_t i = __atomic_fetch_add(&sh->next, job->chunk, __ATOMIC_RELAXED); i < sh->end; i = __atomic_fetch_add(&sh->next, job->chunk, __ATOMIC_RELAXED))
+	    job->fn(job->arg, i, (sh->end - i < job->chunk)? sh->end : i + job->chunk);
+    }
+}
+/**
+ * The pool of worker threads owned by the library. Workers are started the first time they are needed and then sleep until the next job is published. Only one job runs at a time, and callers which find the pool busy run their loop on their own thread.
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    pthread_mutex_t busy;
+    par_job* job;
+    //incremented each time a job is published
+    unsigned long gen;
+    //the last generation seen by each worker when it was started
+    unsigned long seen[PAR_MAX_THREADS];
+    pthread_t threads[PAR_MAX_THREADS];
+    long n_workers;
+    long n_running;
+    //the number of threads to use including the caller or 0 for one per core
+    long n_threads;
+    size_t min_n;
+} par_pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, NULL, 0, {0}, {0}, 0, 0, 0, PAR_THREAD_MIN};
+//set on threads that are running part of a job, so that nested loops run serially instead of waiting for the pool
+static __thread int in_par = 0;
+static void* par_worker(void* arg) {
+    long id = (long)(size_t)arg;
+    in_par = 1;
+    pthread_mutex_lock(&par_pool.lock);
+    unsigned long seen = par_pool.seen[id];
+    for (;;) {
+	while (par_pool.gen == seen)
+	    pthread_cond_wait(&par_pool.wake, &par_pool.lock);
+	seen = par_pool.gen;
+	par_job* job = par_pool.job;
+	pthread_mutex_unlock(&par_pool.lock);
+	if (id < job->n_shares)
+	    par_run(job, id);
+	pthread_mutex_lock(&par_pool.lock);
+	if (--par_pool.n_running == 0)
+	    pthread_cond_signal(&par_pool.done);
+    }
+    return NULL;
+}
+//get the number of threads that par_for() should use
+static inline long par_threads() {
+    static long n_cores = 0;
+    long n = par_pool.n_threads;
+    if (n <= 0) {
+	if (n_cores <= 0)
+	    n_cores = sysconf(_SC_NPROCESSORS_ONLN);
+	n = n_cores;
+    }
+    return (n > PAR_MAX_THREADS)? PAR_MAX_THREADS : n;
+}
+/**
+ * Call fn(arg, start, end) for ranges of at most chunk elements which cover [0, n), splitting them between the threads of the pool. fn may only write outputs in [start, end).
+ */
+static void par_for_chunks(size_t n, size_t chunk, void (*fn)(void* arg, size_t start, size_t end), void* arg) {
+    long n_threads = par_threads();
+    if ((size_t)n_threads > n)
+	n_threads = n;
+    if (n_threads <= 1 || in_par || pthread_mutex_trylock(&par_pool.busy)) {
+	fn(arg, 0, n);
+	return;
+    }
+    //jobs like the fused evaluator look up the kernels from inside workers, so resolve them here where publishing the job under the lock orders the lookup before every worker reads cur_kernels
+    get_kernels();
+    pthread_mutex_lock(&par_pool.lock);
+    for (; par_pool.n_workers < n_threads-1; ++par_pool.n_workers) {
+	long id = par_pool.n_workers+1;
+	par_pool.seen[id] = par_pool.gen;
+	if (pthread_create(par_pool.threads + id, NULL, par_worker, (void*)(size_t)id))
+	    break;
+    }
+    if (n_threads > par_pool.n_workers+1)
+	n_threads = par_pool.n_workers+1;
+    par_job job;
+    job.fn = fn;
+    job.arg = arg;
+    job.chunk = chunk;
+    job.n_shares = n_threads;
+    for (long s = 0; s < n_threads; ++s) {
+	job.shares[s].next = n/n_threads*s + ((size_t)s < n%n_threads? (size_t)s : n%n_threads);
+	job.shares[s].end = job.shares[s].next + n/n_threads + ((size_t)s < n%n_threads);
+    }
+    //every worker wakes up for each job, even if it has no share
+    par_pool.job = &job;
+    ++par_pool.gen;
+    par_pool.n_running = par_pool.n_workers;
+    pthread_cond_broadcast(&par_pool.wake);
+    pthread_mutex_unlock(&par_pool.lock);
+    in_par = 1;
+    par_run(&job, 0);
+    in_par = 0;
+    pthread_mutex_lock(&par_pool.lock);
+    while (par_pool.n_running)
+	pthread_cond_wait(&par_pool.done, &par_pool.lock);
+    pthread_mutex_unlock(&par_pool.lock);
+    pthread_mutex_unlock(&par_pool.busy);
+}
+/**
+ * Call fn(arg, start, end) for consecutive ranges which cover [0, n). Loops with at least par_pool.min_n elements are split between threads, so fn may only write outputs in [start, end).
+ */
+static inline void par_for(size_t n, void (*fn)(void* arg, size_t start, size_t end), void* arg) {
+    if (n < par_pool.min_n) {
+	fn(arg, 0, n);
+	return;
+    }
+    //use a few chunks per thread so that there is something left to steal
+    par_for_chunks(n, n/(4*par_threads()) + 1, fn, arg);
+}
+void spcl_set_threads(unsigned n_threads, size_t min_n) {
+    par_pool.n_threads = (n_threads > PAR_MAX_THREADS)? PAR_MAX_THREADS : n_threads;
+    if (min_n)
+	par_pool.min_n = min_n;
+}
+//arguments for the elementwise kernels which are split between threads
+typedef struct arr_job {
+    const arr_kernels* k;
+    double* x;
+    const double* y;
+    double s;
+    char op;
+    //set if x is raised to the integer power s
+    int powi;
+    vmath_fn vfn;
+    double (*fn)(double);
+} arr_job;
+static void vv_range(void* arg, size_t start, size_t end) {
+    arr_job* job = arg;
+    job->k->vv(job->x+start, job->y+start, end-start, job->op);
+}
+static void vs_range(void* arg, size_t start, size_t end) {
+    arr_job* job = arg;
+    if (job->powi)
+	job->k->powi(job->x+start, (long)job->s, end-start);
+    else
+	job->k->vs(job->x+start, job->s, end-start, job->op);
+}
+/**
+ * Apply the elementwise arithmetic operation op to the array x[n] and the array y[n], overwriting x
+ */
+static inline void arr_op(double* x, const double* y, size_t n, char op) {
+    arr_job job = {get_kernels(), x, y, 0, op, 0, VM_NONE, NULL};
+    par_for(n, vv_range, &job);
+}
+/**
+ * Apply the elementwise arithmetic operation op to the array x[n] and the scalar y, overwriting x
+ */
+static inline void arr_op_scalar(double* x, double y, size_t n, char op) {
+    arr_job job = {get_kernels(), x, NULL, y, op, op == '^' && is_powi(y), VM_NONE, NULL};
+    par_for(n, vs_range, &job);
+}
+//reductions are split into blocks of RED_BLOCK elements which are combined pairwise, so that rounding errors grow like log(n) instead of n
+#define RED_BLOCK	1024
+//reductions do less work per element than other loops, so they are only split between threads for arrays RED_THREAD_SCALE times longer
+#define RED_THREAD_SCALE	4
+//the depth in the tree of blocks at which reductions are split into tasks for threads
+#define RED_TASK_DEPTH	6
+//split n elements into two halves at a multiple of RED_BLOCK
+static inline size_t red_split(size_t n) {
+    return (n/RED_BLOCK + 1)/2*RED_BLOCK;
+}
+static double reduce_pairwise(const arr_kernels* k, const double* x, const double* y, size_t n, char op) {
+    if (n <= RED_BLOCK)
+	return k->reduce(x, y, n, op);
+    size_t h = red_split(n);
+    double a = reduce_pairwise(k, x, y, h, op);
+    return red_apply(a, reduce_pairwise(k, x+h, (y)? y+h : NULL, n-h, op), op);
+}
+typedef struct red_task {
+    const double* x;
+    const double* y;
+    size_t n;
+    double res;
+} red_task;
+typedef struct red_job {
+    const arr_kernels* k;
+    red_task tasks[1 << RED_TASK_DEPTH];
+    size_t n_tasks;
+    char op;
+} red_job;
+//collect the subtrees at depth RED_TASK_DEPTH of the tree used by reduce_pairwise()
+static void red_collect(red_job* job, const double* x, const double* y, size_t n, int depth) {
+    if (depth == 0 || n <= RED_BLOCK) {
+	job->tasks[job->n_tasks++] = (red_task){x, y, n, 0};
+	return;
+    }
+    size_t h = red_split(n);
+    red_collect(job, x, y, h, depth-1);
+    red_collect(job, x+h, (y)? y+h : NULL, n-h, depth-1);
+}
+//combine the results of the tasks from red_collect() in the same order as reduce_pairwise()
+static double red_combine(const red_job* job, size_t* i, size_t n, int depth) {
+    if (depth == 0 || n <= RED_BLOCK)
+	return job->tasks[(*i)++].res;
+    size_t h = red_split(n);
+    double a = red_combine(job, i, h, depth-1);
+    return red_apply(a, red_combine(job, i, n-h, depth-1), job->op);
+}
+static void red_range(void* arg, size_t start, size_t end) {
+    red_job* job = arg;
+    for (size_t i = start; i < end; ++i) {
+	red_task* t = job->tasks + i;
+	t->res = reduce_pairwise(job->k, t->x, t->y, t->n, job->op);
+    }
+}
+/**
+ * Reduce x[n] (or the products x[i]*y[i] if y isn't NULL) with op, which may be '+', '*', '<' (minimum) or '>' (maximum). Large arrays are split between threads along the same tree of blocks used by a single thread, so the result doesn't depend on the number of threads.
+ */
+static inline double arr_reduce(const double* x, const double* y, size_t n, char op) {
+    const arr_kernels* k = get_kernels();
+    if (n < RED_THREAD_SCALE*par_pool.min_n || par_threads() <= 1)
+	return reduce_pairwise(k, x, y, n, op);
+    red_job job;
+    job.k = k;
+    job.n_tasks = 0;
+    job.op = op;
+    red_collect(&job, x, y, n, RED_TASK_DEPTH);
+    par_for_chunks(job.n_tasks, 1, red_range, &job);
+    size_t i = 0;
+    return red_combine(&job, &i, n, RED_TASK_DEPTH);
+}
+//stencils are evaluated in blocks of this many outputs which stay in the L1 cache while each tap is added
+#define STENCIL_BLOCK	512
+typedef struct stencil_job {
+    const arr_kernels* k;
+    double* y;
+    const double* x;
+    const double* coeffs;
+    const size_t* offs;
+    size_t n_taps;
+} stencil_job;
+static void stencil_range(void* arg, size_t start, size_t end) {
+    const stencil_job* job = arg;
+    for (size_t i = start; i < end; i += STENCIL_BLOCK) {
+	size_t n = (end-i < STENCIL_BLOCK)? end-i : STENCIL_BLOCK;
+	memset(job->y + i, 0, sizeof(double)*n);
+	for (size_t t = 0; t < job->n_taps; ++t)
+	    job->k->axpy(job->y + i, job->coeffs[t], job->x + i + job->offs[t], n);
+    }
+}
+/**
+ * Evaluate the stencil y[j] = sum_t coeffs[t]*x[j + offs[t]] for each j < n. Each tap is added to a block of outputs with a vectorized multiply-add.
+ */
+static inline void arr_stencil(double* y, const double* x, size_t n, const double* coeffs, const size_t* offs, size_t n_taps) {
+    stencil_job job = {get_kernels(), y, x, coeffs, offs, n_taps};
+    par_for(n, stencil_range, &job);
+}
+
+/** ============================ linear algebra ============================ **/
+
+//matrix products are computed on blocks of GEMM_MC x GEMM_KC elements of the left matrix, which fit in the L2 cache, and GEMM_KC x GEMM_NC elements of the right matrix, which fit in the L3 cache
+#define GEMM_MC		128
+#define GEMM_KC		256
+#define GEMM_NC		2048
+/**
+ * A strided view of an m x n matrix. Element (i,j) is stored at data[i*rs + j*cs].
+ */
+typedef struct mat_view {
+    const double* data;
+    size_t m;
+    size_t n;
+    psize rs;
+    psize cs;
+} mat_view;
+//pack rows [i0, i0+mc) and columns [p0, p0+kc) of a into panels of GEMM_MR rows. Rows past the end of the block are padded with zeros.
+static void gemm_pack_a(mat_view a, size_t i0, size_t mc, size_t p0, size_t kc, double* dst) {
+    for (size_t ir = 0; ir < mc; ir += GEMM_MR) {
+	for (size_t p = 0; p < kc; ++p) {
+	    const double* src = a.data + (psize)(i0+ir)*a.rs + (psize)(p0+p)*a.cs;
+	    for (size_t i = 0; i < GEMM_MR; ++i)
+		*(dst++) = (ir+i < mc)? src[(psize)i*a.rs] : 0;
 	}
-	if (sig[i] > VAL_NUM && f.args[i].val.s == NULL)
-	    return spcl_make_err(E_BAD_TYPE, "%.*s found empty %s at args[%lu]", f.name.n, f.name.s, valnames[sig[i]], i);
     }
+}
+//pack rows [p0, p0+kc) and columns [j0, j0+nc) of b into panels of GEMM_NR columns. Columns past the end of the block are padded with zeros.
+static void gemm_pack_b(mat_view b, size_t p0, size_t kc, size_t j0, size_t nc, double* dst) {
+    for (size_t jr = 0; jr < nc; jr += GEMM_NR) {
+	for (size_t p = 0; p < kc; ++p) {
+	    const double* src = b.data + (psize)(p0+p)*b.rs + (psize)(j0+jr)*b.cs;
+	    for (size_t j = 0; j < GEMM_NR; ++j)
+		*(dst++) = (jr+j < nc)? src[(psize)j*b.cs] : 0;
+	}
+    }
+}
+#ifdef SPCL_USE_BLAS
+/**
+ * Find how cblas should read the matrix a. This is only possible if the elements of each row or of each column are contiguous.
+ * returns: 1 if a can be passed to cblas or 0 otherwise
+ */
+static inline int blas_layout(mat_view a, enum CBLAS_TRANSPOSE* t, psize* ld) {
+    if ((a.n == 1 || a.cs == 1) && (a.m == 1 || a.rs >= (psize)a.n)) {
+	*t = CblasNoTrans;
+	*ld = (a.m == 1)? (psize)a.n : a.rs;
+	return 1;
+    } else if ((a.m == 1 || a.rs == 1) && (a.n == 1 || a.cs >= (psize)a.m)) {
+	*t = CblasTrans;
+	*ld = (a.n == 1)? (psize)a.m : a.cs;
+	return 1;
+    }
+    return 0;
+}
+#endif
+/**
+ * Compute the matrix product c = a*b, where c is a contiguous a.m x b.n matrix. Blocks of a and b are packed into contiguous panels before they are multiplied, so the register tiles read memory sequentially regardless of the strides of a and b, and transposed views don't need to be copied first.
+ */
+static void gemm(mat_view a, mat_view b, double* c) {
+    size_t m = a.m, n = b.n, k = a.n;
+#ifdef SPCL_USE_BLAS
+    enum CBLAS_TRANSPOSE ta, tb;
+    psize lda, ldb;
+    if (m && n && k && blas_layout(a, &ta, &lda) && blas_layout(b, &tb, &ldb)) {
+	cblas_dgemm(CblasRowMajor, ta, tb, m, n, k, 1.0, a.data, lda, b.data, ldb, 0.0, c, n);
+	return;
+    }
+#endif
+    memset(c, 0, sizeof(double)*m*n);
+    if (m == 0 || n == 0 || k == 0)
+	return;
+    const arr_kernels* kern = get_kernels();
+    //round the block sizes up to a whole number of tiles
+    size_t mc_max = ((m < GEMM_MC)? m : GEMM_MC) + GEMM_MR-1;
+    size_t nc_max = ((n < GEMM_NC)? n : GEMM_NC) + GEMM_NR-1;
+    size_t kc_max = (k < GEMM_KC)? k : GEMM_KC;
+    mc_max -= mc_max % GEMM_MR;
+    nc_max -= nc_max % GEMM_NR;
+    double* ap = xmalloc(sizeof(double)*(mc_max + nc_max)*kc_max);
+    double* bp = ap + mc_max*kc_max;
+    double tile[GEMM_MR*GEMM_NR];
+    for (size_t jc = 0; jc < n; jc += GEMM_NC) {
+	size_t nc = (n-jc < GEMM_NC)? n-jc : GEMM_NC;
+	for (size_t pc = 0; pc < k; pc += GEMM_KC) {
+	    size_t kc = (k-pc < GEMM_KC)? k-pc : GEMM_KC;
+	    gemm_pack_b(b, pc, kc, jc, nc, bp);
+	    for (size_t ic = 0; ic < m; ic += GEMM_MC) {
+		size_t mc = (m-ic < GEMM_MC)? m-ic : GEMM_MC;
+		gemm_pack_a(a, ic, mc, pc, kc, ap);
+		for (size_t jr = 0; jr < nc; jr += GEMM_NR) {
+		    size_t nr = (nc-jr < GEMM_NR)? nc-jr : GEMM_NR;
+		    for (size_t ir = 0; ir < mc; ir += GEMM_MR) {
+			size_t mr = (mc-ir < GEMM_MR)? mc-ir : GEMM_MR;
+			kern->gemm(kc, ap + ir*kc, bp + jr*kc, tile);
+			//only the part of the tile inside c is kept
+			double* dst = c + (ic+ir)*n + jc+jr;
+			for (size_t i = 0; i < mr; ++i) {
+			    for (size_t j = 0; j < nr; ++j)
+				dst[i*n + j] += tile[i*GEMM_NR + j];
+			}
+		    }
+		}
+	    }
+	}
+    }
+    xfree(ap);
+}
+/**
+ * Factor the contiguous n x n matrix a in place so that P*a = L*U using partial pivoting. L has a unit diagonal and is stored below the diagonal of a, while U is stored on and above it. The row swapped with row k is saved to piv[k].
+ * returns: the sign of the permutation P, or 0 if a is singular
+ */
+static int lu_factor(double* a, size_t n, size_t* piv) {
+    //pivots which are tiny compared to the largest element are treated as zero
+    double tol = 0;
+    for (size_t i = 0; i < n*n; ++i) {
+	if (fabs(a[i]) > tol)
+	    tol = fabs(a[i]);
+    }
+    tol *= n*0x1p-52;
+    int sign = 1;
+    for (size_t k = 0; k < n; ++k) {
+	size_t p = k;
+	for (size_t i = k+1; i < n; ++i) {
+	    if (fabs(a[i*n + k]) > fabs(a[p*n + k]))
+		p = i;
+	}
+	piv[k] = p;
+	if (!(fabs(a[p*n + k]) > tol))
+	    return 0;
+	if (p != k) {
+	    for (size_t j = 0; j < n; ++j) {
+		double tmp = a[k*n + j];
+		a[k*n + j] = a[p*n + j];
+		a[p*n + j] = tmp;
+	    }
+	    sign = -sign;
+	}
+	//eliminate column k from the rows below. The inner loop is contiguous so that it vectorizes
+	const double* rk = a + k*n;
+	for (size_t i = k+1; i < n; ++i) {
+	    double* ri = a + i*n;
+	    double l = (ri[k] /= rk[k]);
+	    for (size_t j = k+1; j < n; ++j)
+		ri[j] -= l*rk[j];
+	}
+    }
+    return sign;
+}
+/**
+ * Solve a*x = b in place for the n x r matrix b (stored contiguously), where a and piv were factored by lu_factor()
+ */
+static void lu_solve(const double* a, size_t n, const size_t* piv, double* b, size_t r) {
+    for (size_t k = 0; k < n; ++k) {
+	if (piv[k] == k)
+	    continue;
+	for (size_t j = 0; j < r; ++j) {
+	    double tmp = b[k*r + j];
+	    b[k*r + j] = b[piv[k]*r + j];
+	    b[piv[k]*r + j] = tmp;
+	}
+    }
+    //forward substitution with L
+    for (size_t i = 1; i < n; ++i) {
+	for (size_t k = 0; k < i; ++k) {
+	    double l = a[i*n + k];
+	    for (size_t j = 0; j < r; ++j)
+		b[i*r + j] -= l*b[k*r + j];
+	}
+    }
+    //back substitution with U
+    for (size_t i = n; i-- > 0;) {
+	for (size_t k = i+1; k < n; ++k) {
+	    double u = a[i*n + k];
+	    for (size_t j = 0; j < r; ++j)
+		b[i*r + j] -= u*b[k*r + j];
+	}
+	for (size_t j = 0; j < r; ++j)
+	    b[i*r + j] /= a[i*n + i];
+    }
+}
+
+/** ============================ fast fourier transforms ============================ **/
+
+#define FFT_MAX_STAGES	64
+/**
+ * A plan for ffts of length n. Plans only depend on n, so they are created once and cached by get_fft_plan().
+ */
+typedef struct fft_plan {
+    size_t n;
+    size_t n_stages;
+    fft_stage stages[FFT_MAX_STAGES];
+    //storage for the twiddle factors and roots of every stage
+    double* tw;
+    //half[k] = exp(-i*pi*k/n) for k <= n, used to unpack real transforms of length 2n
+    double* half_r;
+    double* half_i;
+    //lengths with a prime factor larger than FFT_MAX_RADIX are computed as a convolution with the chirp exp(-i*pi*k^2/n) using a power of two fft. filt holds the transform of the conjugate chirp padded to length blue->n.
+    const struct fft_plan* blue;
+    double* chirp_r;
+    double* chirp_i;
+    double* filt_r;
+    double* filt_i;
+    struct fft_plan* next;
+} fft_plan;
+static fft_plan* fft_plans = NULL;
+static pthread_mutex_t fft_plans_lock = PTHREAD_MUTEX_INITIALIZER;
+static const fft_plan* get_fft_plan(size_t n);
+static void fft_exec(const fft_plan* plan, double* re, double* im, int inverse);
+//get exp(-2*pi*i*k/n) for 0 <= k < n
+static inline void fft_root(size_t k, size_t n, double* wr, double* wi) {
+    double theta = 2*M_PI*k/n;
+    *wr = cos(theta);
+    *wi = -sin(theta);
+}
+static fft_plan* make_fft_plan(size_t n) {
+    fft_plan* plan = xmalloc(sizeof(fft_plan));
+    *plan = (fft_plan){0};
+    plan->n = n;
+    //split n into radix 4 stages followed by any other small prime factors
+    size_t radices[FFT_MAX_STAGES];
+    size_t rem = n;
+    for (size_t r = 4; r <= FFT_MAX_RADIX && rem > 1; r = (r == 4)? 2 : (r == 2)? 3 : r+2) {
+	while (rem % r == 0) {
+	    radices[plan->n_stages++] = r;
+	    rem /= r;
+	}
+    }
+    size_t n_tw = 2*(n + 1);
+    for (size_t i = 0; i < plan->n_stages; ++i)
+	n_tw += 2*(n + radices[i]);
+    plan->tw = xmalloc(sizeof(double)*n_tw);
+    double* tw = plan->tw;
+    plan->half_r = tw;
+    plan->half_i = tw + n + 1;
+    tw += 2*(n + 1);
+    for (size_t k = 0; k <= n; ++k)
+	fft_root(k, 2*n, plan->half_r + k, plan->half_i + k);
+    //stage i combines sequences with stride s = radices[0]*...*radices[i-1]
+    size_t s = 1;
+    for (size_t i = 0; i < plan->n_stages; ++i) {
+	fft_stage* st = plan->stages + i;
+	size_t r = radices[i];
+	st->radix = r;
+	st->s = s;
+	st->m = n/(s*r);
+	st->wr = tw;
+	st->wi = tw + st->m*r;
+	st->rr = tw + 2*st->m*r;
+	st->ri = st->rr + r;
+	tw += 2*(st->m*r + r);
+	for (size_t p = 0; p < st->m; ++p) {
+	    for (size_t k = 0; k < r; ++k)
+		fft_root((p*k*s) % n, n, st->wr + p*r + k, st->wi + p*r + k);
+	}
+	for (size_t t = 0; t < r; ++t)
+	    fft_root(t, r, st->rr + t, st->ri + t);
+	s *= r;
+    }
+    if (rem > 1) {
+	plan->n_stages = 0;
+	size_t m = 1;
+	while (m < 2*n-1)
+	    m *= 2;
+	plan->blue = get_fft_plan(m);
+	plan->chirp_r = xmalloc(sizeof(double)*2*(n + m));
+	plan->chirp_i = plan->chirp_r + n;
+	plan->filt_r = plan->chirp_i + n;
+	plan->filt_i = plan->filt_r + m;
+	memset(plan->filt_r, 0, sizeof(double)*2*m);
+	for (size_t k = 0; k < n; ++k) {
+	    //reduce k^2 modulo 2n before dividing so that the angle stays accurate
+	    fft_root(((unsigned long long)k*k) % (2*n), 2*n, plan->chirp_r + k, plan->chirp_i + k);
+	    plan->filt_r[k] = plan->chirp_r[k];
+	    plan->filt_i[k] = -plan->chirp_i[k];
+	    if (k > 0) {
+		plan->filt_r[m-k] = plan->chirp_r[k];
+		plan->filt_i[m-k] = -plan->chirp_i[k];
+	    }
+	}
+	fft_exec(plan->blue, plan->filt_r, plan->filt_i, 0);
+    }
+    return plan;
+}
+/**
+ * Get the plan for ffts of length n, creating it if it hasn't been used before
+ */
+static const fft_plan* get_fft_plan(size_t n) {
+    pthread_mutex_lock(&fft_plans_lock);
+    fft_plan* plan = fft_plans;
+    while (plan && plan->n != n)
+	plan = plan->next;
+    pthread_mutex_unlock(&fft_plans_lock);
+    if (plan)
+	return plan;
+    //the lock isn't held while planning, since Bluestein plans need a second plan
+    plan = make_fft_plan(n);
+    pthread_mutex_lock(&fft_plans_lock);
+    plan->next = fft_plans;
+    fft_plans = plan;
+    pthread_mutex_unlock(&fft_plans_lock);
+    return plan;
+}
+/**
+ * Transform the complex sequence re + i*im of length plan->n in place. The inverse transform is not normalized.
+ */
+static void fft_exec(const fft_plan* plan, double* re, double* im, int inverse) {
+    size_t n = plan->n;
+    //the inverse transform is the conjugate of the forward transform of the conjugate
+    if (inverse)
+	arr_op_scalar(im, -1, n, '*');
+    if (plan->blue) {
+	size_t m = plan->blue->n;
+	double* ar = xmalloc(sizeof(double)*2*m);
+	double* ai = ar + m;
+	for (size_t k = 0; k < n; ++k) {
+	    ar[k] = re[k]*plan->chirp_r[k] - im[k]*plan->chirp_i[k];
+	    ai[k] = re[k]*plan->chirp_i[k] + im[k]*plan->chirp_r[k];
+	}
+	memset(ar + n, 0, sizeof(double)*(m-n));
+	memset(ai + n, 0, sizeof(double)*(m-n));
+	fft_exec(plan->blue, ar, ai, 0);
+	for (size_t k = 0; k < m; ++k) {
+	    double tr = ar[k]*plan->filt_r[k] - ai[k]*plan->filt_i[k];
+	    ai[k] = ar[k]*plan->filt_i[k] + ai[k]*plan->filt_r[k];
+	    ar[k] = tr;
+	}
+	fft_exec(plan->blue, ar, ai, 1);
+	for (size_t k = 0; k < n; ++k) {
+	    re[k] = (ar[k]*plan->chirp_r[k] - ai[k]*plan->chirp_i[k])/m;
+	    im[k] = (ar[k]*plan->chirp_i[k] + ai[k]*plan->chirp_r[k])/m;
+	}
+	xfree(ar);
+    } else if (plan->n_stages) {
+	//stockham stages alternate between the input and a work buffer
+	const arr_kernels* k = get_kernels();
+	double* work = xmalloc(sizeof(double)*2*n);
+	double *xr = re, *xi = im, *yr = work, *yi = work + n;
+	for (size_t i = 0; i < plan->n_stages; ++i) {
+	    k->fft_stage(plan->stages + i, xr, xi, yr, yi);
+	    double* tmp = xr;
+	    xr = yr;
+	    yr = tmp;
+	    tmp = xi;
+	    xi = yi;
+	    yi = tmp;
+	}
+	if (xr != re) {
+	    memcpy(re, xr, sizeof(double)*n);
+	    memcpy(im, xi, sizeof(double)*n);
+	}
+	xfree(work);
+    }
+    if (inverse)
+	arr_op_scalar(im, -1, n, '*');
+}
+/**
+ * Transform the real sequence x of even length n. The first n/2+1 coefficients are written to re + i*im. The odd and even elements are packed into the real and imaginary parts of a sequence of length n/2, so only a half length transform is needed.
+ */
+static void rfft_exec(const double* x, size_t n, double* re, double* im) {
+    size_t h = n/2;
+    const fft_plan* plan = get_fft_plan(h);
+    double* zr = xmalloc(sizeof(double)*2*h);
+    double* zi = zr + h;
+    for (size_t k = 0; k < h; ++k) {
+	zr[k] = x[2*k];
+	zi[k] = x[2*k+1];
+    }
+    fft_exec(plan, zr, zi, 0);
+    //X[k] = E[k] + exp(-2*pi*i*k/n)*O[k] where E = (Z[k] + conj(Z[h-k]))/2 and O = (Z[k] - conj(Z[h-k]))/2i
+    for (size_t k = 0; k <= h; ++k) {
+	size_t a = k % h, b = (h - k) % h;
+	double er = (zr[a] + zr[b])/2, ei = (zi[a] - zi[b])/2;
+	double or = (zi[a] + zi[b])/2, oi = (zr[b] - zr[a])/2;
+	re[k] = er + or*plan->half_r[k] - oi*plan->half_i[k];
+	im[k] = ei + or*plan->half_i[k] + oi*plan->half_r[k];
+    }
+    xfree(zr);
+}
+/**
+ * get the psize of a spcl_context
+ */
+static inline size_t con_size(const spcl_inst* c) {
+    if (!c)
+	return 0;
+    return 1 << c->t_bits;
+}
+
+/**
+ * iterate through a spcl_inst by finding defined entries in the table
+ */
+static inline size_t con_it_next(const spcl_inst* c, size_t i) {
+    for (; i < con_size(c); ++i) {
+	if (c->table[i].v.type)
+	    return i;
+    }
+    return i;
+}
+
+/**
+ * Helper function that finds the start of first token before the index s in the read state rs. The returned spcl_val is greater than or equal to zero.
+ * fs: the line buffer to read from
+ * s: the current position
+ * stop: do not return any tokens before this index
+ */
+static inline psize find_token_before(const spcl_fstream* fs, psize s, psize stop) {
+    int started = 0;
+    while (s > stop) {
+	s -= 1;
+	char c = fs_get(fs, s);
+	if (!is_whitespace(c))
+	    started = 1;
+	if ((!started && is_char_sep(c)) || s ==0)
+	    return s;
+    }
+    return stop;
+}
+
+STACK_DEF(char,BLK_MAX)
+/**
+ * Find the index of the first character c that isn't nested inside a block or NULL if an error occurred
+ */
+static inline psize strchr_block_rs(const spcl_fstream* fs, psize s, psize e, char c) {
+    stack(char,BLK_MAX) blk_stk = make_stack(char,BLK_MAX)();
+    char prev;
+    char cur = 0;
+    while (s < e && s < fs->flen) {
+	prev = cur;
+	cur = fs_get(fs, s);
+	if (!cur)
+	    break;
+	//now look for matches
+	if (cur == c && blk_stk.ptr == 0)
+	    return s;
+	if (cur == BEG_PAR || cur == BEG_SQR || cur == BEG_CRL) {
+	    if ( push(char,BLK_MAX)(&blk_stk, cur) ) return e;
+	} else if (cur == END_CRL || cur == END_SQR ||cur == END_PAR) {
+	    if ( pop(char,BLK_MAX)(&blk_stk, &prev) || cur != get_match(prev) ) return e;
+	} else if (cur == '\"') {
+	    if (blk_stk.ptr != 0 && !peek(char,BLK_MAX)(&blk_stk, 1, &prev) && prev == '\"') {
+		if ( pop(char,BLK_MAX)(&blk_stk, NULL) ) return e;
+	    } else {
+		if ( push(char,BLK_MAX)(&blk_stk, cur) ) return e;
+	    }
+	} else if (cur == '\'') {
+	    //quotes are more complicated
+	    if (blk_stk.ptr != 0 && !peek(char,BLK_MAX)(&blk_stk, 1, &prev) && prev == '\'') {
+		if ( pop(char,BLK_MAX)(&blk_stk, NULL) ) return e;
+	    } else {
+		if ( push(char,BLK_MAX)(&blk_stk, cur) ) return e;
+	    }
+	}
+	++s;
+    }
+    return e;
+}
+
+/**
+ * Find the first instance of a token (i.e. surrounded by whitespace) in the string str which matches comp
+ */
+static inline psize token_block(const spcl_fstream* fs, psize s, psize e, const char* cmp, size_t cmp_len) {
+    if (!fs || !cmp)
+	return e;
+    stack(char,BLK_MAX) blk_stk = make_stack(char,BLK_MAX)();
+    char prev;
+    char cur = 0;
+    while (s != e && s < fs->flen) {
+	prev = cur;
+	cur = fs_get(fs, s);
+	if (!cur)
+	    break;
+	//check whether we're at the root level and there was a seperation terminator
+	if (blk_stk.ptr == 0 && is_char_sep(prev)) {
+	    int found = 1;
+	    for (size_t j = 0; j < cmp_len; ++j) {
+		//make sure the first cmp_len characters match
+		if ( cmp[j] != fs_get(fs, s+j) ) {
+		    found = 0;
+		    break;
+		}
+	    }
+	    //make sure its ended by a separator
+	    if ( found && is_char_sep(fs_get(fs, s+cmp_len)) )
+		return s;
+	}
+	if (cur == BEG_PAR || cur == BEG_SQR || cur == BEG_CRL) {
+	    if ( push(char,BLK_MAX)(&blk_stk, cur) ) return e;
+	} else if (cur == END_CRL || cur == END_SQR || cur == END_PAR) {
+	    if ( pop(char,BLK_MAX)(&blk_stk, &prev)  || cur != get_match(prev) ) return e;
+	//comments use more then one character
+	} else if (prev == '/' && cur == '*') {
+	    if ( push(char,BLK_MAX)(&blk_stk, '*') ) return e;
+	} else if (prev == '*' && cur == '/') {
+	    if ( pop(char,BLK_MAX)(&blk_stk, &prev) || cur != get_match(prev) ) return e;
+	} else if (prev == '/' && cur == '/') {
+	    if ( push(char,BLK_MAX)(&blk_stk, cur) ) return e;
+	//quotes are more complicated 
+	} else if (cur == '\"') {
+	    if (blk_stk.ptr != 0 && !peek(char,BLK_MAX)(&blk_stk, 1, &prev) && prev == '\"') {
+		if ( pop(char,BLK_MAX)(&blk_stk, NULL) ) return e;
+	    } else {
+		if ( push(char,BLK_MAX)(&blk_stk, cur) ) return e;
+	    }
+	} else if (cur == '\'') {
+	    //quotes are more complicated
+	    if (blk_stk.ptr != 0 && !peek(char,BLK_MAX)(&blk_stk, 1, &prev) && prev == '\'') {
+		if ( pop(char,BLK_MAX)(&blk_stk, NULL) ) return e;
+	    } else {
+		if ( push(char,BLK_MAX)(&blk_stk, cur) ) return e;
+	    }
+	}
+	++s;
+    }
+    return e;
+}
+
+/** ============================ psize ============================ **/
+
+spcl_local read_state make_read_state(const spcl_fstream* fs, psize s, psize e) {
+    read_state rs;
+    rs.b = fs;
+    rs.start = s;
+    rs.end = e;
+    return rs;
+}
+
+/** ============================ spcl_fstream ============================ **/
+
+/**
+ * Grow the cache used for the fstream fs by attempting to double its size
+ * returns: 0 on failure or 1 on success
+ */
+static inline int grow_fstream(spcl_fstream* fs) {
+    //detect overflows
+    if (fs->clen > PSIZE_MAX >> 2)
+	return 0;
+    //reallocate and check for success
+    char* tmp_cache = realloc(fs->cache, 2*fs->clen);
+    if (!tmp_cache)
+	return 0;
+    //if successful then adjust the size and the cache
+    fs->clen *= 2;
+    fs->cache = tmp_cache;
+    return 1;
+}
+static inline spcl_fstream* alloc_fstream(psize hint) {
+    spcl_fstream* fs = xmalloc(sizeof(spcl_fstream));
+    memset(fs, 0, sizeof(spcl_fstream));
+    //set the cache to have hint bytes if applicable
+    if (hint > 0) {
+	char* tmp = calloc(hint, sizeof(char));
+	if (!tmp)
+	    return fs;
+	fs->cache = tmp;
+	fs->clen = hint;
+    }
+    return fs;
+}
+spcl_fstream* make_spcl_fstream_str(const char* str, size_t n) {
+    spcl_fstream* fs = alloc_fstream(0);
+    fs->cache = malloc(n);
+    if (!fs->cache) {
+	free(fs);
+	return NULL;
+    }
+    fs->f = NULL;
+    fs->cst = 0;
+    fs->flen = n;
+    fs->clen = n;
+    memcpy(fs->cache, str, n);
+    return fs;
+}
+spcl_fstream* make_spcl_fstreamn(const char* p_fname, size_t n) {
+    if (!p_fname)
+	return alloc_fstream(0);
+
+    //this is so fucking dumb, i hate null-terminated strings
+    char* tmp_fname = strndup(p_fname, n);
+    FILE* fp = fopen(tmp_fname, "r");
+    free(tmp_fname);
+    if (fp) {
+	//allocate memory for the stream and initialize to be empty
+	spcl_fstream* fs = alloc_fstream(SPCL_STR_BSIZE);
+	fs->f = fp;
+	//figure out the length of the file
+	fseek(fp, 0, SEEK_END);
+	fs->flen = ftell(fs->f);
+	fseek(fp, 0, SEEK_SET);
+	//TODO: reading the entire file into memory is dumb, we should stream from it instead
+	psize j = 0;
+	int res = fgetc(fp);
+	while (1) {
+	    //if we reached the end of the buffer, try growing and return NULL if that fails
+	    if (j == fs->clen) {
+		if (!grow_fstream(fs)) {
+		    destroy_spcl_fstream(fs);
+		    return NULL;
+		}
+	    }
+	    //NULL terminate and exit at the end of the file
+	    if (res == EOF) {
+		fs->cache[j] = 0;
+		return fs;
+	    }
+	    //otherwise, append
+	    fs->cache[j++] = (char)res;
+	    res = fgetc(fp);
+	}
+	return fs;
+    }
+    return NULL;
+}
+void destroy_spcl_fstream(spcl_fstream* fs) {
+    if (!fs)
+	return;
+    if (fs->cache)
+	free(fs->cache);
+    if (fs->f)
+	fclose(fs->f);
+    free(fs);
+}
+psize fs_find_line(const spcl_fstream* fs, psize s) {
+    psize ret = 0;
+    for (psize i = 0; i < s; ++i) {
+	if (fs_get(fs, i) == '\n')
+	    ++ret;
+    }
+    return ret;
+}
+psize fs_line_end(const spcl_fstream* fs, psize s) {
+    while (s < fs->flen && fs_get(fs, s) != '\n')
+	++s;
+    return s;
+}
+//Below are protected functions in fstream. They are not intended to be used by external libraries.
+spcl_local s8 fs_read(const spcl_fstream* fs, psize s, psize e) {
+    if (s >= fs->clen)
+	return (s8){NULL, 0};
+    if (e >= fs->clen)
+	e = fs->clen;
+    return (s8){fs->cache+s, e-s};
+}
+
+/**
+ * Helper function which jumps to the first non-whitespace character after rs.
+ * fs: the filestream to use
+ * s: the index to start from
+ * e: ensure that s does not read past this value. Set this value to be negative to indicate reading to the end of the file
+ * force: if non-zero, then the returned value is guaranteed to move rs.start by at least one character. For instance, if you know that the rs.start is on an open parentheses and you want to act on the enclosed string, set this to one
+ * returns: the index of the first non-whitespace character after s before e
+ */
+static inline psize skip_ws(const spcl_fstream* fs, psize s, psize e, int force) {
+    if (force)
+	++s;
+    //ensure that we don't read past the end of the file
+    if (e < s || e > fs->flen)
+	e = fs->flen;
+    while (is_whitespace(fs_get(fs, s)) && s < e)
+	++s;
+    return s;
+}
+
+/** ======================================================== spcl_fn_call ======================================================== **/
+
+void cleanup_spcl_fn_call(spcl_fn_call* f) {
+    if (f) {
+	for (size_t i = 0; i < f->n_args; ++i)
+	    cleanup_spcl_val(f->args+i);
+    }
+}
+
+/** ======================================================== name_val_pair ======================================================== **/
+
+void cleanup_name_val_pair(name_val_pair nv) {
+    if (nv.s.s)
+	free(nv.s.s);
+    cleanup_spcl_val(&nv.v);
+}
+
+/** ======================================================== builtin functions ======================================================== **/
+spcl_val get_sigerr(spcl_fn_call f, size_t min_args, size_t max_args, const valtype* sig) {
+    if (!sig || max_args < min_args)
+	return spcl_make_none();
+    if (f.n_args < min_args)
+	return spcl_make_err(E_LACK_TOKENS, "%.*s expected %lu arguments, got %lu", f.name.n, f.name.s, min_args, f.n_args);
+    if (f.n_args > max_args)
+	return spcl_make_err(E_LACK_TOKENS, "%.*s with too many arguments, %lu", f.name.n, f.name.s, f.n_args);
+    for (size_t i = 0; i < f.n_args; ++i) {
+	//treat undefined as allowing for arbitrary type
+	if (sig[i] && f.args[i].type != sig[i]) {
+	    //if the type is an error, let it pass through
+	    if (f.args[i].type == VAL_ERR)
+		return copy_spcl_val(f.args[i]);
+	    return spcl_make_err(E_BAD_TYPE, "%.*s expected args[%lu].type=%s, got %s", f.name.n, f.name.s, i, valnames[sig[i]], valnames[f.args[i].type]);
+	}
+	if (sig[i] > VAL_NUM && sig[i] != VAL_COMPLEX && sig[i] != VAL_INT && f.args[i].val.s == NULL)
+	    return spcl_make_err(E_BAD_TYPE, "%.*s found empty %s at args[%lu]", f.name.n, f.name.s, valnames[sig[i]], i);
+    }
+    return spcl_make_none();
+}
+static const valtype ANY1_SIG[] = {VAL_UNDEF};
+static const valtype NUM1_SIG[] = {VAL_NUM};
+spcl_val spcl_assert(struct spcl_inst*c, spcl_fn_call f) {
+    static const valtype ASSERT_SIG[] = {VAL_UNDEF, VAL_STR};
+    spcl_sigcheck_opts(f, 1, ASSERT_SIG);
+    if (f.args[0].val.x == 0)
+	return (f.n_args == 1)? spcl_make_err(E_ASSERT, "") : spcl_make_err(E_ASSERT, "%s", f.args[1].val.s);
+    return spcl_make_num(f.args[0].val.x);
+}
+spcl_val spcl_typeof(struct spcl_inst* c, spcl_fn_call f) {
+    spcl_sigcheck(f, ANY1_SIG);
+    spcl_val sto = spcl_make_none();
+    sto.type = VAL_STR;
+    //handle instances as a special case
+    if (f.args[0].type == VAL_INST) {
+	spcl_val t = spcl_find(f.args[0].val.c, "__type__");
+	if (t.type == VAL_STR) {
+	    sto.n_els = t.n_els;
+	    sto.val.s = xmalloc(sizeof(char)*(sto.n_els+1));
+	    for (size_t i = 0; i < sto.n_els; ++i)
+		sto.val.s[i] = t.val.s[i];
+	    sto.val.s[sto.n_els] = 0;
+	} else {
+	    return spcl_make_none();
+	}
+	return sto;
+    }
+    //small vectors are an internal representation of short arrays, so scripts see the same type regardless of length
+    valtype t = (f.args[0].type == VAL_VEC)? VAL_ARRAY : f.args[0].type;
+    return spcl_make_str(valnames[t], strlen(valnames[t]));
+}
+spcl_val spcl_len(struct spcl_inst* c, spcl_fn_call f) {
+    spcl_sigcheck(f, ANY1_SIG);
+    return spcl_make_num(f.args[0].n_els);
+}
+//create a list with undefined elements
+static const valtype LIST_SIG[] = {VAL_NUM};
+spcl_val spcl_list(struct spcl_inst* c, spcl_fn_call f) {
+    spcl_sigcheck(f, LIST_SIG);
+    if (f.args[0].val.x < 0)
+	return spcl_make_err(E_OUT_OF_RANGE, "cannot create list with negative number of elements");
+    spcl_val ret = spcl_make_none();
+    ret.type = VAL_LIST;
+    ret.n_els = (size_t)(f.args[0].val.x);
+    ret.val.l = xmalloc(sizeof(spcl_val)*ret.n_els);
+    memset(ret.val.l, 0, sizeof(spcl_val)*ret.n_els);
+    return ret;
+}
+//the largest magnitude for which every integer can be represented exactly by a double
+#define INT_EXACT_MAX	0x1p53
+//check whether v is an integer or a number with a whole value that can be converted to an integer exactly
+static inline int is_whole(const spcl_val* v) {
+    return v->type == VAL_INT || (v->type == VAL_NUM && v->val.x == floor(v->val.x) && fabs(v->val.x) <= INT_EXACT_MAX);
+}
+static inline long long val_to_i(const spcl_val* v) {
+    return (v->type == VAL_INT)? v->val.i : (long long)v->val.x;
+}
+/**
+ * range() with whole arguments. The length is computed in integer arithmetic so that it is exact.
+ * is_int: if set, then an integer array is returned, otherwise an array
+ */
+static inline spcl_val int_range(spcl_fn_call f, int is_int) {
+    long long min = 0, max, inc = 1;
+    if (f.n_args == 1) {
+	max = val_to_i(f.args);
+    } else {
+	min = val_to_i(f.args);
+	max = val_to_i(f.args+1);
+    }
+    if (f.n_args >= 3)
+	inc = val_to_i(f.args+2);
+    if (inc == 0 || max == min || (max > min) != (inc > 0))
+	return spcl_make_err(E_BAD_VALUE, "range(%d, %d, %d) with invalid increment", (int)min, (int)max, (int)inc);
+    //round up so that the last element is the largest one before max
+    unsigned long long span = (inc > 0)? (unsigned long long)max - (unsigned long long)min : (unsigned long long)min - (unsigned long long)max;
+    unsigned long long step = (inc > 0)? (unsigned long long)inc : -(unsigned long long)inc;
+    size_t n = (size_t)((span - 1)/step + 1);
+    spcl_val ret = (is_int)? alloc_iarray(n) : alloc_array(n);
+    for (size_t i = 0; i < n; ++i) {
+	long long x = (long long)((unsigned long long)min + (unsigned long long)i*(unsigned long long)inc);
+	if (is_int)
+	    ret.val.ia[i] = x;
+	else
+	    ret.val.a[i] = (double)x;
+    }
+    return ret;
+}
+static const valtype RANGE_SIG[] = {VAL_UNDEF, VAL_UNDEF, VAL_UNDEF};
+spcl_val spcl_range(struct spcl_inst* c, spcl_fn_call f) {
+    spcl_sigcheck_opts(f, 1, RANGE_SIG);
+    int all_whole = 1, any_int = 0;
+    for (size_t i = 0; i < f.n_args; ++i) {
+	if (f.args[i].type == VAL_ERR)
+	    return copy_spcl_val(f.args[i]);
+	if (f.args[i].type != VAL_NUM && f.args[i].type != VAL_INT)
+	    return spcl_make_err(E_BAD_TYPE, "range expected args[%lu].type=numeric, got %s", i, valnames[f.args[i].type]);
+	all_whole = all_whole && is_whole(f.args+i);
+	any_int = any_int || f.args[i].type == VAL_INT;
+    }
+    if (all_whole)
+	return int_range(f, any_int);
+    double min, max, inc;
+    //interpret arguments depending on how many were provided
+    if (f.n_args == 1) {
+	min = 0;
+	max = val_to_x(f.args);
+	inc = 1;
+    } else {
+	min = val_to_x(f.args);
+	max = val_to_x(f.args+1);
+	inc = 1;
+    }
+    if (f.n_args >= 3)
+	inc = val_to_x(f.args+2);
+    //make sure arguments are valid
+    if ((max-min)*inc <= 0)
+	return spcl_make_err(E_BAD_VALUE, "range(%f, %f, %f) with invalid increment", min, max, inc);
+    spcl_val ret = alloc_array((max - min) / inc);
+    for (size_t i = 0; i < ret.n_els; ++i)
+	ret.val.a[i] = i*inc + min;
+    return ret;
+}
+spcl_val spcl_int(struct spcl_inst* c, spcl_fn_call f) {
+    spcl_sigcheck(f, ANY1_SIG);
+    valtype t = f.args[0].type;
+    if (t == VAL_INT || t == VAL_IARRAY)
+	return copy_spcl_val(f.args[0]);
+    if (t != VAL_NUM && t != VAL_ARRAY && t != VAL_LIST && !is_typed(t))
+	return spcl_make_err(E_BAD_TYPE, "int() expected args[0].type=numeric, array or list, got %s", valnames[t]);
+    return spcl_cast(f.args[0], (t == VAL_NUM)? VAL_INT : VAL_IARRAY);
+}
+//names of the element types accepted by astype() in the same order as DTYPES
+static const char* const DTYPE_NAMES[] = {"f64", "f32", "i64", "i32", "u8"};
+static const valtype DTYPES[] = {VAL_ARRAY, VAL_FARRAY, VAL_IARRAY, VAL_I32ARRAY, VAL_U8ARRAY};
+#define N_DTYPES (sizeof(DTYPES)/sizeof(valtype))
+static const valtype ASTYPE_SIG[] = {VAL_UNDEF, VAL_STR};
+static const valtype WHERE_SIG[] = {VAL_UNDEF, VAL_UNDEF, VAL_UNDEF};
+spcl_val spcl_astype(struct spcl_inst* c, spcl_fn_call f) {
+    spcl_sigcheck(f, ASTYPE_SIG);
+    valtype t = f.args[0].type;
+    if (!is_real_arr(t) && t != VAL_LIST)
+	return spcl_make_err(E_BAD_TYPE, "astype() expected args[0].type=array or list, got %s", valnames[t]);
+    for (size_t i = 0; i < N_DTYPES; ++i) {
+	if (strcmp(f.args[1].val.s, DTYPE_NAMES[i]) == 0)
+	    return spcl_cast(f.args[0], DTYPES[i]);
+    }
+    return spcl_make_err(E_BAD_VALUE, "astype() got unrecognized dtype %s", f.args[1].val.s);
+}
+spcl_val spcl_dtype(struct spcl_inst* c, spcl_fn_call f) {
+    spcl_sigcheck(f, ANY1_SIG);
+    for (size_t i = 0; i < N_DTYPES; ++i) {
+	if (f.args[0].type == DTYPES[i])
+	    return spcl_make_str(DTYPE_NAMES[i], strlen(DTYPE_NAMES[i]));
+    }
+    return spcl_make_err(E_BAD_TYPE, "dtype() expected args[0].type=array, got %s", valnames[f.args[0].type]);
+}
+//z[i] = (m[i])? a[i*sa] : b[i*sb] for arrays with elements of type T
+#define BLEND_LOOP(T) {									\
+    for (size_t i = 0; i < n; ++i)							\
+	((T*)z)[i] = (m[i])? ((const T*)a)[(psize)i*sa] : ((const T*)b)[(psize)i*sb];	\
+}
+static inline void blend_typed(void* z, const unsigned char* m, const void* a, psize sa, const void* b, psize sb, size_t n, size_t el_size) {
+    switch (el_size) {
+    case 1:	BLEND_LOOP(unsigned char) break;
+    case 4:	BLEND_LOOP(unsigned) break;
+    default:	BLEND_LOOP(unsigned long long) break;
+    }
+}
+//convert the operand v of where() to an array with element type t. Scalars become arrays with a single element.
+static inline spcl_val where_operand(const spcl_val* v, valtype t) {
+    if (v->type == t)
+	return copy_spcl_val(*v);
+    if (is_real_arr(v->type))
+	return convert_arr(v, t);
+    spcl_val ret = alloc_typed(1, t);
+    if (v->type == VAL_INT)
+	arr_seti(&ret, 0, v->val.i);
+    else
+	arr_setx(&ret, 0, v->val.x);
+    return ret;
+}
+spcl_val spcl_where(struct spcl_inst* c, spcl_fn_call f) {
+    spcl_sigcheck(f, WHERE_SIG);
+    const spcl_val* a = f.args+1;
+    const spcl_val* b = f.args+2;
+    if (f.args[0].type != VAL_U8ARRAY)
+	return spcl_make_err(E_BAD_TYPE, "where() expected args[0].type=%s (a mask), got %s", valnames[VAL_U8ARRAY], valnames[f.args[0].type]);
+    size_t n = f.args[0].n_els;
+    //tensors are read in row-major order and give a tensor with the same shape
+    const spcl_tensor* shape = NULL;
+    for (const spcl_val* v = a; v <= b; ++v) {
+	if (v->type == VAL_MAT) {
+	    if (tensor_size(v->val.t) != n)
+		return spcl_make_err(E_OUT_OF_RANGE, "where() got args[%lu] with %lu elements instead of %lu", v - f.args, tensor_size(v->val.t), n);
+	    if (shape && !same_shape(shape, v->val.t))
+		return spcl_make_err(E_OUT_OF_RANGE, "where() got tensors with different shapes");
+	    shape = v->val.t;
+	    continue;
+	}
+	if (!is_real_arr(v->type) && v->type != VAL_NUM && v->type != VAL_INT)
+	    return spcl_make_err(E_BAD_TYPE, "where() expected args[%lu].type=numeric or array, got %s", v - f.args, valnames[v->type]);
+	if (is_real_arr(v->type) && v->n_els != n)
+	    return spcl_make_err(E_OUT_OF_RANGE, "where() got args[%lu] with length %lu instead of %lu", v - f.args, v->n_els, n);
+    }
+    spcl_val flat[2] = {*a, *b};
+    for (size_t k = 0; k < 2; ++k) {
+	if (flat[k].type == VAL_MAT)
+	    flat[k] = tensor_flat(flat+k);
+    }
+    a = flat;
+    b = flat+1;
+    //choose the element type as for arithmetic between a and b
+    valtype t = (is_real_arr(a->type) && is_real_arr(b->type))? promote_dtype(a->type, b->type) : (is_real_arr(a->type))? a->type : (is_real_arr(b->type))? b->type : VAL_ARRAY;
+    if (is_int_dtype(t) && (!(is_real_arr(a->type) || is_whole(a)) || !(is_real_arr(b->type) || is_whole(b))))
+	t = VAL_ARRAY;
+    spcl_val av = where_operand(a, t);
+    spcl_val bv = where_operand(b, t);
+    //tensors have double elements, so t is VAL_ARRAY whenever shape is set
+    spcl_val ret = (shape)? alloc_tensor(shape->ndim, shape->shape) : alloc_typed(n, t);
+    psize sa = (av.n_els != 1 || n == 1), sb = (bv.n_els != 1 || n == 1);
+    if (t == VAL_ARRAY)
+	get_kernels()->blend((shape)? ret.val.t->data : ret.val.a, f.args[0].val.u8, av.val.a, sa, bv.val.a, sb, n);
+    else
+	blend_typed(ret.val.a, f.args[0].val.u8, av.val.a, sa, bv.val.a, sb, n, el_size(t));
+    cleanup_spcl_val(&av);
+    cleanup_spcl_val(&bv);
+    for (size_t k = 0; k < 2; ++k) {
+	if (f.args[k+1].type == VAL_MAT)
+	    cleanup_spcl_val(flat+k);
+    }
+    return ret;
+}
+static const valtype LINSPACE_SIG[] = {VAL_NUM, VAL_NUM, VAL_NUM};
+spcl_val spcl_linspace(struct spcl_inst* c, spcl_fn_call f) {
+    spcl_sigcheck(f, LINSPACE_SIG);
+    size_t n = (size_t)(f.args[2].val.x);
+    //prevent divisions by zero
+    if (n < 2)
+	return spcl_make_err(E_BAD_VALUE, "cannot make linspace with size %lu", n);
+    spcl_val ret = alloc_array(n);
+    double step = (f.args[1].val.x - f.args[0].val.x)/(ret.n_els - 1);
+    for (size_t i = 0; i < ret.n_els; ++i) {
+	ret.val.a[i] = step*i + f.args[0].val.x;
+    }
+    return ret;
+}
+/**
+ * Append copies of the elements in the list l to the end of the list ret, descending into any sublists
+ */
+static inline void flatten_list(spcl_val* ret, spcl_val l) {
+    for (size_t i = 0; i < l.n_els; ++i) {
+	if (l.val.l[i].type == VAL_LIST) {
+	    flatten_list(ret, l.val.l[i]);
+	} else {
+	    grow_val(ret, ret->n_els+1, sizeof(spcl_val));
+	    ret->val.l[ret->n_els++] = copy_spcl_val(l.val.l[i]);
+	}
+    }
+}
+spcl_val spcl_flatten(struct spcl_inst* c, spcl_fn_call f) {
+    spcl_sigcheck(f, ANY1_SIG);
+    spcl_val ret = spcl_make_none();
+    if (f.args[0].type == VAL_LIST) {
+	ret.type = VAL_LIST;
+	flatten_list(&ret, f.args[0]);
+	return ret;
+    } else if (f.args[0].type == VAL_ARRAY) {
+	return copy_spcl_val(f.args[0]);
+    } else if (f.args[0].type == VAL_MAT) {
+	spcl_tensor* t = f.args[0].val.t;
+	//contiguous tensors can share their storage with the result
+	if (f.args[0].buf && tensor_is_contiguous(t)) {
+	    ret.type = VAL_ARRAY;
+	    ret.n_els = tensor_size(t);
+	    ret.val.a = t->data;
+	    ret.buf = f.args[0].buf;
+	    ++ret.buf->n_refs;
+	    return ret;
+	}
+	ret = alloc_array(tensor_size(t));
+	tensor_gather(t, ret.val.a);
+	return ret;
+    }
+    return spcl_make_err(E_BAD_TYPE, "cannot flatten type %s", valnames[f.args[0].type]);
+}
+/**
+ * Append r to the end of l in place. l must be uniquely owned by the caller since its buffer may be reallocated.
+ * returns: an error if the types could not be concatenated or none on success. l is left unmodified on failure.
+ */
+static inline spcl_val cat_in_place(spcl_val* l, spcl_val r) {
+    size_t l1 = l->n_els;
+    size_t l2 = (r.type == VAL_LIST || is_real_arr(r.type))? r.n_els : 1;
+    //tensors always hold doubles
+    if (l->type == VAL_MAT && r.type != VAL_ARRAY && is_real_arr(r.type)) {
+	spcl_val tmp = to_f64(r);
+	spcl_val er = cat_in_place(l, tmp);
+	cleanup_spcl_val(&tmp);
+	return er;
+    }
+    if (l->type == VAL_MAT && (r.type == VAL_ARRAY || r.type == VAL_MAT)) {
+	//special case for tensors, append new entries along the first axis. r may either be a single entry with one less axis than l (e.g. a row of a matrix) or a stack of entries
+	size_t r_ndim = (r.type == VAL_MAT)? r.val.t->ndim : 1;
+	const size_t* r_shape = (r.type == VAL_MAT)? r.val.t->shape : &r.n_els;
+	size_t skip = (r_ndim == l->val.t->ndim);
+	if (r_ndim + 1 - skip != l->val.t->ndim)
+	    return spcl_make_err(E_BAD_VALUE, "can't append %lu dimensional value to %lu dimensional tensor", r_ndim, l->val.t->ndim);
+	for (size_t d = 1; l1 > 0 && d < l->val.t->ndim; ++d) {
+	    if (l->val.t->shape[d] != r_shape[d-1+skip])
+		return spcl_make_err(E_BAD_VALUE, "can't append entries of length %lu along axis %lu to tensor with length %lu", r_shape[d-1+skip], d, l->val.t->shape[d]);
+	}
+	make_contiguous(l);
+	spcl_tensor* t = l->val.t;
+	if (l1 == 0) {
+	    memcpy(t->shape+1, r_shape+skip, sizeof(size_t)*(t->ndim-1));
+	    tensor_set_strides(t);
+	}
+	size_t r_rows = (skip)? r_shape[0] : 1;
+	size_t row_n = (size_t)t->strides[0];
+	if (row_n > 0) {
+	    grow_val(l, l1+r_rows, sizeof(double)*row_n);
+	    double* dst = t->data + l1*row_n;
+	    if (r.type == VAL_MAT)
+		tensor_gather(r.val.t, dst);
+	    else
+		memcpy(dst, r.val.a, sizeof(double)*r.n_els);
+	}
+	t->shape[0] = l->n_els = l1+r_rows;
+    } else if (l->type == VAL_LIST) {
+	grow_val(l, l1+l2, sizeof(spcl_val));
+	if (r.type == VAL_LIST) {
+	    //list -> list
+	    for (size_t i = 0; i < l2; ++i)
+		l->val.l[i+l1] = copy_spcl_val(r.val.l[i]);
+	} else if (is_real_arr(r.type)) {
+	    //array -> list
+	    for (size_t i = 0; i < l2; ++i)
+		l->val.l[i+l1] = (is_int_dtype(r.type))? spcl_make_int(arr_geti(&r, i)) : spcl_make_num(arr_get(&r, i));
+	} else {
+	    //anything -> list
+	    l->val.l[l1] = copy_spcl_val(r);
+	}
+	l->n_els = l1+l2;
+    } else if (is_real_arr(l->type)) {
+	//arrays are promoted as for arithmetic, so integer and typed arrays keep their element type. Numbers keep the type of l unless they aren't whole and l holds integers.
+	valtype t = l->type;
+	if (is_real_arr(r.type)) {
+	    t = promote_dtype(l->type, r.type);
+	} else if (r.type == VAL_NUM || r.type == VAL_INT) {
+	    if (is_int_dtype(t) && !is_whole(&r))
+		t = VAL_ARRAY;
+	} else if (r.type == VAL_LIST) {
+	    //make sure that we don't partially append a list with non-numeric elements
+	    for (size_t i = 0; i < l2; ++i) {
+		if (r.val.l[i].type != VAL_NUM && r.val.l[i].type != VAL_INT)
+		    return spcl_make_err(E_BAD_TYPE, "can only concatenate numeric lists to arrays");
+		if (is_int_dtype(t) && !is_whole(r.val.l+i))
+		    t = VAL_ARRAY;
+	    }
+	} else {
+	    return spcl_make_err(E_BAD_TYPE, "called cat() with types <%s> <%s>", valnames[l->type], valnames[r.type]);
+	}
+	if (t != l->type) {
+	    spcl_val tmp = convert_arr(l, t);
+	    cleanup_spcl_val(l);
+	    *l = tmp;
+	}
+	make_unique(l);
+	grow_val(l, l1+l2, el_size(t));
+	if (r.type == t) {
+	    //array -> array of the same type
+	    memcpy(l->val.u8 + el_size(t)*l1, r.val.u8, el_size(t)*l2);
+	} else {
+	    //numbers, lists and other arrays are converted one element at a time
+	    for (size_t i = 0; i < l2; ++i) {
+		const spcl_val* el = (r.type == VAL_LIST)? r.val.l+i : &r;
+		if (is_real_arr(r.type) && is_int_dtype(r.type) && is_int_dtype(t))
+		    arr_seti(l, l1+i, arr_geti(&r, i));
+		else if (is_real_arr(r.type))
+		    arr_setx(l, l1+i, arr_get(&r, i));
+		else if (el->type == VAL_INT && is_int_dtype(t))
+		    arr_seti(l, l1+i, el->val.i);
+		else
+		    arr_setx(l, l1+i, val_to_x(el));
+	    }
+	}
+	l->n_els = l1+l2;
+    } else {
+	return spcl_make_err(E_BAD_TYPE, "called cat() with types <%s> <%s>", valnames[l->type], valnames[r.type]);
+    }
+    return spcl_make_none();
+}
+/**
+ * Read small vectors in v (including those nested in lists) as arrays so that cat_in_place() may append to or from it.
+ */
+static inline void cat_unbox(spcl_val* v) {
+    if (has_vec(v)) {
+	spcl_val tmp = unbox_vecs(*v);
+	cleanup_spcl_val(v);
+	*v = tmp;
+    }
+}
+spcl_val spcl_cat(struct spcl_inst* c, spcl_fn_call f) {
+    if (f.n_args < 2)
+	return spcl_make_err(E_LACK_TOKENS, "cat() expected 2 arguments but got %lu", f.n_args);
+    //the arguments belong to the caller, so we have to append to a copy. Calls from scripts append to their temporary arguments instead (see parse_literal_fn() and self_cat_rs()).
+    spcl_val sto = copy_spcl_val(f.args[0]);
+    spcl_val er = cat_in_place(&sto, f.args[1]);
+    if (er.type == VAL_ERR) {
+	cleanup_spcl_val(&sto);
+	return er;
+    }
+    return sto;
+}
+spcl_val spcl_shape(struct spcl_inst* c, spcl_fn_call f) {
+    spcl_sigcheck(f, ANY1_SIG);
+    spcl_val ret = spcl_make_none();
+    if (f.args[0].type == VAL_MAT) {
+	ret = alloc_array(f.args[0].val.t->ndim);
+	for (size_t d = 0; d < ret.n_els; ++d)
+	    ret.val.a[d] = f.args[0].val.t->shape[d];
+    } else if (f.args[0].type == VAL_ARRAY || f.args[0].type == VAL_CARRAY || f.args[0].type == VAL_LIST || f.args[0].type == VAL_STR) {
+	ret = alloc_array(1);
+	ret.val.a[0] = f.args[0].n_els;
+    } else if (f.args[0].type == VAL_NUM || f.args[0].type == VAL_COMPLEX) {
+	ret = alloc_array(0);
+    } else {
+	return spcl_make_err(E_BAD_TYPE, "%s has no shape", valnames[f.args[0].type]);
+    }
+    return ret;
+}
+spcl_val spcl_reshape(struct spcl_inst* c, spcl_fn_call f) {
+    if (f.n_args < 2)
+	return spcl_make_err(E_LACK_TOKENS, "reshape() expected at least 2 arguments, got %lu", f.n_args);
+    if (f.args[0].type != VAL_ARRAY && f.args[0].type != VAL_MAT)
+	return spcl_make_err(E_BAD_TYPE, "reshape() expected args[0].type=array or tensor, got %s", valnames[f.args[0].type]);
+    //the shape may be passed either as separate arguments or as a single list
+    spcl_val dims = spcl_make_none();
+    if (f.n_args == 2 && (f.args[1].type == VAL_LIST || f.args[1].type == VAL_ARRAY)) {
+	dims = spcl_cast(f.args[1], VAL_ARRAY);
+    } else {
+	spcl_val lst = spcl_make_none();
+	lst.type = VAL_LIST;
+	lst.n_els = f.n_args-1;
+	lst.val.l = f.args+1;
+	dims = spcl_cast(lst, VAL_ARRAY);
+    }
+    if (dims.type == VAL_ERR)
+	return dims;
+    if (dims.n_els == 0) {
+	cleanup_spcl_val(&dims);
+	return spcl_make_err(E_BAD_VALUE, "reshape() requires at least one axis");
+    }
+    //the source must be contiguous for the result to be a view, otherwise we view a copy
+    spcl_val src = f.args[0];
+    int copied = 0;
+    if (src.type == VAL_MAT && (!src.buf || !tensor_is_contiguous(src.val.t))) {
+	src = alloc_array(tensor_size(f.args[0].val.t));
+	tensor_gather(f.args[0].val.t, src.val.a);
+	copied = 1;
+    } else if (src.type == VAL_ARRAY && !src.buf) {
+	src = spcl_make_array(f.args[0].val.a, f.args[0].n_els);
+	copied = 1;
+    }
+    size_t n = (src.type == VAL_MAT)? tensor_size(src.val.t) : src.n_els;
+    double* data = (src.type == VAL_MAT)? src.val.t->data : src.val.a;
+    //figure out the new shape, inferring at most one axis from the number of elements
+    spcl_tensor* t = alloc_tensor_desc(dims.n_els);
+    spcl_val ret = spcl_make_none();
+    size_t known = 1, infer = t->ndim;
+    for (size_t d = 0; d < t->ndim && ret.type != VAL_ERR; ++d) {
+	double x = dims.val.a[d];
+	if (x == -1 && infer == t->ndim) {
+	    infer = d;
+	} else if (x < 0 || x != floor(x)) {
+	    ret = spcl_make_err(E_BAD_VALUE, "invalid length %g for axis %lu", x, d);
+	} else {
+	    t->shape[d] = (size_t)x;
+	    known *= t->shape[d];
+	}
+    }
+    if (ret.type != VAL_ERR) {
+	if (infer < t->ndim && (known == 0 || n % known)) {
+	    ret = spcl_make_err(E_BAD_VALUE, "cannot infer the length of axis %lu for %lu elements", infer, n);
+	} else if (infer == t->ndim && known != n) {
+	    ret = spcl_make_err(E_BAD_VALUE, "cannot reshape %lu elements into a shape with %lu elements", n, known);
+	} else {
+	    if (infer < t->ndim)
+		t->shape[infer] = n/known;
+	    tensor_set_strides(t);
+	    ret = tensor_view(t, 0, data, src.buf);
+	}
+    }
+    xfree(t);
+    cleanup_spcl_val(&dims);
+    if (copied)
+	cleanup_spcl_val(&src);
+    return ret;
+}
+spcl_val spcl_transpose(struct spcl_inst* c, spcl_fn_call f) {
+    static const valtype TRANSPOSE_SIG[] = {VAL_UNDEF, VAL_UNDEF};
+    spcl_sigcheck_opts(f, 1, TRANSPOSE_SIG);
+    //arrays only have a single axis
+    if (f.args[0].type == VAL_ARRAY)
+	return copy_spcl_val(f.args[0]);
+    if (f.args[0].type != VAL_MAT)
+	return spcl_make_err(E_BAD_TYPE, "transpose() expected args[0].type=tensor, got %s", valnames[f.args[0].type]);
+    const spcl_tensor* t = f.args[0].val.t;
+    spcl_val ret = tensor_view(t, 0, t->data, f.args[0].buf);
+    spcl_tensor* rt = ret.val.t;
+    if (f.n_args == 1) {
+	for (size_t d = 0; d < t->ndim; ++d) {
+	    rt->shape[d] = t->shape[t->ndim-1-d];
+	    rt->strides[d] = t->strides[t->ndim-1-d];
+	}
+    } else {
+	spcl_val axes = spcl_cast(f.args[1], VAL_ARRAY);
+	if (axes.type == VAL_ARRAY && axes.n_els == t->ndim) {
+	    //make sure that axes is a permutation
+	    size_t seen = 0;
+	    for (size_t d = 0; d < t->ndim; ++d) {
+		double x = axes.val.a[d];
+		if (x < 0 || x >= t->ndim || x != floor(x) || rt->shape[(size_t)x] == SIZE_MAX)
+		    break;
+		rt->shape[(size_t)x] = SIZE_MAX;
+		++seen;
+	    }
+	    if (seen == t->ndim) {
+		for (size_t d = 0; d < t->ndim; ++d) {
+		    rt->shape[d] = t->shape[(size_t)axes.val.a[d]];
+		    rt->strides[d] = t->strides[(size_t)axes.val.a[d]];
+		}
+		cleanup_spcl_val(&axes);
+		ret.n_els = rt->shape[0];
+		return ret;
+	    }
+	}
+	cleanup_spcl_val(&axes);
+	cleanup_spcl_val(&ret);
+	return spcl_make_err(E_BAD_VALUE, "transpose() axes must be a permutation of the %lu axes", t->ndim);
+    }
+    ret.n_els = rt->shape[0];
+    return ret;
+}
+/**
+ * Convert v to a number, array or tensor. Lists of numbers become arrays and nested lists become tensors.
+ * returns: a new value that must be cleaned up by the caller, or an error if v isn't numeric
+ */
+static inline spcl_val as_numeric(spcl_fn_call f, size_t i) {
+    spcl_val v = f.args[i];
+    if (v.type == VAL_NUM || v.type == VAL_ARRAY || v.type == VAL_MAT)
+	return copy_spcl_val(v);
+    if (v.type == VAL_VEC)
+	return vec_to_array(&v);
+    if (v.type == VAL_LIST) {
+	spcl_val ret = spcl_cast(v, VAL_ARRAY);
+	if (ret.type != VAL_ERR)
+	    return ret;
+	cleanup_spcl_val(&ret);
+	return spcl_cast(v, VAL_MAT);
+    }
+    return spcl_make_err(E_BAD_TYPE, "%.*s() expected args[%lu].type=array, tensor or list, got %s", f.name.n, f.name.s, i, valnames[v.type]);
+}
+/**
+ * Get a pointer to the elements of the number, array or tensor v in row-major order. If v isn't contiguous, then the elements are copied to a buffer which is saved to tmp and must be freed by the caller.
+ */
+static inline const double* numeric_data(const spcl_val* v, size_t* n, double** tmp) {
+    *tmp = NULL;
+    if (v->type == VAL_NUM) {
+	*n = 1;
+	return &v->val.x;
+    } else if (v->type == VAL_ARRAY) {
+	*n = v->n_els;
+	return v->val.a;
+    }
+    *n = tensor_size(v->val.t);
+    if (tensor_is_contiguous(v->val.t))
+	return v->val.t->data;
+    *tmp = xmalloc(sizeof(double)*(*n));
+    tensor_gather(v->val.t, *tmp);
+    return *tmp;
+}
+//the magnitude of z. This is the only complex math function with real results, which zmath_call() checks for.
+static double complex zabs(double complex z) {
+    return cabs(z);
+}
+/**
+ * Apply the complex function fn to the complex number or complex array f.args[0]
+ */
+static inline spcl_val zmath_call(spcl_fn_call f, double complex (*fn)(double complex)) {
+    if (!fn)
+	return spcl_make_err(E_BAD_TYPE, "%.*s() is not defined for complex values", f.name.n, f.name.s);
+    const spcl_val* v = f.args;
+    if (v->type == VAL_COMPLEX) {
+	double complex z = fn(val_to_z(v));
+	return (fn == zabs)? spcl_make_num(creal(z)) : spcl_make_complex(creal(z), cimag(z));
+    }
+    const double complex* x = (const double complex*)v->val.a;
+    spcl_val ret = (fn == zabs)? alloc_array(v->n_els) : alloc_carray(v->n_els);
+    if (fn == zabs) {
+	for (size_t i = 0; i < v->n_els; ++i)
+	    ret.val.a[i] = cabs(x[i]);
+    } else {
+	for (size_t i = 0; i < v->n_els; ++i)
+	    ((double complex*)ret.val.a)[i] = fn(x[i]);
+    }
+    return ret;
+}
+/**
+ * Dual numbers store the truncated taylor series a[0] + a[1]*t + ... + a[n-1]*t^(n-1) of a value in the variable being differentiated, so a[k] is the kth derivative divided by k!. Arithmetic and math functions on them use the recurrences for taylor coefficients, e.g. from Griewank and Walther, Evaluating Derivatives.
+ */
+#define JET_MAX_ORDER	16
+typedef void (*jet_fn)(const double* a, double* b, size_t n);
+static inline void jet_mul(const double* a, const double* b, double* c, size_t n) {
+    for (size_t k = n; k-- > 0;) {
+	double s = 0;
+	for (size_t j = 0; j <= k; ++j)
+	    s += a[j]*b[k-j];
+	c[k] = s;
+    }
+}
+static inline void jet_div(const double* a, const double* b, double* c, size_t n) {
+    for (size_t k = 0; k < n; ++k) {
+	double s = a[k];
+	for (size_t j = 0; j < k; ++j)
+	    s -= c[j]*b[k-j];
+	c[k] = s/b[0];
+    }
+}
+static void jet_exp(const double* a, double* b, size_t n) {
+    b[0] = exp(a[0]);
+    for (size_t k = 1; k < n; ++k) {
+	double s = 0;
+	for (size_t j = 1; j <= k; ++j)
+	    s += j*a[j]*b[k-j];
+	b[k] = s/k;
+    }
+}
+static void jet_log(const double* a, double* b, size_t n) {
+    b[0] = log(a[0]);
+    for (size_t k = 1; k < n; ++k) {
+	double s = 0;
+	for (size_t j = 1; j < k; ++j)
+	    s += j*b[j]*a[k-j];
+	b[k] = (a[k] - s/k)/a[0];
+    }
+}
+static void jet_sincos(const double* a, double* s, double* c, size_t n) {
+    s[0] = sin(a[0]);
+    c[0] = cos(a[0]);
+    for (size_t k = 1; k < n; ++k) {
+	double ss = 0, sc = 0;
+	for (size_t j = 1; j <= k; ++j) {
+	    ss += j*a[j]*c[k-j];
+	    sc += j*a[j]*s[k-j];
+	}
+	s[k] = ss/k;
+	c[k] = -sc/k;
+    }
+}
+static void jet_sin(const double* a, double* b, size_t n) {
+    double c[JET_MAX_ORDER+1];
+    jet_sincos(a, b, c, n);
+}
+static void jet_cos(const double* a, double* b, size_t n) {
+    double s[JET_MAX_ORDER+1];
+    jet_sincos(a, s, b, n);
+}
+//tan' = 1 + tan^2, where q holds the coefficients of 1 + tan^2
+static void jet_tan(const double* a, double* b, size_t n) {
+    double q[JET_MAX_ORDER+1];
+    b[0] = tan(a[0]);
+    q[0] = 1 + b[0]*b[0];
+    for (size_t k = 1; k < n; ++k) {
+	double s = 0;
+	for (size_t j = 1; j <= k; ++j)
+	    s += j*a[j]*q[k-j];
+	b[k] = s/k;
+	q[k] = 0;
+	for (size_t j = 0; j <= k; ++j)
+	    q[k] += b[j]*b[k-j];
+    }
+}
+static void jet_sqrt(const double* a, double* b, size_t n) {
+    b[0] = sqrt(a[0]);
+    for (size_t k = 1; k < n; ++k) {
+	double s = a[k];
+	for (size_t j = 1; j < k; ++j)
+	    s -= b[j]*b[k-j];
+	b[k] = s/(2*b[0]);
+    }
+}
+//solve r*b' = a' for the coefficients of b after the first
+static inline void jet_integrate(const double* a, const double* r, double* b, size_t n) {
+    for (size_t k = 1; k < n; ++k) {
+	double s = k*a[k];
+	for (size_t j = 1; j < k; ++j)
+	    s -= j*b[j]*r[k-j];
+	b[k] = s/(k*r[0]);
+    }
+}
+//asin' = 1/sqrt(1 - x^2)
+static void jet_asin(const double* a, double* b, size_t n) {
+    double sq[JET_MAX_ORDER+1] = {0}, r[JET_MAX_ORDER+1];
+    jet_mul(a, a, sq, n);
+    for (size_t k = 0; k < n; ++k)
+	sq[k] = (k)? -sq[k] : 1 - sq[k];
+    jet_sqrt(sq, r, n);
+    b[0] = asin(a[0]);
+    jet_integrate(a, r, b, n);
+}
+static void jet_acos(const double* a, double* b, size_t n) {
+    jet_asin(a, b, n);
+    b[0] = acos(a[0]);
+    for (size_t k = 1; k < n; ++k)
+	b[k] = -b[k];
+}
+//atan' = 1/(1 + x^2)
+static void jet_atan(const double* a, double* b, size_t n) {
+    double r[JET_MAX_ORDER+1];
+    jet_mul(a, a, r, n);
+    r[0] += 1;
+    b[0] = atan(a[0]);
+    jet_integrate(a, r, b, n);
+}
+static void jet_fabs(const double* a, double* b, size_t n) {
+    double sign = (a[0] < 0)? -1 : 1;
+    for (size_t k = 0; k < n; ++k)
+	b[k] = sign*a[k];
+}
+static void jet_floor(const double* a, double* b, size_t n) {
+    memset(b, 0, sizeof(double)*n);
+    b[0] = floor(a[0]);
+}
+static void jet_ceil(const double* a, double* b, size_t n) {
+    memset(b, 0, sizeof(double)*n);
+    b[0] = ceil(a[0]);
+}
+//raise a to the number p. Small whole powers are taken by repeated multiplication so that they are exact at a[0] = 0.
+static inline void jet_pow(const double* a, double p, double* b, size_t n) {
+    if (p >= 0 && p <= 64 && p == floor(p)) {
+	double x[JET_MAX_ORDER+1], tmp[JET_MAX_ORDER+1];
+	memcpy(x, a, sizeof(double)*n);
+	memset(b, 0, sizeof(double)*n);
+	b[0] = 1;
+	for (unsigned e = (unsigned)p; e; e >>= 1) {
+	    if (e & 1) {
+		jet_mul(b, x, tmp, n);
+		memcpy(b, tmp, sizeof(double)*n);
+	    }
+	    jet_mul(x, x, tmp, n);
+	    memcpy(x, tmp, sizeof(double)*n);
+	}
+	return;
+    }
+    b[0] = pow(a[0], p);
+    for (size_t k = 1; k < n; ++k) {
+	double s = 0;
+	for (size_t j = 0; j < k; ++j)
+	    s += (p*(k-j) - j)*a[k-j]*b[j];
+	b[k] = s/(k*a[0]);
+    }
+}
+/**
+ * Apply the dual number version fn of a math function to f.args[0]
+ */
+static inline spcl_val jet_math(spcl_fn_call f, jet_fn fn) {
+    spcl_val ret = alloc_typed(f.args[0].n_els, VAL_DUAL);
+    fn(f.args[0].val.a, ret.val.a, ret.n_els);
+    return ret;
+}
+/**
+ * Apply op to l and r where at least one of them is a dual number and the other is a number, overwriting l. An undefined left operand is a unary sign.
+ * returns: 0 if op can't be applied to l and r or 1 otherwise
+ */
+static inline int jet_arith(spcl_val* l, char op, spcl_val r) {
+    const spcl_val* v[2] = {l, &r};
+    double a[2][JET_MAX_ORDER+1];
+    size_t n = JET_MAX_ORDER+1;
+    for (int i = 0; i < 2; ++i) {
+	if (v[i]->type == VAL_DUAL && v[i]->n_els < n)
+	    n = v[i]->n_els;
+    }
+    for (int i = 0; i < 2; ++i) {
+	if (v[i]->type == VAL_DUAL) {
+	    memcpy(a[i], v[i]->val.a, sizeof(double)*n);
+	} else if (v[i]->type == VAL_NUM || v[i]->type == VAL_INT || (i == 0 && v[i]->type == VAL_UNDEF && (op == '+' || op == '-'))) {
+	    memset(a[i], 0, sizeof(double)*n);
+	    a[i][0] = (v[i]->type == VAL_UNDEF)? 0 : val_to_x(v[i]);
+	} else {
+	    return 0;
+	}
+    }
+    spcl_val ret = alloc_typed(n, VAL_DUAL);
+    double* b = ret.val.a;
+    switch (op) {
+    case '+': for (size_t k = 0; k < n; ++k) b[k] = a[0][k] + a[1][k]; break;
+    case '-': for (size_t k = 0; k < n; ++k) b[k] = a[0][k] - a[1][k]; break;
+    case '*': jet_mul(a[0], a[1], b, n); break;
+    case '/': jet_div(a[0], a[1], b, n); break;
+    //the remainder only shifts the value, so its derivatives are those of l
+    case '%':
+	if (r.type == VAL_DUAL) {
+	    cleanup_spcl_val(&ret);
+	    return 0;
+	}
+	memcpy(b, a[0], sizeof(double)*n);
+	b[0] -= a[1][0]*floor(a[0][0]/a[1][0]);
+	break;
+    //powers of dual numbers are taken as exp(r*log(l))
+    case '^':
+	if (r.type != VAL_DUAL) {
+	    jet_pow(a[0], a[1][0], b, n);
+	} else {
+	    double lg[JET_MAX_ORDER+1] = {0}, e[JET_MAX_ORDER+1] = {0};
+	    jet_log(a[0], lg, n);
+	    jet_mul(a[1], lg, e, n);
+	    jet_exp(e, b, n);
+	}
+	break;
+    default:
+	cleanup_spcl_val(&ret);
+	return 0;
+    }
+    cleanup_spcl_val(l);
+    *l = ret;
+    return 1;
+}
+/**
+ * Reduce the tensor t with op along axis. The result has the remaining axes of t.
+ * mean: if set, divide each result by the length of the axis
+ */
+static inline spcl_val reduce_axis(const spcl_tensor* t, size_t axis, char op, int mean) {
+    size_t ndim = t->ndim-1;
+    size_t m = t->shape[axis];
+    psize s = t->strides[axis];
+    size_t* shape = xmalloc(ndim*(2*sizeof(size_t) + sizeof(psize)));
+    size_t* idx = shape + ndim;
+    psize* strides = (psize*)(idx + ndim);
+    size_t n_out = 1;
+    for (size_t d = 0, k = 0; d < t->ndim; ++d) {
+	if (d == axis)
+	    continue;
+	shape[k] = t->shape[d];
+	strides[k] = t->strides[d];
+	idx[k++] = 0;
+	n_out *= t->shape[d];
+    }
+    spcl_val ret = (ndim == 1)? alloc_array(shape[0]) : alloc_tensor(ndim, shape);
+    double* out = (ndim == 1)? ret.val.a : ret.val.t->data;
+    //elements along the axis are gathered into a contiguous buffer unless they already are
+    double* col = (s == 1)? NULL : xmalloc(sizeof(double)*m + 1);
+    const double* base = t->data;
+    for (size_t k = 0; k < n_out; ++k) {
+	const double* x = base;
+	if (col) {
+	    for (size_t j = 0; j < m; ++j)
+		col[j] = base[(psize)j*s];
+	    x = col;
+	}
+	out[k] = arr_reduce(x, NULL, m, op);
+	if (mean)
+	    out[k] /= m;
+	//advance to the next element of the result
+	for (size_t d = ndim; d > 0; --d) {
+	    base += strides[d-1];
+	    if (++idx[d-1] < shape[d-1])
+		break;
+	    base -= strides[d-1]*(psize)shape[d-1];
+	    idx[d-1] = 0;
+	}
+    }
+    xfree(col);
+    xfree(shape);
+    return ret;
+}
+/**
+ * Implement sum(), prod(), min(), max() and mean(). The first argument is reduced completely unless an axis is passed as the second argument.
+ */
+static inline spcl_val reduce_call(spcl_fn_call f, char op, int mean) {
+    if (f.n_args < 1 || f.n_args > 2)
+	return spcl_make_err(E_LACK_TOKENS, "%.*s() expected 1 or 2 arguments, got %lu", f.name.n, f.name.s, f.n_args);
+    //the real and imaginary parts of complex arrays are summed separately
+    if (f.args[0].type == VAL_CARRAY && op == '+' && f.n_args == 1) {
+	size_t n = f.args[0].n_els;
+	double* parts = xmalloc(sizeof(double)*2*n + 1);
+	for (size_t i = 0; i < n; ++i) {
+	    parts[i] = f.args[0].val.a[2*i];
+	    parts[n+i] = f.args[0].val.a[2*i+1];
+	}
+	double re = arr_reduce(parts, NULL, n, '+');
+	double im = arr_reduce(parts+n, NULL, n, '+');
+	xfree(parts);
+	return (mean)? spcl_make_complex(re/n, im/n) : spcl_make_complex(re, im);
+    }
+    if (f.n_args == 2 && (f.args[1].type != VAL_NUM || f.args[1].val.x != floor(f.args[1].val.x)))
+	return spcl_make_err(E_BAD_TYPE, "%.*s() expected an integer axis", f.name.n, f.name.s);
+    spcl_val v = as_numeric(f, 0);
+    if (v.type == VAL_ERR)
+	return v;
+    spcl_val ret = spcl_make_none();
+    size_t ndim = (v.type == VAL_MAT)? v.val.t->ndim : (v.type == VAL_ARRAY);
+    long axis = (f.n_args == 2)? (long)f.args[1].val.x : 0;
+    if (axis < 0)
+	axis += ndim;
+    if (f.n_args == 2 && (axis < 0 || axis >= (long)ndim)) {
+	ret = spcl_make_err(E_OUT_OF_RANGE, "axis %g out of range for value with %lu axes", f.args[1].val.x, ndim);
+    } else if (f.n_args == 2 && ndim > 1) {
+	if ((op == '<' || op == '>') && v.val.t->shape[axis] == 0)
+	    ret = spcl_make_err(E_BAD_VALUE, "%.*s() of an empty axis", f.name.n, f.name.s);
+	else
+	    ret = reduce_axis(v.val.t, axis, op, mean);
+    } else {
+	size_t n;
+	double* tmp;
+	const double* x = numeric_data(&v, &n, &tmp);
+	if ((op == '<' || op == '>') && n == 0) {
+	    ret = spcl_make_err(E_BAD_VALUE, "%.*s() of an empty sequence", f.name.n, f.name.s);
+	} else {
+	    double r = arr_reduce(x, NULL, n, op);
+	    ret = spcl_make_num((mean)? r/n : r);
+	}
+	xfree(tmp);
+    }
+    cleanup_spcl_val(&v);
+    return ret;
+}
+spcl_val spcl_sum(struct spcl_inst* c, spcl_fn_call f) {
+    return reduce_call(f, '+', 0);
+}
+spcl_val spcl_prod(struct spcl_inst* c, spcl_fn_call f) {
+    return reduce_call(f, '*', 0);
+}
+spcl_val spcl_mean(struct spcl_inst* c, spcl_fn_call f) {
+    return reduce_call(f, '+', 1);
+}
+//min() and max() may also be called with several numbers
+static inline spcl_val minmax_call(spcl_fn_call f, char op) {
+    if (f.n_args < 2 || f.args[0].type != VAL_NUM)
+	return reduce_call(f, op, 0);
+    double r = f.args[0].val.x;
+    for (size_t i = 1; i < f.n_args; ++i) {
+	if (f.args[i].type != VAL_NUM)
+	    return spcl_make_err(E_BAD_TYPE, "%.*s() expected args[%lu].type=numeric, got %s", f.name.n, f.name.s, i, valnames[f.args[i].type]);
+	r = red_apply(r, f.args[i].val.x, op);
+    }
+    return spcl_make_num(r);
+}
+spcl_val spcl_min(struct spcl_inst* c, spcl_fn_call f) {
+    return minmax_call(f, '<');
+}
+spcl_val spcl_max(struct spcl_inst* c, spcl_fn_call f) {
+    return minmax_call(f, '>');
+}
+spcl_val spcl_dot(struct spcl_inst* c, spcl_fn_call f) {
+    if (f.n_args != 2)
+	return spcl_make_err(E_LACK_TOKENS, "dot() expected 2 arguments, got %lu", f.n_args);
+    //small vectors are multiplied inline
+    if (f.args[0].type == VAL_VEC && f.args[1].type == VAL_VEC && f.args[0].n_els == f.args[1].n_els) {
+	double r = 0;
+	for (size_t i = 0; i < f.args[0].n_els; ++i)
+	    r += f.args[0].val.v[i]*f.args[1].val.v[i];
+	return spcl_make_num(r);
+    }
+    spcl_val a = as_numeric(f, 0);
+    if (a.type == VAL_ERR)
+	return a;
+    spcl_val b = as_numeric(f, 1);
+    spcl_val ret = b;
+    if (b.type != VAL_ERR) {
+	if (a.type != VAL_ARRAY || b.type != VAL_ARRAY)
+	    ret = spcl_make_err(E_BAD_TYPE, "dot() expected arrays, got %s and %s", valnames[a.type], valnames[b.type]);
+	else if (a.n_els != b.n_els)
+	    ret = spcl_make_err(E_OUT_OF_RANGE, "cannot take the dot product of arrays of length %lu and %lu", a.n_els, b.n_els);
+	else
+	    ret = spcl_make_num( arr_reduce(a.val.a, b.val.a, a.n_els, '+') );
+	cleanup_spcl_val(&b);
+    }
+    cleanup_spcl_val(&a);
+    return ret;
+}
+spcl_val spcl_norm(struct spcl_inst* c, spcl_fn_call f) {
+    static const valtype NORM_SIG[] = {VAL_UNDEF, VAL_NUM};
+    spcl_sigcheck_opts(f, 1, NORM_SIG);
+    double p = (f.n_args > 1)? f.args[1].val.x : 2;
+    if (!(p > 0))
+	return spcl_make_err(E_BAD_VALUE, "norm() expected p > 0, got %g", p);
+    if (f.args[0].type == VAL_VEC && p == 2) {
+	double r = 0;
+	for (size_t i = 0; i < f.args[0].n_els; ++i)
+	    r += f.args[0].val.v[i]*f.args[0].val.v[i];
+	return spcl_make_num(sqrt(r));
+    }
+    //the norm of a complex array is the norm of the magnitudes of its elements
+    spcl_val v = (f.args[0].type == VAL_CARRAY)? zmath_call(f, zabs) : as_numeric(f, 0);
+    if (v.type == VAL_ERR)
+	return v;
+    size_t n;
+    double* tmp;
+    const double* x = numeric_data(&v, &n, &tmp);
+    double r;
+    if (p == 2) {
+	r = sqrt(arr_reduce(x, x, n, '+'));
+    } else {
+	//other norms need the absolute value of each element
+	double* y = (tmp)? tmp : xmalloc(sizeof(double)*n + 1);
+	for (size_t i = 0; i < n; ++i)
+	    y[i] = fabs(x[i]);
+	if (isinf(p)) {
+	    r = arr_reduce(y, NULL, n, '>');
+	} else {
+	    if (p != 1)
+		arr_op_scalar(y, p, n, '^');
+	    r = pow(arr_reduce(y, NULL, n, '+'), 1/p);
+	}
+	tmp = y;
+    }
+    xfree(tmp);
+    cleanup_spcl_val(&v);
+    return spcl_make_num(r);
+}
+//read the three elements of the vector, array or numeric list f.args[i] into x
+static inline spcl_val read_vec3(spcl_fn_call f, size_t i, double* x) {
+    if (f.args[i].type == VAL_VEC && f.args[i].n_els == 3) {
+	memcpy(x, f.args[i].val.v, sizeof(double)*3);
+	return spcl_make_none();
+    }
+    spcl_val v = as_numeric(f, i);
+    if (v.type == VAL_ERR)
+	return v;
+    spcl_val er = spcl_make_none();
+    if (v.type != VAL_ARRAY || v.n_els != 3)
+	er = spcl_make_err(E_BAD_TYPE, "%.*s() expected args[%lu] to have three elements", f.name.n, f.name.s, i);
+    else
+	memcpy(x, v.val.a, sizeof(double)*3);
+    cleanup_spcl_val(&v);
+    return er;
+}
+spcl_val spcl_cross(struct spcl_inst* c, spcl_fn_call f) {
+    if (f.n_args != 2)
+	return spcl_make_err(E_LACK_TOKENS, "cross() expected 2 arguments, got %lu", f.n_args);
+    double a[3], b[3];
+    spcl_val er = read_vec3(f, 0, a);
+    if (er.type != VAL_ERR)
+	er = read_vec3(f, 1, b);
+    if (er.type == VAL_ERR)
+	return er;
+    double x[3] = {a[1]*b[2] - a[2]*b[1], a[2]*b[0] - a[0]*b[2], a[0]*b[1] - a[1]*b[0]};
+    return spcl_make_vec(x, 3);
+}
+/**
+ * Get a matrix view of the array or two dimensional tensor v. Arrays are treated as rows on the left of a product and as columns on the right.
+ * returns: 1 on success or 0 if v can't be used as a matrix
+ */
+static inline int as_mat_view(const spcl_val* v, int right, mat_view* mv) {
+    if (v->type == VAL_ARRAY) {
+	*mv = (right)? (mat_view){v->val.a, v->n_els, 1, 1, 1} : (mat_view){v->val.a, 1, v->n_els, (psize)v->n_els, 1};
+	return 1;
+    } else if (v->type == VAL_MAT && v->val.t->ndim == 2) {
+	const spcl_tensor* t = v->val.t;
+	*mv = (mat_view){t->data, t->shape[0], t->shape[1], t->strides[0], t->strides[1]};
+	return 1;
+    }
+    return 0;
+}
+/**
+ * Compute the matrix product of a and b, which may be arrays or two dimensional tensors. The product of two arrays is their dot product, while an array times a matrix (or vice versa) is an array.
+ */
+static inline spcl_val matmul_vals(spcl_val a, spcl_val b) {
+    mat_view va, vb;
+    if (!as_mat_view(&a, 0, &va) || !as_mat_view(&b, 1, &vb))
+	return spcl_make_err(E_BAD_TYPE, "cannot take the matrix product of %s and %s, expected arrays or matrices", valnames[a.type], valnames[b.type]);
+    if (va.n != vb.m)
+	return spcl_make_err(E_OUT_OF_RANGE, "cannot take the matrix product of a %lux%lu and a %lux%lu matrix", va.m, va.n, vb.m, vb.n);
+    if (a.type == VAL_ARRAY && b.type == VAL_ARRAY)
+	return spcl_make_num( arr_reduce(a.val.a, b.val.a, a.n_els, '+') );
+    spcl_val ret;
+    if (a.type == VAL_ARRAY || b.type == VAL_ARRAY) {
+	ret = alloc_array(va.m*vb.n);
+	gemm(va, vb, ret.val.a);
+    } else {
+	size_t shape[2] = {va.m, vb.n};
+	ret = alloc_tensor(2, shape);
+	gemm(va, vb, ret.val.t->data);
+    }
+    return ret;
+}
+spcl_val spcl_matmul(struct spcl_inst* c, spcl_fn_call f) {
+    if (f.n_args != 2)
+	return spcl_make_err(E_LACK_TOKENS, "matmul() expected 2 arguments, got %lu", f.n_args);
+    spcl_val a = as_numeric(f, 0);
+    if (a.type == VAL_ERR)
+	return a;
+    spcl_val b = as_numeric(f, 1);
+    spcl_val ret = b;
+    if (b.type != VAL_ERR) {
+	ret = matmul_vals(a, b);
+	cleanup_spcl_val(&b);
+    }
+    cleanup_spcl_val(&a);
+    return ret;
+}
+typedef struct lu_fact {
+    double* a;
+    size_t* piv;
+    size_t n;
+    int sign;
+} lu_fact;
+/**
+ * Copy the square matrix in args[0] of f to a contiguous buffer and factor it with lu_factor(). lu->a must be freed by the caller, unless an error is returned.
+ */
+static inline spcl_val lu_arg(spcl_fn_call f, lu_fact* lu) {
+    *lu = (lu_fact){0};
+    spcl_val v = as_numeric(f, 0);
+    if (v.type == VAL_ERR)
+	return v;
+    if (v.type != VAL_MAT || v.val.t->ndim != 2 || v.val.t->shape[0] != v.val.t->shape[1]) {
+	cleanup_spcl_val(&v);
+	return spcl_make_err(E_BAD_TYPE, "%.*s() expected a square matrix", f.name.n, f.name.s);
+    }
+    lu->n = v.n_els;
+    lu->a = xmalloc((sizeof(double) + sizeof(size_t))*lu->n*lu->n);
+    lu->piv = (size_t*)(lu->a + lu->n*lu->n);
+    tensor_gather(v.val.t, lu->a);
+    lu->sign = lu_factor(lu->a, lu->n, lu->piv);
+    cleanup_spcl_val(&v);
+    return spcl_make_none();
+}
+spcl_val spcl_det(struct spcl_inst* c, spcl_fn_call f) {
+    if (f.n_args != 1)
+	return spcl_make_err(E_LACK_TOKENS, "det() expected 1 argument, got %lu", f.n_args);
+    lu_fact lu;
+    spcl_val er = lu_arg(f, &lu);
+    if (er.type == VAL_ERR)
+	return er;
+    double r = lu.sign;
+    for (size_t i = 0; i < lu.n && lu.sign; ++i)
+	r *= lu.a[i*lu.n + i];
+    xfree(lu.a);
+    return spcl_make_num(r);
+}
+spcl_val spcl_inv(struct spcl_inst* c, spcl_fn_call f) {
+    if (f.n_args != 1)
+	return spcl_make_err(E_LACK_TOKENS, "inv() expected 1 argument, got %lu", f.n_args);
+    lu_fact lu;
+    spcl_val ret = lu_arg(f, &lu);
+    if (ret.type == VAL_ERR)
+	return ret;
+    if (lu.sign == 0) {
+	xfree(lu.a);
+	return spcl_make_err(E_BAD_VALUE, "inv() of a singular matrix");
+    }
+    //solve for each column of the identity
+    size_t shape[2] = {lu.n, lu.n};
+    ret = alloc_tensor(2, shape);
+    double* x = ret.val.t->data;
+    memset(x, 0, sizeof(double)*lu.n*lu.n);
+    for (size_t i = 0; i < lu.n; ++i)
+	x[i*lu.n + i] = 1;
+    lu_solve(lu.a, lu.n, lu.piv, x, lu.n);
+    xfree(lu.a);
+    return ret;
+}
+spcl_val spcl_solve(struct spcl_inst* c, spcl_fn_call f) {
+    if (f.n_args != 2)
+	return spcl_make_err(E_LACK_TOKENS, "solve() expected 2 arguments, got %lu", f.n_args);
+    spcl_val b = as_numeric(f, 1);
+    if (b.type == VAL_ERR)
+	return b;
+    lu_fact lu;
+    spcl_val ret = lu_arg(f, &lu);
+    if (ret.type == VAL_ERR) {
+	cleanup_spcl_val(&b);
+	return ret;
+    }
+    if ((b.type != VAL_ARRAY && (b.type != VAL_MAT || b.val.t->ndim != 2)) || b.n_els != lu.n) {
+	ret = spcl_make_err(E_OUT_OF_RANGE, "solve() expected an array or matrix with %lu rows", lu.n);
+    } else if (lu.sign == 0) {
+	ret = spcl_make_err(E_BAD_VALUE, "solve() with a singular matrix");
+    } else {
+	//the solution overwrites a contiguous copy of b
+	ret = b;
+	b = spcl_make_none();
+	make_contiguous(&ret);
+	if (ret.type == VAL_ARRAY)
+	    lu_solve(lu.a, lu.n, lu.piv, ret.val.a, 1);
+	else
+	    lu_solve(lu.a, lu.n, lu.piv, ret.val.t->data, ret.val.t->shape[1]);
+    }
+    xfree(lu.a);
+    cleanup_spcl_val(&b);
+    return ret;
+}
+typedef enum { PAD_NONE, PAD_ZERO, PAD_WRAP, PAD_EDGE } pad_mode;
+/**
+ * A stencil applied along the last axis of an array or tensor. Each row is padded with pad_l elements on the left and pad_r elements on the right, then output j of the row is sum_t coeffs[t]*row[j + offs[t]] for each j < n_out.
+ */
+typedef struct stencil_plan {
+    double* coeffs;
+    size_t* offs;
+    size_t n_taps;
+    size_t pad_l;
+    size_t pad_r;
+    pad_mode pad;
+    size_t n_out;
+} stencil_plan;
+//allocate the coefficients and offsets of a plan with n_taps taps
+static inline void make_stencil_plan(stencil_plan* p, size_t n_taps) {
+    *p = (stencil_plan){0};
+    p->n_taps = n_taps;
+    p->coeffs = xmalloc((sizeof(double) + sizeof(size_t))*n_taps + 1);
+    p->offs = (size_t*)(p->coeffs + n_taps);
+}
+/**
+ * Copy the row x[n] with stride s to xp[pad_l + n + pad_r], filling in the padding on either side.
+ */
+static inline void pad_row(const stencil_plan* p, const double* x, size_t n, psize s, double* xp) {
+    double* row = xp + p->pad_l;
+    for (size_t i = 0; i < n; ++i)
+	row[i] = x[(psize)i*s];
+    for (size_t i = 0; i < p->pad_l + p->pad_r; ++i) {
+	//the index of the padded element relative to the start of the row
+	long q = (i < p->pad_l)? (long)i - (long)p->pad_l : (long)(n + i - p->pad_l);
+	double* dst = row + q;
+	if (n == 0 || p->pad == PAD_ZERO)
+	    *dst = 0;
+	else if (p->pad == PAD_WRAP)
+	    *dst = row[(q % (long)n + (long)n) % (long)n];
+	else
+	    *dst = (q < 0)? row[0] : row[n-1];
+    }
+}
+/**
+ * Apply the stencil p along the last axis of the array or tensor v. Rows are only copied if they are strided or have to be padded.
+ */
+static inline spcl_val stencil_val(const spcl_val* v, const stencil_plan* p) {
+    const spcl_tensor* t = (v->type == VAL_MAT)? v->val.t : NULL;
+    size_t n = (t)? t->shape[t->ndim-1] : v->n_els;
+    size_t rows = (t)? tensor_rows(t) : 1;
+    psize s = (t)? t->strides[t->ndim-1] : 1;
+    spcl_val ret;
+    if (t) {
+	size_t* shape = xmalloc(sizeof(size_t)*t->ndim);
+	memcpy(shape, t->shape, sizeof(size_t)*t->ndim);
+	shape[t->ndim-1] = p->n_out;
+	ret = alloc_tensor(t->ndim, shape);
+	xfree(shape);
+    } else {
+	ret = alloc_array(p->n_out);
+    }
+    double* y = (t)? ret.val.t->data : ret.val.a;
+    double* xp = (s != 1 || p->pad != PAD_NONE)? xmalloc(sizeof(double)*(p->pad_l + n + p->pad_r) + 1) : NULL;
+    for (size_t k = 0; k < rows; ++k) {
+	const double* x = (t)? tensor_row(t, k) : v->val.a;
+	if (xp) {
+	    pad_row(p, x, n, s, xp);
+	    x = xp;
+	}
+	arr_stencil(y + k*p->n_out, x, p->n_out, p->coeffs, p->offs, p->n_taps);
+    }
+    xfree(xp);
+    return ret;
+}
+/**
+ * Get args[i] of f as an array or tensor, converting lists
+ */
+static inline spcl_val stencil_arg(spcl_fn_call f, size_t i) {
+    spcl_val v = as_numeric(f, i);
+    if (v.type == VAL_NUM) {
+	cleanup_spcl_val(&v);
+	return spcl_make_err(E_BAD_TYPE, "%.*s() expected args[%lu].type=array or tensor, got numeric", f.name.n, f.name.s, i);
+    }
+    return v;
+}
+spcl_val spcl_diff(struct spcl_inst* c, spcl_fn_call f) {
+    static const valtype DIFF_SIG[] = {VAL_UNDEF, VAL_NUM};
+    spcl_sigcheck_opts(f, 1, DIFF_SIG);
+    double order = (f.n_args > 1)? f.args[1].val.x : 1;
+    if (order < 0 || order != floor(order))
+	return spcl_make_err(E_BAD_VALUE, "diff() expected a non-negative integer order, got %g", order);
+    spcl_val v = stencil_arg(f, 0);
+    if (v.type == VAL_ERR)
+	return v;
+    //the differences of order m are a single stencil with binomial coefficients of alternating sign
+    size_t m = (size_t)order;
+    size_t n = (v.type == VAL_MAT)? v.val.t->shape[v.val.t->ndim-1] : v.n_els;
+    if (m > n)
+	m = n;
+    stencil_plan p;
+    make_stencil_plan(&p, m+1);
+    double binom = 1;
+    for (size_t k = 0; k <= m; ++k) {
+	p.coeffs[k] = ((m-k) % 2)? -binom : binom;
+	p.offs[k] = k;
+	binom = binom*(m-k)/(k+1);
+    }
+    p.n_out = n - m;
+    spcl_val ret = stencil_val(&v, &p);
+    xfree(p.coeffs);
+    cleanup_spcl_val(&v);
+    return ret;
+}
+spcl_val spcl_stencil(struct spcl_inst* c, spcl_fn_call f) {
+    static const valtype STENCIL_SIG[] = {VAL_UNDEF, VAL_UNDEF, VAL_UNDEF, VAL_STR};
+    spcl_sigcheck_opts(f, 3, STENCIL_SIG);
+    pad_mode pad = PAD_NONE;
+    if (f.n_args > 3) {
+	const char* mode = f.args[3].val.s;
+	if (strcmp(mode, "same") == 0)
+	    pad = PAD_ZERO;
+	else if (strcmp(mode, "wrap") == 0)
+	    pad = PAD_WRAP;
+	else if (strcmp(mode, "edge") == 0)
+	    pad = PAD_EDGE;
+	else if (strcmp(mode, "valid") != 0)
+	    return spcl_make_err(E_BAD_VALUE, "stencil() mode must be \"valid\", \"same\", \"wrap\" or \"edge\", got \"%s\"", mode);
+    }
+    spcl_val coeffs = spcl_cast(f.args[1], VAL_ARRAY);
+    spcl_val offs = spcl_cast(f.args[2], VAL_ARRAY);
+    spcl_val ret = spcl_make_none();
+    if (coeffs.type != VAL_ARRAY || offs.type != VAL_ARRAY) {
+	ret = spcl_make_err(E_BAD_TYPE, "stencil() expected arrays of coefficients and offsets");
+    } else if (coeffs.n_els != offs.n_els || coeffs.n_els == 0) {
+	ret = spcl_make_err(E_BAD_VALUE, "stencil() expected the same nonzero number of coefficients and offsets, got %lu and %lu", coeffs.n_els, offs.n_els);
+    } else {
+	//output i is centred on input i, so the range of taps always includes zero
+	double lo = 0, hi = 0;
+	for (size_t k = 0; k < offs.n_els && ret.type != VAL_ERR; ++k) {
+	    if (offs.val.a[k] != floor(offs.val.a[k]))
+		ret = spcl_make_err(E_BAD_VALUE, "stencil() offsets must be integers, got %g", offs.val.a[k]);
+	    lo = (offs.val.a[k] < lo)? offs.val.a[k] : lo;
+	    hi = (offs.val.a[k] > hi)? offs.val.a[k] : hi;
+	}
+	if (ret.type != VAL_ERR)
+	    ret = stencil_arg(f, 0);
+	if (ret.type != VAL_ERR) {
+	    spcl_val v = ret;
+	    size_t n = (v.type == VAL_MAT)? v.val.t->shape[v.val.t->ndim-1] : v.n_els;
+	    stencil_plan p;
+	    make_stencil_plan(&p, coeffs.n_els);
+	    p.pad = pad;
+	    if (pad == PAD_NONE) {
+		//only outputs for which every tap is inside the input are kept
+		p.n_out = (hi - lo < n)? n - (size_t)(hi - lo) : 0;
+	    } else {
+		//output i is centered on input i
+		p.pad_l = (lo < 0)? (size_t)-lo : 0;
+		p.pad_r = (hi > 0)? (size_t)hi : 0;
+		p.n_out = n;
+	    }
+	    for (size_t k = 0; k < p.n_taps; ++k) {
+		p.coeffs[k] = coeffs.val.a[k];
+		p.offs[k] = (pad == PAD_NONE)? (size_t)(offs.val.a[k] - lo) : (size_t)(offs.val.a[k] + p.pad_l);
+	    }
+	    ret = stencil_val(&v, &p);
+	    xfree(p.coeffs);
+	    cleanup_spcl_val(&v);
+	}
+    }
+    cleanup_spcl_val(&coeffs);
+    cleanup_spcl_val(&offs);
+    return ret;
+}
+spcl_val spcl_convolve(struct spcl_inst* c, spcl_fn_call f) {
+    static const valtype CONVOLVE_SIG[] = {VAL_UNDEF, VAL_UNDEF, VAL_STR};
+    spcl_sigcheck_opts(f, 2, CONVOLVE_SIG);
+    const char* mode = (f.n_args > 2)? f.args[2].val.s : "full";
+    if (strcmp(mode, "full") && strcmp(mode, "same") && strcmp(mode, "valid"))
+	return spcl_make_err(E_BAD_VALUE, "convolve() mode must be \"full\", \"same\" or \"valid\", got \"%s\"", mode);
+    spcl_val a = as_numeric(f, 0);
+    if (a.type == VAL_ERR)
+	return a;
+    spcl_val v = as_numeric(f, 1);
+    spcl_val ret = v;
+    if (v.type != VAL_ERR) {
+	if (a.type != VAL_ARRAY || v.type != VAL_ARRAY) {
+	    ret = spcl_make_err(E_BAD_TYPE, "convolve() expected arrays, got %s and %s", valnames[a.type], valnames[v.type]);
+	} else if (a.n_els == 0 || v.n_els == 0) {
+	    ret = spcl_make_err(E_BAD_VALUE, "convolve() of an empty array");
+	} else {
+	    //convolution is commutative, so the longer array is always the signal
+	    if (v.n_els > a.n_els) {
+		spcl_val tmp = a;
+		a = v;
+		v = tmp;
+	    }
+	    //the full convolution is the stencil sum_t v[t]*a[j-t] over a padded with v.n_els-1 zeros on either side
+	    size_t n = a.n_els, k = v.n_els;
+	    size_t start = 0;
+	    stencil_plan p;
+	    make_stencil_plan(&p, k);
+	    p.pad = PAD_ZERO;
+	    p.pad_l = p.pad_r = k-1;
+	    p.n_out = n+k-1;
+	    if (mode[0] == 's') {
+		start = (k-1)/2;
+		p.n_out = n;
+	    } else if (mode[0] == 'v') {
+		start = k-1;
+		p.n_out = n-k+1;
+	    }
+	    for (size_t t = 0; t < k; ++t) {
+		p.coeffs[t] = v.val.a[t];
+		p.offs[t] = start + k-1-t;
+	    }
+	    ret = stencil_val(&a, &p);
+	    xfree(p.coeffs);
+	}
+	cleanup_spcl_val(&v);
+    }
+    cleanup_spcl_val(&a);
+    return ret;
+}
+/**
+ * Read args[0] of f as a complex sequence of length n. Real and complex arrays are accepted, as well as tensors with shape (n, 2) which hold the real and imaginary parts of each element. The parts are copied to re and im, which share a single allocation that must be freed with xfree(*re).
+ */
+static inline spcl_val fft_arg(spcl_fn_call f, double** re, double** im, size_t* n) {
+    spcl_val v = (f.args[0].type == VAL_CARRAY)? copy_spcl_val(f.args[0]) : as_numeric(f, 0);
+    if (v.type == VAL_ERR)
+	return v;
+    spcl_val ret = spcl_make_none();
+    if (v.type == VAL_ARRAY || v.type == VAL_CARRAY) {
+	*n = v.n_els;
+    } else if (v.type == VAL_MAT && v.val.t->ndim == 2 && v.val.t->shape[1] == 2) {
+	*n = v.val.t->shape[0];
+    } else {
+	cleanup_spcl_val(&v);
+	return spcl_make_err(E_BAD_TYPE, "%.*s() expected a real or complex array, got %s", f.name.n, f.name.s, valnames[v.type]);
+    }
+    if (*n == 0) {
+	ret = spcl_make_err(E_BAD_VALUE, "%.*s() of an empty sequence", f.name.n, f.name.s);
+    } else {
+	*re = xmalloc(sizeof(double)*2*(*n));
+	*im = *re + *n;
+	if (v.type == VAL_ARRAY) {
+	    memcpy(*re, v.val.a, sizeof(double)*(*n));
+	    memset(*im, 0, sizeof(double)*(*n));
+	} else if (v.type == VAL_CARRAY) {
+	    for (size_t k = 0; k < *n; ++k) {
+		(*re)[k] = v.val.a[2*k];
+		(*im)[k] = v.val.a[2*k+1];
+	    }
+	} else {
+	    const spcl_tensor* t = v.val.t;
+	    for (size_t k = 0; k < *n; ++k) {
+		(*re)[k] = t->data[(psize)k*t->strides[0]];
+		(*im)[k] = t->data[(psize)k*t->strides[0] + t->strides[1]];
+	    }
+	}
+    }
+    cleanup_spcl_val(&v);
+    return ret;
+}
+//interleave the real and imaginary parts re[n] and im[n] into a complex array
+static inline spcl_val join_complex(const double* re, const double* im, size_t n) {
+    spcl_val ret = alloc_carray(n);
+    for (size_t k = 0; k < n; ++k) {
+	ret.val.a[2*k] = re[k];
+	ret.val.a[2*k+1] = im[k];
+    }
+    return ret;
+}
+static inline spcl_val fft_call(spcl_fn_call f, int inverse) {
+    if (f.n_args != 1)
+	return spcl_make_err(E_LACK_TOKENS, "%.*s() expected 1 argument, got %lu", f.name.n, f.name.s, f.n_args);
+    double *re = NULL, *im = NULL;
+    size_t n = 0;
+    spcl_val ret = fft_arg(f, &re, &im, &n);
+    if (ret.type == VAL_ERR)
+	return ret;
+    fft_exec(get_fft_plan(n), re, im, inverse);
+    //re and im are contiguous, so they can be normalized together
+    if (inverse)
+	arr_op_scalar(re, n, 2*n, '/');
+    ret = join_complex(re, im, n);
+    xfree(re);
+    return ret;
+}
+spcl_val spcl_fft(struct spcl_inst* c, spcl_fn_call f) {
+    return fft_call(f, 0);
+}
+spcl_val spcl_ifft(struct spcl_inst* c, spcl_fn_call f) {
+    return fft_call(f, 1);
+}
+spcl_val spcl_rfft(struct spcl_inst* c, spcl_fn_call f) {
+    if (f.n_args != 1)
+	return spcl_make_err(E_LACK_TOKENS, "rfft() expected 1 argument, got %lu", f.n_args);
+    spcl_val v = as_numeric(f, 0);
+    if (v.type == VAL_ERR)
+	return v;
+    spcl_val ret;
+    if (v.type != VAL_ARRAY) {
+	ret = spcl_make_err(E_BAD_TYPE, "rfft() expected a real array, got %s", valnames[v.type]);
+    } else if (v.n_els == 0) {
+	ret = spcl_make_err(E_BAD_VALUE, "rfft() of an empty sequence");
+    } else {
+	size_t n = v.n_els;
+	double* re = xmalloc(sizeof(double)*2*n);
+	double* im = re + n;
+	if (n % 2 == 0) {
+	    rfft_exec(v.val.a, n, re, im);
+	} else {
+	    memcpy(re, v.val.a, sizeof(double)*n);
+	    memset(im, 0, sizeof(double)*n);
+	    fft_exec(get_fft_plan(n), re, im, 0);
+	}
+	ret = join_complex(re, im, n/2 + 1);
+	xfree(re);
+    }
+    cleanup_spcl_val(&v);
+    return ret;
+}
+/**
+ * Sorting. Numbers are mapped to unsigned keys with the same order (and NaNs last), so that every element type can share one stable LSD radix sort. Blocks of SORT_BLOCK keys are sorted separately, on several threads for large inputs, and then merged pairwise.
+ */
+#define SORT_BLOCK	(1 << 16)
+//insertion sort beats counting digits for very short blocks
+#define SORT_SMALL	32
+#define KEY_SIGN	(1ull << 63)
+//-0 and 0 compare equal, so they share a key (and are sorted as 0). Otherwise searchsorted() would place 0 after -0, unlike unique() and the comparison operators.
+static inline unsigned long long dbl_key(double x) {
+    if (x != x)
+	x = NAN;
+    else if (x == 0)
+	x = 0;
+    unsigned long long b;
+    memcpy(&b, &x, sizeof(b));
+    return (b & KEY_SIGN)? ~b : b | KEY_SIGN;
+}
+static inline double key_dbl(unsigned long long k) {
+    k = (k & KEY_SIGN)? k & ~KEY_SIGN : ~k;
+    double x;
+    memcpy(&x, &k, sizeof(x));
+    return x;
+}
+static inline unsigned long long int_key(long long i) {
+    return (unsigned long long)i ^ KEY_SIGN;
+}
+static inline long long key_int(unsigned long long k) {
+    return (long long)(k ^ KEY_SIGN);
+}
+/**
+ * Stably sort the n keys k, and move the indices idx along with them if idx is not NULL. tk and tidx are scratch space of the same size.
+ */
+static void radix_sort(unsigned long long* k, size_t* idx, unsigned long long* tk, size_t* tidx, size_t n) {
+    if (n < SORT_SMALL) {
+	for (size_t i = 1; i < n; ++i) {
+	    unsigned long long key = k[i];
+	    size_t id = (idx)? idx[i] : 0;
+	    size_t j = i;
+	    for (; j > 0 && k[j-1] > key; --j) {
+		k[j] = k[j-1];
+		if (idx)
+		    idx[j] = idx[j-1];
+	    }
+	    k[j] = key;
+	    if (idx)
+		idx[j] = id;
+	}
+	return;
+    }
+    size_t counts[8][256];
+    memset(counts, 0, sizeof(counts));
+    for (size_t i = 0; i < n; ++i) {
+	for (int b = 0; b < 8; ++b)
+	    ++counts[b][(k[i] >> 8*b) & 0xff];
+    }
+    unsigned long long *src = k, *dst = tk, *swp;
+    size_t *src_i = idx, *dst_i = tidx, *swp_i;
+    for (int b = 0; b < 8; ++b) {
+	//skip digits that are the same for every key, e.g. the high bytes of small integers
+	if (counts[b][(src[0] >> 8*b) & 0xff] == n)
+	    continue;
+	size_t off = 0;
+	for (int d = 0; d < 256; ++d) {
+	    size_t cnt = counts[b][d];
+	    counts[b][d] = off;
+	    off += cnt;
+	}
+	for (size_t i = 0; i < n; ++i) {
+	    size_t j = counts[b][(src[i] >> 8*b) & 0xff]++;
+	    dst[j] = src[i];
+	    if (idx)
+		dst_i[j] = src_i[i];
+	}
+	swp = src; src = dst; dst = swp;
+	swp_i = src_i; src_i = dst_i; dst_i = swp_i;
+    }
+    if (src != k) {
+	memcpy(k, src, sizeof(*k)*n);
+	if (idx)
+	    memcpy(idx, src_i, sizeof(*idx)*n);
+    }
+}
+typedef struct sort_job {
+    unsigned long long* k;
+    size_t* idx;
+    unsigned long long* tk;
+    size_t* tidx;
+    size_t n;
+    size_t w;
+} sort_job;
+//sort each block which starts in [start, end). Every block starts in exactly one range passed by par_for(), so each is sorted by a single thread.
+static void sort_blocks(void* arg, size_t start, size_t end) {
+    sort_job* job = arg;
+    for (size_t i = (start + SORT_BLOCK-1) / SORT_BLOCK * SORT_BLOCK; i < end; i += SORT_BLOCK) {
+	size_t m = (job->n - i < SORT_BLOCK)? job->n - i : SORT_BLOCK;
+	radix_sort(job->k+i, (job->idx)? job->idx+i : NULL, job->tk+i, (job->idx)? job->tidx+i : NULL, m);
+    }
+}
+//merge each pair of sorted runs of length w in k into tk if the pair starts in [start, end)
+static void merge_runs(void* arg, size_t start, size_t end) {
+    sort_job* job = arg;
+    size_t w2 = 2*job->w;
+    for (size_t i = (start + w2-1) / w2 * w2; i < end; i += w2) {
+	size_t mid = (job->n - i < job->w)? job->n : i + job->w;
+	size_t hi = (job->n - i < w2)? job->n : i + w2;
+	size_t a = i, b = mid;
+	for (size_t j = i; j < hi; ++j) {
+	    size_t s = (b >= hi || (a < mid && job->k[a] <= job->k[b]))? a++ : b++;
+	    job->tk[j] = job->k[s];
+	    if (job->idx)
+		job->tidx[j] = job->idx[s];
+	}
+    }
+}
+/**
+ * Stably sort the n keys k, and move the indices idx along with them if idx is not NULL.
+ */
+static void sort_keys(unsigned long long* k, size_t* idx, size_t n) {
+    unsigned long long* tk = xmalloc(sizeof(*tk)*n + 1);
+    size_t* tidx = (idx)? xmalloc(sizeof(*tidx)*n + 1) : NULL;
+    sort_job job = {k, idx, tk, tidx, n, SORT_BLOCK};
+    par_for(n, sort_blocks, &job);
+    for (; job.w < n; job.w *= 2) {
+	par_for(n, merge_runs, &job);
+	unsigned long long* swp = job.k;
+	job.k = job.tk;
+	job.tk = swp;
+	size_t* swp_i = job.idx;
+	job.idx = job.tidx;
+	job.tidx = swp_i;
+    }
+    if (job.k != k) {
+	memcpy(k, job.k, sizeof(*k)*n);
+	if (idx)
+	    memcpy(idx, job.idx, sizeof(*idx)*n);
+    }
+    xfree(tk);
+    xfree(tidx);
+}
+//check whether v is a real array or a list of numbers, in which case int_keys is set to whether every element is an integer
+static inline int sort_numeric(const spcl_val* v, int* int_keys) {
+    if (is_real_arr(v->type)) {
+	*int_keys = is_int_dtype(v->type);
+	return 1;
+    }
+    if (v->type != VAL_LIST)
+	return 0;
+    *int_keys = 1;
+    for (size_t i = 0; i < v->n_els; ++i) {
+	if (v->val.l[i].type == VAL_NUM)
+	    *int_keys = 0;
+	else if (v->val.l[i].type != VAL_INT)
+	    return 0;
+    }
+    return 1;
+}
+//get the key of element i of the real array or numeric list v
+static inline unsigned long long sort_key(const spcl_val* v, size_t i, int int_keys) {
+    if (v->type == VAL_LIST)
+	return (int_keys)? int_key(v->val.l[i].val.i) : dbl_key(val_to_x(v->val.l+i));
+    return (int_keys)? int_key(arr_geti(v, i)) : dbl_key(arr_get(v, i));
+}
+/**
+ * Stably sort the indices idx of the elements in the list l by comparing them with spcl_valcmp(). An error is returned if two elements can't be compared.
+ */
+static spcl_val sort_list_idx(const spcl_val* l, size_t* idx, size_t n) {
+    size_t* tmp = xmalloc(sizeof(size_t)*n + 1);
+    for (size_t w = 1; w < n; w *= 2) {
+	for (size_t i = 0; i < n; i += 2*w) {
+	    size_t mid = (n - i < w)? n : i + w;
+	    size_t hi = (n - i < 2*w)? n : i + 2*w;
+	    size_t a = i, b = mid;
+	    for (size_t j = i; j < hi; ++j) {
+		int take_a = (b >= hi);
+		if (!take_a && a < mid) {
+		    spcl_val cmp = spcl_valcmp(l[idx[a]], l[idx[b]]);
+		    if (cmp.type == VAL_ERR) {
+			xfree(tmp);
+			return cmp;
+		    }
+		    take_a = (cmp.val.x <= 0);
+		}
+		tmp[j] = (take_a)? idx[a++] : idx[b++];
+	    }
+	}
+	memcpy(idx, tmp, sizeof(size_t)*n);
+    }
+    xfree(tmp);
+    return spcl_make_none();
+}
+/**
+ * Sort the array or list v. If v is numeric, then its sorted keys are saved to keys, otherwise keys is set to NULL. If perm is not NULL, then the permutation which sorts v is saved to it. perm must be passed if v is a list which isn't numeric.
+ */
+static spcl_val sort_perm(const spcl_val* v, unsigned long long** keys, size_t** perm, int* int_keys) {
+    size_t n = v->n_els;
+    *keys = NULL;
+    if (perm) {
+	*perm = xmalloc(sizeof(size_t)*n + 1);
+	for (size_t i = 0; i < n; ++i)
+	    (*perm)[i] = i;
+    }
+    if (!sort_numeric(v, int_keys))
+	return sort_list_idx(v->val.l, *perm, n);
+    *keys = xmalloc(sizeof(**keys)*n + 1);
+    for (size_t i = 0; i < n; ++i)
+	(*keys)[i] = sort_key(v, i, *int_keys);
+    sort_keys(*keys, (perm)? *perm : NULL, n);
+    return spcl_make_none();
+}
+//get the array with element type t that holds the n sorted keys
+static inline spcl_val keys_to_arr(const unsigned long long* keys, size_t n, valtype t, int int_keys) {
+    spcl_val ret = alloc_typed(n, t);
+    for (size_t i = 0; i < n; ++i) {
+	if (int_keys)
+	    arr_seti(&ret, i, key_int(keys[i]));
+	else
+	    arr_setx(&ret, i, key_dbl(keys[i]));
+    }
+    return ret;
+}
+//get a list with copies of the elements l[perm[0]], l[perm[1]], ...
+static inline spcl_val permute_list(const spcl_val* l, const size_t* perm, size_t n) {
+    spcl_val* els = xmalloc(sizeof(spcl_val)*n + 1);
+    for (size_t i = 0; i < n; ++i)
+	els[i] = l[perm[i]];
+    spcl_val ret = spcl_make_list(els, n);
+    xfree(els);
+    return ret;
+}
+static inline spcl_val check_sortable(spcl_fn_call f) {
+    spcl_sigcheck(f, ANY1_SIG);
+    if (!is_real_arr(f.args[0].type) && f.args[0].type != VAL_LIST)
+	return spcl_make_err(E_BAD_TYPE, "%.*s() expected args[0].type=array or list, got %s", f.name.n, f.name.s, valnames[f.args[0].type]);
+    return spcl_make_none();
+}
+spcl_val spcl_sort(struct spcl_inst* c, spcl_fn_call f) {
+    spcl_val ret = check_sortable(f);
+    if (ret.type == VAL_ERR)
+	return ret;
+    const spcl_val* v = f.args;
+    unsigned long long* keys;
+    size_t* perm = NULL;
+    int int_keys;
+    ret = sort_perm(v, &keys, (v->type == VAL_LIST)? &perm : NULL, &int_keys);
+    if (ret.type != VAL_ERR)
+	ret = (v->type == VAL_LIST)? permute_list(v->val.l, perm, v->n_els) : keys_to_arr(keys, v->n_els, v->type, int_keys);
+    xfree(keys);
+    xfree(perm);
+    return ret;
+}
+spcl_val spcl_argsort(struct spcl_inst* c, spcl_fn_call f) {
+    spcl_val ret = check_sortable(f);
+    if (ret.type == VAL_ERR)
+	return ret;
+    unsigned long long* keys;
+    size_t* perm;
+    int int_keys;
+    ret = sort_perm(f.args, &keys, &perm, &int_keys);
+    if (ret.type != VAL_ERR) {
+	ret = alloc_iarray(f.args[0].n_els);
+	for (size_t i = 0; i < ret.n_els; ++i)
+	    ret.val.ia[i] = perm[i];
+    }
+    xfree(keys);
+    xfree(perm);
+    return ret;
+}
+spcl_val spcl_unique(struct spcl_inst* c, spcl_fn_call f) {
+    spcl_val ret = check_sortable(f);
+    if (ret.type == VAL_ERR)
+	return ret;
+    const spcl_val* v = f.args;
+    unsigned long long* keys;
+    size_t* perm = NULL;
+    int int_keys;
+    ret = sort_perm(v, &keys, (v->type == VAL_LIST)? &perm : NULL, &int_keys);
+    if (ret.type != VAL_ERR) {
+	//keep the first of each run of equal elements. Equal numbers always share a key, while NaNs all share one key.
+	size_t m = 0;
+	for (size_t i = 0; i < v->n_els; ++i) {
+	    if (m > 0 && ((keys)? keys[i] == keys[m-1] : spcl_valcmp(v->val.l[perm[i]], v->val.l[perm[m-1]]).val.x == 0))
+		continue;
+	    if (keys)
+		keys[m] = keys[i];
+	    if (perm)
+		perm[m] = perm[i];
+	    ++m;
+	}
+	ret = (v->type == VAL_LIST)? permute_list(v->val.l, perm, m) : keys_to_arr(keys, m, v->type, int_keys);
+    }
+    xfree(keys);
+    xfree(perm);
+    return ret;
+}
+typedef struct search_job {
+    const spcl_val* a;
+    const spcl_val* v;
+    long long* out;
+    int int_keys;
+    int right;
+} search_job;
+//find the number of keys in the sorted array or numeric list a which are less than k, or not greater than k if right is set
+static inline size_t search_key(const spcl_val* a, unsigned long long k, int int_keys, int right) {
+    size_t lo = 0, hi = a->n_els;
+    while (lo < hi) {
+	size_t mid = lo + (hi - lo)/2;
+	unsigned long long ka = sort_key(a, mid, int_keys);
+	if ((right)? ka <= k : ka < k)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+static void search_range(void* arg, size_t start, size_t end) {
+    search_job* job = arg;
+    for (size_t i = start; i < end; ++i)
+	job->out[i] = search_key(job->a, sort_key(job->v, i, job->int_keys), job->int_keys, job->right);
+}
+//the same as search_key() for lists of values that are compared with spcl_valcmp(). The index is saved to pos.
+static inline spcl_val search_val(const spcl_val* a, spcl_val v, int right, size_t* pos) {
+    size_t lo = 0, hi = a->n_els;
+    while (lo < hi) {
+	size_t mid = lo + (hi - lo)/2;
+	spcl_val cmp = spcl_valcmp(a->val.l[mid], v);
+	if (cmp.type == VAL_ERR)
+	    return cmp;
+	if ((right)? cmp.val.x <= 0 : cmp.val.x < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    *pos = lo;
+    return spcl_make_none();
+}
+spcl_val spcl_searchsorted(struct spcl_inst* c, spcl_fn_call f) {
+    static const valtype SEARCHSORTED_SIG[] = {VAL_UNDEF, VAL_UNDEF, VAL_STR};
+    spcl_sigcheck_opts(f, 2, SEARCHSORTED_SIG);
+    const spcl_val* a = f.args;
+    const spcl_val* v = f.args+1;
+    if (!is_real_arr(a->type) && a->type != VAL_LIST)
+	return spcl_make_err(E_BAD_TYPE, "searchsorted() expected args[0].type=array or list, got %s", valnames[a->type]);
+    int right = 0;
+    if (f.n_args > 2) {
+	right = (strcmp(f.args[2].val.s, "right") == 0);
+	if (!right && strcmp(f.args[2].val.s, "left"))
+	    return spcl_make_err(E_BAD_VALUE, "searchsorted() expected side \"left\" or \"right\", got %s", f.args[2].val.s);
+    }
+    int many = (is_real_arr(v->type) || v->type == VAL_LIST);
+    int a_int, v_int = is_int(v->type);
+    if (sort_numeric(a, &a_int) && (v->type == VAL_NUM || v->type == VAL_INT || sort_numeric(v, &v_int))) {
+	int int_keys = a_int && v_int;
+	if (!many)
+	    return spcl_make_int(search_key(a, (int_keys)? int_key(v->val.i) : dbl_key(val_to_x(v)), int_keys, right));
+	spcl_val ret = alloc_iarray(v->n_els);
+	search_job job = {a, v, ret.val.ia, int_keys, right};
+	par_for(v->n_els, search_range, &job);
+	return ret;
+    }
+    //values that aren't numbers (e.g. strings) must be looked up in a sorted list with spcl_valcmp()
+    if (a->type != VAL_LIST)
+	return spcl_make_err(E_BAD_TYPE, "cannot compare types %s and %s", valnames[a->type], valnames[v->type]);
+    size_t pos;
+    if (!many || v->type != VAL_LIST) {
+	spcl_val err = search_val(a, *v, right, &pos);
+	return (err.type == VAL_ERR)? err : spcl_make_int(pos);
+    }
+    spcl_val ret = alloc_iarray(v->n_els);
+    for (size_t i = 0; i < v->n_els; ++i) {
+	spcl_val err = search_val(a, v->val.l[i], right, &pos);
+	if (err.type == VAL_ERR) {
+	    cleanup_spcl_val(&ret);
+	    return err;
+	}
+	ret.val.ia[i] = pos;
+    }
+    return ret;
+}
+/**
+ * Lookup tables. The interval of the grid xp which holds each query point is found with index arithmetic if xp is uniform. Otherwise a binary search is used, but the interval of the previous query is tried first since queries are usually sorted or clustered.
+ */
+//grids whose points are within this fraction of the span of a uniform grid are treated as uniform
+#define GRID_UNIFORM_TOL	1e-12
+typedef struct interp_grid {
+    const double* xp;
+    size_t n;
+    //the spacing of a uniform grid or zero
+    double h;
+} interp_grid;
+//set up the grid xp[n]. Returns an error if xp isn't strictly increasing.
+static inline spcl_val make_grid(interp_grid* g, const double* xp, size_t n, const char* name) {
+    g->xp = xp;
+    g->n = n;
+    g->h = 0;
+    if (n == 0)
+	return spcl_make_err(E_BAD_VALUE, "%s() got an empty grid", name);
+    int uniform = (n > 1);
+    double h = (n > 1)? (xp[n-1] - xp[0])/(n-1) : 0;
+    for (size_t i = 1; i < n; ++i) {
+	if (!(xp[i] > xp[i-1]))
+	    return spcl_make_err(E_BAD_VALUE, "%s() expected a strictly increasing grid, got %g after %g", name, xp[i], xp[i-1]);
+	uniform = uniform && fabs(xp[i] - (xp[0] + i*h)) <= GRID_UNIFORM_TOL*(xp[n-1] - xp[0]);
+    }
+    if (uniform)
+	g->h = h;
     return spcl_make_none();
 }
-static const valtype ANY1_SIG[] = {VAL_UNDEF};
-static const valtype NUM1_SIG[] = {VAL_NUM};
-static const valtype ARR1_SIG[] = {VAL_ARRAY};
-spcl_val spcl_assert(struct spcl_inst*c, spcl_fn_call f) {
-    static const valtype ASSERT_SIG[] = {VAL_UNDEF, VAL_STR};
-    spcl_sigcheck_opts(f, 1, ASSERT_SIG);
-    if (f.args[0].val.x == 0)
-	return (f.n_args == 1)? spcl_make_err(E_ASSERT, "") : spcl_make_err(E_ASSERT, "%s", f.args[1].val.s);
-    return spcl_make_num(f.args[0].val.x);
+//find the interval i < n-1 of a grid with at least two points such that xp[i] <= x < xp[i+1], clamping to the first and last intervals
+static inline size_t grid_find(const interp_grid* g, double x, size_t hint) {
+    const double* xp = g->xp;
+    size_t n = g->n;
+    if (g->h > 0) {
+	double t = (x - xp[0])/g->h;
+	size_t i = (t > 0)? ((t < n-2)? (size_t)t : n-2) : 0;
+	//the rounded index may be off by one from the actual grid points
+	if (i > 0 && x < xp[i])
+	    --i;
+	else if (i+2 < n && x >= xp[i+1])
+	    ++i;
+	return i;
+    }
+    if (hint+1 < n && xp[hint] <= x && x < xp[hint+1])
+	return hint;
+    if (hint+2 < n && xp[hint+1] <= x && x < xp[hint+2])
+	return hint+1;
+    size_t lo = 0, hi = n-1;
+    while (hi - lo > 1) {
+	size_t mid = lo + (hi - lo)/2;
+	if (xp[mid] <= x)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+    return lo;
 }
-spcl_val spcl_typeof(struct spcl_inst* c, spcl_fn_call f) {
-    spcl_sigcheck(f, ANY1_SIG);
-    spcl_val sto;
-    sto.type = VAL_STR;
-    //handle instances as a special case
-    if (f.args[0].type == VAL_INST) {
-	spcl_val t = spcl_find(f.args[0].val.c, "__type__");
-	if (t.type == VAL_STR) {
-	    sto.n_els = t.n_els;
-	    sto.val.s = xmalloc(sizeof(char)*(sto.n_els+1));
-	    for (size_t i = 0; i < sto.n_els; ++i)
-		sto.val.s[i] = t.val.s[i];
-	    sto.val.s[sto.n_els] = 0;
+//get the weight of xp[i+1] for a point x in the interval i, along with the interval which is saved to i
+static inline double grid_weight(const interp_grid* g, double x, size_t* i) {
+    if (g->n == 1) {
+	*i = 0;
+	return 0;
+    }
+    *i = grid_find(g, x, *i);
+    return (x - g->xp[*i])/(g->xp[*i+1] - g->xp[*i]);
+}
+typedef struct interp_job {
+    interp_grid gx;
+    interp_grid gy;
+    const double* fp;
+    const double* x;
+    const double* y;
+    psize sx;
+    psize sy;
+    double* out;
+    double left;
+    double right;
+} interp_job;
+static void interp_range(void* arg, size_t start, size_t end) {
+    interp_job* job = arg;
+    const interp_grid* g = &job->gx;
+    size_t i = 0;
+    for (size_t k = start; k < end; ++k) {
+	double x = job->x[k];
+	if (x < g->xp[0]) {
+	    job->out[k] = job->left;
+	} else if (x > g->xp[g->n-1]) {
+	    job->out[k] = job->right;
 	} else {
-	    return spcl_make_none();
+	    double t = grid_weight(g, x, &i);
+	    job->out[k] = (t == 0)? job->fp[i] : job->fp[i] + t*(job->fp[i+1] - job->fp[i]);
 	}
-	return sto;
     }
-    sto.n_els = strlen(valnames[f.args[0].type])+1;
-    sto.val.s = strdup(valnames[f.args[0].type]);
-    return sto;
 }
-spcl_val spcl_len(struct spcl_inst* c, spcl_fn_call f) {
-    spcl_sigcheck(f, ANY1_SIG);
-    return spcl_make_num(f.args[0].n_els);
+//bilinear interpolation. Points outside the grid are moved to the nearest edge.
+static void interp2d_range(void* arg, size_t start, size_t end) {
+    interp_job* job = arg;
+    const interp_grid* gx = &job->gx;
+    const interp_grid* gy = &job->gy;
+    size_t i = 0, j = 0;
+    for (size_t k = start; k < end; ++k) {
+	double x = job->x[(psize)k*job->sx], y = job->y[(psize)k*job->sy];
+	x = (x < gx->xp[0])? gx->xp[0] : (x > gx->xp[gx->n-1])? gx->xp[gx->n-1] : x;
+	y = (y < gy->xp[0])? gy->xp[0] : (y > gy->xp[gy->n-1])? gy->xp[gy->n-1] : y;
+	double tx = grid_weight(gx, x, &i);
+	double ty = grid_weight(gy, y, &j);
+	const double* f0 = job->fp + i*gy->n + j;
+	const double* f1 = (gx->n > 1)? f0 + gy->n : f0;
+	double dj = (gy->n > 1);
+	double a = f0[0] + ty*(f0[(size_t)dj] - f0[0]);
+	double b = f1[0] + ty*(f1[(size_t)dj] - f1[0]);
+	job->out[k] = a + tx*(b - a);
+    }
 }
-//create a list with undefined elements
-static const valtype LIST_SIG[] = {VAL_NUM};
-spcl_val spcl_list(struct spcl_inst* c, spcl_fn_call f) {
-    spcl_sigcheck(f, LIST_SIG);
-    if (f.args[0].val.x < 0)
-	return spcl_make_err(E_OUT_OF_RANGE, "cannot create list with negative number of elements");
-    spcl_val ret;
-    ret.type = VAL_LIST;
-    ret.n_els = (size_t)(f.args[0].val.x);
-    ret.val.l = xmalloc(sizeof(spcl_val)*ret.n_els);
-    memset(ret.val.l, 0, sizeof(spcl_val)*ret.n_els);
+//allocate a number, array or tensor with the same shape as the number, array or tensor v
+static inline spcl_val alloc_shaped(const spcl_val* v) {
+    return (v->type == VAL_NUM)? spcl_make_num(0) : (v->type == VAL_ARRAY)? alloc_array(v->n_els) : alloc_tensor(v->val.t->ndim, v->val.t->shape);
+}
+//get a pointer to the elements of a value from alloc_shaped()
+static inline double* shaped_data(spcl_val* v) {
+    return (v->type == VAL_NUM)? &v->val.x : (v->type == VAL_ARRAY)? v->val.a : v->val.t->data;
+}
+//convert args[i] to a one dimensional table
+static inline spcl_val table_arg(spcl_fn_call f, size_t i) {
+    spcl_val v = as_numeric(f, i);
+    if (v.type == VAL_NUM || v.type == VAL_MAT) {
+	cleanup_spcl_val(&v);
+	return spcl_make_err(E_BAD_TYPE, "%.*s() expected args[%lu].type=array, got %s", f.name.n, f.name.s, i, valnames[f.args[i].type]);
+    }
+    return v;
+}
+//interpolate x in the table fp over the grid xp
+static inline spcl_val interp_vals(spcl_fn_call f, const spcl_val* v) {
+    const spcl_val *x = v, *xp = v+1, *fp = v+2;
+    if (fp->n_els != xp->n_els)
+	return spcl_make_err(E_OUT_OF_RANGE, "interp() got %lu grid points and %lu values", xp->n_els, fp->n_els);
+    interp_job job;
+    spcl_val ret = make_grid(&job.gx, xp->val.a, xp->n_els, "interp");
+    if (ret.type == VAL_ERR)
+	return ret;
+    size_t n;
+    double* tmp;
+    job.x = numeric_data(x, &n, &tmp);
+    job.fp = fp->val.a;
+    job.left = (f.n_args > 3)? f.args[3].val.x : fp->val.a[0];
+    job.right = (f.n_args > 4)? f.args[4].val.x : fp->val.a[fp->n_els-1];
+    ret = alloc_shaped(x);
+    job.out = shaped_data(&ret);
+    par_for(n, interp_range, &job);
+    xfree(tmp);
     return ret;
 }
-static const valtype RANGE_SIG[] = {VAL_NUM, VAL_NUM, VAL_NUM};
-spcl_val spcl_range(struct spcl_inst* c, spcl_fn_call f) {
-    spcl_sigcheck_opts(f, 1, RANGE_SIG);
-    double min, max, inc;
-    //interpret arguments depending on how many were provided
-    if (f.n_args == 1) {
-	min = 0;
-	max = f.args[0].val.x;
-	inc = 1;
+spcl_val spcl_interp(struct spcl_inst* c, spcl_fn_call f) {
+    static const valtype INTERP_SIG[] = {VAL_UNDEF, VAL_UNDEF, VAL_UNDEF, VAL_NUM, VAL_NUM};
+    spcl_sigcheck_opts(f, 3, INTERP_SIG);
+    spcl_val v[3];
+    size_t k = 0;
+    for (; k < 3; ++k) {
+	v[k] = (k)? table_arg(f, k) : as_numeric(f, k);
+	if (v[k].type == VAL_ERR)
+	    break;
+    }
+    spcl_val ret = (k < 3)? v[k] : interp_vals(f, v);
+    for (size_t i = 0; i < k; ++i)
+	cleanup_spcl_val(v+i);
+    return ret;
+}
+//interpolate the points (x, y) in the table fp over the grid xp by yp
+static inline spcl_val interp2d_vals(const spcl_val* v) {
+    const spcl_val *x = v, *y = v+1, *xp = v+2, *yp = v+3, *fp = v+4;
+    if (fp->type != VAL_MAT || fp->val.t->ndim != 2 || fp->val.t->shape[0] != xp->n_els || fp->val.t->shape[1] != yp->n_els)
+	return spcl_make_err(E_OUT_OF_RANGE, "interp2d() expected values with shape (%lu, %lu)", xp->n_els, yp->n_els);
+    interp_job job;
+    spcl_val ret = make_grid(&job.gx, xp->val.a, xp->n_els, "interp2d");
+    if (ret.type == VAL_ERR)
+	return ret;
+    ret = make_grid(&job.gy, yp->val.a, yp->n_els, "interp2d");
+    if (ret.type == VAL_ERR)
+	return ret;
+    size_t nx, ny, nf;
+    double *tx, *ty, *tf;
+    job.x = numeric_data(x, &nx, &tx);
+    job.y = numeric_data(y, &ny, &ty);
+    job.fp = numeric_data(fp, &nf, &tf);
+    //a single number is paired with every point of the other coordinate
+    if (nx != ny && nx != 1 && ny != 1) {
+	ret = spcl_make_err(E_OUT_OF_RANGE, "interp2d() got %lu x coordinates and %lu y coordinates", nx, ny);
     } else {
-	min = f.args[0].val.x;
-	max = f.args[1].val.x;
-	inc = 1;
+	job.sx = (nx != 1);
+	job.sy = (ny != 1);
+	ret = alloc_shaped((nx >= ny)? x : y);
+	job.out = shaped_data(&ret);
+	par_for((nx >= ny)? nx : ny, interp2d_range, &job);
     }
-    if (f.n_args >= 3)
-	inc = f.args[2].val.x;
-    //make sure arguments are valid
-    if ((max-min)*inc <= 0)
-	return spcl_make_err(E_BAD_VALUE, "range(%f, %f, %f) with invalid increment", min, max, inc);
-    spcl_val ret;
-    ret.type = VAL_ARRAY;
-    ret.n_els = (max - min) / inc;
-    ret.val.a = xmalloc(sizeof(double)*ret.n_els);
-    for (size_t i = 0; i < ret.n_els; ++i)
-	ret.val.a[i] = i*inc + min;
+    xfree(tx);
+    xfree(ty);
+    xfree(tf);
     return ret;
 }
-static const valtype LINSPACE_SIG[] = {VAL_NUM, VAL_NUM, VAL_NUM};
-spcl_val spcl_linspace(struct spcl_inst* c, spcl_fn_call f) {
-    spcl_sigcheck(f, LINSPACE_SIG);
-    spcl_val ret;
-    ret.type = VAL_ARRAY;
-    ret.n_els = (size_t)(f.args[2].val.x);
-    //prevent divisions by zero
-    if (ret.n_els < 2)
-	return spcl_make_err(E_BAD_VALUE, "cannot make linspace with size %lu", ret.n_els);
-    ret.val.a = xmalloc(sizeof(double)*ret.n_els);
-    double step = (f.args[1].val.x - f.args[0].val.x)/(ret.n_els - 1);
-    for (size_t i = 0; i < ret.n_els; ++i) {
-	ret.val.a[i] = step*i + f.args[0].val.x;
+spcl_val spcl_interp2d(struct spcl_inst* c, spcl_fn_call f) {
+    if (f.n_args != 5)
+	return spcl_make_err(E_LACK_TOKENS, "interp2d() expected 5 arguments, got %lu", f.n_args);
+    spcl_val v[5];
+    size_t k = 0;
+    for (; k < 5; ++k) {
+	v[k] = (k == 2 || k == 3)? table_arg(f, k) : as_numeric(f, k);
+	if (v[k].type == VAL_ERR)
+	    break;
     }
+    spcl_val ret = (k < 5)? v[k] : interp2d_vals(v);
+    for (size_t i = 0; i < k; ++i)
+	cleanup_spcl_val(v+i);
     return ret;
 }
-STACK_DEF(spcl_val,LST_MAX)
-STACK_DEF(size_t,LST_MAX)
-static const valtype FLATTEN_SIG[] = {VAL_LIST};
-spcl_val spcl_flatten(struct spcl_inst* c, spcl_fn_call f) {
-    spcl_sigcheck(f, FLATTEN_SIG);
-    spcl_val ret = spcl_make_none();
-    spcl_val cur_list = f.args[0];
-    //flattening an empty list is the identity op.
-    if (cur_list.n_els == 0 || cur_list.val.l == NULL) {
-	ret.type = VAL_LIST;
+//lookups in a table over a uniform grid from lo to hi don't need the grid points. Points outside the grid get the value at the nearest edge.
+static void lookup_range(void* arg, size_t start, size_t end) {
+    interp_job* job = arg;
+    size_t n = job->gx.n;
+    for (size_t k = start; k < end; ++k) {
+	double t = (job->x[k] - job->left)/job->gx.h;
+	if (t != t) {
+	    job->out[k] = t;
+	} else if (t <= 0) {
+	    job->out[k] = job->fp[0];
+	} else if (t >= n-1) {
+	    job->out[k] = job->fp[n-1];
+	} else {
+	    size_t i = (size_t)t;
+	    job->out[k] = job->fp[i] + (t - i)*(job->fp[i+1] - job->fp[i]);
+	}
+    }
+}
+//tables made by tabulate() store a polynomial for each interval in the variable u = 2*(x - x_i)*scale - 1 on [-1, 1]
+#define TAB_MAX_ORDER	15
+double spcl_table_eval(const spcl_table* t, double x) {
+    double s = (x - t->lo)*t->scale;
+    if (s != s)
+	return s;
+    s = (s < 0)? 0 : (s > t->n)? t->n : s;
+    size_t i = (s >= t->n)? t->n-1 : (size_t)s;
+    double u = 2*(s - i) - 1;
+    const double* a = t->coeffs + i*(t->order+1);
+    double y = a[t->order];
+    for (size_t k = t->order; k > 0; --k)
+	y = y*u + a[k-1];
+    return y;
+}
+//read the table stored in the object obj
+static int read_table(const spcl_inst* obj, spcl_table* t) {
+    spcl_val tmp = spcl_find(obj, "__type__");
+    if (tmp.type != VAL_STR || tmp.n_els != 5 || strncmp(tmp.val.s, "table", 5))
+	return -2;
+    spcl_val coeffs = spcl_find(obj, "coeffs");
+    long long order;
+    if (spcl_find_float(obj, "lo", &t->lo) || spcl_find_float(obj, "hi", &t->hi) || spcl_find_float(obj, "err", &t->err) || spcl_find_long(obj, "order", &order))
+	return -2;
+    if (coeffs.type != VAL_ARRAY || order < 1 || order > TAB_MAX_ORDER || coeffs.n_els == 0 || coeffs.n_els % (order+1) || !(t->hi > t->lo))
+	return -2;
+    t->order = (unsigned)order;
+    t->n = coeffs.n_els/(order+1);
+    t->scale = t->n/(t->hi - t->lo);
+    t->coeffs = coeffs.val.a;
+    return 0;
+}
+typedef struct table_job {
+    spcl_table t;
+    const double* x;
+    double* out;
+} table_job;
+static void table_range(void* arg, size_t start, size_t end) {
+    table_job* job = arg;
+    for (size_t k = start; k < end; ++k)
+	job->out[k] = spcl_table_eval(&job->t, job->x[k]);
+}
+//evaluate the table made by tabulate() in the object args[1] at each element of args[0]
+static inline spcl_val lookup_table(spcl_fn_call f) {
+    table_job job;
+    if (read_table(f.args[1].val.c, &job.t))
+	return spcl_make_err(E_BAD_TYPE, "lookup() expected a table made by tabulate()");
+    spcl_val x = as_numeric(f, 0);
+    if (x.type == VAL_ERR)
+	return x;
+    size_t n;
+    double* tmp;
+    job.x = numeric_data(&x, &n, &tmp);
+    spcl_val ret = alloc_shaped(&x);
+    job.out = shaped_data(&ret);
+    par_for(n, table_range, &job);
+    xfree(tmp);
+    cleanup_spcl_val(&x);
+    return ret;
+}
+spcl_val spcl_lookup(struct spcl_inst* c, spcl_fn_call f) {
+    static const valtype LOOKUP_SIG[] = {VAL_UNDEF, VAL_NUM, VAL_NUM, VAL_UNDEF};
+    if (f.n_args == 2 && f.args[1].type == VAL_INST)
+	return lookup_table(f);
+    spcl_sigcheck(f, LOOKUP_SIG);
+    double lo = f.args[1].val.x, hi = f.args[2].val.x;
+    if (!(hi > lo))
+	return spcl_make_err(E_BAD_VALUE, "lookup() expected lo < hi, got %g and %g", lo, hi);
+    spcl_val fp = table_arg(f, 3);
+    if (fp.type == VAL_ERR)
+	return fp;
+    spcl_val ret = (fp.n_els < 2)? spcl_make_err(E_BAD_VALUE, "lookup() expected a table with at least 2 values") : as_numeric(f, 0);
+    if (ret.type != VAL_ERR) {
+	spcl_val x = ret;
+	interp_job job;
+	size_t n;
+	double* tmp;
+	job.gx.n = fp.n_els;
+	job.gx.h = (hi - lo)/(fp.n_els - 1);
+	job.left = lo;
+	job.fp = fp.val.a;
+	job.x = numeric_data(&x, &n, &tmp);
+	ret = alloc_shaped(&x);
+	job.out = shaped_data(&ret);
+	par_for(n, lookup_range, &job);
+	xfree(tmp);
+	cleanup_spcl_val(&x);
+    }
+    cleanup_spcl_val(&fp);
+    return ret;
+}
+//evaluate fn at the single number x, saving the result to y (or NaN if an error occurred)
+static inline spcl_val sample_at(struct spcl_inst* c, spcl_fn_call f, double x, double* y) {
+    *y = NAN;
+    spcl_fn_call call;
+    call.name = f.name;
+    call.n_args = 1;
+    call.args[0] = spcl_make_num(x);
+    spcl_val ret = spcl_uf_eval(f.args[0].val.f, c, call);
+    if (ret.type != VAL_NUM && ret.type != VAL_INT) {
+	if (ret.type == VAL_ERR)
+	    return ret;
+	spcl_val er = spcl_make_err(E_BAD_TYPE, "tabulate() expected fn to return a number, got %s", valnames[ret.type]);
+	cleanup_spcl_val(&ret);
+	return er;
+    }
+    *y = val_to_x(&ret);
+    return spcl_make_none();
+}
+//the number of points (evenly spaced and including both ends) where a call with the whole array of samples is compared to calls with single numbers
+#define TAB_N_CHECKS	5
+//the largest relative difference allowed in those comparisons, which leaves room for the vectorized math functions
+#define TAB_CHECK_TOL	1e-12
+/**
+ * Sample fn at each of the points in x into y. fn is called once for the whole array if that gives an array of the same length which matches calls with single numbers at TAB_N_CHECKS points. Otherwise (e.g. if fn branches on its argument) fn is called once per point.
+ */
+static inline spcl_val sample_fn(struct spcl_inst* c, spcl_fn_call f, spcl_val* x, double* y) {
+    spcl_fn_call call;
+    call.name = f.name;
+    call.n_args = 1;
+    call.args[0] = *x;
+    spcl_val ret = spcl_uf_eval(f.args[0].val.f, c, call);
+    int ok = is_real_arr(ret.type) && ret.n_els == x->n_els;
+    for (size_t k = 0; ok && k < TAB_N_CHECKS; ++k) {
+	size_t i = k*(x->n_els-1)/(TAB_N_CHECKS-1);
+	double yi, ya = arr_get(&ret, i);
+	spcl_val er = sample_at(c, f, x->val.a[i], &yi);
+	if (er.type == VAL_ERR) {
+	    cleanup_spcl_val(&ret);
+	    return er;
+	}
+	ok = ya == yi || fabs(ya - yi) <= TAB_CHECK_TOL*fmax(fabs(ya), fabs(yi));
+    }
+    if (ok) {
+	for (size_t i = 0; i < x->n_els; ++i)
+	    y[i] = arr_get(&ret, i);
+	cleanup_spcl_val(&ret);
+	return spcl_make_none();
+    }
+    cleanup_spcl_val(&ret);
+    for (size_t i = 0; i < x->n_els; ++i) {
+	spcl_val er = sample_at(c, f, x->val.a[i], y+i);
+	if (er.type == VAL_ERR)
+	    return er;
+    }
+    return spcl_make_none();
+}
+spcl_val spcl_tabulate(struct spcl_inst* c, spcl_fn_call f) {
+    static const valtype TAB_SIG[] = {VAL_FN, VAL_NUM, VAL_NUM, VAL_NUM, VAL_NUM};
+    spcl_sigcheck_opts(f, 4, TAB_SIG);
+    double lo = f.args[1].val.x, hi = f.args[2].val.x;
+    spcl_val order = (f.n_args > 4)? f.args[4] : spcl_make_num(3);
+    if (!(hi > lo))
+	return spcl_make_err(E_BAD_VALUE, "tabulate() expected lo < hi, got %g and %g", lo, hi);
+    if (!is_whole(f.args+3) || f.args[3].val.x < 1)
+	return spcl_make_err(E_BAD_VALUE, "tabulate() expected a positive whole number of intervals, got %g", f.args[3].val.x);
+    if (!is_whole(&order) || order.val.x < 1 || order.val.x > TAB_MAX_ORDER)
+	return spcl_make_err(E_BAD_VALUE, "tabulate() expected an order from 1 to %d, got %g", TAB_MAX_ORDER, order.val.x);
+    size_t n = (size_t)f.args[3].val.x, m = (size_t)order.val.x;
+    //each interval is sampled at the m+1 Chebyshev-Lobatto points u_j = -cos(pi*j/m), which include both ends so that neighbouring intervals share a sample and the table is continuous
+    spcl_val x = alloc_array(m*n + 1);
+    double* y = xmalloc(sizeof(double)*x.n_els);
+    double h = (hi - lo)/n;
+    for (size_t i = 0; i < n; ++i) {
+	for (size_t j = 0; j < m; ++j)
+	    x.val.a[m*i + j] = lo + h*(i + (1 - cos(M_PI*j/m))/2);
+    }
+    x.val.a[m*n] = hi;
+    spcl_val ret = sample_fn(c, f, &x, y);
+    if (ret.type == VAL_ERR) {
+	cleanup_spcl_val(&x);
+	xfree(y);
 	return ret;
     }
-    size_t cur_st = 0;
-    //there may potentially be nested lists, we need to be able to find our way back to the parent and the index once we're done
-    stack(spcl_val,LST_MAX) lists = make_stack(spcl_val,LST_MAX)();
-    stack(size_t,LST_MAX) inds = make_stack(size_t,LST_MAX)();
-    //just make sure that there's a root level on the stack to be popped out
-    if ( push(spcl_val,LST_MAX)(&lists, cur_list) ) return ret;
-    if ( push(size_t,LST_MAX)(&inds, 0) ) return ret;
-
-    //this is used for estimating the size of the buffer we need. Take however many elements were needed for this list and assume each sub-list has the same number of elements
-    size_t base_n_els = cur_list.n_els;
-    //start with the number of elements in the lowest order of the list
-    size_t buf_size = cur_list.n_els;
-    ret.val.l = xmalloc(sizeof(spcl_val)*buf_size);
-    size_t j = 0;
-    do {
-	size_t i = cur_st;
-	size_t start_depth = inds.ptr;
-	for (; i < cur_list.n_els; ++i) {
-	    if (cur_list.val.l[i].type == VAL_LIST) {
-		if ( push(spcl_val,LST_MAX)(&lists, cur_list) ) return ret;
-		if ( push(size_t,LST_MAX)(&inds, i+1) ) return ret;//push + 1 so that we start at the next index instead of reading the list again
-		cur_list = cur_list.val.l[i];
-		cur_st = 0;
-		break;
-	    }
-	    if (j >= buf_size) {
-		//-1 since we already have at least one element. no base_n_els=0 check is needed since that case will ensure the for loop is never evaluated
-		buf_size += (base_n_els-1)*(i+1);
-		spcl_val* tmp_val = xrealloc(ret.val.l, sizeof(spcl_val)*buf_size);
-		if (!tmp_val) {
-		    xfree(ret.val.l);
-		    cleanup_spcl_fn_call(&f);
-		    destroy_stack(spcl_val,LST_MAX)(&lists, &cleanup_spcl_val);
-		    return spcl_make_err(E_NOMEM, "");
-		}
-		ret.val.l = tmp_val;
-	    }
-	    ret.val.l[j++] = copy_spcl_val(cur_list.val.l[i]);
+    //interpolating Chebyshev coefficients are a_k = (2/m)*sum''_j y_j*T_k(u_j), where sum'' halves the first and last terms and a_0 and a_m are also halved. These are converted to powers of u through the recurrence T_{k+1} = 2*u*T_k - T_{k-1}, which together give a matrix from samples to coefficients.
+    double cheb[TAB_MAX_ORDER+1][TAB_MAX_ORDER+1] = {{0}};
+    double mat[TAB_MAX_ORDER+1][TAB_MAX_ORDER+1] = {{0}};
+    cheb[0][0] = 1;
+    cheb[1][1] = 1;
+    for (size_t k = 1; k < m; ++k) {
+	for (size_t l = 0; l <= k+1; ++l)
+	    cheb[k+1][l] = ((l)? 2*cheb[k][l-1] : 0) - cheb[k-1][l];
+    }
+    for (size_t k = 0; k <= m; ++k) {
+	for (size_t j = 0; j <= m; ++j) {
+	    double w = ((k == 0 || k == m)? 0.5 : 1)*((j == 0 || j == m)? 0.5 : 1)*2/m;
+	    //T_k(u_j) = cos(k*pi*(m-j)/m)
+	    double t = w*cos(M_PI*k*(m-j)/m);
+	    for (size_t l = 0; l <= k; ++l)
+		mat[l][j] += cheb[k][l]*t;
 	}
-	//if we reached the end of a list without any sublists then we should return back to the parent list
-	if (inds.ptr <= start_depth) {
-	    pop(size_t,LST_MAX)(&inds, &cur_st);
-	    pop(spcl_val,LST_MAX)(&lists, &cur_list);
+    }
+    spcl_val coeffs = alloc_array(n*(m+1));
+    spcl_table tab = {lo, hi, n/(hi - lo), 0, n, (unsigned)m, coeffs.val.a};
+    for (size_t i = 0; i < n; ++i) {
+	const double* ys = y + m*i;
+	double* a = coeffs.val.a + i*(m+1);
+	for (size_t l = 0; l <= m; ++l) {
+	    a[l] = 0;
+	    for (size_t j = 0; j <= m; ++j)
+		a[l] += mat[l][j]*ys[j];
 	}
-    } while (lists.ptr);
-    ret.type = VAL_LIST;
-    ret.n_els = j;
+    }
+    cleanup_spcl_val(&x);
+    xfree(y);
+    //the fit is checked against fn at the points halfway between the samples (in angle), so that the estimate doesn't depend on how the samples were taken. These are sampled the same way as the nodes, so fn is only called once per point if it can't take the whole array.
+    x = alloc_array(n*m);
+    y = xmalloc(sizeof(double)*x.n_els);
+    for (size_t i = 0; i < n*m; ++i)
+	x.val.a[i] = lo + h*(i/m + (1 - cos(M_PI*(2*(i%m) + 1)/(2*m)))/2);
+    ret = sample_fn(c, f, &x, y);
+    if (ret.type == VAL_ERR) {
+	cleanup_spcl_val(&x);
+	xfree(y);
+	cleanup_spcl_val(&coeffs);
+	return ret;
+    }
+    for (size_t i = 0; i < n*m; ++i) {
+	double err = fabs(spcl_table_eval(&tab, x.val.a[i]) - y[i]);
+	tab.err = (err > tab.err || err != err)? err : tab.err;
+    }
+    cleanup_spcl_val(&x);
+    xfree(y);
+    ret = spcl_make_inst(c, "table");
+    spcl_set_val(ret.val.c, "lo", spcl_make_num(lo), 0);
+    spcl_set_val(ret.val.c, "hi", spcl_make_num(hi), 0);
+    spcl_set_val(ret.val.c, "order", spcl_make_int(m), 0);
+    spcl_set_val(ret.val.c, "err", spcl_make_num(tab.err), 0);
+    spcl_set_val(ret.val.c, "coeffs", coeffs, 0);
     return ret;
 }
-spcl_val spcl_cat(struct spcl_inst* c, spcl_fn_call f) {
-    spcl_val sto;
-    if (f.n_args < 2)
-	return spcl_make_err(E_LACK_TOKENS, "cat() expected 2 arguments but got %lu", f.n_args);
-    spcl_val l = f.args[0];
-    spcl_val r = f.args[1];
-    size_t l1 = l.n_els;
-    size_t l2 = (r.type == VAL_LIST || r.type == VAL_ARRAY)? r.n_els : 1;
-    //special case for matrices, just append a new row
-    if (l.type == VAL_MAT && r.type == VAL_ARRAY) {
-	sto.type = VAL_MAT;
-	sto.n_els = l1 + 1;
-	sto.val.l = xmalloc(sizeof(spcl_val)*sto.n_els);
-	for (size_t i = 0; i < l1; ++i)
-	    sto.val.l[i] = copy_spcl_val(l.val.l[i]);
-	sto.val.l[l1] = copy_spcl_val(r);
-	return sto;
+spcl_val spcl_deriv(struct spcl_inst* c, spcl_fn_call f) {
+    static const valtype DERIV_SIG[] = {VAL_FN, VAL_NUM};
+    spcl_sigcheck_opts(f, 1, DERIV_SIG);
+    spcl_val order = (f.n_args > 1)? f.args[1] : spcl_make_num(1);
+    const spcl_uf* uf = f.args[0].val.f;
+    if (uf->deriv < 0)
+	return spcl_make_err(E_BAD_VALUE, "deriv() cannot differentiate a gradient");
+    if (!is_whole(&order) || order.val.x < 0 || order.val.x + uf->deriv > JET_MAX_ORDER)
+	return spcl_make_err(E_BAD_VALUE, "deriv() expected a total order from 0 to %d, got %g", JET_MAX_ORDER, order.val.x + uf->deriv);
+    if (uf->code_lines.b && uf->call_sig.n_args != 1)
+	return spcl_make_err(E_BAD_VALUE, "deriv() expected a function of one variable, got %lu arguments", uf->call_sig.n_args);
+    //derivatives of derivatives just increase the order
+    spcl_val ret = copy_spcl_val(f.args[0]);
+    ret.val.f->deriv += (int)order.val.x;
+    return ret;
+}
+spcl_val spcl_grad(struct spcl_inst* c, spcl_fn_call f) {
+    static const valtype GRAD_SIG[] = {VAL_FN};
+    spcl_sigcheck(f, GRAD_SIG);
+    if (f.args[0].val.f->deriv)
+	return spcl_make_err(E_BAD_VALUE, "grad() cannot differentiate a derivative");
+    spcl_val ret = copy_spcl_val(f.args[0]);
+    ret.val.f->deriv = -1;
+    return ret;
+}
+spcl_val spcl_complex(struct spcl_inst* c, spcl_fn_call f) {
+    if (f.n_args < 1 || f.n_args > 2)
+	return spcl_make_err(E_LACK_TOKENS, "complex() expected 1 or 2 arguments, got %lu", f.n_args);
+    size_t n = 0;
+    for (size_t i = 0; i < f.n_args; ++i) {
+	if (f.args[i].type != VAL_NUM && f.args[i].type != VAL_ARRAY)
+	    return spcl_make_err(E_BAD_TYPE, "complex() expected args[%lu].type=numeric or array, got %s", i, valnames[f.args[i].type]);
+	if (f.args[i].type == VAL_ARRAY && n && f.args[i].n_els != n)
+	    return spcl_make_err(E_OUT_OF_RANGE, "complex() with parts of length %lu and %lu", n, f.args[i].n_els);
+	if (f.args[i].type == VAL_ARRAY)
+	    n = f.args[i].n_els;
     }
-    //otherwise we have to do something else
-    if (l.type != VAL_LIST && r.type != VAL_ARRAY)
-	return spcl_make_err(E_BAD_TYPE, "called cat() with types <%s> <%s>", valnames[l.type], valnames[r.type]);
-    sto.type = l.type;
-    sto.n_els = l1 + l2;
-    //deep copy the first list/array
-    if (sto.type == VAL_LIST) {
-	sto.val.l = xmalloc(sizeof(spcl_val)*sto.n_els);
-	if (!sto.val.l) return spcl_make_err(E_NOMEM, "");
-	for (size_t i = 0; i < l1; ++i)
-	    sto.val.l[i] = copy_spcl_val(l.val.l[i]);
-	if (r.type == VAL_LIST) {
-	    //list -> list
-	    for (size_t i = 0; i < l2; ++i)
-		sto.val.l[i+l1] = copy_spcl_val(r.val.l[i]);
-	} else if (r.type == VAL_ARRAY) {
-	    //array -> list
-	    for (size_t i = 0; i < l2; ++i)
-		sto.val.l[i+l1] = spcl_make_num(r.val.a[i]);
-	} else {
-	    //anything -> list
-	    sto.val.l[l1] = copy_spcl_val(r);
+    const spcl_val* re = f.args;
+    const spcl_val* im = (f.n_args > 1)? f.args+1 : NULL;
+    if (re->type == VAL_NUM && (!im || im->type == VAL_NUM))
+	return spcl_make_complex(re->val.x, (im)? im->val.x : 0);
+    spcl_val ret = alloc_carray(n);
+    for (size_t i = 0; i < n; ++i) {
+	ret.val.a[2*i] = (re->type == VAL_ARRAY)? re->val.a[i] : re->val.x;
+	ret.val.a[2*i+1] = (!im)? 0 : (im->type == VAL_ARRAY)? im->val.a[i] : im->val.x;
+    }
+    return ret;
+}
+/**
+ * Implement real(), imag(), conj() and angle(), which are selected by setting part to 'r', 'i', 'c' or 'a' respectively
+ */
+static inline spcl_val complex_part(spcl_fn_call f, char part) {
+    if (f.n_args != 1)
+	return spcl_make_err(E_LACK_TOKENS, "%.*s() expected 1 argument, got %lu", f.name.n, f.name.s, f.n_args);
+    spcl_val v = f.args[0];
+    if (v.type == VAL_NUM || v.type == VAL_ARRAY || v.type == VAL_MAT) {
+	//real values are their own real part and conjugate
+	spcl_val ret = copy_spcl_val(v);
+	if (part == 'r' || part == 'c')
+	    return ret;
+	make_contiguous(&ret);
+	size_t n;
+	double* tmp;
+	double* x = (double*)numeric_data(&ret, &n, &tmp);
+	for (size_t i = 0; i < n; ++i)
+	    x[i] = (part == 'i')? 0 : atan2(0, x[i]);
+	return ret;
+    } else if (v.type == VAL_COMPLEX) {
+	double complex z = val_to_z(&v);
+	switch (part) {
+	case 'r': return spcl_make_num(creal(z));
+	case 'i': return spcl_make_num(cimag(z));
+	case 'c': return spcl_make_complex(creal(z), -cimag(z));
+	default: return spcl_make_num(carg(z));
 	}
-    } else {
-	sto.val.a = xmalloc(sizeof(double)*sto.n_els);
-	if (!sto.val.a) return spcl_make_err(E_NOMEM, "");
-	for (size_t i = 0; i < l1; ++i)
-	    sto.val.l[i] = copy_spcl_val(f.args[0].val.l[i]);
-	if (r.type == VAL_LIST) {
-	    //list -> array
-	    for (size_t i = 0; i < l2; ++i) {
-		if (r.val.l[i].type != VAL_NUM) {
-		    xfree(sto.val.a);
-		    return spcl_make_err(E_BAD_TYPE, "can only concatenate numeric lists to arrays");
-		}
-		sto.val.a[i+l1] = r.val.l[i].val.x;
-	    }
-	} else if (r.type == VAL_ARRAY) {
-	    //array -> array
-	    for (size_t i = 0; i < l2; ++i)
-		sto.val.a[i+l1] = r.val.a[i];
-	} else if (r.type == VAL_NUM) {
-	    //number -> array
-	    sto.val.a[l1] = r.val.x;
-	} else {
-	    return spcl_make_err(E_BAD_TYPE, "called cat() with types <%s> <%s>", valnames[l.type], valnames[r.type]);
+    } else if (v.type == VAL_CARRAY) {
+	if (part == 'c') {
+	    spcl_val ret = copy_spcl_val(v);
+	    make_unique(&ret);
+	    for (size_t i = 0; i < ret.n_els; ++i)
+		ret.val.a[2*i+1] = -ret.val.a[2*i+1];
+	    return ret;
+	}
+	spcl_val ret = alloc_array(v.n_els);
+	for (size_t i = 0; i < v.n_els; ++i) {
+	    const double* z = v.val.a + 2*i;
+	    ret.val.a[i] = (part == 'r')? z[0] : (part == 'i')? z[1] : atan2(z[1], z[0]);
 	}
+	return ret;
     }
-    return sto;
+    return spcl_make_err(E_BAD_TYPE, "%.*s() expected a numeric value, got %s", f.name.n, f.name.s, valnames[v.type]);
+}
+spcl_val spcl_real(struct spcl_inst* c, spcl_fn_call f) {
+    return complex_part(f, 'r');
+}
+spcl_val spcl_imag(struct spcl_inst* c, spcl_fn_call f) {
+    return complex_part(f, 'i');
+}
+spcl_val spcl_conj(struct spcl_inst* c, spcl_fn_call f) {
+    return complex_part(f, 'c');
+}
+spcl_val spcl_angle(struct spcl_inst* c, spcl_fn_call f) {
+    return complex_part(f, 'a');
 }
 /**
  * print the elements to the console
@@ -630,94 +4595,226 @@ spcl_val spcl_print(struct spcl_inst* inst, spcl_fn_call f) {
  */
 static const valtype ARRAY_SIG[] = {VAL_LIST};
 spcl_val spcl_array(spcl_inst* c, spcl_fn_call f) {
+    //if there are multiple arguments, then each one is a row of the matrix
+    if (f.n_args > 1) {
+	spcl_val rows = spcl_make_none();
+	rows.type = VAL_LIST;
+	rows.n_els = f.n_args;
+	rows.val.l = f.args;
+	return spcl_cast(rows, VAL_MAT);
+    }
     spcl_sigcheck(f, ARRAY_SIG);
     //treat matrices with one row as vectors
-    if (f.n_args == 1) {
-	if (f.args[0].val.l[0].type == VAL_LIST)
-	    return spcl_cast(f.args[0], VAL_MAT);
-	else
-	    return spcl_cast(f.args[0], VAL_ARRAY);
-    }
-    spcl_val ret;
-    //otherwise we need to do more work
-    size_t n_cols = f.args[0].n_els;
-    ret.type = VAL_MAT;
-    ret.n_els = f.n_args;
-    ret.val.l = xmalloc(sizeof(spcl_val)*f.n_args);
-    //iterate through rows
-    for (size_t i = 0; i < f.n_args; ++i) {
-	if (f.args[i].type == VAL_LIST) {
-	    xfree(ret.val.l);
-	    return spcl_make_err(E_BAD_TYPE, "non list encountered in matrix");
-	}
-	if (f.args[i].n_els != n_cols) {
-	    xfree(ret.val.l);
-	    return spcl_make_err(E_BAD_VALUE, "can't create matrix from ragged array");
-	}
-	ret.val.l[i] = spcl_cast(f.args[i], VAL_ARRAY);
-	//check for errors
-	if (ret.val.l[i].type == VAL_ERR) {
-	    xfree(ret.val.l);
-	    ret = copy_spcl_val(ret.val.l[i]);
-	    return ret;
-	}
+    if (f.args[0].n_els > 0 && (f.args[0].val.l[0].type == VAL_LIST || f.args[0].val.l[0].type == VAL_ARRAY))
+	return spcl_cast(f.args[0], VAL_MAT);
+    //lists with any complex elements become complex arrays
+    for (size_t i = 0; i < f.args[0].n_els; ++i) {
+	if (f.args[0].val.l[i].type == VAL_COMPLEX)
+	    return spcl_cast(f.args[0], VAL_CARRAY);
     }
-    return ret;
+    return spcl_cast(f.args[0], VAL_ARRAY);
 }
 
 spcl_val spcl_vec(spcl_inst* c, spcl_fn_call f) {
-    spcl_val ret = spcl_make_none();
-    //just copy the elements
-    ret.type = VAL_ARRAY;
-    ret.n_els = f.n_args;
     //skip copying an empty list
-    if (ret.n_els == 0)
+    if (f.n_args == 0) {
+	spcl_val ret = spcl_make_none();
+	ret.type = VAL_ARRAY;
 	return ret;
-    ret.val.a = xmalloc(sizeof(double)*ret.n_els);
+    }
+    //if any of the elements are complex, then a complex array is returned
     for (size_t i = 0; i < f.n_args; ++i) {
-	if (f.args[i].type != VAL_NUM) {
-	    xfree(ret.val.a);
-	    return spcl_make_err(E_BAD_TYPE, "cannot cast list with non-numeric types to array");
+	if (f.args[i].type == VAL_COMPLEX) {
+	    spcl_val lst = spcl_make_none();
+	    lst.type = VAL_LIST;
+	    lst.n_els = f.n_args;
+	    lst.val.l = f.args;
+	    return spcl_cast(lst, VAL_CARRAY);
 	}
-	ret.val.a[i] = f.args[i].val.x;
     }
+    for (size_t i = 0; i < f.n_args; ++i) {
+	if (f.args[i].type != VAL_NUM)
+	    return spcl_make_err(E_BAD_TYPE, "cannot cast list with non-numeric types to array");
+    }
+    //vectors with two to four elements are stored inline
+    if (f.n_args > 1 && f.n_args <= SPCL_VEC_MAX) {
+	double x[SPCL_VEC_MAX];
+	for (size_t i = 0; i < f.n_args; ++i)
+	    x[i] = f.args[i].val.x;
+	return spcl_make_vec(x, f.n_args);
+    }
+    //just copy the elements
+    spcl_val ret = alloc_array(f.n_args);
+    for (size_t i = 0; i < f.n_args; ++i)
+	ret.val.a[i] = f.args[i].val.x;
     return ret;
 }
 
 //math functions
 /**
- * Wrap a mathematical function that takes a single floating point argument
+ * Wrap a mathematical function that takes a single floating point argument. Arrays and tensors are handled elementwise.
  * FN: the function to wrap
+ * VFN: the vmath_fn for a vectorized version of FN or VM_NONE if there isn't one
+ * CFN: the version of FN for complex numbers or NULL if there isn't one
+ * JFN: the version of FN for dual numbers
  */
-#define WRAP_MATH_FN(FN) spcl_val TYPED(spcl,FN)(struct spcl_inst* c, spcl_fn_call f) {	\
-    spcl_val sto = get_sigerr(f, SIGLEN(NUM1_SIG), SIGLEN(NUM1_SIG), NUM1_SIG);		\
-    if (sto.type == 0)									\
+#define WRAP_MATH_FN(FN, VFN, CFN, JFN) spcl_val TYPED(spcl,FN)(struct spcl_inst* c, spcl_fn_call f) {	\
+    if (f.n_args != 1)									\
+	return get_sigerr(f, SIGLEN(NUM1_SIG), SIGLEN(NUM1_SIG), NUM1_SIG);		\
+    spcl_val ret = spcl_make_none();							\
+    switch (f.args[0].type) {								\
+    case VAL_NUM:									\
 	return spcl_make_num( FN(f.args[0].val.x) );					\
-    cleanup_spcl_val(&sto);								\
-    sto = get_sigerr(f, SIGLEN(ARR1_SIG), SIGLEN(ARR1_SIG), ARR1_SIG);			\
-    if (sto.type == 0) {								\
-	sto.type = VAL_ARRAY;								\
-	sto.n_els = f.args[0].n_els;							\
-	sto.val.a = malloc(sizeof(double)*sto.n_els);					\
-	if (!sto.val.a)									\
-	    return spcl_make_err(E_NOMEM, "");						\
-	for (size_t i = 0; i < f.args[0].n_els; ++i)					\
-	    sto.val.a[i] = FN(f.args[0].val.a[i]);					\
+    case VAL_ARRAY:									\
+	ret = alloc_array(f.args[0].n_els);						\
+	math_arr(ret.val.a, f.args[0].val.a, ret.n_els, FN, VFN);			\
+	return ret;									\
+    case VAL_MAT:									\
+	ret = alloc_tensor(f.args[0].val.t->ndim, f.args[0].val.t->shape);		\
+	tensor_gather(f.args[0].val.t, ret.val.t->data);				\
+	math_arr(ret.val.t->data, ret.val.t->data, tensor_size(ret.val.t), FN, VFN);	\
+	return ret;									\
+    case VAL_COMPLEX:									\
+    case VAL_CARRAY:									\
+	return zmath_call(f, CFN);							\
+    case VAL_DUAL:									\
+	return jet_math(f, JFN);							\
+    default:										\
+	return get_sigerr(f, SIGLEN(NUM1_SIG), SIGLEN(NUM1_SIG), NUM1_SIG);		\
     }											\
-    return sto;										\
-}
-WRAP_MATH_FN(sin)
-WRAP_MATH_FN(cos)
-WRAP_MATH_FN(tan)
-WRAP_MATH_FN(exp)
-WRAP_MATH_FN(asin)
-WRAP_MATH_FN(acos)
-WRAP_MATH_FN(atan)
-WRAP_MATH_FN(log)
-WRAP_MATH_FN(sqrt)
-WRAP_MATH_FN(floor)
-WRAP_MATH_FN(ceil)
-WRAP_MATH_FN(fabs)
+}
+/**
+ * Apply fn to each element of x[n] and save the result to y. If vfn is not VM_NONE, then the vectorized version is used unless strict math is enabled.
+ */
+static void math_range(void* arg, size_t start, size_t end) {
+    arr_job* job = arg;
+    if (job->vfn != VM_NONE) {
+	job->k->math(job->x+start, job->y+start, end-start, job->vfn);
+	return;
+    }
+    for (size_t i = start; i < end; ++i)
+	job->x[i] = job->fn(job->y[i]);
+}
+static inline void math_arr(double* y, const double* x, size_t n, double (*fn)(double), vmath_fn vfn) {
+    arr_job job = {get_kernels(), y, x, 0, 0, 0, (strict_math)? VM_NONE : vfn, fn};
+    par_for(n, math_range, &job);
+}
+void spcl_set_strict_math(int strict) {
+    strict_math = strict;
+}
+WRAP_MATH_FN(sin, VM_SIN, csin, jet_sin)
+WRAP_MATH_FN(cos, VM_COS, ccos, jet_cos)
+WRAP_MATH_FN(tan, VM_TAN, ctan, jet_tan)
+WRAP_MATH_FN(exp, VM_EXP, cexp, jet_exp)
+WRAP_MATH_FN(asin, VM_NONE, casin, jet_asin)
+WRAP_MATH_FN(acos, VM_NONE, cacos, jet_acos)
+WRAP_MATH_FN(atan, VM_NONE, catan, jet_atan)
+WRAP_MATH_FN(log, VM_LOG, clog, jet_log)
+WRAP_MATH_FN(sqrt, VM_NONE, csqrt, jet_sqrt)
+WRAP_MATH_FN(floor, VM_NONE, NULL, jet_floor)
+WRAP_MATH_FN(ceil, VM_NONE, NULL, jet_ceil)
+WRAP_MATH_FN(fabs, VM_NONE, zabs, jet_fabs)
+//random numbers are generated in batches of this many philox blocks which stay in the L1 cache during the Box-Muller transform
+#define RNG_BATCH	256
+typedef struct rng_job {
+    double* y;
+    size_t n;
+    unsigned long long ctr;
+    unsigned long long key;
+    int normal;
+} rng_job;
+//fill the elements of y which come from the blocks [start, end) of the stream
+static void rng_range(void* arg, size_t start, size_t end) {
+    rng_job* job = arg;
+    const arr_kernels* k = get_kernels();
+    double u[2*RNG_BATCH], lr[RNG_BATCH], s[RNG_BATCH], th[RNG_BATCH];
+    for (size_t i = start; i < end; i += RNG_BATCH) {
+	size_t m = (end - i < RNG_BATCH)? end - i : RNG_BATCH;
+	k->philox(u, m, job->ctr + i, job->key);
+	if (job->normal) {
+	    //the Box-Muller transform turns each pair of uniform numbers into a pair of normal numbers. 1-u is in (0, 1] so the log is finite.
+	    for (size_t j = 0; j < m; ++j) {
+		lr[j] = 1 - u[2*j];
+		th[j] = 2*M_PI*u[2*j+1];
+	    }
+	    math_arr(lr, lr, m, log, VM_LOG);
+	    math_arr(s, th, m, sin, VM_SIN);
+	    math_arr(th, th, m, cos, VM_COS);
+	    for (size_t j = 0; j < m; ++j) {
+		double r = sqrt(-2*lr[j]);
+		u[2*j] = r*th[j];
+		u[2*j+1] = r*s[j];
+	    }
+	}
+	//the stream has an odd element left over if n is odd
+	size_t n_out = (job->n - 2*i < 2*m)? job->n - 2*i : 2*m;
+	memcpy(job->y + 2*i, u, sizeof(double)*n_out);
+    }
+}
+/**
+ * Implement rand(), randn() and uniform(). The shape is read from the arguments starting at first, and the random numbers are scaled to [lo, hi) or have standard deviation hi and mean lo if normal is set. The state of the generator is kept by the root instance, so draws continue the same stream for every scope.
+ */
+static inline spcl_val rng_call(struct spcl_inst* c, spcl_fn_call f, size_t first, double lo, double hi, int normal) {
+    while (c && c->parent)
+	c = c->parent;
+    if (!c)
+	return spcl_make_err(E_BAD_VALUE, "%.*s() must be called from an instance", f.name.n, f.name.s);
+    //the shape may be passed either as separate arguments or as a single list
+    size_t ndim = f.n_args - first;
+    const spcl_val* dims = f.args + first;
+    if (ndim == 1 && (dims->type == VAL_LIST || dims->type == VAL_ARRAY)) {
+	ndim = dims->n_els;
+	dims = (dims->type == VAL_LIST)? dims->val.l : NULL;
+    }
+    size_t* shape = xmalloc(sizeof(size_t)*ndim + 1);
+    size_t n = 1;
+    for (size_t d = 0; d < ndim; ++d) {
+	double x = (dims)? ((dims[d].type == VAL_NUM)? dims[d].val.x : -1) : f.args[first].val.a[d];
+	if (x < 0 || x != floor(x)) {
+	    xfree(shape);
+	    return spcl_make_err(E_BAD_VALUE, "%.*s() got invalid length for axis %lu", f.name.n, f.name.s, d);
+	}
+	shape[d] = (size_t)x;
+	n *= shape[d];
+    }
+    spcl_val ret = (ndim == 0)? spcl_make_num(0) : (ndim == 1)? alloc_array(n) : alloc_tensor(ndim, shape);
+    xfree(shape);
+    double* y = (ndim == 0)? &ret.val.x : (ndim == 1)? ret.val.a : ret.val.t->data;
+    //every call uses a fresh range of blocks, so results only depend on the seed and the order of the calls
+    rng_job job = {y, n, c->rng_ctr, c->rng_seed, normal};
+    c->rng_ctr += (n + 1)/2;
+    par_for((n + 1)/2, rng_range, &job);
+    for (size_t i = 0; i < n; ++i)
+	y[i] = (normal)? lo + hi*y[i] : lo + (hi - lo)*y[i];
+    return ret;
+}
+spcl_val spcl_rand(struct spcl_inst* c, spcl_fn_call f) {
+    return rng_call(c, f, 0, 0, 1, 0);
+}
+spcl_val spcl_randn(struct spcl_inst* c, spcl_fn_call f) {
+    return rng_call(c, f, 0, 0, 1, 1);
+}
+spcl_val spcl_uniform(struct spcl_inst* c, spcl_fn_call f) {
+    if (f.n_args < 2)
+	return spcl_make_err(E_LACK_TOKENS, "uniform() expected at least 2 arguments, got %lu", f.n_args);
+    if (f.args[0].type != VAL_NUM || f.args[1].type != VAL_NUM)
+	return spcl_make_err(E_BAD_TYPE, "uniform() expected numeric bounds, got %s and %s", valnames[f.args[0].type], valnames[f.args[1].type]);
+    return rng_call(c, f, 2, f.args[0].val.x, f.args[1].val.x, 0);
+}
+spcl_val spcl_seed(struct spcl_inst* c, spcl_fn_call f) {
+    static const valtype SEED_SIG[] = {VAL_NUM};
+    spcl_sigcheck(f, SEED_SIG);
+    double s = f.args[0].val.x;
+    if (s < 0 || s != floor(s) || s >= 0x1p64)
+	return spcl_make_err(E_BAD_VALUE, "seed() expected a non-negative integer, got %g", s);
+    while (c && c->parent)
+	c = c->parent;
+    if (!c)
+	return spcl_make_err(E_BAD_VALUE, "seed() must be called from an instance");
+    c->rng_seed = (unsigned long long)s;
+    c->rng_ctr = 0;
+    return spcl_make_none();
+}
 #define lcmp(c,l) ((c|0x20)==l) //macro that compares the character c against the lowercase letter l and returns whether they are equal ignoring case
 #define read_base(s, n) ( (n < 2 || s[0] != 0)? 10 : lcmp(s[1],'b')? 2 : lcmp(s[1],'o')? 8 : lcmp(s[1],'x')? 16 : 10 )
 /**
@@ -779,39 +4876,215 @@ spcl_val spcl_make_none() {
     spcl_val v;
     v.type = VAL_UNDEF;
     v.n_els = 0;
+    v.buf = NULL;
     v.val.x = 0;
     return v;
 }
 
+//errors with an empty message (e.g. from assert() without a message) don't need to store anything, so they are preallocated. This also means that out of memory errors never allocate.
+#define PREALLOC_ERR(CODE) {CODE, 0, "", "", 0, {{0}}}
+static spcl_error prealloc_errs[N_ERRORS] = {PREALLOC_ERR(E_SUCCESS), PREALLOC_ERR(E_NOFILE), PREALLOC_ERR(E_LACK_TOKENS), PREALLOC_ERR(E_BAD_SYNTAX), PREALLOC_ERR(E_BAD_VALUE), PREALLOC_ERR(E_BAD_TYPE), PREALLOC_ERR(E_NOMEM), PREALLOC_ERR(E_NAN), PREALLOC_ERR(E_UNDEF), PREALLOC_ERR(E_OUT_OF_RANGE), PREALLOC_ERR(E_ASSERT)};
+
+typedef struct conv_spec {
+    const char* start;	//the location of the '%'
+    const char* end;	//the location of the conversion character
+    int n_stars;	//the number of int arguments consumed by '*' fields
+    int is_long;
+    int prec;		//the precision or -1 if none was specified. -2 indicates that the precision is read from an argument
+} conv_spec;
+/**
+ * Find the next conversion specifier in the printf style format string fmt
+ * returns: 1 if a conversion was found and saved to cs or 0 otherwise
+ */
+static inline int next_conv(const char* fmt, conv_spec* cs) {
+    cs->start = strchr(fmt, '%');
+    if (!cs->start)
+	return 0;
+    cs->n_stars = 0;
+    cs->is_long = 0;
+    cs->prec = -1;
+    const char* p = cs->start+1;
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0')
+	++p;
+    if (*p == '*') {
+	++cs->n_stars;
+	++p;
+    }
+    while (*p >= '0' && *p <= '9')
+	++p;
+    if (*p == '.') {
+	++p;
+	if (*p == '*') {
+	    ++cs->n_stars;
+	    cs->prec = -2;
+	    ++p;
+	}
+	for (cs->prec = (cs->prec == -2)? -2 : 0; *p >= '0' && *p <= '9'; ++p)
+	    cs->prec = 10*cs->prec + (*p - '0');
+    }
+    for (; *p == 'l' || *p == 'z' || *p == 'j' || *p == 't' || *p == 'h'; ++p)
+	cs->is_long |= (*p != 'h');
+    cs->end = p;
+    return (*p != 0);
+}
+
 spcl_val spcl_make_err(parse_ercode code, const char* format, ...) {
-    spcl_val ret;
+    spcl_val ret = spcl_make_none();
     ret.type = VAL_ERR;
     //a nomemory error obviously won't be able to allocate any more memory
-    if (code == E_NOMEM) {
+    if (code == E_NOMEM)
 	fprintf(stderr, "kernel panic: out of memory!\n");
-	ret.val.e = NULL;
+    if (code == E_NOMEM || !format || format[0] == 0) {
+	ret.val.e = prealloc_errs + ((code < N_ERRORS)? code : E_SUCCESS);
 	return ret;
     }
-    ret.val.e = xmalloc(sizeof(struct spcl_error));
-    ret.val.e->c = code;
-    va_list args;
-    va_start(args, format);
-    int tmp = vsnprintf(ret.val.e->msg, ERR_BSIZE, format, args);
-    va_end(args);
-    ret.n_els = (tmp < 0)? ERR_BSIZE : (size_t)tmp;
+    //capture the arguments so that the message only needs to be formatted if somebody asks for it. Strings often point to temporary buffers, so we copy them into the same allocation as the error.
+    spcl_err_arg args[ERR_MAX_ARGS];
+    size_t str_lens[ERR_MAX_ARGS] = {0};
+    size_t n_args = 0, tot_len = 0;
+    conv_spec cs;
+    va_list va;
+    va_start(va, format);
+    for (const char* p = format; next_conv(p, &cs); p = cs.end+1) {
+	if (*cs.end == '%')
+	    continue;
+	if (n_args + cs.n_stars >= ERR_MAX_ARGS || !strchr("diucxXofFeEgGsp", *cs.end))
+	    break;
+	int prec = cs.prec;
+	for (int i = 0; i < cs.n_stars; ++i)
+	    prec = args[n_args++].i = va_arg(va, int);
+	if (cs.prec != -2)
+	    prec = cs.prec;
+	switch (*cs.end) {
+	case 'd': case 'i': case 'c': args[n_args].i = (cs.is_long)? va_arg(va, long) : va_arg(va, int);break;
+	case 'u': case 'x': case 'X': case 'o': args[n_args].u = (cs.is_long)? va_arg(va, unsigned long) : va_arg(va, unsigned);break;
+	case 'p': args[n_args].p = va_arg(va, const void*);break;
+	case 's': args[n_args].p = va_arg(va, const char*);
+		  if (args[n_args].p) {
+		      str_lens[n_args] = (prec >= 0)? strnlen(args[n_args].p, prec) : strlen(args[n_args].p);
+		      tot_len += str_lens[n_args]+1;
+		  }
+		  break;
+	default: args[n_args].x = va_arg(va, double);break;
+	}
+	++n_args;
+    }
+    va_end(va);
+    spcl_error* e = xmalloc(sizeof(spcl_error) + tot_len);
+    e->c = code;
+    e->n_refs = 1;
+    e->fmt = format;
+    e->msg = NULL;
+    e->n_args = n_args;
+    char* strs = (char*)(e+1);
+    for (size_t i = 0; i < n_args; ++i) {
+	e->args[i] = args[i];
+	if (str_lens[i]) {
+	    memcpy(strs, args[i].p, str_lens[i]);
+	    strs[str_lens[i]] = 0;
+	    e->args[i].p = strs;
+	    strs += str_lens[i]+1;
+	}
+    }
+    ret.val.e = e;
     return ret;
 }
 
+//format a single conversion with the '*' fields in w
+#define FMT_ARG(V) ( (cs.n_stars == 0)? snprintf(dst, rem, spec, V) : (cs.n_stars == 1)? snprintf(dst, rem, spec, w[0], V) : snprintf(dst, rem, spec, w[0], w[1], V) )
+const char* spcl_err_msg(spcl_val er) {
+    if (er.type != VAL_ERR || !er.val.e)
+	return "";
+    spcl_error* e = er.val.e;
+    if (e->msg)
+	return e->msg;
+    e->msg = xmalloc(ERR_BSIZE);
+    char spec[32];
+    size_t off = 0, k = 0;
+    conv_spec cs;
+    const char* p = e->fmt;
+    while (next_conv(p, &cs)) {
+	//stop if we ran out of arguments, in which case the rest of the format is copied verbatim
+	size_t spec_len = cs.end+1 - cs.start;
+	if (*cs.end != '%' && (k + cs.n_stars >= e->n_args || spec_len >= sizeof(spec)))
+	    break;
+	//copy everything before the conversion
+	size_t n = cs.start - p;
+	if (n > ERR_BSIZE-1-off)
+	    n = ERR_BSIZE-1-off;
+	memcpy(e->msg+off, p, n);
+	off += n;
+	p = cs.end+1;
+	if (*cs.end == '%') {
+	    if (off+1 < ERR_BSIZE)
+		e->msg[off++] = '%';
+	    continue;
+	}
+	memcpy(spec, cs.start, spec_len);
+	spec[spec_len] = 0;
+	int w[2] = {0, 0};
+	for (int i = 0; i < cs.n_stars; ++i)
+	    w[i] = (int)e->args[k++].i;
+	spcl_err_arg a = e->args[k++];
+	char* dst = e->msg+off;
+	size_t rem = ERR_BSIZE-off;
+	int tmp = 0;
+	switch (*cs.end) {
+	case 'd': case 'i': case 'c': tmp = (cs.is_long)? FMT_ARG(a.i) : FMT_ARG((int)a.i);break;
+	case 'u': case 'x': case 'X': case 'o': tmp = (cs.is_long)? FMT_ARG(a.u) : FMT_ARG((unsigned)a.u);break;
+	case 'p': tmp = FMT_ARG(a.p);break;
+	case 's': tmp = FMT_ARG((a.p)? (const char*)a.p : "(null)");break;
+	default: tmp = FMT_ARG(a.x);break;
+	}
+	if (tmp > 0)
+	    off += ((size_t)tmp < rem)? (size_t)tmp : rem-1;
+    }
+    size_t n = strlen(p);
+    if (n > ERR_BSIZE-1-off)
+	n = ERR_BSIZE-1-off;
+    memcpy(e->msg+off, p, n);
+    off += n;
+    e->msg[off] = 0;
+    return e->msg;
+}
+#undef FMT_ARG
+
 spcl_val spcl_make_num(double x) {
-    spcl_val v;
+    spcl_val v = spcl_make_none();
     v.type = VAL_NUM;
     v.n_els = 1;
     v.val.x = x;
     return v;
 }
 
+spcl_val spcl_make_int(long long i) {
+    spcl_val v = spcl_make_none();
+    v.type = VAL_INT;
+    v.n_els = 1;
+    v.val.i = i;
+    return v;
+}
+
+spcl_val spcl_make_complex(double re, double im) {
+    spcl_val v = spcl_make_none();
+    v.type = VAL_COMPLEX;
+    v.n_els = 1;
+    v.val.z[0] = re;
+    v.val.z[1] = im;
+    return v;
+}
+spcl_val spcl_make_vec(const double* vs, size_t n) {
+    if (n == 0 || n > SPCL_VEC_MAX)
+	return spcl_make_err(E_OUT_OF_RANGE, "small vectors must have between 1 and %d elements, got %lu", SPCL_VEC_MAX, n);
+    spcl_val v = spcl_make_none();
+    v.type = VAL_VEC;
+    v.n_els = n;
+    memcpy(v.val.v, vs, sizeof(double)*n);
+    return v;
+}
+
 spcl_val spcl_make_str(const char* s, size_t n) {
-    spcl_val v;
+    spcl_val v = spcl_make_none();
     v.type = VAL_STR;
     v.n_els = n;
     //we allocate one more than the actual length to null terminate
@@ -821,15 +5094,45 @@ spcl_val spcl_make_str(const char* s, size_t n) {
     return v;
 }
 spcl_val spcl_make_array(double* vs, size_t n) {
-    spcl_val v;
-    v.type = VAL_ARRAY;
-    v.n_els = n;
-    v.val.a = xmalloc(sizeof(double)*v.n_els);
+    spcl_val v = alloc_array(n);
     memcpy(v.val.a, vs, sizeof(double)*n);
     return v;
 }
+spcl_val spcl_make_iarray(const long long* vs, size_t n) {
+    spcl_val v = alloc_iarray(n);
+    memcpy(v.val.ia, vs, sizeof(long long)*n);
+    return v;
+}
+spcl_val spcl_make_typed_array(const void* vs, size_t n, valtype type) {
+    if (type != VAL_ARRAY && type != VAL_IARRAY && !is_typed(type))
+	return spcl_make_err(E_BAD_TYPE, "cannot make a typed array of %s", valnames[type]);
+    spcl_val v = alloc_typed(n, type);
+    memcpy(v.val.a, vs, el_size(type)*n);
+    return v;
+}
+spcl_val spcl_make_carray(const double* vs, size_t n) {
+    spcl_val v = alloc_carray(n);
+    memcpy(v.val.a, vs, sizeof(double)*2*n);
+    return v;
+}
+spcl_val spcl_make_mat(const double* vs, size_t rows, size_t cols) {
+    size_t shape[2] = {rows, cols};
+    return spcl_make_tensor(vs, 2, shape);
+}
+spcl_val spcl_make_tensor(const double* vs, size_t ndim, const size_t* shape) {
+    if (ndim == 0)
+	return spcl_make_num((vs)? vs[0] : 0);
+    spcl_val v = (ndim == 1)? alloc_array(shape[0]) : alloc_tensor(ndim, shape);
+    double* data = (ndim == 1)? v.val.a : v.val.t->data;
+    size_t n = (ndim == 1)? v.n_els : tensor_size(v.val.t);
+    if (vs)
+	memcpy(data, vs, sizeof(double)*n);
+    else
+	memset(data, 0, sizeof(double)*n);
+    return v;
+}
 spcl_val spcl_make_list(const spcl_val* vs, size_t n_vs) {
-    spcl_val v;
+    spcl_val v = spcl_make_none();
     v.type = VAL_LIST;
     v.n_els = n_vs;
     v.val.l = xmalloc(sizeof(spcl_val)*v.n_els);
@@ -837,14 +5140,14 @@ spcl_val spcl_make_list(const spcl_val* vs, size_t n_vs) {
     return v;
 }
 spcl_val spcl_make_fn(const char* name, size_t n_args, spcl_val (*p_exec)(spcl_inst*, spcl_fn_call)) {
-    spcl_val ret;
+    spcl_val ret = spcl_make_none();
     ret.type = VAL_FN;
     ret.n_els = n_args;
     ret.val.f = make_spcl_uf_ex(p_exec);
     return ret;
 }
 spcl_val spcl_make_inst(spcl_inst* parent, const char* s) {
-    spcl_val v;
+    spcl_val v = spcl_make_none();
     v.type = VAL_INST;
     v.val.c = make_spcl_inst(parent);
     if (s && s[0] != 0) {
@@ -853,7 +5156,68 @@ spcl_val spcl_make_inst(spcl_inst* parent, const char* s) {
     }
     return v;
 }
+/**
+ * Compare a and b where at least one of them is an integer, integer array or typed array. Integers are compared exactly with each other and by value with numbers.
+ */
+static inline spcl_val int_cmp(spcl_val a, spcl_val b) {
+    int a_arr = is_real_arr(a.type);
+    int b_arr = is_real_arr(b.type);
+    if (a_arr != b_arr || (!a_arr && (a.type != VAL_INT && a.type != VAL_NUM)) || (!b_arr && (b.type != VAL_INT && b.type != VAL_NUM)))
+	return spcl_make_err(E_BAD_VALUE, "cannot compare types %s and %s", valnames[a.type], valnames[b.type]);
+    if (!a_arr) {
+	if (a.type == VAL_INT && b.type == VAL_INT)
+	    return spcl_make_num((a.val.i > b.val.i) - (a.val.i < b.val.i));
+	return spcl_make_num(val_to_x(&a) - val_to_x(&b));
+    }
+    if (a.n_els != b.n_els)
+	return spcl_make_num((double)a.n_els - (double)b.n_els);
+    int exact = is_int_dtype(a.type) && is_int_dtype(b.type);
+    for (size_t i = 0; i < a.n_els; ++i) {
+	if (exact) {
+	    long long j = arr_geti(&a, i), k = arr_geti(&b, i);
+	    if (j != k)
+		return spcl_make_num((j > k) - (j < k));
+	    continue;
+	}
+	double x = arr_get(&a, i);
+	double y = arr_get(&b, i);
+	if (x != y)
+	    return spcl_make_num(x - y);
+    }
+    return spcl_make_num(0);
+}
 spcl_val spcl_valcmp(spcl_val a, spcl_val b) {
+    //small vectors are compared against vectors and arrays in place. Anything else is compared against the equivalent array.
+    if (a.type == VAL_VEC || b.type == VAL_VEC) {
+	if ((a.type == VAL_VEC || a.type == VAL_ARRAY) && (b.type == VAL_VEC || b.type == VAL_ARRAY)) {
+	    if (a.n_els != b.n_els)
+		return spcl_make_num((double)a.n_els - (double)b.n_els);
+	    const double* x = (a.type == VAL_VEC)? a.val.v : a.val.a;
+	    const double* y = (b.type == VAL_VEC)? b.val.v : b.val.a;
+	    for (size_t i = 0; i < a.n_els; ++i) {
+		if (x[i] != y[i])
+		    return spcl_make_num(x[i] - y[i]);
+	    }
+	    return spcl_make_num(0);
+	}
+	spcl_val tmp = vec_to_array((a.type == VAL_VEC)? &a : &b);
+	spcl_val ret = (a.type == VAL_VEC)? spcl_valcmp(tmp, b) : spcl_valcmp(a, tmp);
+	cleanup_spcl_val(&tmp);
+	return ret;
+    }
+    //complex numbers are ordered by their real parts and then by their imaginary parts. Real numbers may be compared against them.
+    if ((a.type == VAL_COMPLEX || b.type == VAL_COMPLEX) && (a.type == b.type || a.type == VAL_NUM || b.type == VAL_NUM || a.type == VAL_INT || b.type == VAL_INT)) {
+	double complex d = val_to_z(&a) - val_to_z(&b);
+	return spcl_make_num((creal(d) != 0)? creal(d) : cimag(d));
+    }
+    //dual numbers are compared by value, so that branches follow the point being differentiated
+    if ((a.type == VAL_DUAL || b.type == VAL_DUAL) && (a.type == b.type || a.type == VAL_NUM || b.type == VAL_NUM || a.type == VAL_INT || b.type == VAL_INT)) {
+	double x = (a.type == VAL_DUAL)? a.val.a[0] : val_to_x(&a);
+	double y = (b.type == VAL_DUAL)? b.val.a[0] : val_to_x(&b);
+	return spcl_make_num(x - y);
+    }
+    if (is_int(a.type) || is_int(b.type) || is_typed(a.type) || is_typed(b.type))
+	return int_cmp(a, b);
     if (a.type != b.type || a.type == VAL_ERR || b.type == VAL_ERR)
 	return spcl_make_err(E_BAD_VALUE, "cannot compare types %s and %s", valnames[a.type], valnames[b.type]);
     if (a.type == VAL_NUM) {
@@ -863,21 +5227,42 @@ spcl_val spcl_valcmp(spcl_val a, spcl_val b) {
     } else if (a.type == VAL_LIST) {
 	if (a.n_els != b.n_els)
 	    return spcl_make_num(a.n_els - b.n_els);
-	spcl_val tmp;
+	spcl_val tmp = spcl_make_none();
 	for (size_t i = 0; i < a.n_els; ++i) {
 	    tmp = spcl_valcmp(a.val.l[i], b.val.l[i]);
 	    if (tmp.val.x)
 		return tmp;
 	}
 	return spcl_make_num(0);
-    } else if (a.type == VAL_ARRAY) {
+    } else if (a.type == VAL_ARRAY || a.type == VAL_CARRAY) {
 	if (a.n_els != b.n_els)
 	    return spcl_make_num(a.n_els - b.n_els);
-	for (size_t i = 0; i < a.n_els; ++i) {
+	size_t n = (a.type == VAL_CARRAY)? 2*a.n_els : a.n_els;
+	for (size_t i = 0; i < n; ++i) {
 	    if (a.val.a[i] != b.val.a[i])
 		return spcl_make_num(a.val.a[i] - b.val.a[i]);
 	}
 	return spcl_make_num(0);
+    } else if (a.type == VAL_MAT) {
+	const spcl_tensor* at = a.val.t;
+	const spcl_tensor* bt = b.val.t;
+	if (at->ndim != bt->ndim)
+	    return spcl_make_num((double)at->ndim - (double)bt->ndim);
+	for (size_t d = 0; d < at->ndim; ++d) {
+	    if (at->shape[d] != bt->shape[d])
+		return spcl_make_num((double)at->shape[d] - (double)bt->shape[d]);
+	}
+	size_t n = at->shape[at->ndim-1];
+	psize as = at->strides[at->ndim-1], bs = bt->strides[bt->ndim-1];
+	for (size_t k = 0; k < tensor_rows(at); ++k) {
+	    const double* ra = tensor_row(at, k);
+	    const double* rb = tensor_row(bt, k);
+	    for (size_t j = 0; j < n; ++j) {
+		if (ra[(psize)j*as] != rb[(psize)j*bs])
+		    return spcl_make_num(ra[(psize)j*as] - rb[(psize)j*bs]);
+	    }
+	}
+	return spcl_make_num(0);
     }
     return spcl_make_none();
 }
@@ -890,10 +5275,19 @@ int spcl_val_str_cmp(spcl_val a, const char* b) {
 static inline size_t spcl_est_strlen(spcl_val v) {
     switch (v.type) {
 	case VAL_UNDEF: return strlen("none");
-	case VAL_ERR:	return v.n_els;
 	case VAL_NUM:	return MAX_NUM_SIZE;
 	case VAL_STR:	return v.n_els;
-	case VAL_ARRAY: return MAX_NUM_SIZE + 2*v.n_els + 3;
+	case VAL_ARRAY:
+	case VAL_DUAL:	return MAX_NUM_SIZE + 2*v.n_els + 3;
+	case VAL_VEC:	return (MAX_NUM_SIZE + 2)*v.n_els + 3;
+	case VAL_INT:	return MAX_INT_SIZE;
+	case VAL_IARRAY: return (MAX_INT_SIZE + 1)*v.n_els + 3;
+	case VAL_FARRAY: return (MAX_NUM_SIZE + 1)*v.n_els + 3;
+	case VAL_I32ARRAY: return 12*v.n_els + 3;
+	case VAL_U8ARRAY: return 4*v.n_els + 3;
+	case VAL_COMPLEX: return 2*MAX_NUM_SIZE + 2;
+	case VAL_CARRAY: return (2*MAX_NUM_SIZE + 3)*v.n_els + 3;
+	case VAL_MAT:	return (MAX_NUM_SIZE + 1)*tensor_size(v.val.t) + 4*tensor_rows(v.val.t)*v.val.t->ndim + 3;
 	case VAL_LIST:  size_t ret = 2*v.n_els + 3;
 			for (size_t i = 0; i < v.n_els; ++i)
 			    ret += spcl_est_strlen(v.val.l[i]);
@@ -901,39 +5295,129 @@ static inline size_t spcl_est_strlen(spcl_val v) {
 	default:	return strlen("<undefined at 0xffffffffffff>")+2;
     }
 }
+/**
+ * Write the complex number re + im*j to buf in the form 1.000000-2.000000j. Each part is truncated to MAX_NUM_SIZE characters, just like real numbers.
+ * returns: the number of characters that would have been written if n were large enough, as for snprintf
+ */
+static inline int write_complex(char* buf, size_t n, double re, double im) {
+    char parts[2][MAX_NUM_SIZE];
+    write_numeric(parts[0], MAX_NUM_SIZE, re);
+    write_numeric(parts[1], MAX_NUM_SIZE, im);
+    return snprintf(buf, n, "%s%s%sj", parts[0], (signbit(im))? "" : "+", parts[1]);
+}
+/**
+ * Copy the string s to buf, which has room for n characters including the null terminator, truncating it if necessary.
+ * returns: a pointer to the null terminator at the end of the copy
+ */
+static inline char* write_str(char* buf, size_t n, const char* s) {
+    if (n == 0)
+	return buf;
+    size_t len = strlen(s);
+    if (len >= n)
+	len = n-1;
+    memcpy(buf, s, len);
+    buf[len] = 0;
+    return buf+len;
+}
+/**
+ * Write the n_els numbers a[0], a[stride], ... to buf enclosed in curly braces
+ * cplx: if set, a holds complex numbers with the real and imaginary parts next to each other and stride counts complex elements
+ */
+static inline char* stringify_arr(const double* a, size_t n_els, psize stride, int cplx, char* buf, size_t n) {
+    size_t off = 1;
+    buf[0] = BEG_CRL;//}
+    for (size_t i = 0; i < n_els; ++i) {
+	size_t rem = n-off;
+	size_t max_rem = (cplx)? 2*MAX_NUM_SIZE+1 : MAX_NUM_SIZE;
+	if (rem > max_rem)
+	    rem = max_rem;
+	int tmp = (cplx)? write_complex(buf+off, rem, a[2*(psize)i*stride], a[2*(psize)i*stride+1]) : write_numeric(buf+off, rem, a[(psize)i*stride]);
+	if (tmp < 0) {
+	    buf[off] = 0;
+	    return buf+off;
+	}
+	if (tmp >= rem) {
+	    buf[n-1] = 0;
+	    return buf+n-1;
+	}
+	off += (size_t)tmp;
+	if (i+1 < n_els)
+	    buf[off++] = ',';
+    }
+    if (off >= 0 && off < n)
+	buf[off++] = END_CRL;
+    buf[off] = 0;
+    return buf+off;
+}
+/**
+ * Write the elements of the integer array or typed array v to buf enclosed in curly braces
+ */
+static inline char* stringify_typed(const spcl_val* v, char* buf, size_t n) {
+    size_t off = 1;
+    buf[0] = BEG_CRL;//}
+    for (size_t i = 0; i < v->n_els; ++i) {
+	size_t rem = n-off;
+	if (v->type == VAL_FARRAY && rem > MAX_NUM_SIZE)
+	    rem = MAX_NUM_SIZE;
+	int tmp = (v->type == VAL_FARRAY)? write_numeric(buf+off, rem, v->val.fa[i]) : snprintf(buf+off, rem, "%lld", arr_geti(v, i));
+	if (tmp < 0 || (size_t)tmp >= rem) {
+	    buf[n-1] = 0;
+	    return buf+n-1;
+	}
+	off += (size_t)tmp;
+	if (i+1 < v->n_els && off+1 < n)
+	    buf[off++] = ',';
+    }
+    if (off+1 < n)
+	buf[off++] = END_CRL;
+    buf[off] = 0;
+    return buf+off;
+}
+/**
+ * Write the sub-tensor of t with axes t->shape[axis...] starting at data to buf. The last axis is printed as an array and the rest are printed as lists.
+ */
+static inline char* stringify_tensor(const spcl_tensor* t, size_t axis, const double* data, char* buf, size_t n) {
+    if (axis+1 == t->ndim)
+	return stringify_arr(data, t->shape[axis], t->strides[axis], 0, buf, n);
+    size_t len = t->shape[axis];
+    if (len == 0)
+	return write_str(buf, n, "[]");
+    char* cur = buf+1;
+    buf[0] = BEG_SQR;
+    size_t elsize = (len >= MAX_PRINT_ELS)? n/MAX_PRINT_ELS - 5: n/len - 2;
+    if (elsize < 3)
+	return write_str(buf, n, "[...]");
+    for (size_t i = 0; i < len; ++i) {
+	cur = stringify_tensor(t, axis+1, data + (psize)i*t->strides[axis], cur, elsize);
+	if (i+1 < len)
+	    *cur++ = ',';
+	if (i == MAX_PRINT_ELS)
+	    return write_str(cur, (size_t)(buf+n-cur), "...]");
+    }
+    *cur++ = END_SQR;
+    return cur;
+}
 char* spcl_stringify(spcl_val v, char* buf, size_t n) {
     if (!buf || n < 3)
 	return buf;
     //exit if there isn't enough space to write the null terminator
     if (v.type == VAL_STR) {
-	//copy at most n_els
-	if (v.n_els < n)
-	    n = v.n_els;
-	return stpncpy(buf, v.val.s, n);
-    } else if (v.type == VAL_ARRAY) {
-	size_t off = 1;
-	buf[0] = BEG_CRL;//}
-	for (size_t i = 0; i < v.n_els; ++i) {
-	    size_t rem = n-off;
-	    if (rem > MAX_NUM_SIZE)
-		rem = MAX_NUM_SIZE;
-	    int tmp = write_numeric(buf+off, rem, v.val.a[i]);
-	    if (tmp < 0) {
-		buf[off] = 0;
-		return buf+off;
-	    }
-	    if (tmp >= rem) {
-		buf[n-1] = 0;
-		return buf+n-1;
-	    }
-	    off += (size_t)tmp;
-	    if (i+1 < v.n_els)
-		buf[off++] = ',';
-	}
-	if (off >= 0 && off < n)
-	    buf[off++] = END_CRL;
-	buf[off] = 0;
-	return buf+off;
+	//copy at most n_els, leaving room for the null terminator
+	char* end = stpncpy(buf, v.val.s, (v.n_els < n)? v.n_els : n-1);
+	*end = 0;
+	return end;
+    } else if (v.type == VAL_ARRAY || v.type == VAL_CARRAY || v.type == VAL_DUAL) {
+	return stringify_arr(v.val.a, v.n_els, 1, v.type == VAL_CARRAY, buf, n);
+    } else if (v.type == VAL_VEC) {
+	return stringify_arr(v.val.v, v.n_els, 1, 0, buf, n);
+    } else if (v.type == VAL_IARRAY || is_typed(v.type)) {
+	return stringify_typed(&v, buf, n);
+    } else if (v.type == VAL_INT) {
+	int tmp = snprintf(buf, n, "%lld", v.val.i);
+	return buf + ((tmp < 0)? 0 : ((size_t)tmp < n)? (size_t)tmp : n-1);
+    } else if (v.type == VAL_COMPLEX) {
+	int tmp = write_complex(buf, n, v.val.z[0], v.val.z[1]);
+	return buf + ((tmp < 0)? 0 : ((size_t)tmp < n)? (size_t)tmp : n-1);
     } else if (v.type == VAL_NUM) {
 	if (n > MAX_NUM_SIZE)
 	    n = MAX_NUM_SIZE;
@@ -943,21 +5427,29 @@ char* spcl_stringify(spcl_val v, char* buf, size_t n) {
 	    return buf;
 	}
 	return buf+(size_t)tmp;
+    } else if (v.type == VAL_MAT) {
+	//tensors are printed as nested lists of arrays. Leave room for the null terminator.
+	char* end = stringify_tensor(v.val.t, 0, v.val.t->data, buf, n-1);
+	*end = 0;
+	return end;
     } else if (v.type == VAL_LIST) {
+	if (v.n_els == 0)
+	    return write_str(buf, n, "[]");
 	char* cur = buf+1;
 	buf[0] = BEG_SQR;
 	size_t elsize = (v.n_els >= MAX_PRINT_ELS)? n/MAX_PRINT_ELS - 5: n/v.n_els - 2;
 	if (elsize < 3) {
-	    return stpncpy(buf, "[...]", strlen("[...]"));
+	    return write_str(buf, n, "[...]");
 	}
 	for (size_t i = 0; i < v.n_els; ++i) {
 	    cur = spcl_stringify(v.val.l[i], cur, elsize);
 	    if (i+1 < v.n_els)
 		*cur++ = ',';
 	    if (i == MAX_PRINT_ELS)
-		return stpncpy(cur, "...]", strlen("...]"));
+		return write_str(cur, (size_t)(buf+n-cur), "...]");
 	}
 	*cur++ = END_SQR;
+	*cur = 0;
 	return cur;
     } else if (v.type < N_VALTYPES) { 
 	int tmp = snprintf(buf, n, "<%s at %p>", valnames[v.type], v.val.s);
@@ -967,13 +5459,80 @@ char* spcl_stringify(spcl_val v, char* buf, size_t n) {
     return buf+tmp;
 }
 
+/**
+ * Find the shape of the tensor described by the nested lists v by following the first entry at each level.
+ * shape: if not NULL, the length of each axis is saved here
+ * returns: the number of axes
+ */
+static inline size_t list_shape(spcl_val v, size_t* shape) {
+    size_t ndim = 0;
+    while (v.type == VAL_LIST || v.type == VAL_ARRAY || v.type == VAL_MAT) {
+	if (v.type == VAL_MAT) {
+	    if (shape)
+		memcpy(shape+ndim, v.val.t->shape, sizeof(size_t)*v.val.t->ndim);
+	    return ndim + v.val.t->ndim;
+	}
+	if (shape)
+	    shape[ndim] = v.n_els;
+	++ndim;
+	if (v.type == VAL_ARRAY || v.n_els == 0)
+	    break;
+	v = v.val.l[0];
+    }
+    return ndim;
+}
+/**
+ * Copy the numbers in the nested lists v to dst in row-major order, checking that they match the axes t->shape[axis...]
+ * dst: the location to write to, which is advanced past the last element written
+ * returns: an error if v was ragged or had non-numeric entries
+ */
+static inline spcl_val fill_tensor(spcl_val v, const spcl_tensor* t, size_t axis, double** dst) {
+    if (axis == t->ndim) {
+	if (v.type != VAL_NUM && v.type != VAL_INT)
+	    return spcl_make_err(E_BAD_TYPE, "cannot cast list with non-numeric types to tensor");
+	*(*dst)++ = val_to_x(&v);
+	return spcl_make_none();
+    }
+    if (v.type == VAL_MAT) {
+	if (v.val.t->ndim != t->ndim - axis || memcmp(v.val.t->shape, t->shape+axis, sizeof(size_t)*v.val.t->ndim))
+	    return spcl_make_err(E_BAD_VALUE, "can't create tensor from ragged array");
+	tensor_gather(v.val.t, *dst);
+	*dst += tensor_size(v.val.t);
+	return spcl_make_none();
+    }
+    if (v.type != VAL_LIST && v.type != VAL_ARRAY)
+	return spcl_make_err(E_BAD_TYPE, "non list encountered in tensor");
+    if (v.n_els != t->shape[axis] || (v.type == VAL_ARRAY && axis+1 != t->ndim))
+	return spcl_make_err(E_BAD_VALUE, "can't create tensor from ragged array");
+    if (v.type == VAL_ARRAY) {
+	memcpy(*dst, v.val.a, sizeof(double)*v.n_els);
+	*dst += v.n_els;
+	return spcl_make_none();
+    }
+    for (size_t i = 0; i < v.n_els; ++i) {
+	spcl_val er = fill_tensor(v.val.l[i], t, axis+1, dst);
+	if (er.type == VAL_ERR)
+	    return er;
+    }
+    return spcl_make_none();
+}
+
 spcl_val spcl_cast(spcl_val v, valtype t) {
     if (v.type == VAL_UNDEF)
 	return spcl_make_err(E_BAD_TYPE, "cannot cast <undefined> to <%s>", valnames[t]);
     //trivial casts should just be copies
     if (v.type == t)
 	return copy_spcl_val(v);
-    spcl_val ret;
+    //small vectors are cast like the equivalent array
+    if (v.type == VAL_VEC) {
+	spcl_val arr = vec_to_array(&v);
+	if (t == VAL_ARRAY)
+	    return arr;
+	spcl_val ret = spcl_cast(arr, t);
+	cleanup_spcl_val(&arr);
+	return ret;
+    }
+    spcl_val ret = spcl_make_none();
     ret.type = t;
     ret.n_els = v.n_els;
     if (t == VAL_LIST) {
@@ -982,6 +5541,21 @@ spcl_val spcl_cast(spcl_val v, valtype t) {
 	    for (size_t i = 0; i < ret.n_els; ++i)
 		ret.val.l[i] = spcl_make_num(v.val.a[i]);
 	    return ret;
+	} else if (v.type == VAL_CARRAY) {
+	    ret.val.l = xmalloc(sizeof(spcl_val)*ret.n_els);
+	    for (size_t i = 0; i < ret.n_els; ++i)
+		ret.val.l[i] = spcl_make_complex(v.val.a[2*i], v.val.a[2*i+1]);
+	    return ret;
+	} else if (is_int_dtype(v.type)) {
+	    ret.val.l = xmalloc(sizeof(spcl_val)*ret.n_els);
+	    for (size_t i = 0; i < ret.n_els; ++i)
+		ret.val.l[i] = spcl_make_int(arr_geti(&v, i));
+	    return ret;
+	} else if (v.type == VAL_FARRAY) {
+	    ret.val.l = xmalloc(sizeof(spcl_val)*ret.n_els);
+	    for (size_t i = 0; i < ret.n_els; ++i)
+		ret.val.l[i] = spcl_make_num(v.val.fa[i]);
+	    return ret;
 	} else if (v.type == VAL_INST) {
 	    //instance -> list
 	    ret.n_els = v.val.c->n_memb;
@@ -992,45 +5566,107 @@ spcl_val spcl_cast(spcl_val v, valtype t) {
 	    ret.n_els = v.n_els;
 	    return ret;
 	} else if (v.type == VAL_MAT) {
-	    //matrices are basically just an alias for lists
-	    ret = copy_spcl_val(v);
-	    ret.type = t;
+	    //tensor -> list of entries along the first axis. These are views which share storage with v
+	    const spcl_tensor* vt = v.val.t;
+	    ret.val.l = xmalloc(sizeof(spcl_val)*ret.n_els);
+	    for (size_t i = 0; i < ret.n_els; ++i)
+		ret.val.l[i] = tensor_view(vt, 1, vt->data + (psize)i*vt->strides[0], v.buf);
 	    return ret;
 	}
     } else if (t == VAL_MAT) {
 	if (v.type == VAL_LIST) {
-	    ret.val.l = xmalloc(sizeof(spcl_val)*ret.n_els);
-	    for (size_t i = 0; i < ret.n_els; ++i) {
-		//first try making the element an array
-		spcl_val tmp = spcl_cast(v.val.l[i], VAL_ARRAY);
-		if (tmp.type == VAL_ERR) {
-		    //if that doesn't work try making it a matrix
-		    cleanup_spcl_val(&tmp);
-		    tmp = spcl_cast(v.val.l[i], VAL_MAT);
-		    if (tmp.type == VAL_ERR) {
-			//if both of those failed, give up
-			xfree(ret.val.l);
-			return tmp;
-		    }
-		}
-		ret.val.l[i] = tmp;
+	    //nested lists -> tensor. The innermost level may consist of numeric lists, arrays or tensors
+	    size_t ndim = list_shape(v, NULL);
+	    if (ndim < 2)
+		return spcl_make_err(E_BAD_TYPE, "non list encountered in tensor");
+	    size_t* shape = xmalloc(sizeof(size_t)*ndim);
+	    list_shape(v, shape);
+	    ret = alloc_tensor(ndim, shape);
+	    xfree(shape);
+	    double* dst = ret.val.t->data;
+	    spcl_val er = fill_tensor(v, ret.val.t, 0, &dst);
+	    if (er.type == VAL_ERR) {
+		cleanup_spcl_val(&ret);
+		return er;
 	    }
 	    return ret;
 	}
     } else if (t == VAL_ARRAY) {
 	if (v.type == VAL_LIST) {
 	    //list -> array
-	    ret.n_els = v.n_els;
-	    ret.val.a = xmalloc(sizeof(double)*ret.n_els);
+	    ret = alloc_array(v.n_els);
+	    for (size_t i = 0; i < ret.n_els; ++i) {
+		if (v.val.l[i].type != VAL_NUM && v.val.l[i].type != VAL_INT) {
+		    cleanup_spcl_val(&ret);
+		    return spcl_make_err(E_BAD_TYPE, "cannot cast list with non-numeric types to array");
+		}
+		ret.val.a[i] = val_to_x(v.val.l + i);
+	    }
+	    return ret;
+	} else if (v.type == VAL_IARRAY || is_typed(v.type)) {
+	    return to_f64(v);
+	}
+    } else if (t == VAL_IARRAY && is_typed(v.type)) {
+	return convert_arr(&v, t);
+    } else if (t == VAL_IARRAY) {
+	if (v.type == VAL_LIST || v.type == VAL_ARRAY) {
+	    //list or array -> integer array, rounding towards zero
+	    ret = alloc_iarray(v.n_els);
+	    for (size_t i = 0; i < ret.n_els; ++i) {
+		const spcl_val* el = (v.type == VAL_LIST)? v.val.l + i : NULL;
+		if (el && el->type == VAL_INT) {
+		    ret.val.ia[i] = el->val.i;
+		    continue;
+		}
+		double x = (el)? el->val.x : v.val.a[i];
+		if ((el && el->type != VAL_NUM) || !(fabs(x) < 0x1p63)) {
+		    cleanup_spcl_val(&ret);
+		    return (el && el->type != VAL_NUM)? spcl_make_err(E_BAD_TYPE, "cannot cast list with non-numeric types to integer array") : spcl_make_err(E_BAD_VALUE, "cannot convert %f to an integer", x);
+		}
+		ret.val.ia[i] = (long long)x;
+	    }
+	    return ret;
+	}
+    } else if (is_typed(t)) {
+	if (is_real_arr(v.type))
+	    return convert_arr(&v, t);
+	if (v.type == VAL_LIST) {
+	    //lists are read exactly as integer arrays when the target type is an integer type
+	    spcl_val tmp = spcl_cast(v, (is_int_dtype(t))? VAL_IARRAY : VAL_ARRAY);
+	    if (tmp.type == VAL_ERR)
+		return tmp;
+	    ret = convert_arr(&tmp, t);
+	    cleanup_spcl_val(&tmp);
+	    return ret;
+	}
+    } else if (t == VAL_INT) {
+	if (v.type == VAL_NUM) {
+	    if (!(fabs(v.val.x) < 0x1p63))
+		return spcl_make_err(E_BAD_VALUE, "cannot convert %f to an integer", v.val.x);
+	    return spcl_make_int((long long)v.val.x);
+	}
+    } else if (t == VAL_NUM) {
+	if (v.type == VAL_INT)
+	    return spcl_make_num((double)v.val.i);
+    } else if (t == VAL_CARRAY) {
+	if (v.type == VAL_LIST || v.type == VAL_ARRAY) {
+	    //list or real array -> complex array
+	    ret = alloc_carray(v.n_els);
 	    for (size_t i = 0; i < ret.n_els; ++i) {
-		if (v.val.l[i].type != VAL_NUM) {
-		    xfree(ret.val.a);
+		const spcl_val* el = (v.type == VAL_LIST)? v.val.l + i : NULL;
+		if (el && el->type != VAL_NUM && el->type != VAL_COMPLEX && el->type != VAL_INT) {
+		    cleanup_spcl_val(&ret);
 		    return spcl_make_err(E_BAD_TYPE, "cannot cast list with non-numeric types to array");
 		}
-		ret.val.a[i] = v.val.l[i].val.x;
+		double complex z = (el)? val_to_z(el) : v.val.a[i];
+		ret.val.a[2*i] = creal(z);
+		ret.val.a[2*i+1] = cimag(z);
 	    }
 	    return ret;
 	}
+    } else if (t == VAL_COMPLEX) {
+	if (v.type == VAL_NUM || v.type == VAL_INT)
+	    return spcl_make_complex(val_to_x(&v), 0);
     } else if (t == VAL_STR) {
 	//anything -> string
 	ret.val.s = xmalloc(sizeof(char)*SPCL_STR_BSIZE);
@@ -1045,15 +5681,20 @@ spcl_val spcl_cast(spcl_val v, valtype t) {
 
 void cleanup_spcl_val(spcl_val* v) {
     if (v->type == VAL_ERR) {
-	xfree(v->val.e);
-    } else if ((v->type == VAL_STR && v->val.s) || (v->type == VAL_ARRAY && v->val.a)) {
-	xfree(v->val.s);
-    } else if ((v->type == VAL_LIST || v->type == VAL_MAT) && v->val.l) {
+	//errors are shared between copies
+	if (v->val.e && v->val.e->n_refs && --v->val.e->n_refs == 0) {
+	    xfree(v->val.e->msg);
+	    xfree(v->val.e);
+	}
+    } else if ((v->type == VAL_STR && v->val.s) || ((v->type == VAL_ARRAY || v->type == VAL_CARRAY || v->type == VAL_DUAL || is_int_dtype(v->type) || is_typed(v->type)) && v->val.a)) {
+	release_data(v, v->val.s);
+    } else if (v->type == VAL_LIST && v->val.l) {
 	for (size_t i = 0; i < v->n_els; ++i)
 	    cleanup_spcl_val(v->val.l + i);
-	xfree(v->val.l);
-    } else if (v->type == VAL_ARRAY && v->val.a) {
-	xfree(v->val.a);
+	release_data(v, v->val.l);
+    } else if (v->type == VAL_MAT && v->val.t) {
+	release_data(v, v->val.t->data);
+	xfree(v->val.t);
     } else if (v->type == VAL_INST && v->val.c) {
 	destroy_spcl_inst(v->val.c);
     } else if (v->type == VAL_FN && v->val.f) {
@@ -1062,112 +5703,536 @@ void cleanup_spcl_val(spcl_val* v) {
     v->type = VAL_UNDEF;
     v->val.x = 0;
     v->n_els = 0;
+    v->buf = NULL;
+}
+
+spcl_val copy_spcl_val(const spcl_val o) {
+    spcl_val ret = spcl_make_none();
+    ret.type = o.type;
+    ret.n_els = o.n_els;
+    //strings or lists must be copied, while arrays and tensors share their buffer until one of the copies is modified
+    switch (o.type) {
+	case VAL_ERR:	ret.val.e = o.val.e; if (o.val.e && o.val.e->n_refs) ++o.val.e->n_refs; break;
+	//case VAL_STR:	ret.val.s = xmalloc(o.n_els); strncpy(ret.val.s, o.val.s, o.n_els); break;
+	case VAL_STR:	ret.val.s = xmalloc(o.n_els+1); memcpy(ret.val.s, o.val.s, o.n_els); ret.val.s[o.n_els] = 0; break;
+	case VAL_ARRAY:
+	case VAL_CARRAY:
+	case VAL_IARRAY:
+	case VAL_FARRAY:
+	case VAL_I32ARRAY:
+	case VAL_U8ARRAY:
+	case VAL_DUAL:	if (!o.buf) {
+			    ret = alloc_typed(o.n_els, o.type);
+			    if (o.n_els)
+				memcpy(ret.val.a, o.val.a, el_size(o.type)*o.n_els);
+			    break;
+			}
+			ret.val.a = o.val.a; ret.buf = o.buf; ++o.buf->n_refs;
+			break;
+	case VAL_LIST:	ret.val.l = xmalloc(sizeof(spcl_val)*o.n_els);
+			for (size_t i = 0; i < o.n_els; ++i) ret.val.l[i] = copy_spcl_val(o.val.l[i]);
+			break;
+	case VAL_MAT:	if (!o.buf) {
+			    ret = alloc_tensor(o.val.t->ndim, o.val.t->shape);
+			    tensor_gather(o.val.t, ret.val.t->data);
+			    break;
+			}
+			ret.val.t = alloc_tensor_desc(o.val.t->ndim);
+			memcpy(ret.val.t->shape, o.val.t->shape, sizeof(size_t)*o.val.t->ndim);
+			memcpy(ret.val.t->strides, o.val.t->strides, sizeof(psize)*o.val.t->ndim);
+			ret.val.t->data = o.val.t->data;
+			ret.buf = o.buf; ++o.buf->n_refs;
+			break;
+	case VAL_INST:	ret.val.c = copy_spcl_inst(o.val.c); break;
+	case VAL_FN:	ret.val.f = copy_spcl_uf(o.val.f); break;
+	default:	ret.val = o.val; break;
+    }
+    return ret;
+}
+
+/**
+ * swap the spcl_vals stored at a and b
+ */
+void swap_val(spcl_val* a, spcl_val* b) {
+    //swap type and number of elements
+    valtype tmp = a->type;
+    a->type = b->type;
+    b->type = tmp;
+    size_t tmp_n = a->n_els;
+    a->n_els = b->n_els;
+    b->n_els = tmp_n;
+    struct spcl_buf* tmp_buf = a->buf;
+    a->buf = b->buf;
+    b->buf = tmp_buf;
+    union V tmp_v = a->val;
+    a->val = b->val;
+    b->val = tmp_v;
+}
+
+/**
+ * Apply the elementwise arithmetic operation op to the scalar y and the array x[n], overwriting x. This is the same as arr_op_scalar() with the operands swapped.
+ */
+static inline void arr_op_rscalar(double* x, double y, size_t n, char op) {
+    switch (op) {
+    case '+': for (size_t i = 0; i < n; ++i) x[i] = y + x[i];break;
+    case '-': for (size_t i = 0; i < n; ++i) x[i] = y - x[i];break;
+    case '*': for (size_t i = 0; i < n; ++i) x[i] = y * x[i];break;
+    case '/': for (size_t i = 0; i < n; ++i) x[i] = y / x[i];break;
+    case '%': for (size_t i = 0; i < n; ++i) x[i] = y - floor(y/x[i])*x[i];break;
+    case '^': for (size_t i = 0; i < n; ++i) x[i] = pow(y, x[i]);break;
+    }
+}
+/**
+ * Apply the elementwise arithmetic operation op to x[i*sx] and y[i*sy] for each i < n, overwriting x. This is the slow path for data which isn't contiguous.
+ */
+static inline void arr_op_strided(double* x, psize sx, const double* y, psize sy, size_t n, char op) {
+    for (size_t i = 0; i < n; ++i) {
+	double* a = x + (psize)i*sx;
+	double b = y[(psize)i*sy];
+	switch (op) {
+	case '+': *a += b;break;
+	case '-': *a -= b;break;
+	case '*': *a *= b;break;
+	case '/': *a /= b;break;
+	case '%': *a -= floor(*a/b)*b;break;
+	case '^': *a = pow(*a, b);break;
+	}
+    }
+}
+/**
+ * Apply the elementwise arithmetic operation op to x[i*sx] and y[i*sy] for each i < n, overwriting x. If op is '=', then y is copied to x. The common stride patterns are dispatched to the contiguous kernels.
+ */
+static inline void span_op(double* x, psize sx, const double* y, psize sy, size_t n, char op) {
+    if (op == '=') {
+	if (sx == 1 && sy == 1) {
+	    memcpy(x, y, sizeof(double)*n);
+	} else {
+	    for (size_t i = 0; i < n; ++i)
+		x[(psize)i*sx] = y[(psize)i*sy];
+	}
+    } else if (sx == 1 && sy == 1) {
+	arr_op(x, y, n, op);
+    } else if (sx == 1 && sy == 0) {
+	arr_op_scalar(x, *y, n, op);
+    } else {
+	arr_op_strided(x, sx, y, sy, n, op);
+    }
+}
+//read the shape and strides of the number, array or tensor v and a pointer to its first element. Returns the number of axes.
+static inline size_t val_axes(const spcl_val* v, const size_t** shape, const psize** strides, double** data) {
+    static const psize UNIT_STRIDE = 1;
+    switch (v->type) {
+    case VAL_ARRAY: *shape = &v->n_els; *strides = &UNIT_STRIDE; *data = v->val.a; return 1;
+    case VAL_MAT: *shape = v->val.t->shape; *strides = v->val.t->strides; *data = v->val.t->data; return v->val.t->ndim;
+    default: *shape = NULL; *strides = NULL; *data = (double*)&v->val.x; return 0;
+    }
+}
+/**
+ * Find the shape that results from broadcasting l and r together. Axes are matched starting from the last, and an axis with length one (or which is missing) is repeated to match the other operand.
+ * shape: a buffer with room for as many axes as the larger operand. The result is saved here.
+ * ndim: the number of axes in the result
+ * returns: an error if the shapes are incompatible
+ */
+static inline spcl_val bcast_shape(const spcl_val* l, const spcl_val* r, char op, size_t* shape, size_t* ndim) {
+    const size_t *l_shape, *r_shape;
+    const psize *l_strides, *r_strides;
+    double *l_data, *r_data;
+    size_t l_ndim = val_axes(l, &l_shape, &l_strides, &l_data);
+    size_t r_ndim = val_axes(r, &r_shape, &r_strides, &r_data);
+    *ndim = (l_ndim > r_ndim)? l_ndim : r_ndim;
+    for (size_t d = 0; d < *ndim; ++d) {
+	size_t nl = (d + l_ndim >= *ndim)? l_shape[d + l_ndim - *ndim] : 1;
+	size_t nr = (d + r_ndim >= *ndim)? r_shape[d + r_ndim - *ndim] : 1;
+	if (nl != nr && nl != 1 && nr != 1)
+	    return spcl_make_err(E_OUT_OF_RANGE, "cannot apply %c to operands with lengths %lu and %lu along axis %lu", op, nl, nr, d);
+	shape[d] = (nl == 1)? nr : nl;
+    }
+    return spcl_make_none();
+}
+/**
+ * Apply op elementwise to x and y where y is broadcast to the shape of x. Axes of y with length one (or which are missing) get a stride of zero so that they are never copied.
+ * ndim, shape: the shape of x
+ */
+static inline void bcast_apply(size_t ndim, const size_t* shape, spcl_val* x, const spcl_val* y, char op) {
+    const size_t *x_shape, *y_shape;
+    const psize *x_strides, *y_strides;
+    double *xd, *yd;
+    val_axes(x, &x_shape, &x_strides, &xd);
+    size_t y_ndim = val_axes(y, &y_shape, &y_strides, &yd);
+    if (ndim == 0) {
+	span_op(xd, 1, yd, 0, 1, op);
+	return;
+    }
+    size_t* n = xmalloc(ndim*(2*sizeof(size_t) + 2*sizeof(psize)));
+    size_t* idx = n + ndim;
+    psize* xs = (psize*)(idx + ndim);
+    psize* ys = xs + ndim;
+    //merge consecutive axes which both operands step through uniformly so that the innermost loop is as long as possible. Contiguous operands with the same shape are reduced to a single span.
+    size_t k = 0;
+    for (size_t d = 0; d < ndim; ++d) {
+	psize sx = (shape[d] == 1)? 0 : x_strides[d];
+	psize sy = (d + y_ndim < ndim || y_shape[d + y_ndim - ndim] == 1)? 0 : y_strides[d + y_ndim - ndim];
+	if (d > 0 && xs[k] == sx*(psize)shape[d] && ys[k] == sy*(psize)shape[d]) {
+	    n[k] *= shape[d];
+	} else {
+	    if (d > 0)
+		++k;
+	    n[k] = shape[d];
+	}
+	xs[k] = sx;
+	ys[k] = sy;
+	idx[k] = 0;
+    }
+    size_t rows = 1;
+    for (size_t d = 0; d < k; ++d)
+	rows *= n[d];
+    for (size_t j = 0; j < rows; ++j) {
+	span_op(xd, xs[k], yd, ys[k], n[k], op);
+	//advance to the next span, carrying over to outer axes
+	for (size_t d = k; d > 0; --d) {
+	    xd += xs[d-1];
+	    yd += ys[d-1];
+	    if (++idx[d-1] < n[d-1])
+		break;
+	    xd -= xs[d-1]*(psize)n[d-1];
+	    yd -= ys[d-1]*(psize)n[d-1];
+	    idx[d-1] = 0;
+	}
+    }
+    xfree(n);
+}
+/**
+ * Apply the elementwise arithmetic operation op to the numbers, arrays or tensors l and r, overwriting l. The operands are broadcast against each other as in numpy, so that e.g. a row vector can be added to each row of a matrix without copying it. l is modified in place if it already has the shape of the result.
+ */
+static inline void broadcast_op(spcl_val* l, spcl_val r, char op) {
+    size_t l_ndim = (l->type == VAL_MAT)? l->val.t->ndim : (l->type == VAL_ARRAY);
+    size_t r_ndim = (r.type == VAL_MAT)? r.val.t->ndim : (r.type == VAL_ARRAY);
+    size_t ndim;
+    size_t* shape = xmalloc(sizeof(size_t)*((l_ndim > r_ndim)? l_ndim : r_ndim));
+    spcl_val er = bcast_shape(l, &r, op, shape, &ndim);
+    if (er.type == VAL_ERR) {
+	cleanup_spcl_val(l);
+	*l = er;
+    } else if (ndim == l_ndim && (ndim == 0 || !memcmp(shape, (l->type == VAL_ARRAY)? &l->n_els : l->val.t->shape, sizeof(size_t)*ndim))) {
+	make_unique(l);
+	bcast_apply(ndim, shape, l, &r, op);
+    } else {
+	//write the left operand broadcast to the shape of the result into a new buffer, then apply the right operand
+	spcl_val ret = (ndim == 1)? alloc_array(shape[0]) : alloc_tensor(ndim, shape);
+	bcast_apply(ndim, shape, &ret, l, '=');
+	bcast_apply(ndim, shape, &ret, &r, op);
+	cleanup_spcl_val(l);
+	*l = ret;
+    }
+    xfree(shape);
+}
+/**
+ * Raise a to the power b. Small integer exponents use repeated squaring, just like real numbers.
+ */
+static inline double complex zpow(double complex a, double complex b) {
+    if (cimag(b) != 0 || !is_powi(creal(b)))
+	return cpow(a, b);
+    long k = (long)creal(b);
+    double complex r = 1;
+    for (unsigned long m = (k < 0)? -k : k; m; m >>= 1) {
+	if (m & 1)
+	    r *= a;
+	a *= a;
+    }
+    return (k < 0)? 1/r : r;
+}
+static inline double complex zapply(double complex a, double complex b, char op) {
+    switch (op) {
+    case '+': return a + b;
+    case '-': return a - b;
+    //written out so that the compiler can vectorize it instead of calling the fully IEEE compliant library routine
+    case '*': return CMPLX(creal(a)*creal(b) - cimag(a)*cimag(b), creal(a)*cimag(b) + cimag(a)*creal(b));
+    case '/': return a / b;
+    case '^': return zpow(a, b);
+    }
+    return a;
+}
+/**
+ * Apply the elementwise arithmetic operation op to the complex array x[n] and y[i*sy], overwriting x. Addition and subtraction of arrays and scaling by a real number treat the interleaved parts as a real array, so they use the simd kernels.
+ * rev: if set, y is the left operand
+ */
+static inline void zarr_op(double complex* x, const double complex* y, psize sy, size_t n, char op, int rev) {
+    if ((op == '+' || op == '-') && sy == 1 && !rev) {
+	arr_op((double*)x, (const double*)y, 2*n, op);
+	return;
+    }
+    if ((op == '*' || (op == '/' && !rev)) && sy == 0 && cimag(*y) == 0) {
+	arr_op_scalar((double*)x, creal(*y), 2*n, op);
+	return;
+    }
+    for (size_t i = 0; i < n; ++i) {
+	double complex b = y[(psize)i*sy];
+	x[i] = (rev)? zapply(b, x[i], op) : zapply(x[i], b, op);
+    }
+}
+/**
+ * Convert the number or array v to a complex number or complex array in place. Complex arrays are made unique so that they may be modified.
+ */
+static inline void promote_complex(spcl_val* v) {
+    if (v->type == VAL_NUM || v->type == VAL_UNDEF) {
+	*v = spcl_make_complex((v->type == VAL_NUM)? v->val.x : 0, 0);
+    } else if (v->type == VAL_ARRAY) {
+	spcl_val ret = alloc_carray(v->n_els);
+	for (size_t i = 0; i < v->n_els; ++i) {
+	    ret.val.a[2*i] = v->val.a[i];
+	    ret.val.a[2*i+1] = 0;
+	}
+	cleanup_spcl_val(v);
+	*v = ret;
+    } else {
+	make_unique(v);
+    }
+}
+//check whether values of type t may be used with complex_op()
+static inline int is_complex_operand(valtype t) {
+    return t == VAL_NUM || t == VAL_ARRAY || t == VAL_COMPLEX || t == VAL_CARRAY;
+}
+/**
+ * Apply the arithmetic operation op to l and r where at least one of them is complex, overwriting l. Real operands are promoted to complex. Arrays must have the same length unless one of them has a single element, which is then repeated. Complex tensors aren't supported.
+ */
+static inline void complex_op(spcl_val* l, spcl_val r, char op) {
+    //an undefined left operand is a unary sign
+    int l_ok = is_complex_operand(l->type) || (l->type == VAL_UNDEF && (op == '+' || op == '-'));
+    size_t nl = (l->type == VAL_ARRAY || l->type == VAL_CARRAY)? l->n_els : 0;
+    size_t nr = (r.type == VAL_ARRAY || r.type == VAL_CARRAY)? r.n_els : 0;
+    spcl_val er = spcl_make_none();
+    if (op == '%' || !l_ok || !is_complex_operand(r.type))
+	er = spcl_make_err(E_BAD_TYPE, "cannot apply %c to types %s and %s", op, valnames[l->type], valnames[r.type]);
+    else if (nl && nr && nl != nr && nl != 1 && nr != 1)
+	er = spcl_make_err(E_OUT_OF_RANGE, "cannot apply %c to operands with lengths %lu and %lu", op, nl, nr);
+    if (er.type == VAL_ERR) {
+	cleanup_spcl_val(l);
+	*l = er;
+	return;
+    }
+    spcl_val tmp = spcl_make_none();
+    if (r.type == VAL_ARRAY) {
+	tmp = copy_spcl_val(r);
+	promote_complex(&tmp);
+	r = tmp;
+    }
+    double complex rz = val_to_z(&r);
+    const double complex* y = (r.type == VAL_CARRAY)? (const double complex*)r.val.a : &rz;
+    psize sy = (r.type == VAL_CARRAY && r.n_els != 1);
+    promote_complex(l);
+    if (l->type == VAL_CARRAY && (nl != 1 || nr <= 1)) {
+	zarr_op((double complex*)l->val.a, y, sy, l->n_els, op, 0);
+    } else if (nr == 0) {
+	double complex z = zapply(val_to_z(l), rz, op);
+	*l = spcl_make_complex(creal(z), cimag(z));
+    } else {
+	//repeat the single element on the left for each element on the right
+	double complex lz = (l->type == VAL_CARRAY)? *(double complex*)l->val.a : val_to_z(l);
+	spcl_val ret = alloc_carray(nr);
+	memcpy(ret.val.a, r.val.a, sizeof(double complex)*nr);
+	zarr_op((double complex*)ret.val.a, &lz, 0, nr, op, 1);
+	cleanup_spcl_val(l);
+	*l = ret;
+    }
+    cleanup_spcl_val(&tmp);
+}
+//check whether values of type t can be used with broadcast_op()
+static inline int is_numeric(valtype t) {
+    return t == VAL_NUM || t == VAL_ARRAY || t == VAL_MAT;
+}
+static inline int is_complex(valtype t) {
+    return t == VAL_COMPLEX || t == VAL_CARRAY;
+}
+/**
+ * Integer arithmetic is performed on unsigned values so that overflow wraps instead of being undefined.
+ */
+static inline long long ipow(long long a, long long b) {
+    unsigned long long r = 1, x = (unsigned long long)a;
+    for (; b > 0; b >>= 1, x *= x) {
+	if (b & 1)
+	    r *= x;
+    }
+    return (long long)r;
+}
+static inline long long iapply(long long a, long long b, char op) {
+    switch (op) {
+    case '+': return (long long)((unsigned long long)a + (unsigned long long)b);
+    case '-': return (long long)((unsigned long long)a - (unsigned long long)b);
+    case '*': return (long long)((unsigned long long)a * (unsigned long long)b);
+    //the result has the same sign as b, matching the convention for numbers
+    case '%': {
+	if (b == -1)
+	    return 0;
+	long long m = a % b;
+	return (m && (m < 0) != (b < 0))? m + b : m;
+    }
+    case '^': return ipow(a, b);
+    default: return 0;
+    }
+}
+/**
+ * Apply op elementwise to x[i] and y[i*sy] for each i < n, overwriting x. sy=0 repeats a single element of y.
+ * rev: if set, y is the left operand
+ */
+static inline void iarr_op(long long* x, const long long* y, psize sy, size_t n, char op, int rev) {
+    //these are simple enough for the compiler to vectorize
+    if (op == '+' || (op == '-' && !rev) || op == '*') {
+	unsigned long long* ux = (unsigned long long*)x;
+	const unsigned long long* uy = (const unsigned long long*)y;
+	if (op == '+') {
+	    for (size_t i = 0; i < n; ++i) ux[i] += uy[(psize)i*sy];
+	} else if (op == '-') {
+	    for (size_t i = 0; i < n; ++i) ux[i] -= uy[(psize)i*sy];
+	} else {
+	    for (size_t i = 0; i < n; ++i) ux[i] *= uy[(psize)i*sy];
+	}
+	return;
+    }
+    for (size_t i = 0; i < n; ++i)
+	x[i] = (rev)? iapply(y[(psize)i*sy], x[i], op) : iapply(x[i], y[(psize)i*sy], op);
+}
+/**
+ * Check whether op may be applied to l and r exactly in integer arithmetic. This requires both operands to be integers, integer arrays or whole numbers (since numeric literals are stored as numbers). Division always gives numbers, as do negative exponents and modulo zero.
+ */
+static inline int int_exact(const spcl_val* l, char op, const spcl_val* r) {
+    if (!op || !strchr("+-*%^", op))
+	return 0;
+    if (!(l->type == VAL_IARRAY || is_whole(l) || (l->type == VAL_UNDEF && (op == '+' || op == '-'))))
+	return 0;
+    if (r->type != VAL_IARRAY && !is_whole(r))
+	return 0;
+    if (op == '%' || op == '^') {
+	size_t n = (r->type == VAL_IARRAY)? r->n_els : 1;
+	for (size_t i = 0; i < n; ++i) {
+	    long long y = (r->type == VAL_IARRAY)? r->val.ia[i] : val_to_i(r);
+	    if ((op == '%' && y == 0) || (op == '^' && y < 0))
+		return 0;
+	}
+    }
+    //arrays of different lengths use the same broadcasting rules (and errors) as numbers
+    return l->type != VAL_IARRAY || r->type != VAL_IARRAY || l->n_els == r->n_els || l->n_els == 1 || r->n_els == 1;
 }
-
-spcl_val copy_spcl_val(const spcl_val o) {
-    spcl_val ret;
-    ret.type = o.type;
-    ret.n_els = o.n_els;
-    //strings or lists must be copied
-    switch (o.type) {
-	case VAL_ERR:	ret.val.e = xmalloc(sizeof(spcl_error)); memcpy(ret.val.e, o.val.e, sizeof(spcl_error)); break;
-	//case VAL_STR:	ret.val.s = xmalloc(o.n_els); strncpy(ret.val.s, o.val.s, o.n_els); break;
-	case VAL_STR:	ret.val.s = xmalloc(o.n_els); memcpy(ret.val.s, o.val.s, o.n_els); break;
-	case VAL_ARRAY:	ret.val.a = xmalloc(sizeof(double)*o.n_els); memcpy(ret.val.a, o.val.a, sizeof(double)*o.n_els); break;
-	case VAL_LIST:	ret.val.l = xmalloc(sizeof(spcl_val)*o.n_els);
-			for (size_t i = 0; i < o.n_els; ++i) ret.val.l[i] = copy_spcl_val(o.val.l[i]);
-			break;
-	case VAL_MAT:	ret.val.l = xmalloc(sizeof(spcl_val)*o.n_els);
-			for (size_t i = 0; i < o.n_els; ++i) ret.val.l[i] = copy_spcl_val(o.val.l[i]);
-			break;
-	case VAL_INST:	ret.val.c = copy_spcl_inst(o.val.c); break;
-	case VAL_FN:	ret.val.f = copy_spcl_uf(o.val.f); break;
-	default:	ret.val.x = o.val.x; break;
+/**
+ * Apply op to l and r in integer arithmetic, overwriting l. int_exact() must be true for l and r.
+ */
+static inline void int_op(spcl_val* l, char op, spcl_val r) {
+    int l_arr = (l->type == VAL_IARRAY && l->n_els != 1);
+    int r_arr = (r.type == VAL_IARRAY && r.n_els != 1);
+    long long b = (r.type == VAL_IARRAY)? r.val.ia[0] : val_to_i(&r);
+    if (l_arr) {
+	make_unique(l);
+	iarr_op(l->val.ia, (r_arr)? r.val.ia : &b, r_arr, l->n_els, op, 0);
+	return;
     }
-    return ret;
+    long long a = (l->type == VAL_IARRAY)? l->val.ia[0] : (l->type == VAL_UNDEF)? 0 : val_to_i(l);
+    spcl_val ret = spcl_make_none();
+    if (r_arr) {
+	ret = copy_spcl_val(r);
+	make_unique(&ret);
+	iarr_op(ret.val.ia, &a, 0, ret.n_els, op, 1);
+    } else if (l->type == VAL_IARRAY || r.type == VAL_IARRAY) {
+	//single element arrays stay arrays
+	ret = alloc_iarray(1);
+	ret.val.ia[0] = iapply(a, b, op);
+    } else {
+	ret = spcl_make_int(iapply(a, b, op));
+    }
+    cleanup_spcl_val(l);
+    *l = ret;
 }
-
 /**
- * swap the spcl_vals stored at a and b
+ * Get the element type of l op r where at least one operand is a typed array. Numbers and integers don't affect the type, and division of integer types gives float64.
+ * returns: the element type or VAL_UNDEF if the operands aren't real arrays and scalars
  */
-void swap_val(spcl_val* a, spcl_val* b) {
-    //swap type and number of elements
-    valtype tmp = a->type;
-    a->type = b->type;
-    b->type = tmp;
-    size_t tmp_n = a->n_els;
-    a->n_els = b->n_els;
-    b->n_els = tmp_n;
-    union V tmp_v = a->val;
-    a->val = b->val;
-    b->val = tmp_v;
+static inline valtype result_dtype(const spcl_val* l, char op, const spcl_val* r) {
+    if (!op || !strchr("+-*/%^", op))
+	return VAL_UNDEF;
+    int l_sc = l->type == VAL_NUM || l->type == VAL_INT || (l->type == VAL_UNDEF && (op == '+' || op == '-'));
+    int r_sc = r->type == VAL_NUM || r->type == VAL_INT;
+    if ((!l_sc && !is_real_arr(l->type)) || (!r_sc && !is_real_arr(r->type)))
+	return VAL_UNDEF;
+    valtype t = (l_sc)? r->type : (r_sc)? l->type : promote_dtype(l->type, r->type);
+    return (op == '/' && is_int_dtype(t))? VAL_ARRAY : t;
+}
+/**
+ * Apply op (one of +-* /) elementwise to x[i] and y[i*sy] for each i < n in single precision, overwriting x. sy=0 repeats a single element of y.
+ * rev: if set, y is the left operand
+ */
+static inline void farr_op(float* x, const float* y, psize sy, size_t n, char op, int rev) {
+    switch (op) {
+    case '+': for (size_t i = 0; i < n; ++i) x[i] += y[(psize)i*sy]; break;
+    case '*': for (size_t i = 0; i < n; ++i) x[i] *= y[(psize)i*sy]; break;
+    case '-': if (rev) {
+		  for (size_t i = 0; i < n; ++i) x[i] = y[(psize)i*sy] - x[i];
+	      } else {
+		  for (size_t i = 0; i < n; ++i) x[i] -= y[(psize)i*sy];
+	      }
+	      break;
+    case '/': if (rev) {
+		  for (size_t i = 0; i < n; ++i) x[i] = y[(psize)i*sy] / x[i];
+	      } else {
+		  for (size_t i = 0; i < n; ++i) x[i] /= y[(psize)i*sy];
+	      }
+	      break;
+    }
 }
-
 /**
- * handle an error at index i in a matrix
- * returns: whether there was an error
+ * Apply op to l and r in single precision without widening, overwriting l. Only the four basic operations between float32 arrays and scalars are supported.
+ * returns: 1 on success or 0 if l and r must be widened instead
  */
-static inline int matrix_err(spcl_val* l, size_t i) {
-    if (i >= l->n_els || l->val.l[i].type == VAL_LIST || l->val.l[i].type == VAL_ARRAY)
+static inline int farr_arith(spcl_val* l, char op, spcl_val r) {
+    if (!strchr("+-*/", op))
 	return 0;
-    //handle incorrect types
-    if (l->val.l[i].type != VAL_ERR) {
-	cleanup_spcl_val(l);
-	*l = spcl_make_err(E_BAD_TYPE, "matrix contains type <%s>", valnames[l->val.l[i].type]);
+    int l_arr = (l->type == VAL_FARRAY);
+    int r_arr = (r.type == VAL_FARRAY);
+    if ((!l_arr && l->type != VAL_NUM && l->type != VAL_INT && l->type != VAL_UNDEF) || (!r_arr && r.type != VAL_NUM && r.type != VAL_INT))
+	return 0;
+    size_t nl = (l_arr)? l->n_els : 1;
+    size_t nr = (r_arr)? r.n_els : 1;
+    if (nl != nr && nl != 1 && nr != 1)
+	return 0;
+    if (l_arr && (nl != 1 || nr == 1)) {
+	float y = (r_arr)? 0 : (float)val_to_x(&r);
+	make_unique(l);
+	farr_op(l->val.fa, (r_arr)? r.val.fa : &y, r_arr && nr != 1, nl, op, 0);
 	return 1;
     }
-    //move the error to overwrite the list
-    spcl_val tmp = l->val.l[i];
-    for (size_t j = 0; j < l->n_els; ++j) {
-	if (i != j)
-	    cleanup_spcl_val(l->val.l + j);
-    }
-    xfree(l->val.l);
-    *l = tmp;
+    //repeat the single element on the left for each element on the right
+    float x = (l_arr)? l->val.fa[0] : (l->type == VAL_UNDEF)? 0 : (float)val_to_x(l);
+    spcl_val ret = copy_spcl_val(r);
+    make_unique(&ret);
+    farr_op(ret.val.fa, &x, 0, nr, op, 1);
+    cleanup_spcl_val(l);
+    *l = ret;
     return 1;
 }
+//convert typed arrays in v to the wide type (either VAL_ARRAY or VAL_IARRAY) used to compute results. The returned value must be cleaned up by the caller.
+static inline spcl_val widen(spcl_val v, valtype wide) {
+    if (wide == VAL_ARRAY)
+	return to_f64(v);
+    return (is_typed(v.type))? convert_arr(&v, wide) : copy_spcl_val(v);
+}
 spcl_local void val_add(spcl_val* l, spcl_val r) {
     if (l->type == VAL_UNDEF && r.type == VAL_NUM) {
 	*l = r;
     } else if (l->type == VAL_NUM && r.type == VAL_NUM) {
 	*l = spcl_make_num( (l->val.x)+(r.val.x) );
-    } else if (l->type == VAL_ARRAY && r.type == VAL_ARRAY) {
-	//add the two arrays together
-	if (l->n_els != r.n_els) {
-	    cleanup_spcl_val(l);
-	    *l = spcl_make_err(E_OUT_OF_RANGE, "cannot add arrays of length %lu and %lu", l->n_els, r.n_els);
-	} else {
-	    for (size_t i = 0; i < l->n_els; ++i)
-		l->val.a[i] += r.val.a[i];
-	}
-    } else if (l->type == VAL_ARRAY && r.type == VAL_NUM) {
-	//add a scalar to each element of the array
-	for (size_t i = 0; i < l->n_els; ++i)
-	    l->val.a[i] += r.val.x;
-    } else if (l->type == VAL_MAT && r.type == VAL_MAT) {
-	if (l->n_els != r.n_els) {
-	    cleanup_spcl_val(l);
-	    *l = spcl_make_err(E_OUT_OF_RANGE, "cannot add lists of length %lu and %lu", l->n_els, r.n_els);	
-	}
-	//add a scalar to each element of the array
-	for (size_t i = 0; i < l->n_els; ++i) {
-	    val_add(l->val.l+i, r.val.l[i]);
-	    if (matrix_err(l, i))
-		return;
-	}
+    } else if (is_numeric(l->type) && is_numeric(r.type)) {
+	broadcast_op(l, r, '+');
     } else if (l->type == VAL_LIST) {
-	++l->n_els;
-	l->val.l = xrealloc(l->val.l, l->n_els);
-	l->val.l[l->n_els-1] = copy_spcl_val(r);
+	grow_val(l, l->n_els+1, sizeof(spcl_val));
+	l->val.l[l->n_els++] = copy_spcl_val(r);
     } else if (l->type == VAL_STR) {
 	size_t l_len = l->n_els;
-	size_t r_len = spcl_est_strlen(r);
-	//create a new string and copy
-	l->val.s = xrealloc(l->val.s, l_len+r_len+1); //+1 for null terminator
+	//spcl_stringify needs a few bytes of slack to write anything
+	size_t r_len = spcl_est_strlen(r) + 2;
+	grow_val(l, l_len+r_len, sizeof(char));
 	char* tmp = spcl_stringify(r, l->val.s+l_len, r_len);
 	tmp[0] = 0;
 	//now set the spcl_val
 	l->n_els = (size_t)(tmp - l->val.s);
+    } else if (is_complex(l->type) || is_complex(r.type)) {
+	complex_op(l, r, '+');
     } else {
 	cleanup_spcl_val(l);
 	*l = spcl_make_err(E_BAD_TYPE, "cannot add types %s and %s", valnames[l->type], valnames[r.type]);
@@ -1178,30 +6243,10 @@ spcl_local void val_sub(spcl_val* l, spcl_val r) {
 	*l = spcl_make_num(-r.val.x);
     } else if (l->type == VAL_NUM && r.type == VAL_NUM) {
 	*l = spcl_make_num( (l->val.x)-(r.val.x) );
-    } else if (l->type == VAL_ARRAY && r.type == VAL_ARRAY) {
-	//add the two arrays together
-	if (l->n_els != r.n_els) {
-	    cleanup_spcl_val(l);
-	    *l = spcl_make_err(E_OUT_OF_RANGE, "cannot subtract arrays of length %lu and %lu", l->n_els, r.n_els);
-	} else {
-	    for (size_t i = 0; i < l->n_els; ++i)
-		l->val.a[i] -= r.val.a[i];
-	}
-    } else if (l->type == VAL_ARRAY && r.type == VAL_NUM) {
-	//add a scalar to each element of the array
-	for (size_t i = 0; i < l->n_els; ++i)
-	    l->val.a[i] -= r.val.x;
-    } else if (l->type == VAL_MAT && r.type == VAL_MAT) {
-	if (l->n_els != r.n_els) {
-	    cleanup_spcl_val(l);
-	    *l = spcl_make_err(E_OUT_OF_RANGE, "cannot subtract lists of length %lu and %lu", l->n_els, r.n_els);	
-	}
-	//add a scalar to each element of the array
-	for (size_t i = 0; i < l->n_els; ++i) {
-	    val_sub(l->val.l+i, r.val.l[i]);
-	    if (matrix_err(l, i))
-		return;
-	}
+    } else if (is_numeric(l->type) && is_numeric(r.type)) {
+	broadcast_op(l, r, '-');
+    } else if (is_complex(l->type) || is_complex(r.type)) {
+	complex_op(l, r, '-');
     } else {
 	cleanup_spcl_val(l);
 	*l = spcl_make_err(E_BAD_TYPE, "cannot subtract types %s and %s", valnames[l->type], valnames[r.type]);
@@ -1210,39 +6255,10 @@ spcl_local void val_sub(spcl_val* l, spcl_val r) {
 spcl_local void val_mul(spcl_val* l, spcl_val r) {
     if (l->type == VAL_NUM && r.type == VAL_NUM) {
 	*l = spcl_make_num( (l->val.x)*(r.val.x) );
-    } else if (l->type == VAL_ARRAY && r.type == VAL_ARRAY) {
-	//add the two arrays together
-	if (l->n_els != r.n_els) {
-	    cleanup_spcl_val(l);
-	    *l = spcl_make_err(E_OUT_OF_RANGE, "cannot multiply arrays of length %lu and %lu", l->n_els, r.n_els);
-	    return;
-	} else {
-	    for (size_t i = 0; i < l->n_els; ++i)
-		l->val.a[i] *= r.val.a[i];
-	}
-    } else if (l->type == VAL_ARRAY && r.type == VAL_NUM) {
-	//add a scalar to each element of the array
-	for (size_t i = 0; i < l->n_els; ++i)
-	    l->val.a[i] *= r.val.x;
-    } else if (l->type == VAL_MAT && r.type == VAL_MAT) {
-	if (l->n_els != r.n_els) {
-	    cleanup_spcl_val(l);
-	    *l = spcl_make_err(E_OUT_OF_RANGE, "cannot multiply lists of length %lu and %lu", l->n_els, r.n_els);	
-	    return;
-	}
-	//add a scalar to each element of the array
-	for (size_t i = 0; i < l->n_els; ++i) {
-	    val_mul(l->val.l+i, r.val.l[i]);
-	    if (matrix_err(l,i))
-		return;
-	}
-    } else if (l->type == VAL_MAT && r.type == VAL_NUM) {
-	//add a scalar to each element of the array
-	for (size_t i = 0; i < l->n_els; ++i) {
-	    val_mul(l->val.l+i, r);
-	    if (matrix_err(l, i))
-		return;
-	}
+    } else if (is_numeric(l->type) && is_numeric(r.type)) {
+	broadcast_op(l, r, '*');
+    } else if (is_complex(l->type) || is_complex(r.type)) {
+	complex_op(l, r, '*');
     } else {
 	cleanup_spcl_val(l);
 	*l = spcl_make_err(E_BAD_TYPE, "cannot multiply types %s and %s", valnames[l->type], valnames[r.type]);
@@ -1251,39 +6267,10 @@ spcl_local void val_mul(spcl_val* l, spcl_val r) {
 spcl_local void val_div(spcl_val* l, spcl_val r) {
     if (l->type == VAL_NUM && r.type == VAL_NUM) {
 	*l = spcl_make_num( (l->val.x)/(r.val.x) );
-    } else if (l->type == VAL_ARRAY && r.type == VAL_ARRAY) {
-	//add the two arrays together
-	if (l->n_els != r.n_els) {
-	    cleanup_spcl_val(l);
-	    *l = spcl_make_err(E_OUT_OF_RANGE, "cannot divide arrays of length %lu and %lu", l->n_els, r.n_els);
-	    return;
-	} else {
-	    for (size_t i = 0; i < l->n_els; ++i)
-		l->val.a[i] /= r.val.a[i];
-	}
-    } else if (l->type == VAL_ARRAY && r.type == VAL_NUM) {
-	//add a scalar to each element of the array
-	for (size_t i = 0; i < l->n_els; ++i)
-	    l->val.a[i] /= r.val.x;
-    } else if (l->type == VAL_MAT && r.type == VAL_MAT) {
-	if (l->n_els != r.n_els) {
-	    cleanup_spcl_val(l);
-	    *l = spcl_make_err(E_OUT_OF_RANGE, "cannot divide lists of length %lu and %lu", l->n_els, r.n_els);	
-	    return;
-	}
-	//add a scalar to each element of the array
-	for (size_t i = 0; i < l->n_els; ++i) {
-	    val_div(l->val.l+i, r.val.l[i]);
-	    if (matrix_err(l,i))
-		return;
-	}
-    } else if (l->type == VAL_MAT && r.type == VAL_NUM) {
-	//add a scalar to each element of the array
-	for (size_t i = 0; i < l->n_els; ++i) {
-	    val_div(l->val.l+i, r);
-	    if (matrix_err(l, i))
-		return;
-	}
+    } else if (is_numeric(l->type) && is_numeric(r.type)) {
+	broadcast_op(l, r, '/');
+    } else if (is_complex(l->type) || is_complex(r.type)) {
+	complex_op(l, r, '/');
     } else {
 	cleanup_spcl_val(l);
 	*l = spcl_make_err(E_BAD_TYPE, "cannot divide types %s and %s", valnames[l->type], valnames[r.type]);
@@ -1293,44 +6280,10 @@ spcl_local void val_mod(spcl_val* l, spcl_val r) {
     if (l->type == VAL_NUM && r.type == VAL_NUM) {
 	double div = l->val.x / r.val.x;
 	l->val.x -= floor(div)*r.val.x;
-    } else if (l->type == VAL_ARRAY && r.type == VAL_ARRAY) {
-	//add the two arrays together
-	if (l->n_els != r.n_els) {
-	    cleanup_spcl_val(l);
-	    *l = spcl_make_err(E_OUT_OF_RANGE, "cannot divide arrays of length %lu and %lu", l->n_els, r.n_els);
-	    return;
-	} else {
-	    for (size_t i = 0; i < l->n_els; ++i) {
-		double div = l->val.a[i] / r.val.a[i];
-		l->val.a[i] -= floor(div)*r.val.a[i];
-	    }
-	}
-    } else if (l->type == VAL_ARRAY && r.type == VAL_NUM) {
-	//add a scalar to each element of the array
-	for (size_t i = 0; i < l->n_els; ++i) {
-	    double div = l->val.a[i] / r.val.x;
-	    l->val.a[i] -= floor(div)*r.val.x;
-	    l->val.a[i] /= r.val.x;
-	}
-    } else if (l->type == VAL_MAT && r.type == VAL_MAT) {
-	if (l->n_els != r.n_els) {
-	    cleanup_spcl_val(l);
-	    *l = spcl_make_err(E_OUT_OF_RANGE, "cannot divide lists of length %lu and %lu", l->n_els, r.n_els);	
-	    return;
-	}
-	//add a scalar to each element of the array
-	for (size_t i = 0; i < l->n_els; ++i) {
-	    val_mod(l->val.l+i, r.val.l[i]);
-	    if (matrix_err(l,i))
-		return;
-	}
-    } else if (l->type == VAL_MAT && r.type == VAL_NUM) {
-	//add a scalar to each element of the array
-	for (size_t i = 0; i < l->n_els; ++i) {
-	    val_mod(l->val.l+i, r);
-	    if (matrix_err(l, i))
-		return;
-	}
+    } else if (is_numeric(l->type) && is_numeric(r.type)) {
+	broadcast_op(l, r, '%');
+    } else if (is_complex(l->type) || is_complex(r.type)) {
+	complex_op(l, r, '%');
     } else {
 	cleanup_spcl_val(l);
 	*l = spcl_make_err(E_BAD_TYPE, "cannot divide types %s and %s", valnames[l->type], valnames[r.type]);
@@ -1340,39 +6293,10 @@ spcl_local void val_mod(spcl_val* l, spcl_val r) {
 spcl_local void val_exp(spcl_val* l, spcl_val r) {
     if (l->type == VAL_NUM && r.type == VAL_NUM) {
 	*l = spcl_make_num( pow(l->val.x, r.val.x) );
-    } else if (l->type == VAL_ARRAY && r.type == VAL_ARRAY) {
-	//add the two arrays together
-	if (l->n_els != r.n_els) {
-	    cleanup_spcl_val(l);
-	    *l = spcl_make_err(E_OUT_OF_RANGE, "cannot raise arrays of length %lu and %lu", l->n_els, r.n_els);
-	    return;
-	} else {
-	    for (size_t i = 0; i < l->n_els; ++i)
-		l->val.a[i] = pow(l->val.a[i], r.val.a[i]);
-	}
-    } else if (l->type == VAL_ARRAY && r.type == VAL_NUM) {
-	//add a scalar to each element of the array
-	for (size_t i = 0; i < l->n_els; ++i)
-		l->val.a[i] = pow(l->val.a[i], r.val.x);
-    } else if (l->type == VAL_MAT && r.type == VAL_MAT) {
-	if (l->n_els != r.n_els) {
-	    cleanup_spcl_val(l);
-	    *l = spcl_make_err(E_OUT_OF_RANGE, "cannot raise matrices of length %lu and %lu", l->n_els, r.n_els);	
-	    return;
-	}
-	//add a scalar to each element of the array
-	for (size_t i = 0; i < l->n_els; ++i) {
-	    val_exp(l->val.l+i, r.val.l[i]);
-	    if (matrix_err(l,i))
-		return;
-	}
-    } else if (l->type == VAL_MAT && r.type == VAL_NUM) {
-	//add a scalar to each element of the array
-	for (size_t i = 0; i < l->n_els; ++i) {
-	    val_exp(l->val.l+i, r);
-	    if (matrix_err(l, i))
-		return;
-	}
+    } else if (is_numeric(l->type) && is_numeric(r.type)) {
+	broadcast_op(l, r, '^');
+    } else if (is_complex(l->type) || is_complex(r.type)) {
+	complex_op(l, r, '^');
     } else {
 	cleanup_spcl_val(l);
 	*l = spcl_make_err(E_BAD_TYPE, "cannot raise types %s and %s", valnames[l->type], valnames[r.type]);
@@ -1381,15 +6305,14 @@ spcl_local void val_exp(spcl_val* l, spcl_val r) {
 
 /** ============================ spcl_inst ============================ **/
 
-//helper to convert possibly negative index spcl_vals to real C indices
+//helper to convert possibly negative index spcl_vals to real C indices. Integers are used directly, while numbers are rounded towards zero.
 static inline size_t index_to_abs(spcl_val* ind, size_t max_n) {
-    if (-(ind->val.x) > max_n || ind->val.x >= max_n) {
-	*ind = spcl_make_err(E_OUT_OF_RANGE, "index %d out of bounds for list of size %lu", (int)ind->val.x, max_n);
+    long long i = (ind->type == VAL_INT)? ind->val.i : (fabs(ind->val.x) < INT_EXACT_MAX)? (long long)ind->val.x : (long long)max_n;
+    if (i < -(long long)max_n || i >= (long long)max_n) {
+	*ind = spcl_make_err(E_OUT_OF_RANGE, "index %d out of bounds for list of size %lu", (int)i, max_n);
 	return 0;
     }
-    if (ind->val.x < 0)
-	return max_n - (size_t)(-ind->val.x);
-    return (size_t)(ind->val.x);
+    return (i < 0)? max_n - (size_t)(-i) : (size_t)i;
 }
 
 //non-cryptographically hash the string str reading only the first n bytes
@@ -1447,6 +6370,8 @@ static inline int grow_inst(struct spcl_inst* c) {
 	//create a new spcl_inst with twice as many elements
 	struct spcl_inst nc;
 	nc.parent = c->parent;
+	nc.rng_seed = c->rng_seed;
+	nc.rng_ctr = c->rng_ctr;
 	nc.t_bits = c->t_bits + 1;
 	nc.n_memb = 0;
 	nc.table = xmalloc(sizeof(name_val_pair)*con_size(&nc));
@@ -1481,11 +6406,55 @@ static inline void setup_builtins(struct spcl_inst* c) {
     spcl_add_fn(c, spcl_len,		"len");
     spcl_add_fn(c, spcl_list,		"list");
     spcl_add_fn(c, spcl_range,		"range");
+    spcl_add_fn(c, spcl_int,		"int");
+    spcl_add_fn(c, spcl_astype,		"astype");
+    spcl_add_fn(c, spcl_dtype,		"dtype");
+    spcl_add_fn(c, spcl_where,		"where");
     spcl_add_fn(c, spcl_linspace,	"linspace");
     spcl_add_fn(c, spcl_flatten,	"flatten");
     spcl_add_fn(c, spcl_array,		"array");
     spcl_add_fn(c, spcl_vec,		"vec");
     spcl_add_fn(c, spcl_cat,		"cat");
+    spcl_add_fn(c, spcl_shape,		"shape");
+    spcl_add_fn(c, spcl_reshape,	"reshape");
+    spcl_add_fn(c, spcl_transpose,	"transpose");
+    spcl_add_fn(c, spcl_sum,		"sum");
+    spcl_add_fn(c, spcl_prod,		"prod");
+    spcl_add_fn(c, spcl_min,		"min");
+    spcl_add_fn(c, spcl_max,		"max");
+    spcl_add_fn(c, spcl_mean,		"mean");
+    spcl_add_fn(c, spcl_dot,		"dot");
+    spcl_add_fn(c, spcl_norm,		"norm");
+    spcl_add_fn(c, spcl_cross,		"cross");
+    spcl_add_fn(c, spcl_matmul,		"matmul");
+    spcl_add_fn(c, spcl_inv,		"inv");
+    spcl_add_fn(c, spcl_solve,		"solve");
+    spcl_add_fn(c, spcl_det,		"det");
+    spcl_add_fn(c, spcl_diff,		"diff");
+    spcl_add_fn(c, spcl_stencil,	"stencil");
+    spcl_add_fn(c, spcl_convolve,	"convolve");
+    spcl_add_fn(c, spcl_sort,		"sort");
+    spcl_add_fn(c, spcl_argsort,	"argsort");
+    spcl_add_fn(c, spcl_unique,		"unique");
+    spcl_add_fn(c, spcl_searchsorted,	"searchsorted");
+    spcl_add_fn(c, spcl_interp,		"interp");
+    spcl_add_fn(c, spcl_interp2d,	"interp2d");
+    spcl_add_fn(c, spcl_lookup,		"lookup");
+    spcl_add_fn(c, spcl_tabulate,	"tabulate");
+    spcl_add_fn(c, spcl_deriv,		"deriv");
+    spcl_add_fn(c, spcl_grad,		"grad");
+    spcl_add_fn(c, spcl_fft,		"fft");
+    spcl_add_fn(c, spcl_ifft,		"ifft");
+    spcl_add_fn(c, spcl_rfft,		"rfft");
+    spcl_add_fn(c, spcl_complex,	"complex");
+    spcl_add_fn(c, spcl_real,		"real");
+    spcl_add_fn(c, spcl_imag,		"imag");
+    spcl_add_fn(c, spcl_conj,		"conj");
+    spcl_add_fn(c, spcl_angle,		"angle");
+    spcl_add_fn(c, spcl_seed,		"seed");
+    spcl_add_fn(c, spcl_rand,		"rand");
+    spcl_add_fn(c, spcl_randn,		"randn");
+    spcl_add_fn(c, spcl_uniform,	"uniform");
     spcl_add_fn(c, spcl_print,		"print");
     //TODO: this is a really dumb way of adding namespaces
     //math stuff
@@ -1514,6 +6483,8 @@ struct spcl_inst* make_spcl_inst(spcl_inst* parent) {
     spcl_inst* c = xmalloc(sizeof(spcl_inst));
     c->parent = parent;
     c->n_memb = 0;
+    c->rng_seed = 0;
+    c->rng_ctr = 0;
     c->t_bits = DEF_TAB_BITS;
     //double the allocated size for root insts (since they're likely to hold more stuff)
     if (!parent) c->t_bits++;
@@ -1533,6 +6504,8 @@ struct spcl_inst* copy_spcl_inst(const spcl_inst* o) {
     memset(c->table, 0, sizeof(name_val_pair)*con_size(o));
     c->parent = o->parent;
     c->n_memb = o->n_memb;
+    c->rng_seed = o->rng_seed;
+    c->rng_ctr = o->rng_ctr;
     c->t_bits = o->t_bits;
     for (size_t i = con_it_next(o, 0); i < con_size(o); i = con_it_next(o, i+1)) {
 	c->table[i].s.s = strdup(o->table[i].s.s);
@@ -1553,8 +6526,9 @@ void destroy_spcl_inst(struct spcl_inst* c) {
 }
 #define MAX_ASCII 0x7f
 #define MAX_OP_PREC  7
-static const int OP1_PRECS[] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 6, 0, 0, 0, 3, 0, 0, 0, 0, 3, 4, 0, 4, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 5, 7, 5, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-static const int OP2_PRECS[] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 6, 0, 0, 0, 7, 7, 0, 7, 0, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 5, 5, 5, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 6, 0, 0, 0};
+#define LEFT_ASSOC(op) (OP1_PRECS[(unsigned char)op] == OP1_PRECS['+'])
+static const int OP1_PRECS[] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 6, 0, 0, 0, 3, 6, 0, 0, 0, 3, 4, 0, 4, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 5, 7, 5, 1, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 6, 0, 0, 0};
+static const int OP2_PRECS[] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 6, 0, 0, 0, 7, 7, 0, 7, 0, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 5, 5, 5, 0, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 6, 0, 0, 0};
 /**
  * Find the length of an operator sequence e.g. '==', '=', '+=' etc.
  */
@@ -1565,18 +6539,23 @@ static inline int get_oplen(unsigned char op, unsigned char next) {
     //only the '?' operator does not accept an '=' operator immediately after
     if (op == '?')
 	return 1;
-    //matches characters '!', '?', '+', '-', '*', '/', '<', '=', '>', '.', and ','. hopefully those last two don't cause problems
-    if ( op == '!' || op == '^' || (op >= '*' && op <= '/') || (op >= '<' && op <= '>') ) {
+    //matches characters '!', '?', '%', '+', '-', '*', '/', '<', '=', '>', '@', '.', and ','. hopefully those last two don't cause problems
+    if ( op == '!' || op == '^' || op == '%' || op == '@' || (op >= '*' && op <= '/') || (op >= '<' && op <= '>') ) {
 	if (next == '=')
 	    return 2;
 	return 1;
-    } else if ( (op == '|' || op == '&') && next == op ) {
+    } else if (op == '|' || op == '&') {
+	//single & and | combine masks elementwise
 	if (next == op)
 	    return 2;
 	return 1;
     }
     return op == ':';
 }
+//check whether c may continue a name, in which case a matching keyword is only a prefix of that name (e.g. "format")
+static inline int is_name_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
 /**
  * Identify the keyword starting at rs->start up to rs->end. If a key is found, then rs->start is updated to the first character after the keyword.
  * returns: the spck_key code for the matched key.
@@ -1591,7 +6570,7 @@ spcl_local spcl_key get_keyword(read_state* rs) {
 	if (chn >= spcl_keywords[i].n) {
 	    //before we do a comparison we must use the same number of bytes
 	    expr.n = spcl_keywords[i].n;
-	    if (s8cmp(expr, spcl_keywords[i]) == 0) {
+	    if (s8cmp(expr, spcl_keywords[i]) == 0 && !is_name_char(fs_get(rs->b, rs->start+spcl_keywords[i].n))) {
 		rs->start += spcl_keywords[i].n;
 		rs->start = skip_ws(rs->b, rs->start, rs->end, 0);
 		return i;
@@ -1620,6 +6599,8 @@ spcl_local spcl_val find_operator(read_state rs, psize* op_loc, psize* open_ind,
 
     //keep track of the precedence of the orders of operation (lower means executed later) ">,=,>=,==,<=,<"=4 "+,-"=3, "*,/"=2, "**"=1
     int op_prec = 0;
+    //whether the last token was an operand (0), an operator (1) or nothing has been read yet (2). Signs directly after an operator are unary and never split the expression.
+    int after_op = 2;
     for (; rs.start < rs.end || blk_stk.ptr; ++rs.start) {
 	//make sure we don't read past the end of the file
 	if (rs.start >= fs_end(rs.b))
@@ -1628,8 +6609,9 @@ spcl_local spcl_val find_operator(read_state rs, psize* op_loc, psize* open_ind,
 	cur = fs_get(rs.b, rs.start);
 	char next = fs_get(rs.b, rs.start+1);
 	if (cur == BEG_PAR || cur == BEG_CRL || cur == BEG_SQR) {
-	    //if we've already found an entire block we can stop
-	    if (blk_stk.ptr == 0 && *open_ind < rs.end) break;
+	    //if we've already found an entire block we can stop. Chained indices like a[i][j] or f(x)[i] are the exception
+	    int chained = (cur == BEG_SQR && (prev == END_SQR || prev == END_PAR) && (fs_get(rs.b, *open_ind) == BEG_SQR || fs_get(rs.b, *open_ind) == BEG_PAR));
+	    if (blk_stk.ptr == 0 && *open_ind < rs.end && !chained) break;
 	    push(char,BLK_MAX)(&blk_stk, cur);
 	    //only set the open index if this is the first match
 	    if (*open_ind == rs.end) *open_ind = rs.start;
@@ -1652,108 +6634,780 @@ spcl_local spcl_val find_operator(read_state rs, psize* op_loc, psize* open_ind,
 		*close_ind = rs.start;
 	    }
 	}
-
-	if (blk_stk.ptr == 0) {
-	    int oplen = get_oplen(cur, next);
-	    //reset the enclosing indices when we find an operator
-	    if (oplen) {
-		*open_ind = rs.end;
-		*close_ind = rs.end;
-	    }
-	    if (oplen >= 2) {
-		if (op_prec < OP2_PRECS[(unsigned char)cur]) {
-		    *op_loc = rs.start;
-		    op_prec = OP2_PRECS[(unsigned char)cur];
+
+	if (blk_stk.ptr == 0) {
+	    int oplen = get_oplen(cur, next);
+	    //reset the enclosing indices when we find an operator
+	    if (oplen) {
+		*open_ind = rs.end;
+		*close_ind = rs.end;
+	    }
+	    if (oplen >= 2) {
+		if (op_prec < OP2_PRECS[(unsigned char)cur]) {
+		    *op_loc = rs.start;
+		    op_prec = OP2_PRECS[(unsigned char)cur];
+		}
+		rs.start += oplen-1;	
+	    } else if (oplen == 1 && (op_prec < OP1_PRECS[(unsigned char)cur] || (op_prec == OP1_PRECS[(unsigned char)cur] && LEFT_ASSOC(cur)))) {
+		//avoid matches with numeric literals
+		if (OP1_PRECS[(unsigned char)cur] == OP1_PRECS['-'] && is_num && (prev == 'e' || prev == 'E'))
+		    continue;
+		//sums are left associative, so a-b+c must be split at the last + or -
+		if (!(after_op == 1 && (cur == '-' || cur == '+'))) {
+		    *op_loc = rs.start;
+		    op_prec = OP1_PRECS[(unsigned char)cur];
+		}
+	    } else if (!cur || cur == ';' || cur == '\n' || cur == '#') {
+		break;
+	    }
+	    if (oplen)
+		after_op = 1;
+	    else if (!is_whitespace(cur))
+		after_op = 0;
+	}
+    }
+    if (blk_stk.ptr > 0) {
+	pop(char,BLK_MAX)(&blk_stk, &open_type);
+	destroy_stack(char,BLK_MAX)(&blk_stk, NULL);
+	return spcl_make_err(E_BAD_SYNTAX, "expected %c", get_match(open_type));
+    }
+    if (new_end) {
+	//if we didn't find an operator then we have to move the location to the new end to signal that it wasn't found
+	if (!op_prec)
+	    *op_loc = rs.start;
+	*new_end = rs.start;
+    }
+    destroy_stack(char,BLK_MAX)(&blk_stk, NULL);
+    return spcl_make_none();
+}
+//forward declare so that helpers can call
+static inline spcl_val spcl_parse_line_rs(spcl_inst* c, read_state rs, psize* new_end, spcl_key start_key);
+static inline spcl_val spcl_read_lines_block(struct spcl_inst* c, read_state block_rs);
+static inline spcl_val fuse_op(spcl_inst* c, read_state rs, psize op_loc, psize* new_end);
+/**
+ * Copy src to the elements of dst. src may either be a number, which is copied to every element, or an array, tensor or list with the same shape as dst.
+ */
+static inline spcl_val tensor_assign(const spcl_tensor* dst, spcl_val src) {
+    spcl_val tmp = spcl_make_none();
+    if (is_int(src.type) || is_typed(src.type)) {
+	tmp = src = to_f64(src);
+    } else if (src.type == VAL_LIST) {
+	tmp = src = spcl_cast(src, (dst->ndim == 1)? VAL_ARRAY : VAL_MAT);
+	if (tmp.type == VAL_ERR)
+	    return tmp;
+    }
+    //treat arrays as tensors with a single axis
+    psize one = 1;
+    spcl_tensor arr = {1, &src.n_els, &one, src.val.a};
+    const spcl_tensor* st = (src.type == VAL_MAT)? src.val.t : (src.type == VAL_ARRAY)? &arr : NULL;
+    if (src.type != VAL_NUM && (!st || st->ndim != dst->ndim || memcmp(st->shape, dst->shape, sizeof(size_t)*dst->ndim))) {
+	cleanup_spcl_val(&tmp);
+	return spcl_make_err(E_BAD_VALUE, "can only assign numbers or values with matching shape to tensor entries");
+    }
+    size_t n = dst->shape[dst->ndim-1];
+    psize ds = dst->strides[dst->ndim-1];
+    psize ss = (st)? st->strides[st->ndim-1] : 0;
+    for (size_t k = 0; k < tensor_rows(dst); ++k) {
+	double* x = tensor_row(dst, k);
+	const double* y = (st)? tensor_row(st, k) : &src.val.x;
+	for (size_t j = 0; j < n; ++j)
+	    x[(psize)j*ds] = y[(psize)j*ss];
+    }
+    cleanup_spcl_val(&tmp);
+    return spcl_make_none();
+}
+/**
+ * A helper which accesses v[ind]. If assign is not NULL, then v[ind] = *assign.
+ */
+static inline spcl_val _spcl_index(spcl_val v, spcl_val ind, spcl_val* assign) {
+    //check for invalid types
+    if (ind.type != VAL_NUM && ind.type != VAL_INT)
+	return spcl_make_err(E_BAD_TYPE, "cannot index with type %s", valnames[ind.type]);
+    size_t i = index_to_abs(&ind, v.n_els);
+    if (ind.type == VAL_ERR)
+	return ind;
+    //create a new dummy value or return the element depending on type
+    if (v.type == VAL_LIST) {
+	if (assign) {
+	    cleanup_spcl_val(v.val.l+i);
+	    v.val.l[i] = *assign;
+	}
+	return v.val.l[i];
+    } else if (v.type == VAL_MAT) {
+	const spcl_tensor* t = v.val.t;
+	double* data = t->data + (psize)i*t->strides[0];
+	if (assign) {
+	    //write through a descriptor for the trailing axes so that no allocation is needed
+	    spcl_tensor sub = {t->ndim-1, t->shape+1, t->strides+1, data};
+	    spcl_val er = tensor_assign(&sub, *assign);
+	    cleanup_spcl_val(assign);
+	    return er;
+	}
+	//rows of matrices are returned as borrowed arrays, just like list elements. Entries of higher dimensional tensors need a new descriptor, so they can only be read with spcl_index_rs()
+	if (t->ndim > 2 || (t->strides[1] != 1 && t->shape[1] > 1))
+	    return spcl_make_err(E_BAD_TYPE, "cannot borrow entries of a non-contiguous or %lu dimensional tensor", t->ndim);
+	spcl_val row = spcl_make_none();
+	row.type = VAL_ARRAY;
+	row.n_els = t->shape[1];
+	row.val.a = data;
+	row.buf = v.buf;
+	return row;
+    } else if (v.type == VAL_ARRAY) {
+	if (assign) {
+	    if (assign->type != VAL_NUM && assign->type != VAL_INT)
+		return spcl_make_err(E_BAD_TYPE, "cannot assign type %s to array", valnames[assign->type]);
+	    v.val.a[i] = val_to_x(assign);
+	}
+	//in principle this should be a reference, but numerics are trivially destructable so it doesn't matter
+	return spcl_make_num(v.val.a[i]);
+    } else if (v.type == VAL_CARRAY) {
+	if (assign) {
+	    if (assign->type != VAL_NUM && assign->type != VAL_COMPLEX)
+		return spcl_make_err(E_BAD_TYPE, "cannot assign type %s to complex array", valnames[assign->type]);
+	    double complex z = val_to_z(assign);
+	    v.val.a[2*i] = creal(z);
+	    v.val.a[2*i+1] = cimag(z);
+	}
+	return spcl_make_complex(v.val.a[2*i], v.val.a[2*i+1]);
+    } else if (v.type == VAL_IARRAY) {
+	if (assign) {
+	    if (!is_whole(assign))
+		return spcl_make_err(E_BAD_TYPE, "can only assign integers to integer array");
+	    v.val.ia[i] = val_to_i(assign);
+	}
+	return spcl_make_int(v.val.ia[i]);
+    } else if (is_typed(v.type)) {
+	if (assign) {
+	    if ((is_int_dtype(v.type))? !is_whole(assign) : (assign->type != VAL_NUM && assign->type != VAL_INT))
+		return spcl_make_err(E_BAD_TYPE, "cannot assign type %s to %s", valnames[assign->type], valnames[v.type]);
+	    if (assign->type == VAL_INT)
+		arr_seti(&v, i, assign->val.i);
+	    else
+		arr_setx(&v, i, assign->val.x);
+	}
+	return (v.type == VAL_FARRAY)? spcl_make_num(v.val.fa[i]) : spcl_make_int(arr_geti(&v, i));
+    } else if (v.type == VAL_VEC) {
+	//v is a copy of a small vector, so writes have to go through vec_assign() instead
+	if (assign)
+	    return spcl_make_err(E_BAD_TYPE, "cannot assign to an element of a temporary vector");
+	return spcl_make_num(v.val.v[i]);
+    }
+    return spcl_make_err(E_BAD_TYPE, "type %s is not indexable", valnames[v.type]);
+}
+/**
+ * Set element ind of the small vector stored at v to the number in assign.
+ */
+static inline spcl_val vec_assign(spcl_val* v, spcl_val ind, const spcl_val* assign) {
+    if (ind.type != VAL_NUM && ind.type != VAL_INT)
+	return spcl_make_err(E_BAD_TYPE, "cannot index with type %s", valnames[ind.type]);
+    size_t i = index_to_abs(&ind, v->n_els);
+    if (ind.type == VAL_ERR)
+	return ind;
+    if (assign->type != VAL_NUM && assign->type != VAL_INT)
+	return spcl_make_err(E_BAD_TYPE, "cannot assign type %s to vector", valnames[assign->type]);
+    v->val.v[i] = val_to_x(assign);
+    return spcl_make_num(v->val.v[i]);
+}
+/**
+ * An alternative to lookup which only considers the first n bytes in str
+ */
+static inline spcl_val spcl_find_rs(const spcl_inst* c, read_state rs) {
+    psize dot_loc = strchr_block_rs(rs.b, rs.start, rs.end, '.');
+    psize ref_loc = strchr_block_rs(rs.b, rs.start, rs.end, BEG_SQR);//]
+    if (dot_loc == rs.end && ref_loc == rs.end) {
+	//if there was neither a period or open brace, just lookup directly
+	size_t i, n;
+	s8 str = trim_whitespace(fs_read(rs.b, rs.start, rs.end));
+	while (c) {
+	    if (find_ind(c, str, &i))
+		return c->table[i].v;
+	    //go up if we didn't find it
+	    c = c->parent;
+	}
+	//reaching this point in execution means the matching entry wasn't found
+	return spcl_make_none();
+    } else if (dot_loc < ref_loc) {
+	//if there was a dot, access spcl_inst members
+	spcl_val sub_con = spcl_find_rs(c, make_read_state(rs.b, rs.start, dot_loc));
+	if (sub_con.type != VAL_INST)
+	    return spcl_make_err(E_BAD_TYPE, "cannot access member from non-instance type %s", valnames[sub_con.type]);
+	return spcl_find_rs(sub_con.val.c, make_read_state(rs.b, dot_loc+1, rs.end));
+    } else {
+	//access lists/arrays
+	psize close_ind = strchr_block_rs(rs.b, ref_loc+1, rs.end, END_SQR);
+	if (close_ind > rs.end)
+	    return spcl_make_err(E_BAD_SYNTAX, "expected %c", END_SQR);
+	//read the list and the index
+	spcl_val lst = spcl_find_rs(c, make_read_state(rs.b, rs.start, ref_loc));
+	spcl_val index = spcl_parse_line_rs(c, make_read_state(rs.b, ref_loc+1, close_ind), NULL, KEY_NONE);
+	return _spcl_index(lst, index, NULL);
+    }
+}
+/**
+ * Find a pointer to the value named by rs so that it may be modified in place.
+ * up: if zero, only members of c (or of an instance stored in c) are considered since assignments never write to a parent scope. Otherwise parent scopes are searched as well, which is used for writing to elements of an existing value.
+ * returns: a pointer to the stored value or NULL if it could not be found
+ */
+static inline spcl_val* find_slot_rs(struct spcl_inst* c, read_state rs, int up) {
+    psize dot_loc = strchr_block_rs(rs.b, rs.start, rs.end, '.');
+    psize ref_loc = strchr_block_rs(rs.b, rs.start, rs.end, BEG_SQR);//]
+    if (dot_loc == rs.end && ref_loc == rs.end) {
+	size_t i;
+	s8 str = trim_whitespace(fs_read(rs.b, rs.start, rs.end));
+	for (; c; c = (up)? c->parent : NULL) {
+	    if (find_ind(c, str, &i))
+		return &(c->table[i].v);
+	}
+    } else if (dot_loc < ref_loc) {
+	spcl_val sub_con = spcl_find_rs(c, make_read_state(rs.b, rs.start, dot_loc));
+	if (sub_con.type == VAL_INST)
+	    return find_slot_rs(sub_con.val.c, make_read_state(rs.b, dot_loc+1, rs.end), up);
+    }
+    return NULL;
+}
+/**
+ * Check whether the assignment rs_l = rs_r has the form name = cat(name, x) where cat is the builtin, so that x may be appended to the stored value in place instead of to a copy of it.
+ * x: if the assignment matches, this is set to the location of the second argument
+ * returns: a pointer to the stored value or NULL if the assignment doesn't match
+ */
+static inline spcl_val* self_cat_rs(struct spcl_inst* c, read_state rs_l, read_state rs_r, read_state* x) {
+    psize open_ind = strchr_block_rs(rs_r.b, rs_r.start, rs_r.end, BEG_PAR);
+    if (open_ind == rs_r.end)
+	return NULL;
+    spcl_val func_val = spcl_find_rs(c, make_read_state(rs_r.b, rs_r.start, open_ind));
+    if (func_val.type != VAL_FN || func_val.val.f->exec != &spcl_cat)
+	return NULL;
+    //there must be exactly two arguments and nothing after the call
+    psize com_ind = strchr_block_rs(rs_r.b, open_ind+1, rs_r.end, ',');
+    psize close_ind = strchr_block_rs(rs_r.b, open_ind+1, rs_r.end, END_PAR);
+    if (com_ind >= close_ind || close_ind == rs_r.end || strchr_block_rs(rs_r.b, com_ind+1, close_ind, ',') != close_ind)
+	return NULL;
+    if (skip_ws(rs_r.b, close_ind+1, rs_r.end, 0) != rs_r.end)
+	return NULL;
+    s8 name = trim_whitespace(fs_read(rs_l.b, rs_l.start, rs_l.end));
+    s8 first = trim_whitespace(fs_read(rs_r.b, open_ind+1, com_ind));
+    if (s8cmp(name, first) != 0)
+	return NULL;
+    *x = make_read_state(rs_r.b, com_ind+1, close_ind);
+    return find_slot_rs(c, rs_l, 0);
+}
+/**
+ * A single entry of a comma separated index. Slices have the form start:stop:step where each part is optional. Plain indices (is_slice == 0) remove the corresponding axis.
+ */
+typedef struct slice_spec {
+    double lim[3];
+    unsigned char has[3];
+    unsigned char is_slice;
+    //resolved against the length of an axis by resolve_slice()
+    size_t start;
+    size_t n;
+    psize step;
+} slice_spec;
+//check whether the contents of an index block between s and e contain slices or more than one index
+static inline int is_slice_rs(const spcl_fstream* fs, psize s, psize e) {
+    if (strchr_block_rs(fs, s, e, ',') < e)
+	return 1;
+    //colons are also used by ternaries, which take precedence. Slice bounds containing a ternary must be parenthesized.
+    return strchr_block_rs(fs, s, e, ':') < e && strchr_block_rs(fs, s, e, '?') == e;
+}
+/**
+ * Evaluate the comma separated list of indices and slices between rs.start and rs.end.
+ * specs: a pointer to an array of slice_specs which is allocated by this function and must be freed by the caller
+ * n_specs: the number of entries in specs
+ * returns: none on success or an error
+ */
+static inline spcl_val parse_slices(spcl_inst* c, read_state rs, slice_spec** specs, size_t* n_specs) {
+    *n_specs = 0;
+    *specs = NULL;
+    size_t cap = 0;
+    psize s = rs.start;
+    while (s <= rs.end) {
+	psize e = strchr_block_rs(rs.b, s, rs.end, ',');
+	if (*n_specs == cap) {
+	    cap = (cap)? 2*cap : 2;
+	    *specs = xrealloc(*specs, sizeof(slice_spec)*cap);
+	}
+	slice_spec* sp = *specs + (*n_specs)++;
+	memset(sp, 0, sizeof(slice_spec));
+	int tern = strchr_block_rs(rs.b, s, e, '?') < e;
+	for (size_t k = 0; k < 3; ++k) {
+	    psize ee = (tern)? e : strchr_block_rs(rs.b, s, e, ':');
+	    if (ee < e)
+		sp->is_slice = 1;
+	    else if (k == 0 && skip_ws(rs.b, s, e, 0) == e)
+		return spcl_make_err(E_BAD_SYNTAX, "empty index");
+	    if (skip_ws(rs.b, s, ee, 0) < ee) {
+		spcl_val x = spcl_parse_line_rs(c, make_read_state(rs.b, s, ee), NULL, KEY_NONE);
+		if (x.type != VAL_NUM && x.type != VAL_INT) {
+		    if (x.type == VAL_ERR)
+			return x;
+		    cleanup_spcl_val(&x);
+		    return spcl_make_err(E_BAD_TYPE, "cannot index with type %s", valnames[x.type]);
+		}
+		sp->lim[k] = val_to_x(&x);
+		sp->has[k] = 1;
+	    }
+	    s = ee+1;
+	    if (ee >= e)
+		break;
+	}
+	if (s <= e)
+	    return spcl_make_err(E_BAD_SYNTAX, "too many ':' in slice");
+	if (sp->has[2] && sp->lim[2] == 0)
+	    return spcl_make_err(E_BAD_VALUE, "slice step cannot be zero");
+	s = e+1;
+    }
+    return spcl_make_none();
+}
+/**
+ * Resolve the slice or index sp against an axis with len entries. Negative values count from the end and out of range slice bounds are clamped, following python conventions.
+ */
+static inline spcl_val resolve_slice(slice_spec* sp, size_t len) {
+    psize n = (psize)len;
+    if (!sp->is_slice) {
+	psize i = (psize)sp->lim[0];
+	if (i < -n || i >= n)
+	    return spcl_make_err(E_OUT_OF_RANGE, "index %d out of bounds for list of size %lu", (int)i, len);
+	sp->start = (i < 0)? i+n : i;
+	sp->n = 1;
+	sp->step = 0;
+	return spcl_make_none();
+    }
+    psize step = (sp->has[2])? (psize)sp->lim[2] : 1;
+    if (step == 0)
+	return spcl_make_err(E_BAD_VALUE, "slice step cannot be zero");
+    psize lo = (step < 0)? -1 : 0;
+    psize hi = (step < 0)? n-1 : n;
+    psize b[2] = {(step < 0)? hi : lo, (step < 0)? lo : hi};
+    for (size_t k = 0; k < 2; ++k) {
+	if (!sp->has[k])
+	    continue;
+	b[k] = (psize)sp->lim[k];
+	if (b[k] < 0)
+	    b[k] += n;
+	b[k] = (b[k] < lo)? lo : (b[k] > hi)? hi : b[k];
+    }
+    sp->start = (size_t)b[0];
+    sp->step = step;
+    if (step > 0)
+	sp->n = (b[1] > b[0])? (size_t)((b[1]-b[0]+step-1)/step) : 0;
+    else
+	sp->n = (b[0] > b[1])? (size_t)((b[0]-b[1]-step-1)/(-step)) : 0;
+    return spcl_make_none();
+}
+/**
+ * Resolve specs against the shape of the array or tensor v and fill desc with a descriptor of the selected elements. Axes indexed by a single number are dropped.
+ * desc: a descriptor with at least as many axes as v
+ * returns: none on success or an error
+ */
+static inline spcl_val slice_desc(spcl_val v, slice_spec* specs, size_t n_specs, spcl_tensor* desc) {
+    //treat arrays as tensors with a single axis
+    psize one = 1;
+    spcl_tensor arr = {1, &v.n_els, &one, v.val.a};
+    const spcl_tensor* t = (v.type == VAL_MAT)? v.val.t : &arr;
+    if (n_specs > t->ndim)
+	return spcl_make_err(E_OUT_OF_RANGE, "too many indices for value with %lu axes", t->ndim);
+    desc->ndim = 0;
+    desc->data = t->data;
+    for (size_t d = 0; d < t->ndim; ++d) {
+	if (d < n_specs) {
+	    spcl_val er = resolve_slice(specs+d, t->shape[d]);
+	    if (er.type == VAL_ERR)
+		return er;
+	    desc->data += (psize)specs[d].start*t->strides[d];
+	    if (!specs[d].is_slice)
+		continue;
+	    desc->shape[desc->ndim] = specs[d].n;
+	    desc->strides[desc->ndim++] = specs[d].step*t->strides[d];
+	} else {
+	    desc->shape[desc->ndim] = t->shape[d];
+	    desc->strides[desc->ndim++] = t->strides[d];
+	}
+    }
+    return spcl_make_none();
+}
+/**
+ * Read or assign the elements of the complex array v selected by specs. Unlike real arrays, slices of complex arrays are copies.
+ * src: if not NULL, src is assigned to the selection. Numbers are copied to every selected element, otherwise src must be an array with the same length as the selection.
+ * returns: the selected elements, or none if src is not NULL
+ */
+static inline spcl_val slice_carray(spcl_val* v, slice_spec* specs, size_t n_specs, const spcl_val* src) {
+    if (n_specs != 1)
+	return spcl_make_err(E_OUT_OF_RANGE, "too many indices for value with 1 axes");
+    spcl_val er = resolve_slice(specs, v->n_els);
+    if (er.type == VAL_ERR)
+	return er;
+    double complex* x = (double complex*)v->val.a + specs->start;
+    if (!src) {
+	if (!specs->is_slice)
+	    return spcl_make_complex(creal(*x), cimag(*x));
+	spcl_val ret = alloc_carray(specs->n);
+	for (size_t i = 0; i < specs->n; ++i)
+	    ((double complex*)ret.val.a)[i] = x[(psize)i*specs->step];
+	return ret;
+    }
+    if (src->type == VAL_NUM || src->type == VAL_COMPLEX) {
+	double complex z = val_to_z(src);
+	for (size_t i = 0; i < specs->n; ++i)
+	    x[(psize)i*specs->step] = z;
+    } else if ((src->type == VAL_ARRAY || src->type == VAL_CARRAY) && src->n_els == specs->n && specs->is_slice) {
+	for (size_t i = 0; i < specs->n; ++i)
+	    x[(psize)i*specs->step] = (src->type == VAL_ARRAY)? src->val.a[i] : ((double complex*)src->val.a)[i];
+    } else {
+	return spcl_make_err(E_BAD_VALUE, "can only assign numbers or arrays of length %lu to complex array slice", specs->n);
+    }
+    return spcl_make_none();
+}
+/**
+ * Read or assign the elements of the integer array or typed array v selected by specs. As for complex arrays, slices are copies.
+ * src: if not NULL, src is assigned to the selection. Scalars are copied to every selected element, otherwise src must be an array with the same length as the selection. Arrays with integer elements only accept integers.
+ * returns: the selected elements, or none if src is not NULL
+ */
+static inline spcl_val slice_typed(spcl_val* v, slice_spec* specs, size_t n_specs, const spcl_val* src) {
+    if (n_specs != 1)
+	return spcl_make_err(E_OUT_OF_RANGE, "too many indices for value with 1 axes");
+    spcl_val er = resolve_slice(specs, v->n_els);
+    if (er.type == VAL_ERR)
+	return er;
+    int int_els = is_int_dtype(v->type);
+    if (!src) {
+	if (!specs->is_slice)
+	    return (int_els)? spcl_make_int(arr_geti(v, specs->start)) : spcl_make_num(arr_get(v, specs->start));
+	spcl_val ret = alloc_typed(specs->n, v->type);
+	size_t sz = el_size(v->type);
+	for (size_t i = 0; i < specs->n; ++i)
+	    memcpy((char*)ret.val.a + i*sz, (char*)v->val.a + (specs->start + (psize)i*specs->step)*sz, sz);
+	return ret;
+    }
+    if ((int_els)? is_whole(src) : (src->type == VAL_NUM || src->type == VAL_INT)) {
+	for (size_t i = 0; i < specs->n; ++i) {
+	    if (src->type == VAL_INT)
+		arr_seti(v, specs->start + (psize)i*specs->step, src->val.i);
+	    else
+		arr_setx(v, specs->start + (psize)i*specs->step, src->val.x);
+	}
+    } else if (((int_els)? is_int_dtype(src->type) : is_real_arr(src->type)) && src->n_els == specs->n && specs->is_slice) {
+	for (size_t i = 0; i < specs->n; ++i) {
+	    if (int_els)
+		arr_seti(v, specs->start + (psize)i*specs->step, arr_geti(src, i));
+	    else
+		arr_setx(v, specs->start + (psize)i*specs->step, arr_get(src, i));
+	}
+    } else {
+	return spcl_make_err(E_BAD_VALUE, "can only assign %s or arrays of length %lu to %s slice", (int_els)? "integers" : "numbers", specs->n, valnames[v->type]);
+    }
+    return spcl_make_none();
+}
+//the number of nonzero elements in the mask m
+static inline size_t mask_count(const spcl_val* m) {
+    size_t k = 0;
+    for (size_t i = 0; i < m->n_els; ++i)
+	k += (m->val.u8[i] != 0);
+    return k;
+}
+/**
+ * Copy each x[i] where m[i] is nonzero to the start of y, keeping them in order. Elements are always written, and y only advances after selected ones, so y must have room for one element more than the number selected.
+ */
+#define COMPRESS_LOOP(T) {						\
+    T* yt = (T*)y;							\
+    const T* xt = (const T*)x;						\
+    for (size_t i = 0, k = 0; i < n; ++i) {				\
+	yt[k] = xt[i];							\
+	k += (m[i] != 0);						\
+    }									\
+}
+static inline void compress(void* y, const void* x, const unsigned char* m, size_t n, size_t el_size) {
+    switch (el_size) {
+    case 1:	COMPRESS_LOOP(unsigned char) break;
+    case 4:	COMPRESS_LOOP(unsigned) break;
+    case 8:	COMPRESS_LOOP(unsigned long long) break;
+    default:	for (size_t i = 0, k = 0; i < n; ++i) {
+		    if (m[i])
+			memcpy((char*)y + el_size*k++, (const char*)x + el_size*i, el_size);
 		}
-		rs.start += oplen-1;	
-	    } else if (oplen == 1 && op_prec < OP1_PRECS[(unsigned char)cur]) {
-		//avoid matches with numeric literals
-		if (OP1_PRECS[(unsigned char)cur] == OP1_PRECS['-'] && is_num && (prev == 'e' || prev == 'E'))
-		    continue;
-		*op_loc = rs.start;
-		op_prec = OP1_PRECS[(unsigned char)cur];
-	    } else if (!cur || cur == ';' || cur == '\n' || cur == '#') {
-		break;
-	    }
+    }
+}
+/**
+ * Get the elements of the array or list v where the mask m is nonzero as a new value with the same type as v.
+ */
+static inline spcl_val mask_select(spcl_val v, const spcl_val* m) {
+    if (v.type != VAL_LIST && v.type != VAL_CARRAY && !is_real_arr(v.type))
+	return spcl_make_err(E_BAD_TYPE, "cannot apply a mask to type %s", valnames[v.type]);
+    if (m->n_els != v.n_els)
+	return spcl_make_err(E_OUT_OF_RANGE, "mask with length %lu doesn't match length %lu", m->n_els, v.n_els);
+    size_t k = mask_count(m);
+    if (v.type == VAL_LIST) {
+	spcl_val ret = spcl_make_none();
+	ret.type = VAL_LIST;
+	grow_val(&ret, k, sizeof(spcl_val));
+	for (size_t i = 0; i < v.n_els; ++i) {
+	    if (m->val.u8[i])
+		ret.val.l[ret.n_els++] = copy_spcl_val(v.val.l[i]);
 	}
+	return ret;
     }
-    if (blk_stk.ptr > 0) {
-	pop(char,BLK_MAX)(&blk_stk, &open_type);
-	destroy_stack(char,BLK_MAX)(&blk_stk, NULL);
-	return spcl_make_err(E_BAD_SYNTAX, "expected %c", get_match(open_type));
+    spcl_val ret = alloc_typed(k+1, v.type);
+    ret.n_els = k;
+    compress(ret.val.a, v.val.a, m->val.u8, v.n_els, el_size(v.type));
+    return ret;
+}
+/**
+ * Assign src to the elements of the array, tensor or list *v where the mask m is nonzero. v should already be unique.
+ * src: either a scalar which is copied to each selected element or an array (or list) with one element for each selected element. As for slices, arrays with integer elements only accept integers.
+ */
+static inline spcl_val mask_assign(spcl_val* v, const spcl_val* m, const spcl_val* src) {
+    //tensors are assigned through their elements in row-major order
+    if (v->type == VAL_MAT) {
+	spcl_val flat = tensor_flat(v);
+	spcl_val er = mask_assign(&flat, m, src);
+	if (flat.val.a != v->val.t->data)
+	    tensor_scatter(v->val.t, flat.val.a);
+	cleanup_spcl_val(&flat);
+	return er;
     }
-    if (new_end) {
-	//if we didn't find an operator then we have to move the location to the new end to signal that it wasn't found
-	if (!op_prec)
-	    *op_loc = rs.start;
-	*new_end = rs.start;
+    if (v->type != VAL_LIST && !is_real_arr(v->type))
+	return spcl_make_err(E_BAD_TYPE, "cannot assign to masked elements of type %s", valnames[v->type]);
+    if (m->n_els != v->n_els)
+	return spcl_make_err(E_OUT_OF_RANGE, "mask with length %lu doesn't match length %lu", m->n_els, v->n_els);
+    const unsigned char* mask = m->val.u8;
+    if (v->type == VAL_LIST) {
+	int spread = (src->type == VAL_LIST);
+	if (spread && src->n_els != mask_count(m))
+	    return spcl_make_err(E_BAD_VALUE, "can only assign lists of length %lu to masked list", mask_count(m));
+	for (size_t i = 0, k = 0; i < v->n_els; ++i) {
+	    if (mask[i]) {
+		cleanup_spcl_val(v->val.l + i);
+		v->val.l[i] = copy_spcl_val((spread)? src->val.l[k++] : *src);
+	    }
+	}
+	return spcl_make_none();
+    }
+    int int_els = is_int_dtype(v->type);
+    if ((int_els)? is_whole(src) : (src->type == VAL_NUM || src->type == VAL_INT)) {
+	if (v->type == VAL_ARRAY) {
+	    //blend with the scalar so that the loop is vectorized
+	    double x = val_to_x(src);
+	    get_kernels()->blend(v->val.a, mask, &x, 0, v->val.a, 1, v->n_els);
+	    return spcl_make_none();
+	}
+	for (size_t i = 0; i < v->n_els; ++i) {
+	    if (!mask[i])
+		continue;
+	    if (src->type == VAL_INT)
+		arr_seti(v, i, src->val.i);
+	    else
+		arr_setx(v, i, src->val.x);
+	}
+    } else if (((int_els)? is_int_dtype(src->type) : is_real_arr(src->type)) && src->n_els == mask_count(m)) {
+	for (size_t i = 0, k = 0; i < v->n_els; ++i) {
+	    if (!mask[i])
+		continue;
+	    if (int_els)
+		arr_seti(v, i, arr_geti(src, k++));
+	    else
+		arr_setx(v, i, arr_get(src, k++));
+	}
+    } else {
+	return spcl_make_err(E_BAD_VALUE, "can only assign %s or arrays of length %lu to masked %s", (int_els)? "integers" : "numbers", mask_count(m), valnames[v->type]);
     }
-    destroy_stack(char,BLK_MAX)(&blk_stk, NULL);
     return spcl_make_none();
 }
-//forward declare so that helpers can call
-static inline spcl_val spcl_parse_line_rs(spcl_inst* c, read_state rs, psize* new_end, spcl_key start_key);
-static inline spcl_val spcl_read_lines_block(struct spcl_inst* c, read_state block_rs);
 /**
- * A helper which accesses v[ind]. If assign is not NULL, then v[ind] = *assign.
+ * Get the elements of v selected by specs as a value owned by the caller. Slices of arrays with unit step and all slices of tensors are views which share storage with v. Slices of lists are copies.
  */
-static inline spcl_val _spcl_index(spcl_val v, spcl_val ind, spcl_val* assign) {
-    //check for invalid types
-    if (ind.type != VAL_NUM)
-	return spcl_make_err(E_BAD_TYPE, "cannot index with type %s", valnames[ind.type]);
-    if (-(ind.val.x) > v.n_els || ind.val.x >= v.n_els)
-	return spcl_make_err(E_OUT_OF_RANGE, "index %d out of bounds for list of size %lu", (int)ind.val.x, v.n_els);
-    size_t i = (ind.val.x < 0)? v.n_els - (size_t)(-ind.val.x) : (size_t)ind.val.x;
-    //create a new dummy value or return the element depending on type
-    if (v.type == VAL_LIST || v.type == VAL_MAT) {
-	if (assign)
-	    v.val.l[i] = *assign;
-	return v.val.l[i];
-    } else if (v.type == VAL_ARRAY) {
-	if (assign) {
-	    if (assign->type != VAL_NUM)
-		return spcl_make_err(E_BAD_TYPE, "cannot assign type %s to array", valnames[assign->type]);
-	    v.val.a[i] = assign->val.x;
-	}
-	//in principle this should be a reference, but numerics are trivially destructable so it doesn't matter
-	return spcl_make_num(v.val.a[i]);
+static inline spcl_val slice_owned(spcl_val v, slice_spec* specs, size_t n_specs) {
+    //slices of small vectors are arrays
+    if (v.type == VAL_VEC) {
+	spcl_val arr = vec_to_array(&v);
+	spcl_val ret = slice_owned(arr, specs, n_specs);
+	cleanup_spcl_val(&arr);
+	return ret;
     }
-    return spcl_make_err(E_BAD_TYPE, "type %s is not indexable", valnames[v.type]);
+    if (v.type == VAL_LIST) {
+	if (n_specs != 1)
+	    return spcl_make_err(E_OUT_OF_RANGE, "too many indices for list");
+	spcl_val er = resolve_slice(specs, v.n_els);
+	if (er.type == VAL_ERR)
+	    return er;
+	if (!specs->is_slice)
+	    return copy_spcl_val(v.val.l[specs->start]);
+	spcl_val ret = spcl_make_none();
+	ret.type = VAL_LIST;
+	grow_val(&ret, specs->n, sizeof(spcl_val));
+	for (; ret.n_els < specs->n; ++ret.n_els)
+	    ret.val.l[ret.n_els] = copy_spcl_val(v.val.l[specs->start + (psize)ret.n_els*specs->step]);
+	return ret;
+    } else if (v.type == VAL_CARRAY) {
+	return slice_carray(&v, specs, n_specs, NULL);
+    } else if (v.type == VAL_IARRAY || is_typed(v.type)) {
+	return slice_typed(&v, specs, n_specs, NULL);
+    } else if (v.type != VAL_ARRAY && v.type != VAL_MAT) {
+	return spcl_make_err(E_BAD_TYPE, "type %s is not indexable", valnames[v.type]);
+    }
+    size_t ndim = (v.type == VAL_MAT)? v.val.t->ndim : 1;
+    spcl_tensor* desc = alloc_tensor_desc(ndim);
+    spcl_val ret = slice_desc(v, specs, n_specs, desc);
+    if (ret.type != VAL_ERR) {
+	//values which own their data directly can't share it
+	if (v.buf)
+	    ret = tensor_view(desc, 0, desc->data, v.buf);
+	else
+	    ret = spcl_make_err(E_BAD_VALUE, "cannot slice a value without a shared buffer");
+    }
+    xfree(desc);
+    return ret;
 }
 /**
- * An alternative to lookup which only considers the first n bytes in str
+ * Assign src to the elements of *v selected by specs. v should already be unique. Numbers are copied to every selected element, otherwise src must match the shape of the selection.
  */
-static inline spcl_val spcl_find_rs(const spcl_inst* c, read_state rs) {
-    psize dot_loc = strchr_block_rs(rs.b, rs.start, rs.end, '.');
-    psize ref_loc = strchr_block_rs(rs.b, rs.start, rs.end, BEG_SQR);//]
-    if (dot_loc == rs.end && ref_loc == rs.end) {
-	//if there was neither a period or open brace, just lookup directly
-	size_t i, n;
-	s8 str = trim_whitespace(fs_read(rs.b, rs.start, rs.end));
-	while (c) {
-	    if (find_ind(c, str, &i))
-		return c->table[i].v;
-	    //go up if we didn't find it
-	    c = c->parent;
+static inline spcl_val slice_assign(spcl_val* v, slice_spec* specs, size_t n_specs, spcl_val src) {
+    if (v->type == VAL_LIST) {
+	if (n_specs != 1)
+	    return spcl_make_err(E_OUT_OF_RANGE, "too many indices for list");
+	spcl_val er = resolve_slice(specs, v->n_els);
+	if (er.type == VAL_ERR)
+	    return er;
+	if (specs->is_slice && (src.type != VAL_LIST || src.n_els != specs->n))
+	    return spcl_make_err(E_BAD_VALUE, "can only assign lists of length %lu to list slice", specs->n);
+	for (size_t i = 0; i < specs->n; ++i) {
+	    spcl_val* el = v->val.l + specs->start + (psize)i*specs->step;
+	    cleanup_spcl_val(el);
+	    *el = copy_spcl_val((specs->is_slice)? src.val.l[i] : src);
 	}
-	//reaching this point in execution means the matching entry wasn't found
 	return spcl_make_none();
-    } else if (dot_loc < ref_loc) {
-	//if there was a dot, access spcl_inst members
-	spcl_val sub_con = spcl_find_rs(c, make_read_state(rs.b, rs.start, dot_loc));
-	if (sub_con.type != VAL_INST)
-	    return spcl_make_err(E_BAD_TYPE, "cannot access member from non-instance type %s", valnames[sub_con.type]);
-	return spcl_find_rs(sub_con.val.c, make_read_state(rs.b, dot_loc+1, rs.end));
+    } else if (v->type == VAL_CARRAY) {
+	return slice_carray(v, specs, n_specs, &src);
+    } else if (v->type == VAL_IARRAY || is_typed(v->type)) {
+	return slice_typed(v, specs, n_specs, &src);
+    } else if (v->type != VAL_ARRAY && v->type != VAL_MAT) {
+	return spcl_make_err(E_BAD_TYPE, "type %s is not indexable", valnames[v->type]);
+    }
+    size_t ndim = (v->type == VAL_MAT)? v->val.t->ndim : 1;
+    spcl_tensor* desc = alloc_tensor_desc(ndim);
+    spcl_val ret = slice_desc(*v, specs, n_specs, desc);
+    if (ret.type != VAL_ERR) {
+	if (desc->ndim == 0 && (src.type == VAL_NUM || src.type == VAL_INT))
+	    desc->data[0] = val_to_x(&src);
+	else if (desc->ndim == 0)
+	    ret = spcl_make_err(E_BAD_TYPE, "cannot assign type %s to array", valnames[src.type]);
+	else
+	    ret = tensor_assign(desc, src);
+    }
+    xfree(desc);
+    return ret;
+}
+static inline spcl_val index_owned(spcl_val v, spcl_val ind);
+/**
+ * Find the value selected by name[inds[0]]...[inds[n_inds-1]] where name is read from rs so that it may be modified in place. Lists are descended into directly, while indices into tensors select views which share storage with the tensor after it was made unique.
+ * view: holds the last view that was taken. The caller must clean it up, and the returned slot may point to it.
+ * er: saves an error if one occurred
+ * returns: a pointer to the selected value or NULL if it could not be found
+ */
+static inline spcl_val* find_el_slot_rs(struct spcl_inst* c, read_state rs, const spcl_val* inds, size_t n_inds, spcl_val* view, spcl_val* er) {
+    spcl_val* slot = find_slot_rs(c, rs, 1);
+    for (size_t i = 0; slot && i < n_inds; ++i) {
+	if (slot->type == VAL_LIST) {
+	    spcl_val ind = inds[i];
+	    if (ind.type != VAL_NUM && ind.type != VAL_INT) {
+		*er = spcl_make_err(E_BAD_TYPE, "cannot index with type %s", valnames[ind.type]);
+		return NULL;
+	    }
+	    size_t j = index_to_abs(&ind, slot->n_els);
+	    if (ind.type == VAL_ERR) {
+		*er = ind;
+		return NULL;
+	    }
+	    slot = slot->val.l + j;
+	} else if (slot->type == VAL_MAT) {
+	    //rows of contiguous tensors are views rather than copies
+	    if (slot != view)
+		make_contiguous(slot);
+	    spcl_val sub = index_owned(*slot, inds[i]);
+	    if (sub.type == VAL_ERR) {
+		*er = sub;
+		return NULL;
+	    }
+	    cleanup_spcl_val(view);
+	    *view = sub;
+	    slot = view;
+	} else {
+	    *er = spcl_make_err(E_BAD_TYPE, "cannot assign to an element of type %s", valnames[slot->type]);
+	    return NULL;
+	}
+    }
+    return slot;
+}
+/**
+ * Assign p_val to name[inds[0]]...[inds[n_inds-1]][i] where name is read from name_rs and i is read from ind_rs. p_val is consumed.
+ */
+static inline spcl_val assign_index_rs(struct spcl_inst* c, read_state name_rs, const spcl_val* inds, size_t n_inds, read_state ind_rs, spcl_val p_val) {
+    spcl_val view = spcl_make_none();
+    spcl_val er = spcl_make_none();
+    //read the index before the list since it may modify c. Arrays and tensors may share their buffer with other values, so they have to be made unique before writing
+    if (is_slice_rs(ind_rs.b, ind_rs.start, ind_rs.end)) {
+	slice_spec* specs;
+	size_t n_specs;
+	er = parse_slices(c, ind_rs, &specs, &n_specs);
+	spcl_val* slot = (er.type == VAL_ERR)? NULL : find_el_slot_rs(c, name_rs, inds, n_inds, &view, &er);
+	if (er.type != VAL_ERR && !slot)
+	    er = spcl_make_err(E_UNDEF, "cannot assign to slice of undefined value");
+	if (er.type != VAL_ERR) {
+	    //slices of small vectors are written as arrays
+	    if (slot->type == VAL_VEC)
+		*slot = vec_to_array(slot);
+	    if (p_val.type == VAL_VEC)
+		p_val = vec_to_array(&p_val);
+	    //views write through to a tensor which is already unique
+	    if (slot != &view)
+		make_unique(slot);
+	    er = slice_assign(slot, specs, n_specs, p_val);
+	}
+	xfree(specs);
+	cleanup_spcl_val(&p_val);
+	cleanup_spcl_val(&view);
+	return er;
+    }
+    spcl_val index = spcl_parse_line_rs(c, ind_rs, NULL, KEY_NONE);
+    spcl_val* slot = (index.type == VAL_ERR)? NULL : find_el_slot_rs(c, name_rs, inds, n_inds, &view, &er);
+    if (index.type == VAL_ERR)
+	er = index;
+    else if (er.type != VAL_ERR && !slot && n_inds > 0)
+	er = spcl_make_err(E_UNDEF, "cannot assign to an element of an undefined value");
+    if (er.type != VAL_ERR && slot && slot->type == VAL_VEC) {
+	if (index.type != VAL_U8ARRAY) {
+	    er = vec_assign(slot, index, &p_val);
+	    cleanup_spcl_val(&index);
+	    cleanup_spcl_val(&p_val);
+	    return er;
+	}
+	*slot = vec_to_array(slot);
+    }
+    if (er.type == VAL_ERR) {
+	cleanup_spcl_val(&p_val);
+	cleanup_spcl_val(&view);
+	return er;
+    }
+    if (slot && slot != &view)
+	make_unique(slot);
+    spcl_val lst = (slot)? *slot : spcl_find_rs(c, name_rs);
+    //lists may hold small vectors, but arrays and tensors are written from the equivalent array
+    if (p_val.type == VAL_VEC && lst.type != VAL_LIST)
+	p_val = vec_to_array(&p_val);
+    //masks select the elements to assign
+    if (index.type == VAL_U8ARRAY) {
+	er = (slot)? mask_assign(slot, &index, &p_val) : spcl_make_err(E_UNDEF, "cannot assign to masked elements of undefined value");
+	cleanup_spcl_val(&p_val);
     } else {
-	//access lists/arrays
-	psize close_ind = strchr_block_rs(rs.b, ref_loc+1, rs.end, END_SQR);
-	if (close_ind > rs.end)
-	    return spcl_make_err(E_BAD_SYNTAX, "expected %c", END_SQR);
-	//read the list and the index
-	spcl_val lst = spcl_find_rs(c, make_read_state(rs.b, rs.start, ref_loc));
-	spcl_val index = spcl_parse_line_rs(c, make_read_state(rs.b, ref_loc+1, close_ind), NULL, KEY_NONE);
-	return _spcl_index(lst, index, NULL);
+	//list elements take ownership of p_val and tensors consume it, everything else stores a copy
+	spcl_val el = _spcl_index(lst, index, &p_val);
+	if (el.type == VAL_ERR)
+	    er = el;
+	if ((el.type == VAL_ERR && lst.type != VAL_MAT) || (lst.type != VAL_LIST && lst.type != VAL_MAT))
+	    cleanup_spcl_val(&p_val);
     }
+    cleanup_spcl_val(&index);
+    cleanup_spcl_val(&view);
+    return er;
 }
 /**
  * similar to set_spcl_valn(), but read in place from a read state
@@ -1773,17 +7427,342 @@ static inline spcl_val set_spcl_val_rs(struct spcl_inst* c, read_state rs, spcl_
 	    return spcl_make_err(E_BAD_TYPE, "cannot access member from non instance type %s", valnames[sub_con.type]);
 	return set_spcl_val_rs(sub_con.val.c, make_read_state(rs.b, dot_loc+1, rs.end), p_val);
     } else {
-	//access lists/arrays
+	//access lists/arrays. In a chain name[i][j]...[k] every index but the last selects the value that is written to.
+	size_t n_inds = 0;
+	size_t alloc_n = 0;
+	spcl_val* inds = NULL;
+	spcl_val er = spcl_make_none();
+	psize base_end = ref_loc;
 	psize close_ind = strchr_block_rs(rs.b, ref_loc+1, rs.end, END_SQR);
-	if (close_ind > rs.end)
+	while (close_ind < rs.end) {
+	    psize next = skip_ws(rs.b, close_ind+1, rs.end, 0);
+	    if (next >= rs.end)
+		break;
+	    if (fs_get(rs.b, next) != BEG_SQR) {
+		er = spcl_make_err(E_BAD_SYNTAX, "unexpected %c after index in assignment", fs_get(rs.b, next));
+		break;
+	    }
+	    if (is_slice_rs(rs.b, ref_loc+1, close_ind)) {
+		er = spcl_make_err(E_BAD_SYNTAX, "only the last index of a chained assignment may be a slice");
+		break;
+	    }
+	    if (n_inds == alloc_n) {
+		alloc_n = (alloc_n)? 2*alloc_n : ALLOC_LST_N;
+		inds = xrealloc(inds, sizeof(spcl_val)*alloc_n);
+	    }
+	    inds[n_inds] = spcl_parse_line_rs(c, make_read_state(rs.b, ref_loc+1, close_ind), NULL, KEY_NONE);
+	    if (inds[n_inds].type == VAL_ERR) {
+		er = inds[n_inds];
+		break;
+	    }
+	    ++n_inds;
+	    ref_loc = next;
+	    close_ind = strchr_block_rs(rs.b, ref_loc+1, rs.end, END_SQR);
+	}
+	if (er.type != VAL_ERR && close_ind >= rs.end)
+	    er = spcl_make_err(E_BAD_SYNTAX, "expected %c", END_SQR);
+	if (er.type != VAL_ERR)
+	    er = assign_index_rs(c, make_read_state(rs.b, rs.start, base_end), inds, n_inds, make_read_state(rs.b, ref_loc+1, close_ind), p_val);
+	else
+	    cleanup_spcl_val(&p_val);
+	for (size_t i = 0; i < n_inds; ++i)
+	    cleanup_spcl_val(inds+i);
+	xfree(inds);
+	return er;
+    }
+    return spcl_make_none();
+}
+
+/**
+ * Get v[ind] as a value owned by the caller. Entries of tensors are views which share storage with v. Masks select the elements where they are nonzero, and give an array for tensors.
+ */
+static inline spcl_val index_owned(spcl_val v, spcl_val ind) {
+    if (v.type == VAL_MAT && ind.type != VAL_U8ARRAY) {
+	if (ind.type != VAL_NUM && ind.type != VAL_INT)
+	    return spcl_make_err(E_BAD_TYPE, "cannot index with type %s", valnames[ind.type]);
+	size_t i = index_to_abs(&ind, v.n_els);
+	if (ind.type == VAL_ERR)
+	    return ind;
+	return tensor_view(v.val.t, 1, v.val.t->data + (psize)i*v.val.t->strides[0], v.buf);
+    }
+    if (ind.type == VAL_U8ARRAY) {
+	if (v.type != VAL_VEC && v.type != VAL_MAT)
+	    return mask_select(v, &ind);
+	//tensors select from their elements in row-major order
+	spcl_val arr = (v.type == VAL_MAT)? tensor_flat(&v) : vec_to_array(&v);
+	spcl_val ret = mask_select(arr, &ind);
+	cleanup_spcl_val(&arr);
+	return ret;
+    }
+    spcl_val el = _spcl_index(v, ind, NULL);
+    return (el.type == VAL_ERR)? el : copy_spcl_val(el);
+}
+/**
+ * Apply the chain of indices [i][j]... starting at s in rs to cur.
+ * owned: if set, cur is owned and will be consumed. Otherwise cur is looked up from the name before s after evaluating the first index.
+ */
+static inline spcl_val index_chain(struct spcl_inst* c, read_state rs, psize s, spcl_val cur, int owned) {
+    psize ref_loc = s;
+    while (s < rs.end && fs_get(rs.b, s) == BEG_SQR) {
+	psize close_ind = strchr_block_rs(rs.b, s+1, rs.end, END_SQR);
+	if (close_ind >= rs.end) {
+	    if (owned) cleanup_spcl_val(&cur);
 	    return spcl_make_err(E_BAD_SYNTAX, "expected %c", END_SQR);
-	//read the list and the index
-	spcl_val lst = spcl_find_rs(c, make_read_state(rs.b, rs.start, ref_loc));
-	spcl_val index = spcl_parse_line_rs(c, make_read_state(rs.b, ref_loc+1, close_ind), NULL, KEY_NONE);
-	return _spcl_index(lst, index, &p_val);
+	}
+	//evaluate the index before looking up the value, since the index expression may modify c
+	slice_spec* specs = NULL;
+	size_t n_specs = 0;
+	spcl_val ind = (is_slice_rs(rs.b, s+1, close_ind))?
+	    parse_slices(c, make_read_state(rs.b, s+1, close_ind), &specs, &n_specs) :
+	    spcl_parse_line_rs(c, make_read_state(rs.b, s+1, close_ind), NULL, KEY_NONE);
+	if (ind.type == VAL_ERR) {
+	    xfree(specs);
+	    if (owned) cleanup_spcl_val(&cur);
+	    return ind;
+	}
+	if (!owned) {
+	    cur = spcl_find_rs(c, make_read_state(rs.b, rs.start, ref_loc));
+	    if (cur.type == VAL_UNDEF || cur.type == VAL_ERR) {
+		xfree(specs);
+		cleanup_spcl_val(&ind);
+		return cur;
+	    }
+	}
+	spcl_val next = (specs)? slice_owned(cur, specs, n_specs) : index_owned(cur, ind);
+	xfree(specs);
+	cleanup_spcl_val(&ind);
+	if (owned)
+	    cleanup_spcl_val(&cur);
+	if (next.type == VAL_ERR)
+	    return next;
+	cur = next;
+	owned = 1;
+	s = skip_ws(rs.b, close_ind+1, rs.end, 0);
+    }
+    //fall back to a plain lookup for anything else (e.g. member access after an index)
+    if (s < rs.end) {
+	if (owned) cleanup_spcl_val(&cur);
+	return copy_spcl_val(spcl_find_rs(c, rs));
+    }
+    return cur;
+}
+/**
+ * Read an indexed expression of the form name[i][j]... from rs. Unlike spcl_find_rs(), any number of indices may be chained and the result is owned by the caller.
+ */
+static inline spcl_val spcl_index_rs(struct spcl_inst* c, read_state rs) {
+    return index_chain(c, rs, strchr_block_rs(rs.b, rs.start, rs.end, BEG_SQR), spcl_make_none(), 0);//]
+}
+static inline int val_arith(spcl_val* l, char op, spcl_val r);
+/**
+ * Apply the arithmetic operator op to l and r where at least one is a small vector, overwriting the result to l. Vectors of the same length, numbers and unary signs are computed inline without touching the heap. Anything else (e.g. a vector and an array) is computed with arrays.
+ * returns: 1 if op is an arithmetic operator or 0 otherwise
+ */
+static inline int vec_arith(spcl_val* l, char op, spcl_val r) {
+    int l_sc = l->type == VAL_NUM || l->type == VAL_INT || (l->type == VAL_UNDEF && (op == '+' || op == '-'));
+    int r_sc = r.type == VAL_NUM || r.type == VAL_INT;
+    if (op && strchr("+-*/%^", op) && (l_sc || l->type == VAL_VEC) && (r_sc || r.type == VAL_VEC) && (l->type != r.type || l->n_els == r.n_els)) {
+	if (l->type == VAL_VEC && r.type == VAL_VEC) {
+	    scalar_vv(l->val.v, r.val.v, l->n_els, op);
+	} else if (l->type == VAL_VEC) {
+	    double y = val_to_x(&r);
+	    if (op == '^' && is_powi(y))
+		scalar_powi_arr(l->val.v, (long)y, l->n_els);
+	    else
+		scalar_vs(l->val.v, y, l->n_els, op);
+	} else {
+	    double x = (l->type == VAL_UNDEF)? 0 : val_to_x(l);
+	    *l = r;
+	    arr_op_rscalar(l->val.v, x, l->n_els, op);
+	}
+	return 1;
+    }
+    if (l->type == VAL_VEC)
+	*l = vec_to_array(l);
+    if (r.type != VAL_VEC)
+	return val_arith(l, op, r);
+    spcl_val tmp = vec_to_array(&r);
+    int ret = val_arith(l, op, tmp);
+    cleanup_spcl_val(&tmp);
+    return ret;
+}
+/**
+ * Apply the arithmetic operator op to l and r, overwriting the result to l.
+ * returns: 1 if op is an arithmetic operator or 0 otherwise
+ */
+static inline int val_arith(spcl_val* l, char op, spcl_val r) {
+    //lists and strings append small vectors as they are
+    if (l->type == VAL_VEC || (r.type == VAL_VEC && l->type != VAL_LIST && l->type != VAL_STR))
+	return vec_arith(l, op, r);
+    if (l->type == VAL_DUAL || r.type == VAL_DUAL)
+	return jet_arith(l, op, r);
+    //typed arrays are computed natively in single precision where possible. Otherwise the operands are widened and the result is narrowed back to the promoted type.
+    valtype dt = (is_typed(l->type) || is_typed(r.type))? result_dtype(l, op, &r) : VAL_UNDEF;
+    if (dt == VAL_FARRAY && farr_arith(l, op, r))
+	return 1;
+    if (dt != VAL_UNDEF) {
+	//integer types are computed as integer arrays so that int_exact() decides which results stay exact
+	valtype wide = (is_int_dtype(dt))? VAL_IARRAY : VAL_ARRAY;
+	spcl_val tmp = widen(*l, wide);
+	cleanup_spcl_val(l);
+	*l = tmp;
+	tmp = widen(r, wide);
+	int ret = val_arith(l, op, tmp);
+	cleanup_spcl_val(&tmp);
+	if (l->type == wide && dt != wide) {
+	    tmp = convert_arr(l, dt);
+	    cleanup_spcl_val(l);
+	    *l = tmp;
+	}
+	return ret;
+    }
+    //integers stay exact where possible. Otherwise they are converted to numbers, unless the other operand isn't numeric (e.g. when appending to a list)
+    if (is_int(l->type) || is_int(r.type) || is_typed(l->type) || is_typed(r.type)) {
+	if (int_exact(l, op, &r)) {
+	    int_op(l, op, r);
+	    return 1;
+	}
+	int l_num = is_int(l->type) || is_typed(l->type) || is_numeric(l->type) || is_complex(l->type) || l->type == VAL_UNDEF;
+	int r_num = is_int(r.type) || is_typed(r.type) || is_numeric(r.type) || is_complex(r.type);
+	if (l_num && r_num) {
+	    spcl_val tmp = to_f64(*l);
+	    cleanup_spcl_val(l);
+	    *l = tmp;
+	    tmp = to_f64(r);
+	    int ret = val_arith(l, op, tmp);
+	    cleanup_spcl_val(&tmp);
+	    return ret;
+	}
+    }
+    //matrix products can't be computed in place
+    if (op == '@') {
+	spcl_val prod = matmul_vals(*l, r);
+	cleanup_spcl_val(l);
+	*l = prod;
+	return 1;
+    }
+    //scalars (or a unary sign) on the left are applied to each element of an array or tensor on the right
+    if ((l->type == VAL_NUM || (l->type == VAL_UNDEF && (op == '+' || op == '-'))) && (r.type == VAL_ARRAY || r.type == VAL_MAT)) {
+	if (!op || !strchr("+-*/%^", op))
+	    return 0;
+	double x = (l->type == VAL_NUM)? l->val.x : 0;
+	*l = copy_spcl_val(r);
+	make_contiguous(l);
+	if (l->type == VAL_ARRAY)
+	    arr_op_rscalar(l->val.a, x, l->n_els, op);
+	else
+	    arr_op_rscalar(l->val.t->data, x, tensor_size(l->val.t), op);
+	return 1;
+    }
+    switch(op) {
+    case '+': val_add(l, r);return 1;
+    case '-': val_sub(l, r);return 1;
+    case '*': val_mul(l, r);return 1;
+    case '/': val_div(l, r);return 1;
+    case '%': val_mod(l, r);return 1;
+    case '^': val_exp(l, r);return 1;
+    default: return 0;
+    }
+}
+//check whether v may be used in an elementwise comparison or mask operation
+static inline int is_mask_operand(const spcl_val* v) {
+    return is_real_arr(v->type) || v->type == VAL_NUM || v->type == VAL_INT;
+}
+//get the length of the elementwise result of l and r or SIZE_MAX if the lengths are incompatible. Scalars and single elements are repeated.
+static inline size_t mask_len(const spcl_val* l, const spcl_val* r) {
+    size_t nl = (is_real_arr(l->type))? l->n_els : 1;
+    size_t nr = (is_real_arr(r->type))? r->n_els : 1;
+    if (nl != nr && nl != 1 && nr != 1)
+	return SIZE_MAX;
+    return (nl == 1)? nr : nl;
+}
+/**
+ * Compare the real arrays or scalars l and r elementwise with op ('<' or '>'), including equality if or_eq is set. Integer types are compared exactly.
+ * returns: a mask, i.e. a uint8 array which is 1 wherever the comparison holds and 0 elsewhere
+ */
+static inline spcl_val cmp_mask(spcl_val l, char op, int or_eq, spcl_val r) {
+    //a > b is computed as b < a
+    if (op == '>') {
+	spcl_val tmp = l;
+	l = r;
+	r = tmp;
+    }
+    size_t n = mask_len(&l, &r);
+    if (n == SIZE_MAX)
+	return spcl_make_err(E_OUT_OF_RANGE, "cannot compare arrays with lengths %lu and %lu", l.n_els, r.n_els);
+    psize sx = (is_real_arr(l.type) && l.n_els != 1);
+    psize sy = (is_real_arr(r.type) && r.n_els != 1);
+    spcl_val ret = alloc_typed(n, VAL_U8ARRAY);
+    if ((is_int_dtype(l.type) || is_whole(&l)) && (is_int_dtype(r.type) || is_whole(&r))) {
+	for (size_t i = 0; i < n; ++i) {
+	    long long a = (is_real_arr(l.type))? arr_geti(&l, i*sx) : val_to_i(&l);
+	    long long b = (is_real_arr(r.type))? arr_geti(&r, i*sy) : val_to_i(&r);
+	    ret.val.u8[i] = (or_eq)? a <= b : a < b;
+	}
+	return ret;
+    }
+    spcl_val a = to_f64(l);
+    spcl_val b = to_f64(r);
+    get_kernels()->cmp(ret.val.u8, (sx)? a.val.a : (a.type == VAL_ARRAY)? a.val.a : &a.val.x, sx, (sy)? b.val.a : (b.type == VAL_ARRAY)? b.val.a : &b.val.x, sy, n, or_eq);
+    cleanup_spcl_val(&a);
+    cleanup_spcl_val(&b);
+    return ret;
+}
+/**
+ * Replace the tensors among the operands l and r of an ordering comparison by arrays with their elements in row-major order, so that the comparison gives a mask over all of their elements. Tensors may only be compared with numbers or with tensors of the same shape.
+ */
+static inline spcl_val flatten_cmp_operands(spcl_val* l, spcl_val* r) {
+    const spcl_val* t = (l->type == VAL_MAT)? l : r;
+    const spcl_val* o = (t == l)? r : l;
+    if (o->type != VAL_MAT && o->type != VAL_NUM && o->type != VAL_INT)
+	return spcl_make_err(E_BAD_TYPE, "tensors may only be compared with numbers or tensors, got %s and %s", valnames[l->type], valnames[r->type]);
+    if (o->type == VAL_MAT && !same_shape(l->val.t, r->val.t))
+	return spcl_make_err(E_OUT_OF_RANGE, "cannot compare tensors with different shapes");
+    spcl_val* ops[] = {l, r};
+    for (size_t k = 0; k < 2; ++k) {
+	if (ops[k]->type == VAL_MAT) {
+	    spcl_val tmp = tensor_flat(ops[k]);
+	    cleanup_spcl_val(ops[k]);
+	    *ops[k] = tmp;
+	}
     }
     return spcl_make_none();
 }
+/**
+ * Combine l and r elementwise with op, which is '&' for logical and, '|' for logical or or '!' for logical not of r. Nonzero elements of masks (or any real arrays) are true.
+ * returns: a mask, or a number if neither operand is an array
+ */
+static inline spcl_val mask_logic(spcl_val l, char op, spcl_val r) {
+    if (op == '!')
+	l = spcl_make_num(1);
+    if (!is_mask_operand(&l) || !is_mask_operand(&r))
+	return spcl_make_err(E_BAD_TYPE, "cannot apply %c to types %s and %s", op, valnames[l.type], valnames[r.type]);
+    if (!is_real_arr(l.type) && !is_real_arr(r.type))
+	return spcl_make_num((op == '!')? spcl_isfalse(r) : (op == '&')? spcl_istrue(l) && spcl_istrue(r) : spcl_istrue(l) || spcl_istrue(r));
+    size_t n = mask_len(&l, &r);
+    if (n == SIZE_MAX)
+	return spcl_make_err(E_OUT_OF_RANGE, "cannot combine masks with lengths %lu and %lu", l.n_els, r.n_els);
+    psize sx = (is_real_arr(l.type) && l.n_els != 1);
+    psize sy = (is_real_arr(r.type) && r.n_els != 1);
+    spcl_val ret = alloc_typed(n, VAL_U8ARRAY);
+    unsigned char* m = ret.val.u8;
+    if ((l.type == VAL_U8ARRAY || op == '!') && r.type == VAL_U8ARRAY) {
+	//masks can be combined directly without any conversions
+	const unsigned char* x = (op == '!')? r.val.u8 : l.val.u8;
+	const unsigned char* y = r.val.u8;
+	switch (op) {
+	case '!': for (size_t i = 0; i < n; ++i) m[i] = !y[i]; break;
+	case '&': for (size_t i = 0; i < n; ++i) m[i] = (x[i*sx] != 0) & (y[i*sy] != 0); break;
+	default: for (size_t i = 0; i < n; ++i) m[i] = (x[i*sx] != 0) | (y[i*sy] != 0); break;
+	}
+	return ret;
+    }
+    for (size_t i = 0; i < n; ++i) {
+	int a = (is_real_arr(l.type))? arr_get(&l, i*sx) != 0 : spcl_istrue(l);
+	int b = (is_real_arr(r.type))? arr_get(&r, i*sy) != 0 : spcl_istrue(r);
+	m[i] = (op == '!')? !b : (op == '&')? a && b : a || b;
+    }
+    return ret;
+}
 //TODO: to inline or not to inline
 spcl_local spcl_val do_op(spcl_inst* c, read_state rs, psize op_loc, psize* new_end, spcl_key key) {
     spcl_val sto = spcl_make_none();
@@ -1799,6 +7778,9 @@ spcl_local spcl_val do_op(spcl_inst* c, read_state rs, psize op_loc, psize* new_
     //fast-forward
     rs_l.start = skip_ws(rs_l.b, rs_l.start, rs_l.end, 0);
     rs_r.start = skip_ws(rs_r.b, rs_r.start, rs_r.end, 0);
+    //arithmetic is captured as a tree so that array expressions can be evaluated in a single pass
+    if (op_width == 1 && op && strchr("+-*/%^", op))
+	return fuse_op(c, rs, op_loc, new_end);
     //handle special cases
     if (op == '?') {
 	//ternary operators and dereferences are special cases
@@ -1810,8 +7792,10 @@ spcl_local spcl_val do_op(spcl_inst* c, read_state rs, psize op_loc, psize* new_
 	spcl_val l = spcl_parse_line_rs(c, rs_l, NULL, key);
 	if (l.type == VAL_ERR)
 	    return l;
+	int cond = !(l.type == VAL_UNDEF || (l.type == VAL_INT && l.val.i == 0) || (l.type == VAL_DUAL && l.val.a[0] == 0) || (l.type != VAL_INT && l.type != VAL_DUAL && l.type != VAL_VEC && l.val.x == 0));
+	cleanup_spcl_val(&l);
 	//0 branch
-	if (l.type == VAL_UNDEF || l.val.x == 0) {
+	if (!cond) {
 	    rs_r.start = col_loc+1;
 	    sto = spcl_parse_line_rs(c, rs_r, new_end, key);
 	    return sto;
@@ -1822,11 +7806,46 @@ spcl_local spcl_val do_op(spcl_inst* c, read_state rs, psize op_loc, psize* new_
 	    return sto;
 	}
     } else if (op == '=' && op_width == 1) {
+	//l = cat(l, x) appends to the stored value in place, so building a list in a loop doesn't copy it every iteration
+	read_state rs_x;
+	if (self_cat_rs(c, rs_l, rs_r, &rs_x)) {
+	    //the right hand side has to be evaluated first since it may add entries to c and invalidate the slot
+	    spcl_val r = spcl_parse_line_rs(c, rs_x, NULL, KEY_NONE);
+	    if (r.type == VAL_ERR)
+		return r;
+	    spcl_val* slot = find_slot_rs(c, rs_l, 0);
+	    if (!slot) {
+		cleanup_spcl_val(&r);
+		return spcl_make_err(E_UNDEF, "undefined variable in assignment");
+	    }
+	    cat_unbox(&r);
+	    spcl_val er;
+	    if (slot->type == VAL_VEC) {
+		//small vectors are appended as a copy, so that the stored value is left as it was if that fails
+		spcl_val tmp = unbox_vecs(*slot);
+		er = cat_in_place(&tmp, r);
+		if (er.type == VAL_ERR) {
+		    cleanup_spcl_val(&tmp);
+		} else {
+		    cleanup_spcl_val(slot);
+		    *slot = tmp;
+		}
+	    } else {
+		//small vectors nested in a stored list are left as they are, since scanning them would make every append linear
+		er = cat_in_place(slot, r);
+	    }
+	    cleanup_spcl_val(&r);
+	    if (new_end)
+		*new_end = rs_r.end;
+	    return er;
+	}
 	//assignments
 	spcl_val tmp_val = spcl_parse_line_rs(c, rs_r, new_end, key);
 	if (tmp_val.type == VAL_ERR)
 	    return tmp_val;
-	set_spcl_val_rs(c, rs_l, tmp_val);
+	spcl_val er = set_spcl_val_rs(c, rs_l, tmp_val);
+	if (er.type == VAL_ERR)
+	    return er;
 	//this is a super ugly hack to make function names appear in debugging info
 	//TODO: this entire thing needs to be refactored into a buffer of tokens
 	if (tmp_val.type == VAL_FN) {
@@ -1834,6 +7853,39 @@ spcl_local spcl_val do_op(spcl_inst* c, read_state rs, psize op_loc, psize* new_
 	}
 	return spcl_make_none();
     }
+    //relative assignments modify the stored value in place, so appending to a list or string doesn't copy the whole thing
+    if (op_width == 2 && next == '=' && op != '=' && op != '!' && op != '<' && op != '>') {
+	//the right hand side has to be evaluated first since it may add entries to c and invalidate the slot
+	spcl_val r = spcl_parse_line_rs(c, rs_r, new_end, KEY_NONE);
+	if (r.type == VAL_ERR)
+	    return r;
+	spcl_val* slot = find_slot_rs(c, rs_l, 0);
+	if (slot) {
+	    if (!val_arith(slot, op, r)) {
+		cleanup_spcl_val(&r);
+		return spcl_make_err(E_BAD_SYNTAX, "unexpected %c", op);
+	    }
+	    cleanup_spcl_val(&r);
+	    //don't leave errors in the table
+	    if (slot->type == VAL_ERR) {
+		spcl_val er = *slot;
+		*slot = spcl_make_none();
+		return er;
+	    }
+	    return spcl_make_none();
+	}
+	//otherwise fall back to reading a copy and assigning the result (e.g. for list elements)
+	spcl_val l = spcl_parse_line_rs(c, rs_l, NULL, KEY_NONE);
+	if (l.type == VAL_ERR || !val_arith(&l, op, r)) {
+	    cleanup_spcl_val(&r);
+	    return (l.type == VAL_ERR)? l : spcl_make_err(E_BAD_SYNTAX, "unexpected %c", op);
+	}
+	cleanup_spcl_val(&r);
+	if (l.type == VAL_ERR)
+	    return l;
+	spcl_val er = set_spcl_val_rs(c, rs_l, l);
+	return (er.type == VAL_ERR)? er : spcl_make_none();
+    }
     //parse right and left spcl_vals. Note that we don't pass the key since we must do type checking after the operation completes
     spcl_val l = spcl_parse_line_rs(c, rs_l, NULL, KEY_NONE);
     if (l.type == VAL_ERR)
@@ -1849,6 +7901,29 @@ spcl_local spcl_val do_op(spcl_inst* c, read_state rs, psize op_loc, psize* new_
 	cleanup_spcl_val(&l);
 	return r;
     }
+    //elementwise comparisons and mask logic read small vectors as arrays
+    if (op == '>' || op == '<' || (op_width == 1 && (op == '|' || op == '&' || op == '!'))) {
+	if (l.type == VAL_VEC)
+	    l = vec_to_array(&l);
+	if (r.type == VAL_VEC)
+	    r = vec_to_array(&r);
+    }
+    //tensors are compared in row-major order, giving a mask over all of their elements
+    if ((op == '>' || op == '<') && (l.type == VAL_MAT || r.type == VAL_MAT)) {
+	spcl_val er = flatten_cmp_operands(&l, &r);
+	if (er.type == VAL_ERR) {
+	    cleanup_spcl_val(&l);
+	    cleanup_spcl_val(&r);
+	    return er;
+	}
+    }
+    //ordering comparisons with arrays are elementwise and give masks
+    if ((op == '>' || op == '<') && (is_real_arr(l.type) || is_real_arr(r.type)) && is_mask_operand(&l) && is_mask_operand(&r)) {
+	spcl_val mask = cmp_mask(l, op, op_width == 2, r);
+	cleanup_spcl_val(&l);
+	cleanup_spcl_val(&r);
+	return mask;
+    }
     //handle equality comparisons
     if (op == '=' || (op_width == 2 && op == '!') || op == '>' || op == '<') {
 	spcl_val cmp = spcl_valcmp(l,r);
@@ -1870,37 +7945,49 @@ spcl_local spcl_val do_op(spcl_inst* c, read_state rs, psize op_loc, psize* new_
 	    return spcl_make_num(cmp.val.x < 0);
 	}
     } else if (op == '|' || op == '&') {
-	if (next != op)
-	    return spcl_make_err(E_BAD_SYNTAX, "invalid operation \'%c%c\'", op, next);
-	if (l.type == VAL_NUM && r.type == VAL_NUM)
-	    return (op == '|')? spcl_make_num(l.val.x || r.val.x) : spcl_make_num(l.val.x && r.val.x);
+	if (next != op) {
+	    spcl_val mask = mask_logic(l, op, r);
+	    cleanup_spcl_val(&l);
+	    cleanup_spcl_val(&r);
+	    return mask;
+	}
+	if ((l.type == VAL_NUM || l.type == VAL_INT) && (r.type == VAL_NUM || r.type == VAL_INT))
+	    return (op == '|')? spcl_make_num(spcl_istrue(l) || spcl_istrue(r)) : spcl_make_num(spcl_istrue(l) && spcl_istrue(r));
 	//undefined == false
 	if (l.type == VAL_UNDEF)
-	    return (op == '|')? spcl_make_num(r.val.x) : spcl_make_num(0);
+	    return (op == '|')? spcl_make_num((r.type == VAL_INT)? r.val.i != 0 : r.val.x) : spcl_make_num(0);
 	if (r.type == VAL_UNDEF)
 	    return (op == '|')? spcl_make_num(1) : spcl_make_num(0);
 	return spcl_make_num(1);
     } else {
 	//arithmetic is all relatively simple
-	switch(op) {
-	case '+': val_add(&l, r);break;
-	case '-': val_sub(&l, r);break;
-	case '*': val_mul(&l, r);break;
-	case '/': val_div(&l, r);break;
-	case '%': val_mod(&l, r);break;
-	case '^': val_exp(&l, r);break;
-	case '!': l = (r.type == VAL_UNDEF || r.val.x == 0)? spcl_make_num(1) : spcl_make_num(0);break;
-	default: cleanup_spcl_val(&l);return spcl_make_err(E_BAD_SYNTAX, "unexpected %c", op);break;
-	}
-	//if this is a relative assignment, do that
-	if (next == '=') {
-	    set_spcl_val_rs(c, rs_l, l);
-	    l = spcl_make_none();
+	if (op == '!' && is_real_arr(r.type)) {
+	    l = mask_logic(l, op, r);
+	} else if (op == '!') {
+	    l = (r.type == VAL_UNDEF || (r.type == VAL_INT && r.val.i == 0) || (r.type != VAL_INT && r.val.x == 0))? spcl_make_num(1) : spcl_make_num(0);
+	} else if (!val_arith(&l, op, r)) {
+	    cleanup_spcl_val(&l);
+	    cleanup_spcl_val(&r);
+	    return spcl_make_err(E_BAD_SYNTAX, "unexpected %c", op);
 	}
 	cleanup_spcl_val(&r);
 	return l;
     }
 }
+//check whether for loops and comprehensions may iterate over values of type t
+static inline int is_iterable(valtype t) {
+    return t == VAL_ARRAY || t == VAL_LIST || t == VAL_MAT || t == VAL_IARRAY || t == VAL_VEC || is_typed(t);
+}
+//get an owned copy of the ith element of an iterable value
+static inline spcl_val iter_get(spcl_val lst, size_t i) {
+    if (lst.type == VAL_ARRAY)
+	return spcl_make_num(lst.val.a[i]);
+    if (lst.type == VAL_FARRAY)
+	return spcl_make_num(lst.val.fa[i]);
+    if (is_int_dtype(lst.type))
+	return spcl_make_int(arr_geti(&lst, i));
+    return index_owned(lst, spcl_make_int(i));
+}
 typedef struct for_state {
     read_state expr_name;
     psize for_start;
@@ -1929,7 +8016,7 @@ static inline for_state* make_for_state(spcl_inst* c, read_state rs, psize for_s
 	*er = spcl_make_err(E_BAD_SYNTAX, "in expression %s", fs_read(rs.b, after_in, rs.end));
 	return fs;
     }
-    if (fs->it_list.type != VAL_ARRAY && fs->it_list.type != VAL_LIST) {
+    if (!is_iterable(fs->it_list.type)) {
 	*er =  spcl_make_err(E_BAD_TYPE, "can't iterate over type %s", valnames[fs->it_list.type]);
 	return fs;
     }
@@ -1938,6 +8025,7 @@ static inline for_state* make_for_state(spcl_inst* c, read_state rs, psize for_s
     find_ind(c, var_name, &(fs->var_ind));
     fs->prev = c->table[fs->var_ind];
     c->table[fs->var_ind].s = var_name;
+    c->table[fs->var_ind].v = spcl_make_none();
     *er = spcl_make_none();
     return fs;
 }
@@ -1951,7 +8039,7 @@ static inline void destroy_for_state(for_state* fs, spcl_inst* c) {
 }
 //helper for spcl_parse_line to handle string literals
 static inline spcl_val parse_literal_str(spcl_inst* c, read_state rs, psize open_ind, psize close_ind) {
-    spcl_val v;
+    spcl_val v = spcl_make_none();
     v.type = VAL_STR;
     //set up a buffer with enough memory
     v.val.s = xmalloc(close_ind - open_ind + 1);
@@ -1983,7 +8071,7 @@ static inline spcl_val parse_literal_list(struct spcl_inst* c, read_state rs, ps
     rs.start = open_ind;
     rs.end = close_ind;
     //store the return value
-    spcl_val sto;
+    spcl_val sto = spcl_make_none();
     //read the coordinates separated by spaces
     spcl_val* lbuf;
     //check if this is a list interpretation
@@ -1997,10 +8085,10 @@ static inline spcl_val parse_literal_list(struct spcl_inst* c, read_state rs, ps
 	lbuf = xmalloc(sizeof(spcl_val)*sto.n_els);
 	//we now iterate through the list specified, substituting VAL in the expression with the current spcl_val
 	for (size_t i = 0; i < sto.n_els; ++i) {
-	    if (fs->it_list.type == VAL_LIST)
-		c->table[fs->var_ind].v = fs->it_list.val.l[i];
-	    else if (fs->it_list.type == VAL_ARRAY)
-		c->table[fs->var_ind].v = spcl_make_num(fs->it_list.val.a[i]);
+	    //the variable holds its own copy so that modifying it in the expression can't change the list
+	    spcl_val* var = &(c->table[fs->var_ind].v);
+	    cleanup_spcl_val(var);
+	    *var = iter_get(fs->it_list, i);
 	    lbuf[i] = spcl_parse_line_rs(c, fs->expr_name, NULL, KEY_NONE);
 	    if (lbuf[i].type == VAL_ERR) {
 		spcl_val ret = copy_spcl_val(lbuf[i]);
@@ -2148,7 +8236,18 @@ static inline spcl_val parse_literal_fn(struct spcl_inst* c, spcl_key key, read_
 		return er;
 	    }
 	}
-	sto = spcl_uf_eval(func_val.val.f, c, f);
+	//arguments are temporaries owned by this call, so cat() can append to the first one in place instead of copying it
+	if (func_val.val.f->exec == &spcl_cat && f.n_args == 2) {
+	    cat_unbox(f.args);
+	    cat_unbox(f.args+1);
+	    sto = cat_in_place(f.args, f.args[1]);
+	    if (sto.type != VAL_ERR) {
+		sto = f.args[0];
+		f.args[0] = spcl_make_none();
+	    }
+	} else {
+	    sto = spcl_uf_eval(func_val.val.f, c, f);
+	}
     }
     cleanup_spcl_fn_call(&f);
     xfree(arg_inds);
@@ -2168,6 +8267,357 @@ static inline spcl_val parse_literal_table(struct spcl_inst* c, read_state rs, p
     return ret;
 }
 
+/**
+ * Parse an expression that doesn't contain any operators outside of blocks, i.e. a variable, literal, function call or parenthetical expression.
+ * open_ind, close_ind: the first block in rs as found by find_operator()
+ */
+static inline spcl_val parse_operand(struct spcl_inst* c, read_state rs, psize open_ind, psize close_ind, psize* new_end, spcl_key start_key) {
+    spcl_val sto = spcl_make_none();
+    //if the first non-whitespace character after a keyword is a letter, then interpret as a variable name. Note that _ through z includes all lowercase letters, _, and `. The backtick is kind of weird but i'm not using it for anything else...
+    char thisc = fs_get(rs.b, rs.start);
+    int is_var = (thisc > MAX_ASCII || (thisc >= 'A' && thisc <= 'Z') || (thisc >= '_' && thisc <= 'z'));
+
+    //if there isn't a valid parenthetical expression, then we should interpret this as a variable
+    if (open_ind == rs.end || close_ind == rs.end) {
+	//ensure that empty strings return undefined
+	rs.start = skip_ws(rs.b, rs.start, rs.end, 0);
+	char cur = fs_get(rs.b, rs.start);
+	if (cur == 0 || rs.start == rs.end)
+	    return spcl_make_none(); 
+	if (is_var) {
+	    //spcl_find variables
+	    sto = copy_spcl_val( spcl_find_rs(c, make_read_state(rs.b, rs.start, rs.end)) );
+	    if (sto.type == VAL_UNDEF) {
+		s8 tmp = fs_read(rs.b, rs.start, rs.end);
+		return spcl_make_err(E_UNDEF, "token \"%.*s\" not defined", tmp.n, tmp.s);
+	    }
+	} else {
+	    //interpret number literals
+	    errno = 0;
+	    s8 tmp = fs_read(rs.b, rs.start, rs.end);
+	    char* str = strndup(tmp.s, tmp.n);
+	    char* end;
+	    sto.val.x = strtod(str, &end);
+	    sto.n_els = 1;
+	    if (errno) {
+		sto = spcl_make_err(E_BAD_SYNTAX, "invalid numeric %s", str);
+		xfree(str);
+		return sto;
+	    }
+	    sto.type = VAL_NUM;
+	    //a j suffix makes the literal imaginary
+	    if (end[0] == 'j' && (end[1] == 0 || is_whitespace(end[1])))
+		sto = spcl_make_complex(0, sto.val.x);
+	    xfree(str);
+	}
+    } else {
+	//if there are enclosed blocks then we need to read those
+	switch (fs_get(rs.b, open_ind)) {
+	case '\"': sto = parse_literal_str(c, rs, open_ind, close_ind);break;
+	case BEG_SQR:  sto = (is_var)? spcl_index_rs(c, rs) : parse_literal_list(c, rs, open_ind, close_ind);break; //]
+	case BEG_CRL:  sto = parse_literal_table(c, rs, open_ind, close_ind);break; //}
+	case BEG_PAR:
+	    //the results of calls and parenthetical expressions may be indexed too
+	    if (fs_get(rs.b, close_ind) == END_SQR) {
+		psize par_close = strchr_block_rs(rs.b, open_ind+1, close_ind, END_PAR);
+		sto = parse_literal_fn(c, start_key, rs, open_ind, par_close, new_end);
+		if (sto.type != VAL_ERR)
+		    sto = index_chain(c, rs, par_close+1, sto, 1);
+	    } else {
+		sto = parse_literal_fn(c, start_key, rs, open_ind, close_ind, new_end);
+	    }
+	    break; //)
+	}
+    }
+    return sto;
+}
+
+/** ============================ fused array expressions ============================ **/
+
+/*
+ * Arithmetic on arrays evaluated one operator at a time allocates a full temporary per operator and streams every operand through memory once per operator. Instead, do_op() captures the whole tree of arithmetic operators and math functions in an expression, evaluates the operands (in the same order as the unfused version would) and then computes array valued subtrees blockwise. Each block of FUSE_BLOCK elements passes through every operator while it is still in L1 before being written to a single output buffer. The results are identical to evaluating one operator at a time since the same kernels are applied in the same order.
+ */
+//the number of elements computed at a time. Each level of the tree may need a buffer of this size, so keep it small enough that a few of them fit in L1
+#define FUSE_BLOCK	512
+//the largest number of nodes captured in a single tree. Deeper expressions are split into several trees.
+#define FUSE_MAX_NODES	64
+//the operator used for calls to math functions
+#define FUSE_CALL	'f'
+
+typedef struct fuse_node {
+    char op;		//the arithmetic operator, FUSE_CALL for calls or 0 for operands
+    size_t l, r;	//the indices of the children. Calls only use l.
+    spcl_val v;		//the value of an operand
+    spcl_uf* f;		//the function called
+    s8 name;		//the name of the function called (used for error messages)
+    double (*fn)(double);
+    vmath_fn vfn;
+} fuse_node;
+typedef struct fuse_tree {
+    fuse_node nodes[FUSE_MAX_NODES];
+    size_t n;
+} fuse_tree;
+
+//math builtins which may be fused along with the scalar function and vectorized version they apply
+static const struct {
+    spcl_val (*exec)(spcl_inst*, spcl_fn_call);
+    double (*fn)(double);
+    vmath_fn vfn;
+} FUSE_FNS[] = {
+    {spcl_sin, sin, VM_SIN}, {spcl_cos, cos, VM_COS}, {spcl_tan, tan, VM_TAN}, {spcl_exp, exp, VM_EXP},
+    {spcl_asin, asin, VM_NONE}, {spcl_acos, acos, VM_NONE}, {spcl_atan, atan, VM_NONE}, {spcl_log, log, VM_LOG},
+    {spcl_sqrt, sqrt, VM_NONE}, {spcl_floor, floor, VM_NONE}, {spcl_ceil, ceil, VM_NONE}, {spcl_fabs, fabs, VM_NONE}
+};
+
+static inline size_t fuse_alloc(fuse_tree* t) {
+    fuse_node* e = t->nodes + t->n;
+    memset(e, 0, sizeof(fuse_node));
+    e->v = spcl_make_none();
+    return t->n++;
+}
+static inline void fuse_cleanup(fuse_tree* t) {
+    for (size_t i = 0; i < t->n; ++i)
+	cleanup_spcl_val(&t->nodes[i].v);
+}
+/**
+ * Capture the arithmetic in rs to the node ind of the tree t. Operands are evaluated as they are found.
+ * returns: an error if one occurred while evaluating an operand
+ */
+static inline spcl_val fuse_parse(spcl_inst* c, read_state rs, psize* new_end, fuse_tree* t, size_t ind) {
+    rs.start = skip_ws(rs.b, rs.start, rs.end, 0);
+    if (new_end)
+	*new_end = rs.end;
+    psize open_ind, close_ind, op_loc;
+    spcl_val er = find_operator(rs, &op_loc, &open_ind, &close_ind, new_end);
+    if (new_end) rs.end = *new_end;
+    if (er.type == VAL_ERR)
+	return er;
+    fuse_node* e = t->nodes + ind;
+    if (op_loc < rs.end) {
+	char op = fs_get(rs.b, op_loc);
+	if (op && strchr("+-*/%^", op) && get_oplen(op, fs_get(rs.b, op_loc+1)) == 1 && t->n+2 <= FUSE_MAX_NODES) {
+	    e->op = op;
+	    e->l = fuse_alloc(t);
+	    e->r = fuse_alloc(t);
+	    er = fuse_parse(c, make_read_state(rs.b, rs.start, op_loc), NULL, t, e->l);
+	    if (er.type == VAL_ERR)
+		return er;
+	    return fuse_parse(c, make_read_state(rs.b, op_loc+1, rs.end), new_end, t, e->r);
+	}
+	e->v = do_op(c, rs, op_loc, new_end, KEY_NONE);
+    } else if (open_ind < rs.end && fs_get(rs.b, open_ind) == BEG_PAR && skip_ws(rs.b, close_ind+1, rs.end, 0) == rs.end) {
+	//parenthetical expressions are part of the tree
+	if (skip_ws(rs.b, rs.start, open_ind, 0) == open_ind)
+	    return fuse_parse(c, make_read_state(rs.b, open_ind+1, close_ind), NULL, t, ind);
+	//so are calls to math functions with a single argument
+	psize s = find_token_before(rs.b, open_ind, rs.start);
+	spcl_val func_val = spcl_find_rs(c, make_read_state(rs.b, s, open_ind));
+	psize arg_s = skip_ws(rs.b, open_ind+1, close_ind, 0);
+	if (func_val.type == VAL_FN && t->n < FUSE_MAX_NODES && arg_s < close_ind && strchr_block_rs(rs.b, arg_s, close_ind, ',') >= close_ind) {
+	    for (size_t i = 0; i < sizeof(FUSE_FNS)/sizeof(FUSE_FNS[0]); ++i) {
+		if (func_val.val.f->exec == FUSE_FNS[i].exec && !func_val.val.f->deriv) {
+		    e->op = FUSE_CALL;
+		    e->f = func_val.val.f;
+		    e->name = fs_read(rs.b, s, open_ind);
+		    e->fn = FUSE_FNS[i].fn;
+		    e->vfn = FUSE_FNS[i].vfn;
+		    e->l = fuse_alloc(t);
+		    return fuse_parse(c, make_read_state(rs.b, arg_s, close_ind), NULL, t, e->l);
+		}
+	    }
+	}
+	e->v = parse_operand(c, rs, open_ind, close_ind, new_end, KEY_NONE);
+    } else {
+	e->v = parse_operand(c, rs, open_ind, close_ind, new_end, KEY_NONE);
+    }
+    if (e->v.type == VAL_ERR) {
+	er = e->v;
+	e->v = spcl_make_none();
+	return er;
+    }
+    return spcl_make_none();
+}
+static inline spcl_val fuse_eval(spcl_inst* c, fuse_tree* t, size_t ind);
+/**
+ * Check whether the subtree at ind may be evaluated blockwise. Subtrees that don't contain any arrays are evaluated immediately so that they can be treated as scalars.
+ * shape: the first array or tensor found. All others must match it.
+ * returns: 1 if the subtree can be fused, 0 if it doesn't contain any arrays or -1 if it must be evaluated one operator at a time
+ */
+static inline int fuse_check(spcl_inst* c, fuse_tree* t, size_t ind, const spcl_val** shape) {
+    fuse_node* e = t->nodes + ind;
+    if (e->op == 0) {
+	const spcl_val* v = &e->v;
+	if (v->type == VAL_NUM || v->type == VAL_UNDEF || v->type == VAL_INT)
+	    return 0;
+	if (v->type == VAL_MAT && !tensor_is_contiguous(v->val.t))
+	    return -1;
+	if (v->type != VAL_ARRAY && v->type != VAL_MAT)
+	    return -1;
+	if (!*shape) {
+	    *shape = v;
+	    return 1;
+	}
+	if ((*shape)->type != v->type || (*shape)->n_els != v->n_els)
+	    return -1;
+	if (v->type == VAL_MAT && ((*shape)->val.t->ndim != v->val.t->ndim || memcmp((*shape)->val.t->shape, v->val.t->shape, sizeof(size_t)*v->val.t->ndim)))
+	    return -1;
+	return 1;
+    }
+    if (e->op == FUSE_CALL)
+	return fuse_check(c, t, e->l, shape);
+    int fl = fuse_check(c, t, e->l, shape);
+    int fr = fuse_check(c, t, e->r, shape);
+    if (fl < 0 || fr < 0)
+	return -1;
+    if (fl == 0 && fr == 0)
+	return 0;
+    //reduce scalar subtrees to a single number. Unary signs are only allowed on the left of + and -
+    for (int i = 0; i < 2; ++i) {
+	if ((i? fr : fl) != 0)
+	    continue;
+	size_t k = (i)? e->r : e->l;
+	spcl_val v = fuse_eval(c, t, k);
+	//integers combined with arrays give numbers anyway
+	if (v.type == VAL_INT)
+	    v = spcl_make_num((double)v.val.i);
+	t->nodes[k].op = 0;
+	t->nodes[k].v = v;
+	if (v.type != VAL_NUM && (i || v.type != VAL_UNDEF || (e->op != '+' && e->op != '-')))
+	    return -1;
+    }
+    return 1;
+}
+//the number of scratch blocks needed to evaluate the subtree at ind
+static inline size_t fuse_depth(const fuse_tree* t, size_t ind) {
+    const fuse_node* e = t->nodes + ind;
+    if (e->op == 0)
+	return 0;
+    const fuse_node* l = t->nodes + e->l;
+    const fuse_node* r = t->nodes + e->r;
+    if (e->op == FUSE_CALL || (r->op == 0 && r->v.type == VAL_NUM))
+	return fuse_depth(t, e->l);
+    if (l->op == 0 && (l->v.type == VAL_NUM || l->v.type == VAL_UNDEF))
+	return fuse_depth(t, e->r);
+    if (r->op == 0)
+	return fuse_depth(t, e->l);
+    size_t dl = fuse_depth(t, e->l);
+    size_t dr = fuse_depth(t, e->r)+1;
+    return (dl > dr)? dl : dr;
+}
+static inline const double* fuse_data(const spcl_val* v) {
+    return (v->type == VAL_ARRAY)? v->val.a : v->val.t->data;
+}
+/**
+ * Evaluate elements [i, i+m) of the subtree at ind and save them to out.
+ * scratch: a buffer with room for fuse_depth() blocks
+ */
+static void fuse_block(const fuse_tree* t, size_t ind, size_t i, size_t m, double* out, double* scratch) {
+    const fuse_node* e = t->nodes + ind;
+    if (e->op == 0) {
+	memcpy(out, fuse_data(&e->v) + i, sizeof(double)*m);
+	return;
+    }
+    if (e->op == FUSE_CALL) {
+	fuse_block(t, e->l, i, m, out, scratch);
+	math_arr(out, out, m, e->fn, e->vfn);
+	return;
+    }
+    const fuse_node* l = t->nodes + e->l;
+    const fuse_node* r = t->nodes + e->r;
+    if (r->op == 0 && r->v.type == VAL_NUM) {
+	fuse_block(t, e->l, i, m, out, scratch);
+	arr_op_scalar(out, r->v.val.x, m, e->op);
+    } else if (l->op == 0 && (l->v.type == VAL_NUM || l->v.type == VAL_UNDEF)) {
+	fuse_block(t, e->r, i, m, out, scratch);
+	arr_op_rscalar(out, (l->v.type == VAL_NUM)? l->v.val.x : 0, m, e->op);
+    } else if (r->op == 0) {
+	fuse_block(t, e->l, i, m, out, scratch);
+	arr_op(out, fuse_data(&r->v) + i, m, e->op);
+    } else {
+	fuse_block(t, e->l, i, m, out, scratch);
+	fuse_block(t, e->r, i, m, scratch, scratch+FUSE_BLOCK);
+	arr_op(out, scratch, m, e->op);
+    }
+}
+typedef struct fuse_job {
+    const fuse_tree* t;
+    size_t ind;
+    double* out;
+    size_t n;
+    size_t depth;
+} fuse_job;
+//evaluate each block which starts in [start, end). Every thread uses its own scratch space.
+static void fuse_range(void* arg, size_t start, size_t end) {
+    fuse_job* job = arg;
+    double* scratch = (job->depth)? xmalloc(sizeof(double)*FUSE_BLOCK*job->depth) : NULL;
+    for (size_t i = (start + FUSE_BLOCK-1) / FUSE_BLOCK * FUSE_BLOCK; i < end; i += FUSE_BLOCK)
+	fuse_block(job->t, job->ind, i, (job->n-i < FUSE_BLOCK)? job->n-i : FUSE_BLOCK, job->out+i, scratch);
+    xfree(scratch);
+}
+/**
+ * Evaluate the subtree at ind, consuming the values of its operands.
+ */
+static inline spcl_val fuse_eval(spcl_inst* c, fuse_tree* t, size_t ind) {
+    fuse_node* e = t->nodes + ind;
+    spcl_val ret = spcl_make_none();
+    if (e->op == 0) {
+	ret = e->v;
+	e->v = spcl_make_none();
+	return ret;
+    }
+    const spcl_val* shape = NULL;
+    if (fuse_check(c, t, ind, &shape) > 0) {
+	size_t n = (shape->type == VAL_ARRAY)? shape->n_els : tensor_size(shape->val.t);
+	ret = (shape->type == VAL_ARRAY)? alloc_array(n) : alloc_tensor(shape->val.t->ndim, shape->val.t->shape);
+	double* out = (double*)fuse_data(&ret);
+	fuse_job job = {t, ind, out, n, fuse_depth(t, ind)};
+	par_for(n, fuse_range, &job);
+	return ret;
+    }
+    //otherwise apply the operators one at a time
+    if (e->op == FUSE_CALL) {
+	spcl_fn_call f;
+	memset(f.args, 0, sizeof(f.args));
+	f.name = e->name;
+	f.n_args = 1;
+	f.args[0] = fuse_eval(c, t, e->l);
+	if (f.args[0].type == VAL_ERR)
+	    return f.args[0];
+	ret = spcl_uf_eval(e->f, c, f);
+	cleanup_spcl_fn_call(&f);
+	return ret;
+    }
+    ret = fuse_eval(c, t, e->l);
+    if (ret.type == VAL_ERR)
+	return ret;
+    spcl_val r = fuse_eval(c, t, e->r);
+    if (r.type == VAL_ERR) {
+	cleanup_spcl_val(&ret);
+	return r;
+    }
+    val_arith(&ret, e->op, r);
+    cleanup_spcl_val(&r);
+    return ret;
+}
+/**
+ * Evaluate the arithmetic expression in rs with the lowest precedence operator at op_loc
+ */
+static inline spcl_val fuse_op(spcl_inst* c, read_state rs, psize op_loc, psize* new_end) {
+    fuse_tree t;
+    t.n = 0;
+    size_t root = fuse_alloc(&t);
+    t.nodes[root].op = fs_get(rs.b, op_loc);
+    t.nodes[root].l = fuse_alloc(&t);
+    t.nodes[root].r = fuse_alloc(&t);
+    spcl_val ret = fuse_parse(c, make_read_state(rs.b, rs.start, op_loc), NULL, &t, t.nodes[root].l);
+    if (ret.type != VAL_ERR)
+	ret = fuse_parse(c, make_read_state(rs.b, op_loc+1, rs.end), new_end, &t, t.nodes[root].r);
+    if (ret.type != VAL_ERR)
+	ret = fuse_eval(c, &t, root);
+    fuse_cleanup(&t);
+    return ret;
+}
+
 /**
  * Parse a spcl_val from the line buffer rs.b
  * c: the spcl_inst to use for function calls and variables etc.
@@ -2188,55 +8638,10 @@ static inline spcl_val spcl_parse_line_rs(struct spcl_inst* c, read_state rs, ps
     if (sto.type == VAL_ERR)
 	return sto;
 
-    //if the first non-whitespace character after a keyword is a letter, then interpret as a variable name. Note that _ through z includes all lowercase letters, _, and `. The backtick is kind of weird but i'm not using it for anything else...
-    char thisc = fs_get(rs.b, rs.start);
-    int is_var = (thisc > MAX_ASCII || (thisc >= 'A' && thisc <= 'Z') || (thisc >= '_' && thisc <= 'z'));
-
     //last try removing parenthesis 
-    if (op_loc >= rs.end) {
-	//if there isn't a valid parenthetical expression, then we should interpret this as a variable
-	if (open_ind == rs.end || close_ind == rs.end) {
-	    //ensure that empty strings return undefined
-	    rs.start = skip_ws(rs.b, rs.start, rs.end, 0);
-	    char cur = fs_get(rs.b, rs.start);
-	    if (cur == 0 || rs.start == rs.end)
-		return spcl_make_none(); 
-	    if (is_var) {
-		//spcl_find variables
-		sto = copy_spcl_val( spcl_find_rs(c, make_read_state(rs.b, rs.start, rs.end)) );
-		if (sto.type == VAL_UNDEF) {
-		    s8 tmp = fs_read(rs.b, rs.start, rs.end);
-		    return spcl_make_err(E_UNDEF, "token \"%.*s\" not defined", tmp.n, tmp.s);
-		}
-	    } else {
-		//interpret number literals
-		errno = 0;
-		s8 tmp = fs_read(rs.b, rs.start, rs.end);
-		char* str = strndup(tmp.s, tmp.n);
-		sto.val.x = strtod(str, NULL);
-		sto.n_els = 1;
-		if (errno) {
-		    sto = spcl_make_err(E_BAD_SYNTAX, "invalid numeric %s", str);
-		    xfree(str);
-		    return sto;
-		}
-		xfree(str);
-		sto.type = VAL_NUM;
-	    }
-	} else {
-	    //if there are enclosed blocks then we need to read those
-	    switch (fs_get(rs.b, open_ind)) {
-	    case '\"': sto = parse_literal_str(c, rs, open_ind, close_ind);break;
-	    case BEG_SQR:  sto = (is_var)? copy_spcl_val(spcl_find_rs(c, rs)) : parse_literal_list(c, rs, open_ind, close_ind);break; //]
-	    case BEG_CRL:  sto = parse_literal_table(c, rs, open_ind, close_ind);break; //}
-	    case BEG_PAR:  sto = parse_literal_fn(c, start_key, rs, open_ind, close_ind, new_end);break; //)
-	    }
-	}
-    } else {
-	return do_op(c, rs, op_loc, new_end, start_key);
-    }
-    //TODO: the current implementation may leak memory if the user declares a variable without assigning it. I still haven't decided upon the most elegant solution
-    return sto;
+    if (op_loc >= rs.end)
+	return parse_operand(c, rs, open_ind, close_ind, new_end, start_key);
+    return do_op(c, rs, op_loc, new_end, start_key);
 }
 spcl_val spcl_parse_line(spcl_inst* c, const char* str) {
     //Setup a dummy line buffer. We're calling alloca with sizes known at compile-time, don't get mad at me.
@@ -2284,8 +8689,8 @@ int spcl_find_c_iarray(const spcl_inst* c, const char* str, int* sto, size_t n)
     //bounds check
     size_t n_write = (tmp.n_els > n) ? n : tmp.n_els;
     for (size_t i = 0; i < n_write; ++i) {
-	spcl_val sub = _spcl_index(tmp, spcl_make_num(i), NULL);
-	sto[i] = (int)sub.val.x;
+	spcl_val sub = _spcl_index(tmp, spcl_make_int(i), NULL);
+	sto[i] = (sub.type == VAL_INT)? (int)sub.val.i : (int)sub.val.x;
     }
     return (int)n_write;
 }
@@ -2298,8 +8703,8 @@ int spcl_find_c_uarray(const spcl_inst* c, const char* str, unsigned* sto, size_
     //bounds check
     size_t n_write = (tmp.n_els > n) ? n : tmp.n_els;
     for (size_t i = 0; i < n_write; ++i) {
-	spcl_val sub = _spcl_index(tmp, spcl_make_num(i), NULL);
-	sto[i] = (unsigned)sub.val.x;
+	spcl_val sub = _spcl_index(tmp, spcl_make_int(i), NULL);
+	sto[i] = (sub.type == VAL_INT)? (unsigned)sub.val.i : (unsigned)sub.val.x;
     }
     return (int)n_write;
 }
@@ -2311,19 +8716,63 @@ int spcl_find_c_darray(const spcl_inst* c, const char* str, double* sto, size_t
 	return -1;
     //bounds check
     size_t n_write = (tmp.n_els > n) ? n : tmp.n_els;
-    if (tmp.type == VAL_ARRAY) {
-	memcpy(sto, tmp.val.a, sizeof(double)*n_write);
+    if (tmp.type == VAL_ARRAY || tmp.type == VAL_VEC) {
+	memcpy(sto, (tmp.type == VAL_VEC)? tmp.val.v : tmp.val.a, sizeof(double)*n_write);
+	return (int)n_write;
+    } else if (is_real_arr(tmp.type)) {
+	for (size_t i = 0; i < n_write; ++i)
+	    sto[i] = arr_get(&tmp, i);
 	return (int)n_write;
     } else if (tmp.type == VAL_LIST) {
 	for (size_t i = 0; i < n_write; ++i) {
-	    if (tmp.val.l[i].type != VAL_NUM)
+	    if (tmp.val.l[i].type != VAL_NUM && tmp.val.l[i].type != VAL_INT)
 		return -3;
-	    sto[i] = tmp.val.l[i].val.x;
+	    sto[i] = val_to_x(tmp.val.l + i);
+	}
+	return (int)n_write;
+    } else if (tmp.type == VAL_MAT) {
+	//tensors are written in row-major order one row at a time
+	const spcl_tensor* t = tmp.val.t;
+	size_t row_n = t->shape[t->ndim-1];
+	psize stride = t->strides[t->ndim-1];
+	n_write = (tensor_size(t) > n)? n : tensor_size(t);
+	for (size_t k = 0; row_n > 0 && k*row_n < n_write; ++k) {
+	    const double* row = tensor_row(t, k);
+	    size_t n_row = (n_write - k*row_n < row_n)? n_write - k*row_n : row_n;
+	    for (size_t j = 0; j < n_row; ++j)
+		sto[k*row_n + j] = row[(psize)j*stride];
 	}
 	return (int)n_write;
     }
     return -2;
 }
+int spcl_find_c_farray(const spcl_inst* c, const char* str, float* sto, size_t n) {
+    if (sto == NULL || n == 0)
+	return 0;
+    spcl_val tmp = spcl_find(c, str);
+    if (tmp.type == VAL_FARRAY) {
+	size_t n_write = (tmp.n_els > n) ? n : tmp.n_els;
+	memcpy(sto, tmp.val.fa, sizeof(float)*n_write);
+	return (int)n_write;
+    }
+    //everything else is read as doubles and then narrowed
+    double* buf = xmalloc(sizeof(double)*n);
+    int n_write = spcl_find_c_darray(c, str, buf, n);
+    for (int i = 0; i < n_write; ++i)
+	sto[i] = (float)buf[i];
+    xfree(buf);
+    return n_write;
+}
+const void* spcl_find_c_data(const spcl_inst* c, const char* str, valtype* type, size_t* n) {
+    spcl_val tmp = spcl_find(c, str);
+    if (!is_real_arr(tmp.type))
+	return NULL;
+    if (type)
+	*type = tmp.type;
+    if (n)
+	*n = tmp.n_els;
+    return tmp.val.a;
+}
 int spcl_find_c_str(const spcl_inst* c, const char* str, char* sto, size_t n) {
     //we can't save anything to an empty buffer so exit early
     if (sto == NULL || n == 0)
@@ -2341,23 +8790,40 @@ int spcl_find_c_str(const spcl_inst* c, const char* str, char* sto, size_t n) {
 }
 int spcl_find_int(const spcl_inst* c, const char* str, int* sto) {
     spcl_val tmp = spcl_find(c, str);
-    if (tmp.type != VAL_NUM)
+    if (tmp.type != VAL_NUM && tmp.type != VAL_INT)
 	return -1;
-    if (sto) *sto = (int)tmp.val.x;
+    if (sto) *sto = (tmp.type == VAL_INT)? (int)tmp.val.i : (int)tmp.val.x;
     return 0;
 }
 int spcl_find_uint(const spcl_inst* c, const char* str, unsigned* sto) {
     spcl_val tmp = spcl_find(c, str);
-    if (tmp.type != VAL_NUM)
+    if (tmp.type != VAL_NUM && tmp.type != VAL_INT)
 	return -1;
-    if (sto) *sto = (size_t)tmp.val.x;
+    if (sto) *sto = (tmp.type == VAL_INT)? (unsigned)tmp.val.i : (size_t)tmp.val.x;
+    return 0;
+}
+int spcl_find_long(const spcl_inst* c, const char* str, long long* sto) {
+    spcl_val tmp = spcl_find(c, str);
+    if (tmp.type != VAL_NUM && tmp.type != VAL_INT)
+	return -1;
+    if (sto) *sto = val_to_i(&tmp);
     return 0;
 }
 int spcl_find_float(const spcl_inst* c, const char* str, double* sto) {
     spcl_val tmp = spcl_find(c, str);
-    if (tmp.type != VAL_NUM)
+    if (tmp.type != VAL_NUM && tmp.type != VAL_INT)
+	return -1;
+    if (sto) *sto = val_to_x(&tmp);
+    return 0;
+}
+int spcl_find_table(const spcl_inst* c, const char* str, spcl_table* sto) {
+    spcl_val tmp = spcl_find(c, str);
+    if (tmp.type != VAL_INST)
 	return -1;
-    if (sto) *sto = tmp.val.x;
+    spcl_table t;
+    if (read_table(tmp.val.c, &t))
+	return -2;
+    if (sto) *sto = t;
     return 0;
 }
 void spcl_set_valn(struct spcl_inst* c, const char* p_name, size_t namelen, spcl_val p_val, int copy) {
@@ -2384,90 +8850,366 @@ void spcl_set_valn(struct spcl_inst* c, const char* p_name, size_t namelen, spcl
     }
 }
 
+/** ============================ statements ============================ **/
+
+typedef enum {STMT_EXPR, STMT_IMPORT, STMT_IF, STMT_WHILE, STMT_FOR, STMT_BREAK, STMT_CONT} stmt_type;
+//how control leaves a statement
+typedef enum {FLOW_NEXT, FLOW_BREAK, FLOW_CONT, FLOW_RET} stmt_flow;
+typedef struct spcl_block spcl_block;
 /**
- * For if, while, and for blocks, we need to find the enclosing block
+ * A single statement split from the text of a block. Expressions are still evaluated from rs, but the control structure is only read once so that loop and function bodies may be run repeatedly without rescanning.
  */
-static inline spcl_val get_block(spcl_key k, read_state* rs) {
-    //store the final end so that we can easily reset rs
-    psize end = fs_end(rs->b);
-    psize open_ind, close_ind;
-    char open_char = 0;
-    psize op_loc;
-    while (1) {//}
-	spcl_val v = find_operator(*rs, &op_loc, &open_ind, &close_ind, &end);
-	if (v.type == VAL_ERR)
-	    return v;
-	if (open_ind >= rs->end) {
-	    //we only accept single line blocks if there was a perenthesis that produces a well defined end and the statement is not a function.
-	    if (open_char != BEG_PAR || k == KEY_FN)//)
-		return spcl_make_err(E_BAD_SYNTAX, "expected a block enclosed by {...} after keyword %s", spcl_keywords[k]);
-	    return spcl_make_num(0);
+typedef struct spcl_stmt {
+    stmt_type type;
+    spcl_key key;	//the keyword passed to spcl_parse_line_rs for expressions
+    read_state rs;	//the expression, import name, loop condition or iterated list
+    s8 var;		//the loop variable for for statements (not owned)
+    spcl_block* body;
+    spcl_block* orelse;
+} spcl_stmt;
+struct spcl_block {
+    size_t n;
+    spcl_stmt* stmts;
+};
+static void destroy_block(spcl_block* b) {
+    if (!b)
+	return;
+    for (size_t i = 0; i < b->n; ++i) {
+	destroy_block(b->stmts[i].body);
+	destroy_block(b->stmts[i].orelse);
+    }
+    xfree(b->stmts);
+    xfree(b);
+}
+//print an error raised at position s and strip its message so that enclosing blocks don't print it again
+static inline void report_err(const spcl_fstream* fs, psize s, spcl_val* er) {
+    if (!er->val.e)
+	return;
+    s8 line = fs_read(fs, s, fs_line_end(fs, s));
+    fprintf(stderr, "\e[1m\033[31mError\033[0m\e[1m %s on line %lu:\e[m %.*s\n\t%s\n", errnames[er->val.e->c], fs_find_line(fs, s)+1, line.n, line.s, spcl_err_msg(*er));
+    cleanup_spcl_val(er);
+    er->type = VAL_ERR;
+    er->val.e = NULL;
+}
+/**
+ * Scan forward from s while skipping strings, comments and anything nested in brackets.
+ * match: if zero, return the first ';', newline or comment which isn't nested. Otherwise s must be an open bracket and the index of its matching close bracket is returned.
+ * returns: the index found or e if there was none
+ */
+static inline psize stmt_scan(const spcl_fstream* fs, psize s, psize e, int match) {
+    size_t depth = 0;
+    for (; s < e; ++s) {
+	char cur = fs_get(fs, s);
+	if (!cur)
+	    break;
+	if (depth == 0 && !match && (cur == ';' || cur == '\n' || cur == '#'))
+	    return s;
+	if (cur == '#') {
+	    s = fs_line_end(fs, s);
+	} else if (cur == '\"' || cur == '\'') {
+	    for (++s; s < e && fs_get(fs, s) != cur; ++s) {
+		if (fs_get(fs, s) == '\\')
+		    ++s;
+	    }
+	} else if (cur == BEG_PAR || cur == BEG_SQR || cur == BEG_CRL) {
+	    ++depth;
+	} else if (cur == END_PAR || cur == END_SQR || cur == END_CRL) {
+	    //an unmatched close bracket can only be the end of the enclosing block
+	    if (depth == 0)
+		return (match)? e : s;
+	    if (--depth == 0 && match)
+		return s;
 	}
-	open_char = fs_get(rs->b, open_ind);
-	if (open_char == BEG_CRL) {
-	    rs->start = open_ind+1;
-	    rs->end = close_ind;
-	    return spcl_make_num(1);
+    }
+    return e;
+}
+//skip whitespace, empty statements and comments starting at s
+static inline psize skip_blank(const spcl_fstream* fs, psize s, psize e) {
+    while (s < e) {
+	char c = fs_get(fs, s);
+	if (c == '#')
+	    s = fs_line_end(fs, s);
+	else if (is_whitespace(c) || c == ';')
+	    ++s;
+	else
+	    break;
+    }
+    return s;
+}
+
+static spcl_val compile_block(read_state rs, int in_loop, spcl_block** sto);
+static inline spcl_val compile_stmt(read_state rs, int in_loop, spcl_stmt* st, psize* end);
+//compile the single statement starting at rs.start into a block of its own
+static inline spcl_val compile_single(read_state rs, int in_loop, spcl_block** sto, psize* end) {
+    spcl_block* b = xmalloc(sizeof(spcl_block));
+    b->n = 0;
+    b->stmts = xmalloc(sizeof(spcl_stmt));
+    *sto = b;
+    spcl_val er = compile_stmt(rs, in_loop, b->stmts, end);
+    if (er.type != VAL_ERR)
+	b->n = 1;
+    return er;
+}
+/**
+ * Compile the body of an if, while or for statement. Bodies are either enclosed in {...} or, when the header is parenthesized, a single statement on the same line.
+ * rs: rs.start is the first character after the keyword
+ * hdr: saves the condition or loop specification
+ * end: saves the index after the end of the body
+ */
+static inline spcl_val compile_body(read_state rs, spcl_key k, int in_loop, read_state* hdr, spcl_block** sto, psize* end) {
+    psize line_end = stmt_scan(rs.b, rs.start, rs.end, 0);
+    psize open = strchr_block_rs(rs.b, rs.start, line_end, BEG_CRL);
+    psize hs = rs.start, he = open;
+    if (open == line_end) {
+	he = line_end;
+	//a parenthesized header may be followed by a single statement
+	if (fs_get(rs.b, rs.start) == BEG_PAR) {
+	    psize close = stmt_scan(rs.b, rs.start, line_end, 1);
+	    if (close == line_end)
+		return spcl_make_err(E_BAD_SYNTAX, "unmatched %c", BEG_PAR);
+	    psize rest = skip_ws(rs.b, close+1, line_end, 0);
+	    if (rest < line_end) {
+		*hdr = make_read_state(rs.b, hs, close+1);
+		return compile_single(make_read_state(rs.b, rest, rs.end), in_loop, sto, end);
+	    }
 	}
-	//move the block forward
-	rs->start = close_ind+1;
-	rs->end = fs_end(rs->b);
+	//otherwise the body must start on the next line
+	open = skip_blank(rs.b, line_end, rs.end);
+	if (open >= rs.end || fs_get(rs.b, open) != BEG_CRL)
+	    return spcl_make_err(E_BAD_SYNTAX, "expected a block enclosed by {...} after keyword %s", spcl_keywords[k].s);
     }
-    return spcl_make_err(E_BAD_SYNTAX, "something that should be impossible happened! congratulations!");
+    psize close = stmt_scan(rs.b, open, rs.end, 1);
+    if (close == rs.end)
+	return spcl_make_err(E_BAD_SYNTAX, "unmatched %c", BEG_CRL);
+    *hdr = make_read_state(rs.b, hs, he);
+    *end = close+1;
+    return compile_block(make_read_state(rs.b, open+1, close), in_loop, sto);
 }
-static inline spcl_val spcl_read_lines_block(struct spcl_inst* c, read_state block_rs) {
-    spcl_val ret;
-    psize end;
-    read_state rs = make_read_state(block_rs.b, block_rs.start, block_rs.end);
-
-    //iterate over each line in the file
-    while (rs.start < block_rs.end) {
-	rs.end = block_rs.end;
-
-	//look for keywords at the start of a line. If fast-forwarding takes us to a newline, then this string was empty unless there was a keyword.
-	spcl_key start_key = get_keyword(&rs);
-	if (start_key == KEY_BREAK || start_key == KEY_CONT) {
-	    //TODO: return break and continue statements should immediately exit
-	    //return sto;
-	} else if (start_key == KEY_IMPORT) {
-	    rs.start = skip_ws(rs.b, rs.start, rs.end, 0);
-	    //TODO: allow enclosed quotes for files with whitespace
-	    s8 name = fs_read(rs.b, rs.start, rs.end);
-	    name.n = (psize)(strchr(name.s, '\n') - name.s);
-	    spcl_fstream* fs = make_spcl_fstreamn(name.s,  name.n);
-	    if (!fs)
-		return spcl_make_err(E_BAD_VALUE, "couldn't open file %.*s", name.n, name.s);
-	    ret = spcl_read_lines(c, fs);
-	    //set the end to the last character in the line
-	    end = rs.start + name.n;
-	/*TODO: if, else, for, and while
-	 * } else if (start_key == KEY_IF) {
-	    ret = get_block(start_key, &rs, &open_ind, &close_ind);*/
-	} else {
-	    ret = spcl_parse_line_rs(c, rs, &end, start_key);
+//compile an if, while or for statement starting at rs.start (just after the keyword)
+static inline spcl_val compile_ctrl(read_state rs, spcl_key k, int in_loop, spcl_stmt* st, psize* end) {
+    read_state hdr;
+    spcl_val er = compile_body(rs, k, in_loop || k != KEY_IF, &hdr, &st->body, end);
+    if (er.type == VAL_ERR)
+	return er;
+    //strip redundant parentheses and whitespace around the header
+    hdr.start = skip_ws(hdr.b, hdr.start, hdr.end, 0);
+    while (hdr.end > hdr.start && is_whitespace(fs_get(hdr.b, hdr.end-1)))
+	--hdr.end;
+    if (fs_get(hdr.b, hdr.start) == BEG_PAR && stmt_scan(hdr.b, hdr.start, hdr.end, 1) == hdr.end-1) {
+	hdr.start = skip_ws(hdr.b, hdr.start+1, hdr.end, 0);
+	--hdr.end;
+    }
+    if (hdr.start >= hdr.end)
+	return spcl_make_err(E_LACK_TOKENS, "expected an expression after keyword %s", spcl_keywords[k].s);
+    st->rs = hdr;
+    if (k == KEY_FOR) {
+	psize in_start = token_block(hdr.b, hdr.start, hdr.end, "in", strlen("in"));
+	st->var = trim_whitespace(fs_read(hdr.b, hdr.start, in_start));
+	if (in_start == hdr.end || st->var.n == 0)
+	    return spcl_make_err(E_BAD_SYNTAX, "expected for <name> in <list>");
+	st->type = STMT_FOR;
+	st->rs.start = in_start+strlen("in");
+	return spcl_make_none();
+    }
+    st->type = (k == KEY_IF)? STMT_IF : STMT_WHILE;
+    if (k == KEY_WHILE)
+	return spcl_make_none();
+    //look ahead for an else clause, which may follow on the next line
+    read_state ers = make_read_state(rs.b, skip_blank(rs.b, *end, rs.end), rs.end);
+    if (ers.start >= ers.end || get_keyword(&ers) != KEY_ELSE)
+	return spcl_make_none();
+    if (fs_get(ers.b, ers.start) != BEG_CRL)
+	return compile_single(ers, in_loop, &st->orelse, end);
+    psize close = stmt_scan(ers.b, ers.start, ers.end, 1);
+    if (close == ers.end)
+	return spcl_make_err(E_BAD_SYNTAX, "unmatched %c", BEG_CRL);
+    *end = close+1;
+    return compile_block(make_read_state(ers.b, ers.start+1, close), in_loop, &st->orelse);
+}
+/**
+ * Compile the statement starting at rs.start
+ * in_loop: whether break and continue are allowed
+ * end: saves the index after the end of the statement
+ */
+static inline spcl_val compile_stmt(read_state rs, int in_loop, spcl_stmt* st, psize* end) {
+    memset(st, 0, sizeof(spcl_stmt));
+    rs.start = skip_ws(rs.b, rs.start, rs.end, 0);
+    //get_keyword() also skips newlines, so simple statements are read from the end of the keyword to keep them on one line
+    psize kw_end = rs.start;
+    st->key = get_keyword(&rs);
+    if (st->key != KEY_NONE)
+	kw_end += spcl_keywords[st->key].n;
+    switch (st->key) {
+    case KEY_IF:
+    case KEY_WHILE:
+    case KEY_FOR:
+	return compile_ctrl(rs, st->key, in_loop, st, end);
+    case KEY_ELSE:
+	*end = rs.start;
+	return spcl_make_err(E_BAD_SYNTAX, "else without a matching if");
+    case KEY_BREAK:
+    case KEY_CONT:
+	st->type = (st->key == KEY_BREAK)? STMT_BREAK : STMT_CONT;
+	*end = stmt_scan(rs.b, kw_end, rs.end, 0);
+	if (!in_loop)
+	    return spcl_make_err(E_BAD_SYNTAX, "%s outside of a loop", spcl_keywords[st->key].s);
+	kw_end = skip_ws(rs.b, kw_end, *end, 0);
+	if (kw_end < *end)
+	    return spcl_make_err(E_BAD_SYNTAX, "unexpected %c after %s", fs_get(rs.b, kw_end), spcl_keywords[st->key].s);
+	return spcl_make_none();
+    case KEY_IMPORT:
+	//TODO: allow enclosed quotes for files with whitespace
+	st->type = STMT_IMPORT;
+	*end = fs_line_end(rs.b, kw_end);
+	st->rs = make_read_state(rs.b, skip_ws(rs.b, kw_end, *end, 0), *end);
+	return spcl_make_none();
+    default:
+	st->type = STMT_EXPR;
+	*end = stmt_scan(rs.b, kw_end, rs.end, 0);
+	st->rs = make_read_state(rs.b, skip_ws(rs.b, kw_end, *end, 0), *end);
+	return spcl_make_none();
+    }
+}
+/**
+ * Split the text in rs into statements. The result may be executed any number of times with exec_block().
+ * in_loop: whether break and continue are allowed
+ * sto: saves the compiled block, which must be freed with destroy_block() (even if an error is returned)
+ * returns: an error if the block was invalid. Errors are reported here so that they point to the offending line.
+ */
+static spcl_val compile_block(read_state rs, int in_loop, spcl_block** sto) {
+    spcl_block* b = xmalloc(sizeof(spcl_block));
+    size_t alloc_n = ALLOC_LST_N;
+    b->n = 0;
+    b->stmts = xmalloc(sizeof(spcl_stmt)*alloc_n);
+    *sto = b;
+    psize s = skip_blank(rs.b, rs.start, rs.end);
+    while (s < rs.end) {
+	if (b->n == alloc_n) {
+	    alloc_n *= 2;
+	    b->stmts = xrealloc(b->stmts, sizeof(spcl_stmt)*alloc_n);
 	}
-	if (ret.type == VAL_ERR || start_key == KEY_RET) {
-	    if (start_key != KEY_RET && ret.val.e) {
-		s8 line = fs_read(rs.b, rs.start, fs_line_end(rs.b, rs.start));
-		fprintf(stderr, "\e[1m\033[31mError\033[0m\e[1m %s on line %lu:\e[m %.*s\n\t%s\n", errnames[ret.val.e->c], fs_find_line(rs.b, rs.start)+1, line.n, line.s, ret.val.e->msg);
-		free(ret.val.e);
-		ret.val.e = NULL;
-	    }
-	    return ret;
+	psize end = rs.end;
+	spcl_val er = compile_stmt(make_read_state(rs.b, s, rs.end), in_loop, b->stmts + b->n, &end);
+	if (er.type == VAL_ERR) {
+	    //the failed statement may own partially compiled bodies
+	    destroy_block(b->stmts[b->n].body);
+	    destroy_block(b->stmts[b->n].orelse);
+	    report_err(rs.b, s, &er);
+	    return er;
+	}
+	++b->n;
+	s = skip_blank(rs.b, end, rs.end);
+    }
+    return spcl_make_none();
+}
+
+static spcl_val exec_block(spcl_inst* c, const spcl_block* b, stmt_flow* flow);
+//run a loop body, returns non-zero if the loop should stop
+static inline int exec_loop_body(spcl_inst* c, const spcl_block* body, stmt_flow* flow, spcl_val* ret) {
+    *ret = exec_block(c, body, flow);
+    if (ret->type == VAL_ERR || *flow == FLOW_RET)
+	return 1;
+    if (*flow == FLOW_BREAK) {
+	*flow = FLOW_NEXT;
+	return 1;
+    }
+    *flow = FLOW_NEXT;
+    return 0;
+}
+static inline spcl_val exec_stmt(spcl_inst* c, const spcl_stmt* st, stmt_flow* flow) {
+    spcl_val ret = spcl_make_none();
+    switch (st->type) {
+    case STMT_BREAK:
+	*flow = FLOW_BREAK;
+	return ret;
+    case STMT_CONT:
+	*flow = FLOW_CONT;
+	return ret;
+    case STMT_IMPORT: {
+	s8 name = fs_read(st->rs.b, st->rs.start, st->rs.end);
+	spcl_fstream* fs = make_spcl_fstreamn(name.s, name.n);
+	if (!fs)
+	    return spcl_make_err(E_BAD_VALUE, "couldn't open file %.*s", name.n, name.s);
+	return spcl_read_lines(c, fs);
+    }
+    case STMT_EXPR: {
+	psize end;
+	if (st->key == KEY_RET)
+	    *flow = FLOW_RET;
+	return spcl_parse_line_rs(c, st->rs, &end, st->key);
+    }
+    case STMT_IF: {
+	spcl_val cond = spcl_parse_line_rs(c, st->rs, NULL, KEY_NONE);
+	if (cond.type == VAL_ERR)
+	    return cond;
+	int taken = spcl_istrue(cond);
+	cleanup_spcl_val(&cond);
+	if (taken)
+	    return exec_block(c, st->body, flow);
+	if (st->orelse)
+	    return exec_block(c, st->orelse, flow);
+	return ret;
+    }
+    case STMT_WHILE:
+	while (1) {
+	    spcl_val cond = spcl_parse_line_rs(c, st->rs, NULL, KEY_NONE);
+	    if (cond.type == VAL_ERR)
+		return cond;
+	    int taken = spcl_istrue(cond);
+	    cleanup_spcl_val(&cond);
+	    if (!taken || exec_loop_body(c, st->body, flow, &ret))
+		return ret;
 	}
-	//TODO: Currently I'm using end=SIZE_MAX to signal that the line just read wanted to return a value and go back to the previous stack frame. We should decide if this is actually a good way of doing things or an ugly hack.
-	if (end == SIZE_MAX)
+    case STMT_FOR: {
+	//the list is evaluated once, so changing it in the body doesn't change the iteration
+	spcl_val lst = spcl_parse_line_rs(c, st->rs, NULL, KEY_FOR);
+	if (lst.type == VAL_ERR)
+	    return lst;
+	if (!is_iterable(lst.type)) {
+	    ret = spcl_make_err(E_BAD_TYPE, "can't iterate over type %s", valnames[lst.type]);
+	    cleanup_spcl_val(&lst);
 	    return ret;
-	//if its a comment we should skip this line
-	if (fs_get(rs.b, end) == '#') {
-	    rs.start = fs_line_end(rs.b, end);
-	    ++rs.start;
-	} else {
-	    rs.start = end+1;
 	}
+	for (size_t i = 0; i < lst.n_els; ++i) {
+	    spcl_set_valn(c, st->var.s, st->var.n, iter_get(lst, i), 0);
+	    if (exec_loop_body(c, st->body, flow, &ret))
+		break;
+	}
+	cleanup_spcl_val(&lst);
+	return ret;
+    }
+    }
+    return ret;
+}
+/**
+ * Execute each statement in a compiled block
+ * flow: saves how control left the block. If this is FLOW_RET then the returned value is the value of the return statement.
+ */
+static spcl_val exec_block(spcl_inst* c, const spcl_block* b, stmt_flow* flow) {
+    for (size_t i = 0; i < b->n; ++i) {
+	spcl_val ret = exec_stmt(c, b->stmts+i, flow);
+	//errors in return statements are passed on to the caller instead of being reported here
+	if (ret.type == VAL_ERR && *flow != FLOW_RET)
+	    report_err(b->stmts[i].rs.b, b->stmts[i].rs.start, &ret);
+	if (ret.type == VAL_ERR || *flow != FLOW_NEXT)
+	    return ret;
+	cleanup_spcl_val(&ret);
     }
     return spcl_make_none();
 }
+static inline spcl_val spcl_read_lines_block(struct spcl_inst* c, read_state block_rs) {
+    spcl_block* b;
+    spcl_val ret = compile_block(block_rs, 0, &b);
+    if (ret.type != VAL_ERR) {
+	stmt_flow flow = FLOW_NEXT;
+	ret = exec_block(c, b, &flow);
+	//only return statements pass values out of a block
+	if (flow != FLOW_RET && ret.type != VAL_ERR)
+	    cleanup_spcl_val(&ret);
+    }
+    destroy_block(b);
+    return ret;
+}
 
 spcl_val spcl_read_lines(struct spcl_inst* c, const spcl_fstream* b) {
     read_state rs = make_read_state(b, 0, b->flen);
@@ -2580,6 +9322,8 @@ static inline spcl_val spcl_make_fn_rs(struct spcl_inst* c, read_state rs, psize
     }
     sto.val.f->code_lines = make_read_state(rs.b, open_ind+1, close_ind);
     sto.val.f->exec = NULL;
+    sto.val.f->code = NULL;
+    sto.val.f->deriv = 0;
     //we change the parent in spcl_uf_eval. However, calling with NULL indicates no parent, so we must pass a dummy
     sto.val.f->fn_scope = make_spcl_inst(c);
     return sto;
@@ -2591,12 +9335,20 @@ spcl_uf* make_spcl_uf_ex(spcl_val (*p_exec)(spcl_inst*, spcl_fn_call)) {
     uf->call_sig.n_args = 0;
     uf->exec = p_exec;
     uf->fn_scope = NULL;
+    uf->code = NULL;
+    uf->deriv = 0;
     return uf;
 }
 spcl_uf* copy_spcl_uf(const spcl_uf* o) {
     spcl_uf* uf = xmalloc(sizeof(spcl_uf));
     memcpy(uf, o, sizeof(spcl_uf));
     uf->call_sig.name = (s8){0};
+    uf->code = NULL;
+    //argument names and the scope are owned by each copy, so that functions can be assigned and passed as arguments
+    for (size_t i = 0; i < o->call_sig.n_args && i < SPCL_ARGS_BSIZE; ++i)
+	uf->call_sig.args[i] = copy_spcl_val(o->call_sig.args[i]);
+    if (o->fn_scope)
+	uf->fn_scope = make_spcl_inst(o->fn_scope->parent);
     return uf;
 }
 //deallocation
@@ -2604,11 +9356,37 @@ void destroy_spcl_uf(spcl_uf* uf) {
     cleanup_spcl_fn_call(&(uf->call_sig));
     if (uf->fn_scope)
 	destroy_spcl_inst(uf->fn_scope);
+    destroy_block(uf->code);
     xfree(uf);
 }
-spcl_val spcl_uf_eval(spcl_uf* uf, spcl_inst* c, spcl_fn_call call) {
+//builtins which handle integers and typed arrays themselves. All others read numeric arguments as doubles.
+static lib_call const DTYPE_FNS[] = {spcl_typeof, spcl_len, spcl_print, spcl_range, spcl_int, spcl_astype, spcl_dtype, spcl_where, spcl_sort, spcl_argsort, spcl_unique, spcl_searchsorted, spcl_cat};
+//builtins which handle small vectors themselves. All others read them as arrays.
+static lib_call const VEC_FNS[] = {spcl_typeof, spcl_len, spcl_print, spcl_dot, spcl_norm, spcl_cross};
+static spcl_val uf_call(spcl_uf* uf, spcl_inst* c, spcl_fn_call call) {
     if (uf->exec) {
-	return (*uf->exec)(c, call);
+	int int_ok = 0, vec_ok = 0;
+	for (size_t i = 0; i < sizeof(DTYPE_FNS)/sizeof(lib_call); ++i)
+	    int_ok = int_ok || uf->exec == DTYPE_FNS[i];
+	for (size_t i = 0; i < sizeof(VEC_FNS)/sizeof(lib_call); ++i)
+	    vec_ok = vec_ok || uf->exec == VEC_FNS[i];
+	//call is a shallow copy of the caller's arguments, so converted arguments can be swapped in and then cleaned up without touching the originals
+	unsigned conv = 0;
+	for (size_t i = 0; i < call.n_args && i < SPCL_ARGS_BSIZE; ++i) {
+	    if (!vec_ok && has_vec(call.args + i)) {
+		call.args[i] = unbox_vecs(call.args[i]);
+		conv |= 1u << i;
+	    } else if (!int_ok && (is_int(call.args[i].type) || is_typed(call.args[i].type))) {
+		call.args[i] = to_f64(call.args[i]);
+		conv |= 1u << i;
+	    }
+	}
+	spcl_val ret = (*uf->exec)(c, call);
+	for (size_t i = 0; conv; ++i, conv >>= 1) {
+	    if (conv & 1)
+		cleanup_spcl_val(call.args+i);
+	}
+	return ret;
     } else if (uf->code_lines.b) {
 	//TODO: handle script functions
 	if (call.n_args != uf->call_sig.n_args)
@@ -2616,13 +9394,111 @@ spcl_val spcl_uf_eval(spcl_uf* uf, spcl_inst* c, spcl_fn_call call) {
 	//setup a new scope with function arguments defined
 	uf->fn_scope->parent = c;
 	for (size_t i = 0; i < uf->call_sig.n_args; ++i) {
-	    spcl_set_valn(uf->fn_scope, uf->call_sig.args[i].val.s, uf->call_sig.args[i].n_els, call.args[i], 0);
+	    spcl_set_valn(uf->fn_scope, uf->call_sig.args[i].val.s, uf->call_sig.args[i].n_els, call.args[i], 1);
+	}
+	//the body is only split into statements once, later calls reuse it
+	if (!uf->code) {
+	    spcl_val er = compile_block(uf->code_lines, 0, &uf->code);
+	    if (er.type == VAL_ERR) {
+		destroy_block(uf->code);
+		uf->code = NULL;
+		return er;
+	    }
+	}
+	stmt_flow flow = FLOW_NEXT;
+	spcl_val ret = exec_block(uf->fn_scope, uf->code, &flow);
+	if (flow != FLOW_RET && ret.type != VAL_ERR)
+	    cleanup_spcl_val(&ret);
+	//arguments are copies (which is cheap for arrays since they share storage), so everything in the scope can be cleaned up before the next call
+	for (size_t i = 0; i < con_size(uf->fn_scope); ++i) {
+	    if (uf->fn_scope->table[i].s.s)
+		cleanup_name_val_pair(uf->fn_scope->table[i]);
 	}
-	spcl_val ret = spcl_read_lines_block(uf->fn_scope, uf->code_lines);
-	//function calls make shallow copies, so we need to reset memory to avoid double frees
 	memset( uf->fn_scope->table, 0, sizeof(name_val_pair)*con_size(uf->fn_scope) );
+	uf->fn_scope->n_memb = 0;
 	return ret;
 
     }
     return spcl_make_err(E_BAD_VALUE, "function not implemented");
 }
+/**
+ * Evaluate the order-th derivative of uf with respect to call.args[i] at x, saving it to sto. uf is called with a dual number in place of args[i].
+ */
+static inline spcl_val deriv_at(spcl_uf* uf, spcl_inst* c, spcl_fn_call call, size_t i, double x, size_t order, double* sto) {
+    spcl_val jet = alloc_typed(order+1, VAL_DUAL);
+    memset(jet.val.a, 0, sizeof(double)*(order+1));
+    jet.val.a[0] = x;
+    jet.val.a[1] = 1;
+    call.args[i] = jet;
+    spcl_val ret = uf_call(uf, c, call);
+    cleanup_spcl_val(&jet);
+    if (ret.type == VAL_ERR)
+	return ret;
+    //results which don't depend on the argument are constant
+    *sto = 0;
+    if (ret.type == VAL_DUAL && ret.n_els > order) {
+	*sto = ret.val.a[order];
+	for (size_t k = 2; k <= order; ++k)
+	    *sto *= k;
+    } else if (ret.type != VAL_DUAL && ret.type != VAL_NUM && ret.type != VAL_INT) {
+	spcl_val er = spcl_make_err(E_BAD_TYPE, "%.*s() can only differentiate functions which return numbers, got %s", call.name.n, call.name.s, valnames[ret.type]);
+	cleanup_spcl_val(&ret);
+	return er;
+    }
+    cleanup_spcl_val(&ret);
+    return spcl_make_none();
+}
+static inline spcl_val deriv_call(spcl_uf* uf, spcl_inst* c, spcl_fn_call call) {
+    if (call.n_args != 1)
+	return spcl_make_err(E_LACK_TOKENS, "%.*s() expected 1 argument, got %lu", call.name.n, call.name.s, call.n_args);
+    spcl_val x = call.args[0];
+    size_t order = (size_t)uf->deriv;
+    if (x.type == VAL_NUM || x.type == VAL_INT) {
+	double d;
+	spcl_val er = deriv_at(uf, c, call, 0, val_to_x(&x), order, &d);
+	return (er.type == VAL_ERR)? er : spcl_make_num(d);
+    }
+    //small vectors are differentiated elementwise into another small vector
+    if (x.type == VAL_VEC) {
+	spcl_val ret = x;
+	for (size_t i = 0; i < x.n_els; ++i) {
+	    spcl_val er = deriv_at(uf, c, call, 0, x.val.v[i], order, ret.val.v+i);
+	    if (er.type == VAL_ERR)
+		return er;
+	}
+	return ret;
+    }
+    if (!is_real_arr(x.type))
+	return spcl_make_err(E_BAD_TYPE, "%.*s() expected a number or array, got %s", call.name.n, call.name.s, valnames[x.type]);
+    spcl_val ret = alloc_array(x.n_els);
+    for (size_t i = 0; i < x.n_els; ++i) {
+	spcl_val er = deriv_at(uf, c, call, 0, arr_get(&x, i), order, ret.val.a+i);
+	if (er.type == VAL_ERR) {
+	    cleanup_spcl_val(&ret);
+	    return er;
+	}
+    }
+    return ret;
+}
+static inline spcl_val grad_call(spcl_uf* uf, spcl_inst* c, spcl_fn_call call) {
+    spcl_val ret = alloc_array(call.n_args);
+    for (size_t i = 0; i < call.n_args; ++i) {
+	spcl_val er = spcl_make_none();
+	if (call.args[i].type != VAL_NUM && call.args[i].type != VAL_INT)
+	    er = spcl_make_err(E_BAD_TYPE, "%.*s() can only differentiate with respect to numbers, got args[%lu].type=%s", call.name.n, call.name.s, i, valnames[call.args[i].type]);
+	else
+	    er = deriv_at(uf, c, call, i, val_to_x(call.args+i), 1, ret.val.a+i);
+	if (er.type == VAL_ERR) {
+	    cleanup_spcl_val(&ret);
+	    return er;
+	}
+    }
+    return ret;
+}
+spcl_val spcl_uf_eval(spcl_uf* uf, spcl_inst* c, spcl_fn_call call) {
+    if (uf->deriv > 0)
+	return deriv_call(uf, c, call);
+    if (uf->deriv < 0)
+	return grad_call(uf, c, call);
+    return uf_call(uf, c, call);
+}
@@ -12,7 +12,7 @@ extern "C" {
 #define safecpy(dst,src,n) strncpy(dst, src, n);dst[n-1] = 0;
 
 spcl_val cstr_to_spcl(const char* str) {
-    spcl_val v;
+    spcl_val v = spcl_make_none();
     v.type = VAL_STR;
     v.n_els = strlen(str);
     v.val.s = const_cast<char*>(str);
@@ -40,6 +40,8 @@ void test_num(spcl_val v, double x) {
     CHECK(v.val.x == x);
     CHECK(v.n_els == 1);
 }
+//write each of the lines to the file fname, defined with the file parsing tests
+void write_test_file(const char** lines, size_t n_lines, const char* fname);
 
 /**
  * save the mean and variance of values in the flattened array x[n] to mean and var. Takes only points where the index i satisfies off <= i % (dim+space) < off+dim these samples are treated as a vector. For instance mean_var(x, 6, 2, 1, 0, &mean, &var) will take the samples i=(0,1),(3,4). mean_var(x, 6, 2, 0, 0, &mean, &var) will take the samples i=(0,1),(2,3),(4,5)
@@ -222,11 +224,11 @@ TEST_CASE("spcl_val parsing") {
 	//test one element lists
 	safecpy(buf, "vec(1.2, 3.4,56.7)", SPCL_STR_BSIZE);
 	tmp_val = spcl_parse_line(sc, buf);
-	CHECK(tmp_val.type == VAL_ARRAY);
-	CHECK(tmp_val.val.a != NULL);
-	CHECK(tmp_val.val.a[0] == doctest::Approx(1.2));
-	CHECK(tmp_val.val.a[1] == doctest::Approx(3.4));
-	CHECK(tmp_val.val.a[2] == doctest::Approx(56.7));
+	CHECK(tmp_val.type == VAL_VEC);
+	CHECK(tmp_val.n_els == 3);
+	CHECK(tmp_val.val.v[0] == doctest::Approx(1.2));
+	CHECK(tmp_val.val.v[1] == doctest::Approx(3.4));
+	CHECK(tmp_val.val.v[2] == doctest::Approx(56.7));
 	cleanup_spcl_val(&tmp_val);
 
 	safecpy(buf, "array([1.2, 3.4,56.7])", SPCL_STR_BSIZE);
@@ -241,16 +243,82 @@ TEST_CASE("spcl_val parsing") {
 	safecpy(buf, "array([[0, 1, 2], [3, 4, 5], [6, 7, 8]])", SPCL_STR_BSIZE);
 	tmp_val = spcl_parse_line(sc, buf);
 	REQUIRE(tmp_val.type == VAL_MAT);
-	REQUIRE(tmp_val.val.l != NULL);
+	REQUIRE(tmp_val.val.t != NULL);
 	REQUIRE(tmp_val.n_els == 3);
+	REQUIRE(tmp_val.val.t->ndim == 2);
+	REQUIRE(tmp_val.val.t->shape[0] == 3);
+	REQUIRE(tmp_val.val.t->shape[1] == 3);
 	for (size_t i = 0; i < 3; ++i) {
-	    REQUIRE(tmp_val.val.l[i].type == VAL_ARRAY);
-	    REQUIRE(tmp_val.val.l[i].n_els == 3);
 	    for (size_t j = 0; j < 3; ++j) {
-		CHECK(tmp_val.val.l[i].val.a[j] == i*3 + j);
+		CHECK(tmp_val.val.t->data[i*tmp_val.val.t->strides[0] + j] == i*3 + j);
 	    }
 	}
 	cleanup_spcl_val(&tmp_val);
+
+	safecpy(buf, "array(vec(0, 1), [2, 3])*2 + array([[1, 1], [1, 1]])", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_MAT);
+	REQUIRE(tmp_val.val.t->shape[0] == 2);
+	REQUIRE(tmp_val.val.t->shape[1] == 2);
+	for (size_t i = 0; i < 4; ++i)
+	    CHECK(tmp_val.val.t->data[i] == 2*i + 1);
+	cleanup_spcl_val(&tmp_val);
+
+	safecpy(buf, "transpose(reshape(range(24), 2, 3, 4))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_MAT);
+	REQUIRE(tmp_val.val.t->ndim == 3);
+	CHECK(tmp_val.val.t->shape[0] == 4);
+	CHECK(tmp_val.val.t->shape[2] == 2);
+	CHECK(tmp_val.val.t->strides[0] == 1);
+	CHECK(tmp_val.val.t->strides[2] == 12);
+	cleanup_spcl_val(&tmp_val);
+
+	//chained indices only write to the selected element
+	safecpy(buf, "g = reshape(range(24), 2, 3, 4)", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	safecpy(buf, "g_cp = g", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	safecpy(buf, "g[1][2][3] = -5", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	CHECK(tmp_val.type != VAL_ERR);
+	safecpy(buf, "g[0][1] += 100", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	CHECK(tmp_val.type != VAL_ERR);
+	tmp_val = spcl_find(sc, "g");
+	REQUIRE(tmp_val.type == VAL_MAT);
+	for (size_t i = 0; i < 24; ++i)
+	    CHECK(tmp_val.val.t->data[i] == ((i == 23)? -5.0 : (i >= 4 && i < 8)? i + 100.0 : i));
+	tmp_val = spcl_find(sc, "g_cp");
+	REQUIRE(tmp_val.type == VAL_MAT);
+	CHECK(tmp_val.val.t->data[23] == 23);
+	CHECK(tmp_val.val.t->data[4] == 4);
+	safecpy(buf, "l = [[1, 2], [3, [4, 5]]]", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	safecpy(buf, "l[0][1] = 9", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	safecpy(buf, "l[1][1][0] += 10", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	tmp_val = spcl_find(sc, "l");
+	REQUIRE(tmp_val.type == VAL_LIST);
+	REQUIRE(tmp_val.val.l[0].type == VAL_LIST);
+	test_num(tmp_val.val.l[0].val.l[0], 1);
+	test_num(tmp_val.val.l[0].val.l[1], 9);
+	test_num(tmp_val.val.l[1].val.l[0], 3);
+	REQUIRE(tmp_val.val.l[1].val.l[1].type == VAL_LIST);
+	test_num(tmp_val.val.l[1].val.l[1].val.l[0], 14);
+	test_num(tmp_val.val.l[1].val.l[1].val.l[1], 5);
+	//graceful failure cases
+	safecpy(buf, "l[0][2] = 1", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_OUT_OF_RANGE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "g[0][1:][0] = 1", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_SYNTAX);
+	cleanup_spcl_val(&tmp_val);
     }
     destroy_spcl_inst(sc);
 }
@@ -289,6 +357,26 @@ TEST_CASE("string handling") {
     destroy_spcl_inst(sc);
 }
 
+TEST_CASE("errors") {
+    char tok[] = "foo_bar";
+    spcl_val er = spcl_make_err(E_UNDEF, "token \"%.*s\" not defined at %lu, %c %d %s %%", 3, tok, (size_t)12, 'x', -4, "str");
+    REQUIRE(er.type == VAL_ERR);
+    CHECK(er.val.e->c == E_UNDEF);
+    //arguments should be copied, so changing the buffer shouldn't change the message
+    tok[0] = 'g';
+    spcl_val cpy = copy_spcl_val(er);
+    CHECK(cpy.val.e == er.val.e);
+    CHECK(strcmp(spcl_err_msg(cpy), "token \"foo\" not defined at 12, x -4 str %") == 0);
+    cleanup_spcl_val(&er);
+    CHECK(strcmp(spcl_err_msg(cpy), "token \"foo\" not defined at 12, x -4 str %") == 0);
+    cleanup_spcl_val(&cpy);
+    //errors without a message don't need to allocate
+    er = spcl_make_err(E_ASSERT, "");
+    CHECK(er.val.e->c == E_ASSERT);
+    CHECK(strcmp(spcl_err_msg(er), "") == 0);
+    cleanup_spcl_val(&er);
+}
+
 TEST_CASE("operations") {
     spcl_inst* sc = make_spcl_inst(NULL);
     char buf[SPCL_STR_BSIZE];
@@ -310,6 +398,9 @@ TEST_CASE("operations") {
         safecpy(buf, "2*2-1", SPCL_STR_BSIZE);
         tmp_val = spcl_parse_line(sc, buf);
 	test_num(tmp_val, 3);
+        safecpy(buf, "5-2+1", SPCL_STR_BSIZE);
+        tmp_val = spcl_parse_line(sc, buf);
+	test_num(tmp_val, 4);
         safecpy(buf, "1+3/2", SPCL_STR_BSIZE);
         tmp_val = spcl_parse_line(sc, buf);
 	test_num(tmp_val, 2.5);
@@ -427,8 +518,8 @@ TEST_CASE("operations") {
 	tmp_val = spcl_parse_line(sc, buf);
 	REQUIRE(tmp_val.type == VAL_ERR);
 	WARN(tmp_val.val.e->c == E_BAD_SYNTAX);
-	INFO("message=", tmp_val.val.e->msg);
-	WARN(strcmp(tmp_val.val.e->msg, "expected \':\' in ternary") == 0);
+	INFO("message=", spcl_err_msg(tmp_val));
+	WARN(strcmp(spcl_err_msg(tmp_val), "expected \':\' in ternary") == 0);
 	cleanup_spcl_val(&tmp_val);
     }
     SUBCASE("Missing end graceful failure") {
@@ -436,43 +527,43 @@ TEST_CASE("operations") {
 	spcl_val tmp_val = spcl_parse_line(sc, buf);
 	REQUIRE(tmp_val.type == VAL_ERR);
 	WARN(tmp_val.val.e->c == E_BAD_SYNTAX);
-	INFO("message=", tmp_val.val.e->msg);
-	WARN(strcmp(tmp_val.val.e->msg, "expected ]") == 0);
+	INFO("message=", spcl_err_msg(tmp_val));
+	WARN(strcmp(spcl_err_msg(tmp_val), "expected ]") == 0);
 	cleanup_spcl_val(&tmp_val);
 	safecpy(buf, "a(1,2", SPCL_STR_BSIZE);
 	tmp_val = spcl_parse_line(sc, buf);
 	REQUIRE(tmp_val.type == VAL_ERR);
 	WARN(tmp_val.val.e->c == E_BAD_SYNTAX);
-	INFO("message=", tmp_val.val.e->msg);
-	WARN(strcmp(tmp_val.val.e->msg, "expected )") == 0);
+	INFO("message=", spcl_err_msg(tmp_val));
+	WARN(strcmp(spcl_err_msg(tmp_val), "expected )") == 0);
 	cleanup_spcl_val(&tmp_val);
 	safecpy(buf, "\"1,2", SPCL_STR_BSIZE);
 	tmp_val = spcl_parse_line(sc, buf);
 	REQUIRE(tmp_val.type == VAL_ERR);
 	WARN(tmp_val.val.e->c == E_BAD_SYNTAX);
-	INFO("message=", tmp_val.val.e->msg);
-	WARN(strcmp(tmp_val.val.e->msg, "expected \"") == 0);
+	INFO("message=", spcl_err_msg(tmp_val));
+	WARN(strcmp(spcl_err_msg(tmp_val), "expected \"") == 0);
 	cleanup_spcl_val(&tmp_val);
 	safecpy(buf, "1,2]", SPCL_STR_BSIZE);
 	tmp_val = spcl_parse_line(sc, buf);
 	REQUIRE(tmp_val.type == VAL_ERR);
 	WARN(tmp_val.val.e->c == E_BAD_SYNTAX);
-	INFO("message=", tmp_val.val.e->msg);
-	WARN(strcmp(tmp_val.val.e->msg, "unexpected ]") == 0);
+	INFO("message=", spcl_err_msg(tmp_val));
+	WARN(strcmp(spcl_err_msg(tmp_val), "unexpected ]") == 0);
 	cleanup_spcl_val(&tmp_val);
 	safecpy(buf, "1,2)", SPCL_STR_BSIZE);
 	tmp_val = spcl_parse_line(sc, buf);
 	REQUIRE(tmp_val.type == VAL_ERR);
 	WARN(tmp_val.val.e->c == E_BAD_SYNTAX);
-	INFO("message=", tmp_val.val.e->msg);
-	WARN(strcmp(tmp_val.val.e->msg, "unexpected )") == 0);
+	INFO("message=", spcl_err_msg(tmp_val));
+	WARN(strcmp(spcl_err_msg(tmp_val), "unexpected )") == 0);
 	cleanup_spcl_val(&tmp_val);
 	safecpy(buf, "1,2\"", SPCL_STR_BSIZE);
 	tmp_val = spcl_parse_line(sc, buf);
 	REQUIRE(tmp_val.type == VAL_ERR);
 	WARN(tmp_val.val.e->c == E_BAD_SYNTAX);
-	INFO("message=", tmp_val.val.e->msg);
-	WARN(strcmp(tmp_val.val.e->msg, "expected \"") == 0);
+	INFO("message=", spcl_err_msg(tmp_val));
+	WARN(strcmp(spcl_err_msg(tmp_val), "expected \"") == 0);
 	cleanup_spcl_val(&tmp_val);
     }
     destroy_spcl_inst(sc);
@@ -724,6 +815,34 @@ TEST_CASE("builtin functions") {
 	CHECK(tmp_val.type == VAL_NUM);
 	CHECK(tmp_val.val.x == 0);
 	CHECK(tmp_val.n_els == 1);
+	//arrays use vectorized approximations unless strict math is enabled
+	const char* fn_names[] = {"exp", "log", "sin", "cos", "tan"};
+	double (*fns[])(double) = {exp, log, sin, cos, tan};
+	spcl_val xs = spcl_parse_line(sc, "linspace(0.01, 20, 1001)");
+	REQUIRE(xs.type == VAL_ARRAY);
+	for (int strict = 0; strict < 2; ++strict) {
+	    spcl_set_strict_math(strict);
+	    for (size_t j = 0; j < sizeof(fns)/sizeof(fns[0]); ++j) {
+		snprintf(buf, SPCL_STR_BSIZE, "math.%s(linspace(0.01, 20, 1001))", fn_names[j]);
+		tmp_val = spcl_parse_line(sc, buf);
+		REQUIRE(tmp_val.type == VAL_ARRAY);
+		REQUIRE(tmp_val.n_els == xs.n_els);
+		for (size_t i = 0; i < xs.n_els; ++i) {
+		    if (strict)
+			CHECK(tmp_val.val.a[i] == fns[j](xs.val.a[i]));
+		    else
+			CHECK(tmp_val.val.a[i] == doctest::Approx(fns[j](xs.val.a[i])).epsilon(1e-15));
+		}
+		cleanup_spcl_val(&tmp_val);
+	    }
+	}
+	spcl_set_strict_math(0);
+	cleanup_spcl_val(&xs);
+	safecpy(buf, "math.cos(reshape(range(6), 2, 3))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_MAT);
+	CHECK(tmp_val.val.t->data[5] == doctest::Approx(cos(5)));
+	cleanup_spcl_val(&tmp_val);
 	//failure conditions
 	safecpy(buf, "math.sin()", SPCL_STR_BSIZE);
 	tmp_val = spcl_parse_line(sc, buf);
@@ -776,6 +895,740 @@ TEST_CASE("builtin functions") {
 	WARN(tmp_val.val.e->c == E_BAD_TYPE);
 	cleanup_spcl_val(&tmp_val);
     }
+    SUBCASE("reductions") {
+	safecpy(buf, "sum([1, 2, 3])", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	test_num(tmp_val, 6);
+	safecpy(buf, "prod(vec(1, 2, 3, 4)) + min(vec(3, 1, 2)) + max(1, 7, 2)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	test_num(tmp_val, 32);
+	safecpy(buf, "dot(vec(1, 2, 3), [4, 5, 6]) + norm(vec(3, 4)) + norm(vec(3, -4), 1)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	test_num(tmp_val, 44);
+	//reductions along axes
+	safecpy(buf, "sum(reshape(range(6), 2, 3), 0)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	REQUIRE(tmp_val.n_els == 3);
+	for (size_t i = 0; i < 3; ++i)
+	    CHECK(tmp_val.val.a[i] == 2*i+3);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "mean(transpose(reshape(range(6), 2, 3)), -1)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	REQUIRE(tmp_val.n_els == 3);
+	for (size_t i = 0; i < 3; ++i)
+	    CHECK(tmp_val.val.a[i] == i+1.5);
+	cleanup_spcl_val(&tmp_val);
+	//large sums are split between threads and added pairwise
+	safecpy(buf, "sum(linspace(0, 1, 4000001))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_NUM);
+	CHECK(tmp_val.val.x == doctest::Approx(2000000.5).epsilon(1e-14));
+	//graceful failure cases
+	safecpy(buf, "sum(\"a\")", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_TYPE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "max(vec())", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_VALUE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "sum(vec(1, 2), 1)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_OUT_OF_RANGE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "dot(vec(1, 2), vec(1, 2, 3))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_OUT_OF_RANGE);
+	cleanup_spcl_val(&tmp_val);
+    }
+    SUBCASE("linear algebra") {
+	safecpy(buf, "array([[1, 2], [3, 4]]) @ array([[5, 6], [7, 8]])", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_MAT);
+	REQUIRE(tmp_val.val.t->ndim == 2);
+	CHECK(tmp_val.val.t->data[0] == 19);
+	CHECK(tmp_val.val.t->data[1] == 22);
+	CHECK(tmp_val.val.t->data[2] == 43);
+	CHECK(tmp_val.val.t->data[3] == 50);
+	cleanup_spcl_val(&tmp_val);
+	//arrays are rows on the left and columns on the right
+	safecpy(buf, "matmul([[1, 2], [3, 4]], vec(1, -1))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	REQUIRE(tmp_val.n_els == 2);
+	CHECK(tmp_val.val.a[0] == -1);
+	CHECK(tmp_val.val.a[1] == -1);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "vec(1, 2) @ vec(3, 4) + det(array([[1, 2], [3, 4]]))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	test_num(tmp_val, 9);
+	safecpy(buf, "solve(array([[2, 1], [1, 3]]), vec(3, 5))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	REQUIRE(tmp_val.n_els == 2);
+	CHECK(tmp_val.val.a[0] == doctest::Approx(0.8));
+	CHECK(tmp_val.val.a[1] == doctest::Approx(1.4));
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "inv(array([[0, 2], [4, 0]]))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_MAT);
+	CHECK(tmp_val.val.t->data[0] == 0);
+	CHECK(tmp_val.val.t->data[1] == 0.25);
+	CHECK(tmp_val.val.t->data[2] == 0.5);
+	CHECK(tmp_val.val.t->data[3] == 0);
+	cleanup_spcl_val(&tmp_val);
+	//graceful failure cases
+	safecpy(buf, "inv(array([[1, 2], [2, 4]]))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_VALUE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "array([[1, 2], [3, 4]]) @ vec(1, 2, 3)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_OUT_OF_RANGE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "det(vec(1, 2))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_TYPE);
+	cleanup_spcl_val(&tmp_val);
+    }
+    SUBCASE("stencils") {
+	safecpy(buf, "diff(vec(1, 4, 9, 16), 2)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	REQUIRE(tmp_val.n_els == 2);
+	CHECK(tmp_val.val.a[0] == 2);
+	CHECK(tmp_val.val.a[1] == 2);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "stencil(vec(1, 4, 9, 16), vec(-0.5, 0.5), vec(-1, 1), \"same\")", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	REQUIRE(tmp_val.n_els == 4);
+	CHECK(tmp_val.val.a[0] == 2);
+	CHECK(tmp_val.val.a[1] == 4);
+	CHECK(tmp_val.val.a[2] == 6);
+	CHECK(tmp_val.val.a[3] == -4.5);
+	cleanup_spcl_val(&tmp_val);
+	//one sided stencils are still centred on the output element
+	safecpy(buf, "stencil(vec(1, 4, 9, 16, 25), vec(1, 1), vec(1, 2))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	REQUIRE(tmp_val.n_els == 3);
+	CHECK(tmp_val.val.a[0] == 13);
+	CHECK(tmp_val.val.a[2] == 41);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "convolve(vec(1, 1), vec(1, 2, 3, 4), \"valid\")", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	REQUIRE(tmp_val.n_els == 3);
+	CHECK(tmp_val.val.a[0] == 3);
+	CHECK(tmp_val.val.a[1] == 5);
+	CHECK(tmp_val.val.a[2] == 7);
+	cleanup_spcl_val(&tmp_val);
+	//large inputs are split between threads
+	safecpy(buf, "sum(diff(linspace(0, 1, 2000001)))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_NUM);
+	CHECK(tmp_val.val.x == doctest::Approx(1));
+	//graceful failure cases
+	safecpy(buf, "stencil(vec(1, 2), vec(1, 2), vec(0))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_VALUE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "convolve(vec(1, 2), vec(1), \"middle\")", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_VALUE);
+	cleanup_spcl_val(&tmp_val);
+    }
+    SUBCASE("fourier transforms") {
+	safecpy(buf, "fft(vec(1, 2, 3, 4))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_CARRAY);
+	REQUIRE(tmp_val.n_els == 4);
+	const double expect[] = {10, 0, -2, 2, -2, 0, -2, -2};
+	for (size_t i = 0; i < 8; ++i)
+	    CHECK(tmp_val.val.a[i] == doctest::Approx(expect[i]));
+	cleanup_spcl_val(&tmp_val);
+	//odd and prime lengths
+	safecpy(buf, "rfft(vec(1, 2, 3))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_CARRAY);
+	REQUIRE(tmp_val.n_els == 2);
+	CHECK(tmp_val.val.a[0] == doctest::Approx(6));
+	CHECK(tmp_val.val.a[2] == doctest::Approx(-1.5));
+	CHECK(tmp_val.val.a[3] == doctest::Approx(sqrt(3)/2));
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "norm(ifft(fft(range(1031))) - range(1031))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_NUM);
+	CHECK(tmp_val.val.x < 1e-9);
+	//graceful failure cases
+	safecpy(buf, "fft(vec())", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_VALUE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "rfft(reshape(range(6), 3, 2))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_TYPE);
+	cleanup_spcl_val(&tmp_val);
+    }
+    SUBCASE("complex numbers") {
+	safecpy(buf, "(1 + 2j)*(3 - 1j)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_COMPLEX);
+	CHECK(tmp_val.val.z[0] == 5);
+	CHECK(tmp_val.val.z[1] == 5);
+	safecpy(buf, "math.abs(3 + 4j)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_NUM);
+	CHECK(tmp_val.val.x == 5);
+	safecpy(buf, "vec(1, 2j, 3)*1j - 1", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_CARRAY);
+	REQUIRE(tmp_val.n_els == 3);
+	const double expect[] = {-1, 1, -3, 0, -1, 3};
+	for (size_t i = 0; i < 6; ++i)
+	    CHECK(tmp_val.val.a[i] == expect[i]);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "math.exp(1j*linspace(0, 3, 1000))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_CARRAY);
+	REQUIRE(tmp_val.n_els == 1000);
+	CHECK(tmp_val.val.a[2*999] == doctest::Approx(cos(3)));
+	CHECK(tmp_val.val.a[2*999+1] == doctest::Approx(sin(3)));
+	cleanup_spcl_val(&tmp_val);
+	//graceful failure cases
+	safecpy(buf, "vec(1j, 2) + vec(1, 2, 3)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_OUT_OF_RANGE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "(1 + 1j) % 2", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_TYPE);
+	cleanup_spcl_val(&tmp_val);
+    }
+    SUBCASE("integers") {
+	//2^62 + 1 can't be represented by a double
+	safecpy(buf, "int(2)^62 + 1", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_INT);
+	CHECK(tmp_val.val.i == (1ll << 62) + 1);
+	safecpy(buf, "int(-7) % 3", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_INT);
+	CHECK(tmp_val.val.i == 2);
+	safecpy(buf, "int(7)/2", SPCL_STR_BSIZE);
+	test_num(spcl_parse_line(sc, buf), 3.5);
+	safecpy(buf, "range(int(3), 12, 4)*2", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_IARRAY);
+	REQUIRE(tmp_val.n_els == 3);
+	for (size_t i = 0; i < 3; ++i)
+	    CHECK(tmp_val.val.ia[i] == 8*i + 6);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "range(int(4)) + 0.5", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	REQUIRE(tmp_val.n_els == 4);
+	CHECK(tmp_val.val.a[3] == 3.5);
+	cleanup_spcl_val(&tmp_val);
+	spcl_set_val(sc, "big_count", spcl_make_int((1ll << 60) + 3), 0);
+	long long count = 0;
+	CHECK(spcl_find_long(sc, "big_count", &count) == 0);
+	CHECK(count == (1ll << 60) + 3);
+	//concatenation keeps integers exact
+	safecpy(buf, "cat(int(vec(0, 0)) + int(2)^53 + 1, int(vec(1)))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_IARRAY);
+	REQUIRE(tmp_val.n_els == 3);
+	CHECK(tmp_val.val.ia[0] == (1ll << 53) + 1);
+	CHECK(tmp_val.val.ia[2] == 1);
+	cleanup_spcl_val(&tmp_val);
+	//graceful failure cases
+	safecpy(buf, "int(\"1\")", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_TYPE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "range(int(3))[3]", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_OUT_OF_RANGE);
+	cleanup_spcl_val(&tmp_val);
+	//a failed append leaves the stored value as it was
+	safecpy(buf, "counts = int(vec(1, 2))", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	safecpy(buf, "counts = cat(counts, \"a\")", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_TYPE);
+	cleanup_spcl_val(&tmp_val);
+	tmp_val = spcl_find(sc, "counts");
+	CHECK(tmp_val.type == VAL_IARRAY);
+	CHECK(tmp_val.n_els == 2);
+    }
+    SUBCASE("typed arrays") {
+	safecpy(buf, "astype(range(4), \"f32\")*2 + 0.5", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_FARRAY);
+	REQUIRE(tmp_val.n_els == 4);
+	for (size_t i = 0; i < 4; ++i)
+	    CHECK(tmp_val.val.fa[i] == 2.0f*i + 0.5f);
+	cleanup_spcl_val(&tmp_val);
+	//uint8 arithmetic wraps, while division promotes to float64
+	safecpy(buf, "astype([250, 3], \"u8\") + 10", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_U8ARRAY);
+	CHECK(tmp_val.val.u8[0] == 4);
+	CHECK(tmp_val.val.u8[1] == 13);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "astype([1, 2], \"i32\")/2", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	CHECK(tmp_val.val.a[0] == 0.5);
+	cleanup_spcl_val(&tmp_val);
+	//lookup from c
+	const float table[] = {0.25f, -1.5f, 3.0f};
+	spcl_set_val(sc, "table", spcl_make_typed_array(table, 3, VAL_FARRAY), 0);
+	float f_sto[3];
+	double d_sto[3];
+	CHECK(spcl_find_c_farray(sc, "table", f_sto, 3) == 3);
+	CHECK(spcl_find_c_darray(sc, "table", d_sto, 3) == 3);
+	for (size_t i = 0; i < 3; ++i) {
+	    CHECK(f_sto[i] == table[i]);
+	    CHECK(d_sto[i] == table[i]);
+	}
+	valtype dtype;
+	size_t n_els;
+	const float* data = (const float*)spcl_find_c_data(sc, "table", &dtype, &n_els);
+	REQUIRE(data != NULL);
+	CHECK(dtype == VAL_FARRAY);
+	CHECK(n_els == 3);
+	CHECK(data[1] == -1.5f);
+	safecpy(buf, "vec(0.5, 1)", SPCL_STR_BSIZE);
+	spcl_set_val(sc, "dvec", spcl_parse_line(sc, buf), 0);
+	CHECK(spcl_find_c_farray(sc, "dvec", f_sto, 3) == 2);
+	CHECK(f_sto[0] == 0.5f);
+	CHECK(spcl_find_c_data(sc, "not_a_table", NULL, NULL) == NULL);
+	//graceful failure cases
+	safecpy(buf, "astype(range(4), \"f16\")", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_VALUE);
+	cleanup_spcl_val(&tmp_val);
+    }
+    SUBCASE("masks") {
+	safecpy(buf, "xs = linspace(-2, 2, 5)", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	safecpy(buf, "(xs > -1) & (xs <= 1)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_U8ARRAY);
+	REQUIRE(tmp_val.n_els == 5);
+	for (size_t i = 0; i < 5; ++i)
+	    CHECK(tmp_val.val.u8[i] == (i == 2 || i == 3));
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "where(xs < 0, -xs, xs^2)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	REQUIRE(tmp_val.n_els == 5);
+	CHECK(tmp_val.val.a[0] == 2);
+	CHECK(tmp_val.val.a[1] == 1);
+	CHECK(tmp_val.val.a[4] == 4);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "xs[xs >= 1]", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	REQUIRE(tmp_val.n_els == 2);
+	CHECK(tmp_val.val.a[0] == 1);
+	CHECK(tmp_val.val.a[1] == 2);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "xs[xs < 0] = 0", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	double sto[5];
+	REQUIRE(spcl_find_c_darray(sc, "xs", sto, 5) == 5);
+	CHECK(sto[0] == 0);
+	CHECK(sto[1] == 0);
+	CHECK(sto[4] == 2);
+	//tensors give masks over all of their elements in row-major order
+	safecpy(buf, "grid = reshape(range(6), 2, 3)", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	safecpy(buf, "grid > 2", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_U8ARRAY);
+	REQUIRE(tmp_val.n_els == 6);
+	for (size_t i = 0; i < 6; ++i)
+	    CHECK(tmp_val.val.u8[i] == (i > 2));
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "where(grid > 2, 1, grid)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_MAT);
+	REQUIRE(tmp_val.val.t->ndim == 2);
+	CHECK(tmp_val.val.t->shape[0] == 2);
+	CHECK(tmp_val.val.t->shape[1] == 3);
+	CHECK(tmp_val.val.t->data[2] == 2);
+	CHECK(tmp_val.val.t->data[5] == 1);
+	cleanup_spcl_val(&tmp_val);
+	//graceful failure cases
+	safecpy(buf, "grid > vec(1, 2, 3)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_TYPE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "grid < reshape(range(6), 3, 2)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_OUT_OF_RANGE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "xs[vec(1, 2) > 0]", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_OUT_OF_RANGE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "where(xs, 1, 0)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_TYPE);
+	cleanup_spcl_val(&tmp_val);
+    }
+    SUBCASE("sorting") {
+	safecpy(buf, "xs = vec(3, -1, 2.5, 7, -1)", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	safecpy(buf, "sort(xs)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	REQUIRE(tmp_val.n_els == 5);
+	for (size_t i = 1; i < 5; ++i)
+	    CHECK(tmp_val.val.a[i-1] <= tmp_val.val.a[i]);
+	CHECK(tmp_val.val.a[0] == -1);
+	CHECK(tmp_val.val.a[4] == 7);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "argsort(xs)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_IARRAY);
+	REQUIRE(tmp_val.n_els == 5);
+	CHECK(tmp_val.val.ia[0] == 1);
+	CHECK(tmp_val.val.ia[1] == 4);
+	CHECK(tmp_val.val.ia[4] == 3);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "unique([\"b\", \"a\", \"b\"])", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_LIST);
+	REQUIRE(tmp_val.n_els == 2);
+	CHECK(strcmp(tmp_val.val.l[0].val.s, "a") == 0);
+	CHECK(strcmp(tmp_val.val.l[1].val.s, "b") == 0);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "searchsorted(sort(xs), vec(-2, 2.5, 8), \"right\")", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_IARRAY);
+	REQUIRE(tmp_val.n_els == 3);
+	CHECK(tmp_val.val.ia[0] == 0);
+	CHECK(tmp_val.val.ia[1] == 3);
+	CHECK(tmp_val.val.ia[2] == 5);
+	cleanup_spcl_val(&tmp_val);
+	//-0 and 0 are equal, so neither is placed after the other
+	safecpy(buf, "searchsorted(vec(-0.0, 1), vec(0, -0.0))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_IARRAY);
+	REQUIRE(tmp_val.n_els == 2);
+	CHECK(tmp_val.val.ia[0] == 0);
+	CHECK(tmp_val.val.ia[1] == 0);
+	cleanup_spcl_val(&tmp_val);
+	//graceful failure cases
+	safecpy(buf, "sort([1, \"a\"])", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_VALUE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "searchsorted(xs, 1, \"middle\")", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_VALUE);
+	cleanup_spcl_val(&tmp_val);
+    }
+    SUBCASE("random numbers") {
+	//the first block of the philox4x32-10 stream with a zero key and counter is 6627e8d5 e169c58d bc57ac4c 9b00dbd8
+	safecpy(buf, "us = rand(3, 2)", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	safecpy(buf, "us", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_MAT);
+	REQUIRE(tmp_val.val.t->ndim == 2);
+	CHECK(tmp_val.val.t->shape[0] == 3);
+	CHECK(tmp_val.val.t->shape[1] == 2);
+	CHECK(tmp_val.val.t->data[0] == (double)(0x6627e8d5e169c58dull >> 11)*0x1p-53);
+	CHECK(tmp_val.val.t->data[1] == (double)(0xbc57ac4c9b00dbd8ull >> 11)*0x1p-53);
+	cleanup_spcl_val(&tmp_val);
+	//draws continue the stream until it is reseeded
+	safecpy(buf, "rand(6) == flatten(us)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	CHECK(tmp_val.type == VAL_NUM);
+	CHECK(tmp_val.val.x == 0);
+	safecpy(buf, "seed(0)", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	safecpy(buf, "rand(6) == flatten(us)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	CHECK(tmp_val.type == VAL_NUM);
+	CHECK(tmp_val.val.x == 1);
+	safecpy(buf, "uniform(2, 3, 1000)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	REQUIRE(tmp_val.n_els == 1000);
+	for (size_t i = 0; i < tmp_val.n_els; ++i) {
+	    CHECK(tmp_val.val.a[i] >= 2);
+	    CHECK(tmp_val.val.a[i] < 3);
+	}
+	cleanup_spcl_val(&tmp_val);
+	//graceful failure cases
+	safecpy(buf, "rand(-1)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_VALUE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "seed(0.5)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_VALUE);
+	cleanup_spcl_val(&tmp_val);
+    }
+    SUBCASE("interpolation") {
+	safecpy(buf, "xp = vec(0, 1, 3, 6)", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	safecpy(buf, "interp(vec(-1, 0.5, 2, 4.5, 7), xp, vec(0, 10, 30, 0))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	REQUIRE(tmp_val.n_els == 5);
+	CHECK(tmp_val.val.a[0] == 0);
+	CHECK(tmp_val.val.a[1] == 5);
+	CHECK(tmp_val.val.a[2] == 20);
+	CHECK(tmp_val.val.a[3] == 15);
+	CHECK(tmp_val.val.a[4] == 0);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "lookup(0.25, 0, 1, linspace(0, 1, 11)^2)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_NUM);
+	CHECK(tmp_val.val.x == doctest::Approx(0.065));
+	safecpy(buf, "interp2d(vec(0, 1, 0.5), 0.5, vec(0, 1), vec(0, 1), array([[0, 1], [2, 3]]))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	REQUIRE(tmp_val.n_els == 3);
+	CHECK(tmp_val.val.a[0] == 0.5);
+	CHECK(tmp_val.val.a[1] == 2.5);
+	CHECK(tmp_val.val.a[2] == 1.5);
+	cleanup_spcl_val(&tmp_val);
+	//graceful failure cases
+	safecpy(buf, "interp(1, vec(0, 2, 1), vec(0, 1, 2))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_VALUE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "interp(1, xp, vec(1, 2))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_OUT_OF_RANGE);
+	cleanup_spcl_val(&tmp_val);
+    }
+    SUBCASE("tabulation") {
+	safecpy(buf, "tab = tabulate(math.exp, -1, 2, 24, 5)", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	spcl_table tab;
+	REQUIRE(spcl_find_table(sc, "tab", &tab) == 0);
+	CHECK(tab.n == 24);
+	CHECK(tab.order == 5);
+	CHECK(tab.err > 0);
+	CHECK(tab.err < 1e-9);
+	//the estimate is the largest error at the points halfway between the samples
+	double mid_err = 0;
+	for (size_t i = 0; i < tab.n*tab.order; ++i) {
+	    double x = -1 + 3.0/tab.n*(i/tab.order + (1 - cos(M_PI*(2*(i%tab.order) + 1)/(2*tab.order)))/2);
+	    mid_err = fmax(mid_err, fabs(spcl_table_eval(&tab, x) - exp(x)));
+	}
+	CHECK(tab.err == doctest::Approx(mid_err).epsilon(1e-3));
+	for (double x = -1; x <= 2; x += 0.01)
+	    CHECK(fabs(spcl_table_eval(&tab, x) - exp(x)) <= 2*tab.err + 1e-14);
+	//points outside the range are moved to the nearest end
+	CHECK(spcl_table_eval(&tab, -5) == doctest::Approx(exp(-1)));
+	CHECK(spcl_table_eval(&tab, 5) == doctest::Approx(exp(2)));
+	safecpy(buf, "lookup(vec(0, 1.5), tabulate(math.sin, 0, 2, 4, 9))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	REQUIRE(tmp_val.n_els == 2);
+	CHECK(tmp_val.val.a[0] == doctest::Approx(0));
+	CHECK(tmp_val.val.a[1] == doctest::Approx(sin(1.5)));
+	cleanup_spcl_val(&tmp_val);
+	//functions which branch on their argument give the wrong values when called with the whole array, so they have to be sampled one point at a time
+	const char* lines[] = { "fn ramp = (x) {", "if (x < 0.5) { return 0*x }", "return x - 0.5", "}", "ramp_tab = tabulate(ramp, 0, 1, 4)" };
+	write_test_file(lines, sizeof(lines)/sizeof(char*), TEST_FNAME);
+	spcl_fstream* fs = make_spcl_fstream(TEST_FNAME);
+	tmp_val = spcl_read_lines(sc, fs);
+	CHECK(tmp_val.type != VAL_ERR);
+	REQUIRE(spcl_find_table(sc, "ramp_tab", &tab) == 0);
+	CHECK(spcl_table_eval(&tab, 0.25) == doctest::Approx(0));
+	CHECK(spcl_table_eval(&tab, 0.75) == doctest::Approx(0.25));
+	CHECK(spcl_table_eval(&tab, 1) == doctest::Approx(0.5));
+	CHECK(tab.err < 1e-12);
+	destroy_spcl_fstream(fs);
+	//graceful failure cases
+	CHECK(spcl_find_table(sc, "missing", &tab) == -1);
+	safecpy(buf, "not_tab = {a = 1}", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	CHECK(spcl_find_table(sc, "not_tab", &tab) == -2);
+	safecpy(buf, "tabulate(math.exp, 1, 0, 4)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_VALUE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "tabulate(math.exp, 0, 1, 4, 16)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_VALUE);
+	cleanup_spcl_val(&tmp_val);
+    }
+    SUBCASE("derivatives") {
+	safecpy(buf, "dsin = deriv(math.sin, 3)", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	safecpy(buf, "dsin(array([0, 1]))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	REQUIRE(tmp_val.n_els == 2);
+	CHECK(tmp_val.val.a[0] == doctest::Approx(-1));
+	CHECK(tmp_val.val.a[1] == doctest::Approx(-cos(1)));
+	cleanup_spcl_val(&tmp_val);
+	//derivatives of derivatives add their orders
+	safecpy(buf, "dlog = deriv(deriv(math.log), 2)", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	safecpy(buf, "dlog(2)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_NUM);
+	CHECK(tmp_val.val.x == doctest::Approx(0.25));
+	safecpy(buf, "gexp = grad(math.exp)", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	safecpy(buf, "gexp(1)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	REQUIRE(tmp_val.n_els == 1);
+	CHECK(tmp_val.val.a[0] == doctest::Approx(exp(1)));
+	cleanup_spcl_val(&tmp_val);
+	//graceful failure cases
+	safecpy(buf, "deriv(math.sin, 17)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_VALUE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "deriv(gexp)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_VALUE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "dsin(\"a\")", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_TYPE);
+	cleanup_spcl_val(&tmp_val);
+    }
+    SUBCASE("small vectors") {
+	safecpy(buf, "2*vec(1, 2, 3) - vec(0, 1, 2)/2", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_VEC);
+	REQUIRE(tmp_val.n_els == 3);
+	CHECK(tmp_val.buf == NULL);
+	CHECK(tmp_val.val.v[0] == 2);
+	CHECK(tmp_val.val.v[1] == 3.5);
+	CHECK(tmp_val.val.v[2] == 5);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "cross(vec(1, 0, 0), [0, 1, 0])", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_VEC);
+	CHECK(tmp_val.val.v[0] == 0);
+	CHECK(tmp_val.val.v[1] == 0);
+	CHECK(tmp_val.val.v[2] == 1);
+	safecpy(buf, "dot(vec(1, 2, 3, 4), vec(4, 3, 2, 1)) + norm(vec(3, 4))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_NUM);
+	CHECK(tmp_val.val.x == 25);
+	//vectors are promoted to arrays when mixed with them
+	safecpy(buf, "vec(1, 2) + array([3, 4])", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ARRAY);
+	CHECK(tmp_val.val.a[0] == 4);
+	CHECK(tmp_val.val.a[1] == 6);
+	cleanup_spcl_val(&tmp_val);
+	//elements can be written in place and read from C
+	safecpy(buf, "pt = vec(1, 2, 3)", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	safecpy(buf, "pt[-1] = 5", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	double sto[4] = {0};
+	CHECK(spcl_find_c_darray(sc, "pt", sto, 4) == 3);
+	CHECK(sto[2] == 5);
+	valtype type;
+	CHECK(spcl_find_c_data(sc, "pt", &type, NULL) == NULL);
+	spcl_val made = spcl_make_vec(sto, 3);
+	CHECK(made.type == VAL_VEC);
+	CHECK(spcl_valcmp(made, spcl_find(sc, "pt")).val.x == 0);
+	//graceful failure cases
+	safecpy(buf, "vec(1, 2) + vec(1, 2, 3)", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_OUT_OF_RANGE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "cross(vec(1, 2), vec(3, 4))", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_BAD_TYPE);
+	cleanup_spcl_val(&tmp_val);
+	safecpy(buf, "pt[3]", SPCL_STR_BSIZE);
+	tmp_val = spcl_parse_line(sc, buf);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_OUT_OF_RANGE);
+	cleanup_spcl_val(&tmp_val);
+	tmp_val = spcl_make_vec(sto, 5);
+	REQUIRE(tmp_val.type == VAL_ERR);
+	WARN(tmp_val.val.e->c == E_OUT_OF_RANGE);
+	cleanup_spcl_val(&tmp_val);
+    }
+    SUBCASE("threads") {
+	safecpy(buf, "xs = linspace(-1, 1, 100003)", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	const char* exprs[] = {"xs*xs + 2", "math.exp(-(xs - 0.5)^2)/2", "math.sin(xs)", "sum(xs^3)", "argsort(-xs)", "interp(xs, xs^3, xs)", "randn(100003)"};
+	const size_t n_exprs = sizeof(exprs)/sizeof(char*);
+	spcl_val refs[n_exprs];
+	spcl_set_threads(1, 0);
+	safecpy(buf, "seed(1)", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	for (size_t j = 0; j < n_exprs; ++j) {
+	    safecpy(buf, exprs[j], SPCL_STR_BSIZE);
+	    refs[j] = spcl_parse_line(sc, buf);
+	}
+	//use more threads than there are likely to be cores, and a threshold small enough that every expression is split
+	spcl_set_threads(7, 1000);
+	safecpy(buf, "seed(1)", SPCL_STR_BSIZE);
+	spcl_parse_line(sc, buf);
+	for (size_t j = 0; j < n_exprs; ++j) {
+	    safecpy(buf, exprs[j], SPCL_STR_BSIZE);
+	    tmp_val = spcl_parse_line(sc, buf);
+	    CHECK(tmp_val.type == refs[j].type);
+	    spcl_val cmp = spcl_valcmp(tmp_val, refs[j]);
+	    CHECK(cmp.type == VAL_NUM);
+	    CHECK(cmp.val.x == 0);
+	    cleanup_spcl_val(&tmp_val);
+	    cleanup_spcl_val(refs+j);
+	}
+	spcl_set_threads(0, 1 << 18);
+    }
     SUBCASE("assertions") {
 	safecpy(buf, "assert(1)", SPCL_STR_BSIZE);
 	spcl_val tmp = spcl_parse_line(sc, buf);
@@ -807,7 +1660,7 @@ TEST_CASE("builtin functions") {
 	tmp = spcl_parse_line(sc, buf);
 	CHECK(tmp.type == VAL_ERR);
 	WARN(tmp.val.e->c == E_ASSERT);
-	WARN(strcmp(tmp.val.e->msg, "1 is not greater than 3") == 0);
+	WARN(strcmp(spcl_err_msg(tmp), "1 is not greater than 3") == 0);
 	cleanup_spcl_val(&tmp);
 	safecpy(buf, "isdef(apple)", SPCL_STR_BSIZE);
 	tmp = spcl_parse_line(sc, buf);
@@ -996,8 +1849,8 @@ TEST_CASE("spcl_inst lookups") {
     auto end = std::chrono::steady_clock::now();
     double time = std::chrono::duration <double, std::milli> (end-start).count();
     printf("took %f ms to set %lu elements\n", time, n_combs);
-    //lookup something not in the spcl_inst, check that we only added n_combs-1 elements because we added one match explicitly before
-    CHECK(c->n_memb == n_combs+before_size-1);
+    //lookup something not in the spcl_inst, check that we only added n_combs-2 elements because we added one match explicitly before and the builtin int() is another
+    CHECK(c->n_memb == n_combs+before_size-2);
     v = spcl_find(c, "vetaon");
     CHECK(v.type == VAL_UNDEF);
     CHECK(v.val.x == 0);
@@ -1118,6 +1971,49 @@ TEST_CASE("spcl_inst parsing") {
 	CHECK(spcl_strcmp(val_c, cstr_to_spcl("test_inst")) == 0);
 	cleanup_spcl_val(&v);
     }
+    SUBCASE ("control flow") {
+	const char* lines[] = {
+	    "fn first_over = (lst, t) {",
+	    "for x in lst {",
+	    "if (x > t) { return x }",
+	    "}",
+	    "return -1",
+	    "}",
+	    "i = 0;total = 0",
+	    "while (i < 10) {",
+	    "i += 1",
+	    "if (i == 3) continue",
+	    "if (i > 6) {",
+	    "break",
+	    "} else if (i == 5) {",
+	    "total += 100",
+	    "} else { total += i }",
+	    "}",
+	    "for (j in range(3)) total += j",
+	    "a = first_over([1, 5, 9], 4);b = first_over([1, 2], 4)" };
+	size_t n_lines = sizeof(lines)/sizeof(char*);
+	write_test_file(lines, n_lines, TEST_FNAME);
+	spcl_val v = spcl_inst_from_file(TEST_FNAME, 0, NULL);
+	REQUIRE(v.type != VAL_ERR);
+	test_num(spcl_find(v.val.c, "i"), 7);
+	test_num(spcl_find(v.val.c, "total"), 1+2+4+100+6+3);
+	test_num(spcl_find(v.val.c, "a"), 5);
+	test_num(spcl_find(v.val.c, "b"), -1);
+	//the body of first_over is only split into statements on the first call
+	spcl_val val_fun = spcl_find(v.val.c, "first_over");
+	REQUIRE(val_fun.type == VAL_FN);
+	CHECK(val_fun.val.f->code != NULL);
+	cleanup_spcl_val(&v);
+	//graceful failure cases
+	const char* bad_lines[] = { "x = 1", "break" };
+	write_test_file(bad_lines, 2, TEST_FNAME);
+	spcl_fstream* b_1 = make_spcl_fstream(TEST_FNAME);
+	spcl_inst* c = make_spcl_inst(NULL);
+	spcl_val er = spcl_read_lines(c, b_1);
+	CHECK(er.type == VAL_ERR);
+	destroy_spcl_inst(c);
+	destroy_spcl_fstream(b_1);
+    }
     SUBCASE ("stress test") {
 	//first we add a bunch of arbitrary variables to make searching harder for the parser
 	const char* lines1[] = {
@@ -1337,3 +2233,165 @@ TEST_CASE("benchmarks") {
     mean_var(times, N_RUNS, &mean, &var);
     printf("pot_test.spcl evaluated in %f\xc2\xb1%f ms\n", mean, sqrt(var));
 }
+
+#if SPCL_DEBUG_LVL>0
+TEST_CASE("array kernels") {
+    const size_t N_RUNS = 20;
+    const char* isas[] = {"scalar", "sse2", "avx2", "avx512"};
+    const char* exprs[] = {"xs*ys + 2.5", "xs/ys - xs", "xs^2 + ys^6", "xs % 0.3"};
+    const size_t n_exprs = sizeof(exprs)/sizeof(char*);
+    char buf[SPCL_STR_BSIZE];
+    spcl_inst* c = make_spcl_inst(NULL);
+    //use a length which isn't a multiple of any vector width to exercise the remainder loops
+    safecpy(buf, "xs = linspace(-3, 3, 100003)", SPCL_STR_BSIZE);
+    spcl_val v = spcl_parse_line(c, buf);
+    REQUIRE(v.type == VAL_UNDEF);
+    safecpy(buf, "ys = xs^2 + 1", SPCL_STR_BSIZE);
+    v = spcl_parse_line(c, buf);
+    REQUIRE(v.type == VAL_UNDEF);
+    //every instruction set should give exactly the same result as the scalar kernels
+    spcl_val refs[n_exprs];
+    REQUIRE(set_arr_kernels("scalar") != NULL);
+    for (size_t j = 0; j < n_exprs; ++j) {
+	safecpy(buf, exprs[j], SPCL_STR_BSIZE);
+	refs[j] = spcl_parse_line(c, buf);
+	REQUIRE(refs[j].type == VAL_ARRAY);
+    }
+    double times[N_RUNS];
+    double mean, var;
+    for (size_t k = 0; k < sizeof(isas)/sizeof(char*); ++k) {
+	if (!set_arr_kernels(isas[k]))
+	    continue;
+	for (size_t j = 0; j < n_exprs; ++j) {
+	    safecpy(buf, exprs[j], SPCL_STR_BSIZE);
+	    for (size_t i = 0; i < N_RUNS; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		v = spcl_parse_line(c, buf);
+		auto end = std::chrono::steady_clock::now();
+		times[i] = std::chrono::duration <double, std::milli> (end-start).count();
+		if (i == 0) {
+		    spcl_val cmp = spcl_valcmp(v, refs[j]);
+		    CHECK(cmp.type == VAL_NUM);
+		    CHECK(cmp.val.x == 0);
+		}
+		cleanup_spcl_val(&v);
+	    }
+	    mean_var(times, N_RUNS, &mean, &var);
+	    printf("%s: %s evaluated in %f\xc2\xb1%f ms\n", isas[k], exprs[j], mean, sqrt(var));
+	}
+    }
+    //reductions use the same accumulators on every instruction set, so they should match exactly too
+    const char* reds[] = {"sum(xs)", "dot(xs, ys)", "min(xs^3)", "mean(ys, 0)"};
+    double red_refs[sizeof(reds)/sizeof(char*)];
+    for (size_t k = 0; k < sizeof(isas)/sizeof(char*); ++k) {
+	if (!set_arr_kernels(isas[k]))
+	    continue;
+	for (size_t j = 0; j < sizeof(reds)/sizeof(char*); ++j) {
+	    safecpy(buf, reds[j], SPCL_STR_BSIZE);
+	    v = spcl_parse_line(c, buf);
+	    REQUIRE(v.type == VAL_NUM);
+	    if (k == 0)
+		red_refs[j] = v.val.x;
+	    CHECK(v.val.x == red_refs[j]);
+	}
+    }
+    //uniform random numbers only depend on the seed and the position in the stream, so every instruction set gives the same draws
+    spcl_val rng_ref = spcl_make_none();
+    for (size_t k = 0; k < sizeof(isas)/sizeof(char*); ++k) {
+	if (!set_arr_kernels(isas[k]))
+	    continue;
+	safecpy(buf, "seed(3)", SPCL_STR_BSIZE);
+	spcl_parse_line(c, buf);
+	safecpy(buf, "rand(300001)", SPCL_STR_BSIZE);
+	v = spcl_parse_line(c, buf);
+	REQUIRE(v.type == VAL_ARRAY);
+	if (rng_ref.type == VAL_UNDEF) {
+	    rng_ref = v;
+	    continue;
+	}
+	spcl_val cmp = spcl_valcmp(v, rng_ref);
+	CHECK(cmp.type == VAL_NUM);
+	CHECK(cmp.val.x == 0);
+	cleanup_spcl_val(&v);
+    }
+    cleanup_spcl_val(&rng_ref);
+    //matrix products use register tiles on every instruction set. The sizes aren't multiples of the tile or block sizes, and the right operand is a transposed view.
+    safecpy(buf, "as = reshape(xs[:90300], 300, 301)", SPCL_STR_BSIZE);
+    v = spcl_parse_line(c, buf);
+    REQUIRE(v.type == VAL_UNDEF);
+    safecpy(buf, "prod_ref = as @ transpose(as)", SPCL_STR_BSIZE);
+    v = spcl_parse_line(c, buf);
+    REQUIRE(v.type == VAL_UNDEF);
+    safecpy(buf, "prod_ref[7][11] - dot(as[7], as[11])", SPCL_STR_BSIZE);
+    v = spcl_parse_line(c, buf);
+    REQUIRE(v.type == VAL_NUM);
+    CHECK(fabs(v.val.x) < 1e-10);
+    for (size_t k = 0; k < sizeof(isas)/sizeof(char*); ++k) {
+	if (!set_arr_kernels(isas[k]))
+	    continue;
+	safecpy(buf, "as @ transpose(as)", SPCL_STR_BSIZE);
+	for (size_t i = 0; i < N_RUNS; ++i) {
+	    auto start = std::chrono::steady_clock::now();
+	    v = spcl_parse_line(c, buf);
+	    auto end = std::chrono::steady_clock::now();
+	    times[i] = std::chrono::duration <double, std::milli> (end-start).count();
+	    REQUIRE(v.type == VAL_MAT);
+	    cleanup_spcl_val(&v);
+	}
+	mean_var(times, N_RUNS, &mean, &var);
+	printf("%s: %s evaluated in %f\xc2\xb1%f ms\n", isas[k], buf, mean, sqrt(var));
+	safecpy(buf, "norm(as @ transpose(as) - prod_ref)/norm(prod_ref)", SPCL_STR_BSIZE);
+	v = spcl_parse_line(c, buf);
+	REQUIRE(v.type == VAL_NUM);
+	CHECK(v.val.x < 1e-14);
+    }
+    set_arr_kernels(NULL);
+    //compare vectorized math against the C math library
+    safecpy(buf, "math.exp(-xs^2) + math.sin(xs)", SPCL_STR_BSIZE);
+    for (int strict = 1; strict >= 0; --strict) {
+	spcl_set_strict_math(strict);
+	for (size_t i = 0; i < N_RUNS; ++i) {
+	    auto start = std::chrono::steady_clock::now();
+	    v = spcl_parse_line(c, buf);
+	    auto end = std::chrono::steady_clock::now();
+	    times[i] = std::chrono::duration <double, std::milli> (end-start).count();
+	    CHECK(v.type == VAL_ARRAY);
+	    cleanup_spcl_val(&v);
+	}
+	mean_var(times, N_RUNS, &mean, &var);
+	printf("%s: %s evaluated in %f\xc2\xb1%f ms\n", (strict)? "libm" : "vector", buf, mean, sqrt(var));
+    }
+    //fused expressions should give the same result as applying one operator at a time
+    const char* steps[] = {"tmp = xs - 0.5", "tmp = tmp^2", "tmp = -tmp", "tmp = math.exp(tmp)", "tmp = tmp/2"};
+    for (size_t i = 0; i < N_RUNS; ++i) {
+	auto start = std::chrono::steady_clock::now();
+	for (size_t j = 0; j < sizeof(steps)/sizeof(char*); ++j) {
+	    safecpy(buf, steps[j], SPCL_STR_BSIZE);
+	    v = spcl_parse_line(c, buf);
+	    REQUIRE(v.type == VAL_UNDEF);
+	}
+	auto end = std::chrono::steady_clock::now();
+	times[i] = std::chrono::duration <double, std::milli> (end-start).count();
+    }
+    mean_var(times, N_RUNS, &mean, &var);
+    printf("one operator at a time: evaluated in %f\xc2\xb1%f ms\n", mean, sqrt(var));
+    safecpy(buf, "math.exp(-(xs - 0.5)^2)/2", SPCL_STR_BSIZE);
+    for (size_t i = 0; i < N_RUNS; ++i) {
+	auto start = std::chrono::steady_clock::now();
+	v = spcl_parse_line(c, buf);
+	auto end = std::chrono::steady_clock::now();
+	times[i] = std::chrono::duration <double, std::milli> (end-start).count();
+	if (i == 0) {
+	    spcl_val cmp = spcl_valcmp(v, spcl_find(c, "tmp"));
+	    CHECK(cmp.type == VAL_NUM);
+	    CHECK(cmp.val.x == 0);
+	}
+	cleanup_spcl_val(&v);
+    }
+    mean_var(times, N_RUNS, &mean, &var);
+    printf("fused: %s evaluated in %f\xc2\xb1%f ms\n", buf, mean, sqrt(var));
+    for (size_t j = 0; j < n_exprs; ++j)
+	cleanup_spcl_val(refs + j);
+    destroy_spcl_inst(c);
+}
+#endif
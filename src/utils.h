@@ -8,7 +8,6 @@
 #include "s8.h"
 
 #define BLK_MAX			16	//the maximum number of nested blocks
-#define LST_MAX			8	//the maximum number of nested lists for a flatten statement
 
 #define BEG_PAR			'('
 #define END_PAR			')'